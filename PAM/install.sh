@@ -14,6 +14,8 @@ yum update
 yum upgrade -y
 yum install openssl-devel -y
 yum install pam-devel.x86_64 -y
+# sys/sdt.h for the tracing probes (optional)
+yum install systemtap-sdt-devel -y
 
 #yum install libghc-pem-dev libgnutls-openssl openssl -y;
 #cp etc/* /etc/ -Rv
@@ -0,0 +1,156 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <unistd.h>
+#include <time.h>
+#include "header.h"
+
+/* Microbenchmark of the token response decoding in check_userInput
+ *  legacy: userInput_to_data (strSanitizer, asciiToBin, binToChar)
+ *  decode: userInput_decode (stack buffer, shifts)
+ * each alone and with public_decrypt + verify_rsa (full verification),
+ * on the same random responses. Prints ns per verification as JSON
+ * and fails if the two decoders ever disagree.
+ *
+ * usage: bench_main [-n responses] [-k public.pem] [-o out.json]
+ */
+
+#define BENCH_INPUTS 1024
+
+static const char alphabet[] =
+	"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ!abcdefghijklmnopqrstuvwxyz\"";
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// keeps the compiler from dropping unused results
+static volatile unsigned char sink;
+
+static double bench_legacy(char inputs[][KEY_LEN_6BIT+1], int n, const struct auth_ctx* ctx, int verify) {
+	long long start = now_ns();
+	int i;
+	for (i = 0; i < n; i++) {
+		// check_userInput gets (and frees) the malloc:ed PAM response
+		char* userInput = strdup(inputs[i % BENCH_INPUTS]);
+		unsigned char* data = userInput_to_data(userInput);
+		if (verify) {
+			const unsigned char* cleartext = public_decrypt(data);
+			sink ^= verify_rsa(cleartext, ctx);
+			free((char*) cleartext);
+		} else {
+			sink ^= data[0];
+		}
+		free(data);
+	}
+	return (double) (now_ns() - start) / n;
+}
+
+static double bench_decode(char inputs[][KEY_LEN_6BIT+1], int n, const struct auth_ctx* ctx, int verify) {
+	long long start = now_ns();
+	int i;
+	for (i = 0; i < n; i++) {
+		char* userInput = strdup(inputs[i % BENCH_INPUTS]);
+		unsigned char data[KEY_LEN_BYTE];
+		userInput_decode(userInput, data);
+		free(userInput);
+		if (verify) {
+			const unsigned char* cleartext = public_decrypt(data);
+			sink ^= verify_rsa(cleartext, ctx);
+			free((char*) cleartext);
+		} else {
+			sink ^= data[0];
+		}
+	}
+	return (double) (now_ns() - start) / n;
+}
+
+int main(int argc, char **argv) {
+	const char* outFile = NULL;
+	int n = 1000000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:k:o:")) != -1) {
+		switch (opt) {
+			case 'n': n = atoi(optarg); break;
+			case 'k': public_key_file = optarg; break;
+			case 'o': outFile = optarg; break;
+			default:
+				fprintf(stderr,"usage: %s [-n responses] [-k public.pem] [-o out.json]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (n < 1) {
+		n = 1;
+	}
+
+	// random responses, every 8th one short (leading zeroes left out)
+	static char inputs[BENCH_INPUTS][KEY_LEN_6BIT+1];
+	int i, j;
+	srand(1);
+	for (i = 0; i < BENCH_INPUTS; i++) {
+		int len = (i % 8 == 0) ? 1 + rand() % ciphertextLen : ciphertextLen;
+		for (j = 0; j < len; j++) {
+			inputs[i][j] = alphabet[rand() % 64];
+		}
+		// stay below the modulus (top byte 0xcd in data/public.pem)
+		if (len == ciphertextLen) {
+			inputs[i][0] = alphabet[rand() % 48];
+		}
+		inputs[i][len] = '\0';
+	}
+
+	// both decoders must give the same bytes
+	int mismatches = 0;
+	for (i = 0; i < BENCH_INPUTS; i++) {
+		unsigned char* legacy = userInput_to_data(strdup(inputs[i]));
+		unsigned char data[KEY_LEN_BYTE];
+		userInput_decode(inputs[i], data);
+		if (memcmp(legacy, data, KEY_LEN_BYTE) != 0) {
+			mismatches++;
+		}
+		free(legacy);
+	}
+
+	struct auth_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+
+	// warm up key cache and allocator
+	bench_legacy(inputs, 1000, &ctx, 1);
+	bench_decode(inputs, 1000, &ctx, 1);
+
+	double legacyDecode = bench_legacy(inputs, n, &ctx, 0);
+	double newDecode = bench_decode(inputs, n, &ctx, 0);
+	double legacyVerify = bench_legacy(inputs, n/10+1, &ctx, 1);
+	double newVerify = bench_decode(inputs, n/10+1, &ctx, 1);
+
+	FILE* out = stdout;
+	if (outFile != NULL && (out = fopen(outFile, "w")) == NULL) {
+		fprintf(stderr,"Cannot write '%s'\n", outFile);
+		return 1;
+	}
+	fprintf(out, "{\n");
+	fprintf(out, "  \"responses\": %i,\n", n);
+	fprintf(out, "  \"mismatches\": %i,\n", mismatches);
+	fprintf(out, "  \"decode_ns\": {\"legacy\": %.1f, \"decode\": %.1f},\n", legacyDecode, newDecode);
+	fprintf(out, "  \"verify_ns\": {\"legacy\": %.1f, \"decode\": %.1f}\n", legacyVerify, newVerify);
+	fprintf(out, "}\n");
+	if (out != stdout) {
+		fclose(out);
+	}
+	return (mismatches == 0) ? 0 : 1;
+}
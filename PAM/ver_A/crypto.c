@@ -15,6 +15,9 @@
 
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <unistd.h>
 #include "header.h"
 
@@ -24,10 +27,72 @@
  */
 char *public_key_file = "/home/user/Desktop/koddosa_git/koddosa/PAM_directory/ver_A/data/public.pem";
 
+/* Public key cache
+ * The key is parsed once per process and kept as an EVP_PKEY,
+ * OpenSSL then also keeps its Montgomery context between calls.
+ * The file is stat:ed on every call and reloaded if it changed
+ * (new inode, size or mtime), so keys can be rotated without restart.
+ */
+static pthread_mutex_t keyCache_lock = PTHREAD_MUTEX_INITIALIZER;
+static EVP_PKEY *keyCache_pkey = NULL;
+static struct stat keyCache_stat;
+
+static int keyCache_isStale(const struct stat *st) {
+	return (keyCache_pkey == NULL
+		|| st->st_dev != keyCache_stat.st_dev
+		|| st->st_ino != keyCache_stat.st_ino
+		|| st->st_size != keyCache_stat.st_size
+		|| st->st_mtim.tv_sec != keyCache_stat.st_mtim.tv_sec
+		|| st->st_mtim.tv_nsec != keyCache_stat.st_mtim.tv_nsec);
+}
+
+/* Returns a new reference to the cached key (free with EVP_PKEY_free),
+ * or NULL if the key file cannot be read
+ */
+static EVP_PKEY* public_key_get(void) {
+	struct stat st;
+	EVP_PKEY *pkey = NULL;
+
+	if (stat(public_key_file, &st) == -1 || access(public_key_file, R_OK) == -1) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&keyCache_lock);
+	if (keyCache_isStale(&st)) {
+		FILE *fp0 = fopen(public_key_file, "r");
+		RSA *rsa = NULL;
+		if (fp0 != NULL) {
+			rsa = PEM_read_RSAPublicKey(fp0, NULL, NULL, NULL);
+			fclose(fp0);
+		}
+
+		if (rsa != NULL) {
+			EVP_PKEY *newKey = EVP_PKEY_new();
+			if (newKey != NULL && EVP_PKEY_set1_RSA(newKey, rsa) == 1) {
+				//replace old key, in-flight users hold their own reference
+				EVP_PKEY_free(keyCache_pkey);
+				keyCache_pkey = newKey;
+				keyCache_stat = st;
+			} else {
+				EVP_PKEY_free(newKey);
+			}
+			RSA_free(rsa);
+		}
+	}
+
+	if (keyCache_pkey != NULL && EVP_PKEY_up_ref(keyCache_pkey) == 1) {
+		pkey = keyCache_pkey;
+	}
+	pthread_mutex_unlock(&keyCache_lock);
+	return pkey;
+}
+
 const unsigned char* public_decrypt(const unsigned char* ciphertext){
  	unsigned char * cleartext;
+	AUTH_PROBE1(decrypt__start, KEY_LEN_BYTE); // bytes
+	EVP_PKEY *pkey = public_key_get();
 
-	if( access(public_key_file, R_OK) == -1 ) {
+	if (pkey == NULL) {
 		fprintf(stderr, "\nCannot read public key:\n '%s'\n", public_key_file);
 
 		//To avoid seg fault, return zeroed cleartext (the character '0')
@@ -37,27 +102,22 @@ const unsigned char* public_decrypt(const unsigned char* ciphertext){
 	}
 
 	else {
-		// file is readable
+		// key is loaded
 	
 		int rsa_inLen = KEY_LEN_BYTE; //strlen((char*) ciphertext);
-		FILE *fp0 = fopen(public_key_file, "r");
-
-		/* init RSA struct and read public key */
-		RSA *rsa;
-		rsa = PEM_read_RSAPublicKey(fp0, NULL, NULL, NULL);
-		fclose(fp0);
-
-		int rsaSize = RSA_size(rsa);
-		cleartext = malloc(rsaSize+1); //unsigned char*
-	
-	  int ret = RSA_public_decrypt(
-			rsa_inLen, ciphertext, cleartext,
-			rsa, RSA_NO_PADDING
-		);
-
-		if(ret == -1){
+		size_t rsa_outLen = EVP_PKEY_size(pkey);
+		cleartext = calloc(1, rsa_outLen+1); //unsigned char*
+
+		/* raw RSA (no padding), same as RSA_public_decrypt */
+		EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
+		if (ctx == NULL
+			|| EVP_PKEY_verify_recover_init(ctx) != 1
+			|| EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_NO_PADDING) != 1
+			|| EVP_PKEY_verify_recover(ctx, cleartext, &rsa_outLen,
+			                           ciphertext, rsa_inLen) != 1) {
 			fprintf(stderr, "Decryption fail!\n Make sure dependencies are met and correct input\n");
 		}
+		EVP_PKEY_CTX_free(ctx);
 		cleartext[rsa_inLen] = '\0';
 	
 		/*
@@ -71,11 +131,12 @@ const unsigned char* public_decrypt(const unsigned char* ciphertext){
 		// ------- DEBUG -------
 		*/
 	
-		//clear key from memory
-		RSA_free(rsa);
+		//drop our reference, the cache keeps the key
+		EVP_PKEY_free(pkey);
 	
 	} // end of IF-statement
 	
+	AUTH_PROBE1(decrypt__done, KEY_LEN_BYTE);
 	return cleartext;
 }
 
@@ -83,33 +144,25 @@ const unsigned char* public_decrypt(const unsigned char* ciphertext){
 /*
  * using global variables:
  *  static const int cleartextLen
- *  unsigned char randData_orig[(CLEARTEXT_LEN/2+1)];
  */
-int verify_rsa(const unsigned char* cleartext_user) {
+int verify_rsa(const unsigned char* cleartext_user, const struct auth_ctx* ctx) {
 
 	// take only the last (3) chars of user input
 	// , as 3 Bytes = 6 hex = CLEARTEXT_LEN
-	unsigned char* cleartextStripped = malloc(cleartextLen/2+1);
-	int i;
-
 	// WARNING: this only works for constants set in original header!
-	for (i = 0; i < cleartextLen/2; i++) {
-	  cleartextStripped[i] = cleartext_user[i+6];
-	}
-	cleartextStripped[cleartextLen/2] = '\0';
+	const unsigned char* cleartextStripped = cleartext_user+6;
 		
 	/* NOTE:
-	 * randData_orig (and cleartext_user) is not reversed,
+	 * ctx->challenge (and cleartext_user) is not reversed,
 	 * 	unlike the hexStr (cleartext) seen by user
 	 */
 
 	//success! Authenticate user
-	if (strcmp((char*) cleartextStripped,(char*) randData_orig) == 0) {
-		free(cleartextStripped);
+	// memcmp, random data may contain '\0'
+	if (memcmp(cleartextStripped, ctx->challenge, cleartextLen/2) == 0) {
 		return 0; 
 	} else {
 	  //access denied
-		free(cleartextStripped);
 		return 1;
 	}
 }
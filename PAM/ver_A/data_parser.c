@@ -18,6 +18,55 @@
 #include "header.h"
 #include <stdbool.h>
 
+/* token alphabet (see asciiToBin) -> 6-bit value
+ * unknown characters are read as '0' (48), same as asciiToBin */
+static unsigned char charToSixBit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - 48;
+	} else if (c >= 'A' && c <= 'Z') {
+		return c - 55;
+	} else if (c >= 'a' && c <= 'z') {
+		return c - 60;
+	} else if (c == '!') {
+		return 36;
+	} else if (c == '"') {
+		return 63;
+	}
+	fprintf(stderr,"\n\n User input ERROR!\n");
+	fprintf(stderr,"Interpreting character as '0'\n");
+	fprintf(stderr,"\n(will probably fail, try again)\n");
+	return 48;
+}
+
+/*
+ * using global variables:
+ *  static const int ciphertextLen
+ */
+void userInput_decode(const char* userInput, unsigned char* data) {
+	// at most ciphertextLen chars, right aligned with leading '0' (as strSanitizer)
+	int len = 0;
+	while (len < ciphertextLen && userInput[len] != '\0') {
+		len++;
+	}
+	int pad = ciphertextLen - len;
+
+	// shift in 6 bits per char, out 8 bits per byte (as asciiToBin + binToChar)
+	unsigned int bits = 0;
+	int nBits = 0;
+	int out = 0;
+	int i;
+	for (i = 0; i < ciphertextLen; i++) {
+		unsigned char value = (i < pad) ? 0 : charToSixBit(userInput[i-pad]);
+		bits = (bits << 6) | value;
+		nBits += 6;
+		if (nBits >= 8) {
+			nBits -= 8;
+			data[out++] = (unsigned char) (bits >> nBits);
+			bits &= (1u << nBits) - 1;
+		}
+	}
+}
+
 /*
  * using global variables:
  *  static const int ciphertextLen
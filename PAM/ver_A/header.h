@@ -38,20 +38,49 @@ static const int ciphertextLen = KEY_LEN_6BIT;
 
 // Amount of hex chars to generate (entered on 2-fa device)
 static const int cleartextLen = CLEARTEXT_LEN; // chars = bytes
- 
-// Random data generated (data 8bit not 4bit hex -> len/2)
-// Checked by verify_rsa to ensure signed message is correct
-// Note:
-// 		these are NOT printable characters
-// Note:
-// 		randData_orig (and cleartext_user) is not reversed,
-//  	unlike the hexStr (cleartext) seen by user
-unsigned char randData_orig[(CLEARTEXT_LEN/2+1)];
 
+// Name of the auth_ctx in the PAM handle (pam_set_data)
+#define AUTH_CTX_NAME "pam_cthAuth_ctx"
+// ----  DO NOT CHANGE ----------------------------------
 
 
 
-// ----  DO NOT CHANGE ----------------------------------
+/* ---- PROBES ---- */
+// USDT probes (provider pam_cthAuth), nops until bpftrace/perf attach.
+// Left out without sys/sdt.h or with -DNO_AUTH_PROBES
+#if !defined(NO_AUTH_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define AUTH_PROBES 1
+#endif
+#endif
+
+#ifdef AUTH_PROBES
+#define AUTH_PROBE(name)             DTRACE_PROBE(pam_cthAuth, name)
+#define AUTH_PROBE1(name, a)         DTRACE_PROBE1(pam_cthAuth, name, a)
+#else
+#define AUTH_PROBE(name)             ((void) 0)
+#define AUTH_PROBE1(name, a)         ((void) 0)
+#endif
+
+
+/* ---- TYPES ---- */
+
+/* auth_ctx
+ *
+ * State of one authentication (pam_sm_authenticate call),
+ * kept with its PAM handle, never shared between calls or threads
+ */
+struct auth_ctx {
+	// Random data generated (data 8bit not 4bit hex -> len/2)
+	// Checked by verify_rsa to ensure signed message is correct
+	// Note:
+	// 		these are NOT printable characters
+	// Note:
+	// 		challenge (and cleartext_user) is not reversed,
+	//  	unlike the hexStr (cleartext) seen by user
+	unsigned char challenge[(CLEARTEXT_LEN/2+1)];
+};
 
 
 
@@ -60,6 +89,14 @@ unsigned char randData_orig[(CLEARTEXT_LEN/2+1)];
 // ___________________________
 // data_parser.c
 
+/* userInput_decode
+ *
+ * Token output format -> raw data, without heap or libm
+ * same result as strSanitizer + asciiToBin + binToChar
+ * data gets KEY_LEN_BYTE bytes
+ */
+void userInput_decode(const char* userInput, unsigned char* data);
+
 /* asciiToBin
  *
  * Recieves sanitized input (orginating from device)
@@ -101,6 +138,12 @@ char* strSanitizer(char* inputStr);
 // ___________________________
 // crypto.c 
 
+/* public_key_file
+ *
+ * path to public key (PEM), see crypto.c
+ */
+extern char *public_key_file;
+
 /* public_decrypt
  *
  * raw data -> raw data 
@@ -110,11 +153,11 @@ const unsigned char* public_decrypt(const unsigned char*);
 
 /* verify_rsa
  *
- * compare cleartext to global variable randData_orig
+ * compare cleartext to the challenge in ctx
  * 	both are raw data (not hex)
  * returns 0 if success
  */
-int   verify_rsa(const unsigned char*);
+int   verify_rsa(const unsigned char*, const struct auth_ctx* ctx);
 
 
 // ___________________________
@@ -125,27 +168,30 @@ int   verify_rsa(const unsigned char*);
  * Token output format -> raw data
  * (calls strSanitizer, asciiToBin and binToChar)
  * any length / "infinite" -> KEY_LEN_BYTE length
+ * Note: replaced by userInput_decode, kept for comparison (bench_main.c)
  */
 unsigned char* userInput_to_data(char*);
 
 /* check_userInput
  *
  * Sanitize, convert and verify (decrypt) - user input (from token)
- * (calls userInput_to_data and public_decrypt)
+ * against the challenge in ctx
+ * (calls userInput_decode and public_decrypt)
  * ciphertext -> int
  * 0 = sign successful, else 1
  */
-int check_userInput(char*);
+int check_userInput(char*, const struct auth_ctx* ctx);
 
 /* genNumber_raw
  *
  * Generates random hex sequence for two-factor device
  * In bytes, cleartextLen/2 long (+ 1 Byte, null termination)
+ * a copy is kept in ctx->challenge
  *
- * void -> Random raw data 
+ * ctx -> Random raw data 
  * utilizes <openssl/rand.h>
  */
-unsigned char* genNumber_raw(void);
+unsigned char* genNumber_raw(struct auth_ctx* ctx);
 
 
 /* genNumber_hexStr
@@ -153,10 +199,10 @@ unsigned char* genNumber_raw(void);
  * generates cleartextLen random chars (+ 1 Byte, null termination
  * 	converts each byte (data) to 2 hex (printable chars)
  *
- * void -> Random hex chars
+ * ctx -> Random hex chars
  * (calls genNumber_raw, hexToAscii)
  */
-char*	genNumber_hexStr(void);
+char*	genNumber_hexStr(struct auth_ctx* ctx);
 
 
 /* reverseStr
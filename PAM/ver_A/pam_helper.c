@@ -29,15 +29,18 @@ unsigned char* userInput_to_data(char* userInput){
 }
 
 
-int check_userInput(char* ciphertext_user){
-	unsigned char* ciphertext_data = userInput_to_data(ciphertext_user);
+int check_userInput(char* ciphertext_user, const struct auth_ctx* ctx){
+	unsigned char ciphertext_data[KEY_LEN_BYTE];
+	AUTH_PROBE1(input__start, strlen(ciphertext_user)); // chars typed
+	userInput_decode(ciphertext_user, ciphertext_data);
+	free(ciphertext_user);
 	const unsigned char* cleartext = public_decrypt(ciphertext_data);
-	free(ciphertext_data);
 
-	int result = verify_rsa(cleartext);
+	int result = verify_rsa(cleartext, ctx);
 
 	// const char*
 	free((char*) cleartext);
+	AUTH_PROBE1(input__done, result); // 0 = verified
 	return(result);
 }
 
@@ -45,12 +48,12 @@ int check_userInput(char* ciphertext_user){
 /*
  * using global variables:
  *  static const int cleartextLen
- *  unsigned char randData_orig[(CLEARTEXT_LEN/2+1)];		
  */
-unsigned char* genNumber_raw(void) {
+unsigned char* genNumber_raw(struct auth_ctx* ctx) {
 	//half size cleartextLen since different data per printable char
 	//data (8bit) , hex (4bit) per visable char for user
 	unsigned char* randData  =  malloc(cleartextLen/2+1);
+	AUTH_PROBE(rng__start);
 	
 	//randData fills with random data
 	while(RAND_bytes(randData, (cleartextLen/2)) != 1 ){
@@ -63,7 +66,8 @@ unsigned char* genNumber_raw(void) {
 
 	//null terminate
 	randData[cleartextLen/2] = '\0';
-	memcpy(randData_orig, randData, (cleartextLen/2+1));
+	memcpy(ctx->challenge, randData, (cleartextLen/2+1));
+	AUTH_PROBE1(rng__done, cleartextLen/2); // bytes
 	
 	return randData;
 }
@@ -73,9 +77,9 @@ unsigned char* genNumber_raw(void) {
  * using global variables:
  *  static const int cleartextLen
  */
-char* genNumber_hexStr(void){
+char* genNumber_hexStr(struct auth_ctx* ctx){
 	//generate random data cleartextLen/2 long
-	unsigned char* randData = genNumber_raw();	
+	unsigned char* randData = genNumber_raw(ctx);	
 
 	/* Reverse the bytestring bc FPGA mem handling */
 	reverseStr(randData);
@@ -56,14 +56,31 @@ PAM_EXTERN int pam_sm_acct_mgmt(pam_handle_t *pamh, int flags, int argc, const c
   return (PAM_SUCCESS);
 }
 
+// pam_set_data cleanup, at pam_end or next pam_sm_authenticate
+static void auth_ctx_cleanup(pam_handle_t *pamh, void *data, int error_status) {
+	memset(data, 0, sizeof(struct auth_ctx));
+	free(data);
+}
+
 // Does NOT check user please use pam_unix too
 // Authenticate using two-factor device
 PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv) {
 
   int ret = 0;
+	AUTH_PROBE(auth__start);
+
+	// challenge of this call, lives with pamh (thread safe per handle)
+	struct auth_ctx *ctx = calloc(1, sizeof(struct auth_ctx));
+	if (ctx == NULL) {
+		return PAM_BUF_ERR;
+	}
+	if (pam_set_data(pamh, AUTH_CTX_NAME, ctx, auth_ctx_cleanup) != PAM_SUCCESS) {
+		free(ctx);
+		return PAM_SYSTEM_ERR;
+	}
  	
  	//msgPrompt is malloc:ed - cleartextLen+1 chars	
-  char *msgPrompt = genNumber_hexStr();
+  char *msgPrompt = genNumber_hexStr(ctx);
   
 	//terminal output in msgPromptInstr
 	char* strOutput0 = "Enter on device: ";
@@ -96,13 +113,14 @@ PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, cons
   if (resp != NULL) {
     if (ret == PAM_SUCCESS) {
 			// Verify token response (user input) against original cleartext
-  		strCompared = check_userInput(resp->resp);
+  		strCompared = check_userInput(resp->resp, ctx);
 		}
 		else {free(resp->resp);}
     
 		free(resp);
   }
 	
+	AUTH_PROBE1(auth__done, strCompared); // 0 = success
   if (strCompared == 0) {
     return PAM_SUCCESS;
   }
@@ -0,0 +1,13 @@
+#!/bin/bash
+
+cd ..
+#compile and run decoding microbenchmark
+#  ./run_bench.sh [bench_main options], e.g. ./run_bench.sh -n 100000
+gcc -Wall -O2 -o bench_main crypto.c data_parser.c pam_helper.c bench_main.c -lcrypto -lm -pthread || exit 1
+
+./bench_main -k data/public.pem -o bench_result.json "$@"
+RET=$?
+cat bench_result.json
+
+cd -
+exit $RET
@@ -13,7 +13,8 @@
 int main(int argc, char **argv){
 	//if (argc != 2) {printf("Enter ONE input");return 1;}
 	
-	char *msgPrompt = genNumber_hexStr();
+	struct auth_ctx ctx;
+	char *msgPrompt = genNumber_hexStr(&ctx);
 
 	//terminal output in msgPromptInstr
 	char* strOutput0 = "Enter on device: ";
@@ -28,7 +29,7 @@ int main(int argc, char **argv){
 	strcpy(userInputt, "QB5jjpsmzKFB\0");
 
   // Decrypt user input see if same
-  int strCompared = check_userInput(userInputt);
+  int strCompared = check_userInput(userInputt, &ctx);
 	
 	printf("\nEOF\n");
   if (strCompared == 0) {
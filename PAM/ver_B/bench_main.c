@@ -0,0 +1,197 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <unistd.h>
+#include <time.h>
+#include "header.h"
+
+/* Latency benchmark of the full authentication (as in pam_module.c)
+ * against a token or token_emulator, N times.
+ * Prints p50/p95/p99/max per phase as JSON (see auth_timing)
+ *
+ * usage: bench_main [-n auths] [-d device] [-k public.pem] [-o out.json] [-p] [-s baud] [-c]
+ *  -p  persistent session (usb_session_sign), port opened once
+ *  -s  switch the token to baud (usb_configure), -c RTS/CTS
+ */
+
+#define BENCH_PHASES 8
+
+static const char* phaseNames[BENCH_PHASES] = {
+	"open", "rng", "write", "ack", "sign", "decrypt", "compare", "total"
+};
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int cmp_ll(const void* a, const void* b) {
+	long long x = *(const long long*) a;
+	long long y = *(const long long*) b;
+	return (x > y) - (x < y);
+}
+
+// nearest rank percentile of sorted samples, in us
+static double percentile(const long long* sorted, int n, int pct) {
+	int rank = (pct*n + 99)/100;
+	if (rank < 1) {
+		rank = 1;
+	}
+	return sorted[rank-1] / 1000.0;
+}
+
+/* one authentication, same steps as pam_sm_authenticate
+ * returns 0 if signature verified */
+static int bench_auth(const char* device, int persistent, int baud, int rtscts, struct auth_timing* t) {
+	unsigned char usbReceiveBuf[ciphertextLen+1];
+	memset(usbReceiveBuf, 0, sizeof(usbReceiveBuf));
+	memset(t, 0, sizeof(*t));
+	int ret;
+
+	long long start = now_ns();
+	struct challenge challenge;
+	if (challenge_next(&challenge) != 0) {
+		return -1;
+	}
+	const unsigned char *usbMessage = challenge.message;
+	t->rng = now_ns() - start;
+
+	if (persistent) {
+		ret = usb_session_sign(device, usbMessage, usbReceiveBuf, t);
+	} else {
+		start = now_ns();
+		struct termios tty_old;
+		int usb = usb_open(device, &tty_old);
+		if (usb != -1 && (baud != 0 || rtscts)) {
+			usb_configure(usb, baud, rtscts);
+		}
+		t->open = now_ns() - start;
+		if (usb == -1) {
+			return -1;
+		}
+
+		ret = usb_sign(usb, usbMessage, usbReceiveBuf, t);
+
+		start = now_ns();
+		usb_close(usb, &tty_old);
+		t->open += now_ns() - start;
+	}
+	if (ret != 0) {
+		return -1;
+	}
+
+	start = now_ns();
+	reverseStr(usbReceiveBuf);
+	const unsigned char *verifiedMessage = public_decrypt(usbReceiveBuf);
+	t->decrypt = now_ns() - start;
+
+	start = now_ns();
+	ret = memcmp(verifiedMessage, challenge.orig, ciphertextLen);
+	t->compare = now_ns() - start;
+	free((unsigned char*) verifiedMessage);
+
+	return (ret == 0) ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+	const char* device = USB_DEVICE;
+	const char* outFile = NULL;
+	int n = 1000;
+	int persistent = 0;
+	int baud = 0;
+	int rtscts = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:d:k:o:ps:c")) != -1) {
+		switch (opt) {
+			case 'n': n = atoi(optarg); break;
+			case 'd': device = optarg; break;
+			case 'k': public_key_file = optarg; break;
+			case 'o': outFile = optarg; break;
+			case 'p': persistent = 1; break;
+			case 's': baud = atoi(optarg); break;
+			case 'c': rtscts = 1; break;
+			default:
+				fprintf(stderr,"usage: %s [-n auths] [-d device] [-k public.pem] [-o out.json] [-p] [-s baud] [-c]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (n < 1) {
+		n = 1;
+	}
+	if (persistent && (baud != 0 || rtscts)) {
+		usb_session_configure(baud, rtscts);
+	}
+
+	long long* samples[BENCH_PHASES];
+	int i, p;
+	for (p = 0; p < BENCH_PHASES; p++) {
+		samples[p] = calloc(n, sizeof(long long));
+	}
+	long long resends = 0, polls = 0;
+	int failures = 0;
+
+	long long benchStart = now_ns();
+	for (i = 0; i < n; i++) {
+		struct auth_timing t;
+		if (bench_auth(device, persistent, baud, rtscts, &t) != 0) {
+			failures++;
+		}
+		samples[0][i] = t.open;
+		samples[1][i] = t.rng;
+		samples[2][i] = t.write;
+		samples[3][i] = t.ack;
+		samples[4][i] = t.sign;
+		samples[5][i] = t.decrypt;
+		samples[6][i] = t.compare;
+		samples[7][i] = t.open + t.rng + t.write + t.ack + t.sign + t.decrypt + t.compare;
+		resends += t.resends;
+		polls += t.polls;
+	}
+	double seconds = (now_ns() - benchStart) / 1e9;
+
+	FILE* out = stdout;
+	if (outFile != NULL && (out = fopen(outFile, "w")) == NULL) {
+		fprintf(stderr,"Cannot write '%s'\n", outFile);
+		return 1;
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"device\": \"%s\",\n", device);
+	fprintf(out, "  \"persistent\": %s,\n", persistent ? "true" : "false");
+	fprintf(out, "  \"baud\": %i,\n", baud);
+	fprintf(out, "  \"auths\": %i,\n", n);
+	fprintf(out, "  \"failures\": %i,\n", failures);
+	fprintf(out, "  \"auths_per_s\": %.1f,\n", n / seconds);
+	fprintf(out, "  \"resends\": %lld,\n", resends);
+	fprintf(out, "  \"polls\": %lld,\n", polls);
+	fprintf(out, "  \"phases_us\": {\n");
+	for (p = 0; p < BENCH_PHASES; p++) {
+		qsort(samples[p], n, sizeof(long long), cmp_ll);
+		fprintf(out, "    \"%s\": {\"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n",
+			phaseNames[p],
+			percentile(samples[p], n, 50), percentile(samples[p], n, 95),
+			percentile(samples[p], n, 99), samples[p][n-1] / 1000.0,
+			(p < BENCH_PHASES-1) ? "," : "");
+		free(samples[p]);
+	}
+	fprintf(out, "  }\n}\n");
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <unistd.h>
+#include <time.h>
+#include "header.h"
+
+/* Microbenchmark of signature verification (decrypt step of
+ * pam_sm_authenticate) on random signatures, N times each:
+ *  openssl  public_decrypt_generic (EVP_PKEY_verify_recover)
+ *  decrypt  public_decrypt (rsa_fixed.c if RSA_FIXED_VERIFY, incl. key cache)
+ *  fixed    rsa_fixed_public alone (no allocation, no key cache)
+ *  batchL   rsa_fixed_public_batch, BENCH_BATCH at a time in L lanes
+ *           (time per signature; lanes limited by the CPU)
+ * Fails if the results differ. Prints p50/p99 in us as JSON.
+ *
+ * usage: bench_verify [-n verifications] [-k public.pem] [-o out.json]
+ */
+
+#define BENCH_INPUTS 256
+#define BENCH_BATCH  16
+#define BENCH_PATHS  6
+
+static const char* pathNames[BENCH_PATHS] = {
+	"openssl", "decrypt", "fixed", "batch1", "batch4", "batch8"
+};
+static const int pathLanes[BENCH_PATHS] = { 0, 0, 0, 1, 4, 8 };
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int cmp_ll(const void* a, const void* b) {
+	long long x = *(const long long*) a;
+	long long y = *(const long long*) b;
+	return (x > y) - (x < y);
+}
+
+// nearest rank percentile of sorted samples, in us
+static double percentile(const long long* sorted, int n, int pct) {
+	int rank = (pct*n + 99)/100;
+	if (rank < 1) {
+		rank = 1;
+	}
+	return sorted[rank-1] / 1000.0;
+}
+
+// keeps the compiler from dropping unused results
+static volatile unsigned char sink;
+
+int main(int argc, char **argv) {
+	const char* outFile = NULL;
+	int n = 100000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:k:o:")) != -1) {
+		switch (opt) {
+			case 'n': n = atoi(optarg); break;
+			case 'k': public_key_file = optarg; break;
+			case 'o': outFile = optarg; break;
+			default:
+				fprintf(stderr,"usage: %s [-n verifications] [-k public.pem] [-o out.json]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (n < 1) {
+		n = 1;
+	}
+
+	// rsa_fixed_key straight from the key file
+	struct rsa_fixed_key key;
+	unsigned char modulus[KEY_LEN_BYTE];
+	const BIGNUM *bn_n, *bn_e;
+	FILE* fp = fopen(public_key_file, "r");
+	RSA* rsa = (fp != NULL) ? PEM_read_RSAPublicKey(fp, NULL, NULL, NULL) : NULL;
+	if (fp != NULL) {
+		fclose(fp);
+	}
+	if (rsa == NULL) {
+		fprintf(stderr,"Cannot read public key '%s'\n", public_key_file);
+		return 1;
+	}
+	RSA_get0_key(rsa, &bn_n, &bn_e, NULL);
+	if (BN_num_bytes(bn_n) != KEY_LEN_BYTE
+		|| BN_bn2binpad(bn_n, modulus, KEY_LEN_BYTE) != KEY_LEN_BYTE
+		|| rsa_fixed_init(&key, modulus, BN_get_word(bn_e)) != 0) {
+		fprintf(stderr,"Key is not %i bytes with e=65537\n", KEY_LEN_BYTE);
+		RSA_free(rsa);
+		return 1;
+	}
+	RSA_free(rsa);
+	struct rsa_batch_key batchKey;
+	rsa_fixed_batch_init(&batchKey, &key);
+
+	// random signatures below the modulus, plus 0, 1 and n-1
+	static unsigned char inputs[BENCH_INPUTS][KEY_LEN_BYTE];
+	int i, j;
+	srand(1);
+	for (i = 0; i < BENCH_INPUTS; i++) {
+		for (j = 0; j < KEY_LEN_BYTE; j++) {
+			inputs[i][j] = rand();
+		}
+		inputs[i][0] %= modulus[0];
+	}
+	memset(inputs[0], 0, KEY_LEN_BYTE);
+	memset(inputs[1], 0, KEY_LEN_BYTE);
+	inputs[1][KEY_LEN_BYTE-1] = 1;
+	memcpy(inputs[2], modulus, KEY_LEN_BYTE);
+	inputs[2][KEY_LEN_BYTE-1] -= 1; //n odd
+
+	// all paths must give the same bytes
+	static unsigned char expected[BENCH_INPUTS][KEY_LEN_BYTE];
+	int mismatches = 0;
+	for (i = 0; i < BENCH_INPUTS; i++) {
+		unsigned char fixed[KEY_LEN_BYTE];
+		const unsigned char* generic = public_decrypt_generic(inputs[i]);
+		const unsigned char* cleartext = public_decrypt(inputs[i]);
+		if (rsa_fixed_public(&key, inputs[i], fixed) != 0
+			|| memcmp(generic, fixed, KEY_LEN_BYTE) != 0
+			|| memcmp(generic, cleartext, KEY_LEN_BYTE) != 0) {
+			mismatches++;
+		}
+		memcpy(expected[i], generic, KEY_LEN_BYTE);
+		free((char*) generic);
+		free((char*) cleartext);
+	}
+	// too large for modulus, rejected by both
+	unsigned char fixed[KEY_LEN_BYTE];
+	if (rsa_fixed_public(&key, modulus, fixed) != -1) {
+		mismatches++;
+	}
+
+	// batches in every lane count, odd sizes, modulus (rejected) in between
+	static unsigned char batchOut[BENCH_INPUTS+1][KEY_LEN_BYTE];
+	const unsigned char* batchIn[BENCH_INPUTS+1];
+	unsigned char* batchOuts[BENCH_INPUTS+1];
+	const unsigned char* batchExpected[BENCH_INPUTS+1];
+	int ok[BENCH_INPUTS+1];
+	int lanes;
+	for (lanes = 1; lanes <= 8; lanes *= 2) {
+		rsa_fixed_batch_lanes(lanes);
+		for (i = 0; i <= BENCH_INPUTS; i++) {
+			batchIn[i] = (i == 5) ? modulus : inputs[i - (i > 5)];
+			batchOuts[i] = batchOut[i];
+		}
+		int start = 0, len = 1;
+		while (start <= BENCH_INPUTS) {
+			if (len > BENCH_INPUTS+1 - start) {
+				len = BENCH_INPUTS+1 - start;
+			}
+			rsa_fixed_public_batch(&batchKey, batchIn+start, batchOuts+start, len, ok+start);
+			start += len;
+			len = len % 19 + 2;
+		}
+		for (i = 0; i <= BENCH_INPUTS; i++) {
+			if (i == 5 ? ok[i] : (!ok[i] || memcmp(batchOut[i], expected[i - (i > 5)], KEY_LEN_BYTE) != 0)) {
+				mismatches++;
+			}
+		}
+	}
+	rsa_fixed_batch_lanes(0);
+
+	// public_verify_batch, one wrong challenge
+	for (i = 0; i < BENCH_INPUTS; i++) {
+		batchIn[i] = inputs[i];
+		batchExpected[i] = expected[i];
+	}
+	expected[7][KEY_LEN_BYTE-1] ^= 1;
+	if (public_verify_batch(batchIn, batchExpected, BENCH_INPUTS, ok) != BENCH_INPUTS-1 || ok[7]) {
+		mismatches++;
+	}
+	expected[7][KEY_LEN_BYTE-1] ^= 1;
+
+	long long* samples = malloc(BENCH_PATHS*n*sizeof(long long));
+	if (samples == NULL) {
+		return 1;
+	}
+	int counts[BENCH_PATHS];
+	int usedLanes[BENCH_PATHS];
+	int path;
+	for (path = 0; path < BENCH_PATHS; path++) {
+		long long* s = samples + path*n;
+		if (pathLanes[path] > 0) {
+			// time per signature of whole batches
+			usedLanes[path] = rsa_fixed_batch_lanes(pathLanes[path]);
+			counts[path] = (n + BENCH_BATCH-1)/BENCH_BATCH;
+			for (i = 0; i < counts[path]; i++) {
+				int first = (i*BENCH_BATCH) % (BENCH_INPUTS-BENCH_BATCH);
+				long long start = now_ns();
+				rsa_fixed_public_batch(&batchKey, batchIn+first, batchOuts+first, BENCH_BATCH, ok);
+				s[i] = (now_ns() - start)/BENCH_BATCH;
+			}
+			qsort(s, counts[path], sizeof(long long), cmp_ll);
+			continue;
+		}
+		usedLanes[path] = 1;
+		counts[path] = n;
+		for (i = 0; i < n; i++) {
+			const unsigned char* in = inputs[i % BENCH_INPUTS];
+			long long start = now_ns();
+			if (path == 2) {
+				rsa_fixed_public(&key, in, fixed);
+				sink ^= fixed[0];
+			} else {
+				const unsigned char* out = (path == 0) ? public_decrypt_generic(in) : public_decrypt(in);
+				sink ^= out[0];
+				free((char*) out);
+			}
+			s[i] = now_ns() - start;
+		}
+		qsort(s, n, sizeof(long long), cmp_ll);
+	}
+
+	FILE* out = stdout;
+	if (outFile != NULL && (out = fopen(outFile, "w")) == NULL) {
+		fprintf(stderr,"Cannot write '%s'\n", outFile);
+		free(samples);
+		return 1;
+	}
+	fprintf(out, "{\n");
+	fprintf(out, "  \"verifications\": %i,\n", n);
+	fprintf(out, "  \"rsa_fixed_verify\": %i,\n", RSA_FIXED_VERIFY);
+	fprintf(out, "  \"mismatches\": %i,\n", mismatches);
+	for (path = 0; path < BENCH_PATHS; path++) {
+		const long long* s = samples + path*n;
+		fprintf(out, "  \"%s\": {\"lanes\": %i, \"p50\": %.2f, \"p99\": %.2f}%s\n", pathNames[path],
+			usedLanes[path], percentile(s, counts[path], 50), percentile(s, counts[path], 99),
+			(path < BENCH_PATHS-1) ? "," : "");
+	}
+	fprintf(out, "}\n");
+	if (out != stdout) {
+		fclose(out);
+	}
+	free(samples);
+	return (mismatches == 0) ? 0 : 1;
+}
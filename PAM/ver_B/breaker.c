@@ -0,0 +1,114 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <time.h>
+#include <pthread.h>
+#include "header.h"
+
+/* Circuit breaker of the token
+ *
+ * A token that is gone or wedged costs every login the full deadlines
+ * (USB_ACK_TIMEOUT_MS, USB_SIGN_TIMEOUT_MS), and sshd children waiting
+ * on it fill MaxStartups. After BREAKER_FAILURES token failures in a row
+ * logins fail at once (open) for BREAKER_COOLDOWN_MS. Then one login is
+ * let through to probe the token with *I, the others keep failing until
+ * it answers. State in one shared memory segment (BREAKER_SHM) for every
+ * process using the module, in this process only if it cannot be used.
+ * Atomics only, no locks: a process dying holds nothing, a probe it had
+ * is given to another login after BREAKER_PROBE_MS.
+ */
+
+// a probe login has this long (session wait, *I, *W incl. PIN and *R)
+#define BREAKER_PROBE_MS (USB_SESSION_WAIT_MS+USB_PIN_TIMEOUT_MS+USB_SIGN_TIMEOUT_MS)
+
+static pthread_once_t breakerOnce = PTHREAD_ONCE_INIT;
+static struct breaker_shm* breaker = NULL;
+static struct breaker_shm breakerLocal; // no shared segment
+
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+struct breaker_shm* breaker_open(int writable) {
+	return (struct breaker_shm*) shm_map(BREAKER_SHM, sizeof(struct breaker_shm), BREAKER_MAGIC, writable);
+}
+
+static void breaker_map(void) {
+	breaker = breaker_open(1);
+	if (breaker == NULL) {
+		if (BREAKER_SHM[0] != '\0') {
+			fprintf(stderr,"Token breaker of this process only\n");
+		}
+		breaker = &breakerLocal;
+	}
+}
+
+enum breaker_state breaker_allow(void) {
+	pthread_once(&breakerOnce, breaker_map);
+	int64_t openUntil = __atomic_load_n(&breaker->openUntil, __ATOMIC_ACQUIRE);
+	if (openUntil == 0) {
+		return BREAKER_PASS;
+	}
+	long long now = now_ms();
+	if (now < openUntil) {
+		return BREAKER_FAIL_FAST;
+	}
+	// cooldown over, first to claim the probe goes
+	int64_t probeUntil = __atomic_load_n(&breaker->probeUntil, __ATOMIC_ACQUIRE);
+	if (probeUntil > now) {
+		return BREAKER_FAIL_FAST;
+	}
+	if (__atomic_compare_exchange_n(&breaker->probeUntil, &probeUntil, now + BREAKER_PROBE_MS,
+		0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		return BREAKER_PROBE;
+	}
+	return BREAKER_FAIL_FAST;
+}
+
+void breaker_release(int probe) {
+	pthread_once(&breakerOnce, breaker_map);
+	if (probe) {
+		__atomic_store_n(&breaker->probeUntil, 0, __ATOMIC_RELEASE);
+	}
+}
+
+void breaker_record(int ok, int probe) {
+	pthread_once(&breakerOnce, breaker_map);
+	if (ok) {
+		__atomic_store_n(&breaker->failures, 0, __ATOMIC_RELAXED);
+		if (__atomic_exchange_n(&breaker->openUntil, 0, __ATOMIC_ACQ_REL) != 0) {
+			fprintf(stderr,"Token answers again\n");
+		}
+		__atomic_store_n(&breaker->probeUntil, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	int64_t failures = __atomic_add_fetch(&breaker->failures, 1, __ATOMIC_ACQ_REL);
+	int64_t until = now_ms() + BREAKER_COOLDOWN_MS;
+	if (probe) {
+		// still broken, next probe after another cooldown
+		__atomic_store_n(&breaker->openUntil, until, __ATOMIC_RELEASE);
+		__atomic_store_n(&breaker->probeUntil, 0, __ATOMIC_RELEASE);
+	} else if (failures >= BREAKER_FAILURES) {
+		int64_t closed = 0;
+		if (__atomic_compare_exchange_n(&breaker->openUntil, &closed, until,
+			0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_fetch_add(&breaker->trips, 1, __ATOMIC_RELAXED);
+			fprintf(stderr,"Token failed %i times, failing logins for %i ms\n", (int) failures, BREAKER_COOLDOWN_MS);
+		}
+	}
+}
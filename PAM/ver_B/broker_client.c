@@ -0,0 +1,97 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include "header.h"
+
+/* Client side of token_broker.c
+ * One connection per signature:
+ *  request  KEY_LEN_BYTE message (as from genNumber_raw)
+ *  response 1B status (0 = ok) + KEY_LEN_BYTE signature (as from FPGA)
+ */
+
+// read/write all len bytes, socket timeouts end the loop
+static int broker_io(int sock, unsigned char* buf, int len, int doWrite) {
+	int done = 0;
+	while (done < len) {
+		ssize_t ret = doWrite ? write(sock, buf+done, len-done)
+		                      : read(sock, buf+done, len-done);
+		if (ret > 0) {
+			done += ret;
+		} else if (ret == -1 && errno == EINTR) {
+			continue;
+		} else {
+			return -1;
+		}
+	}
+	return done;
+}
+
+// connected socket, -1 if no broker is running
+static int broker_connect(const char* socketPath) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path)-1);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock != -1 && connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+		close(sock);
+		sock = -1;
+	}
+	return sock;
+}
+
+int broker_running(const char* socketPath) {
+	int sock = broker_connect(socketPath);
+	if (sock == -1) {
+		return 0;
+	}
+	close(sock); // broker sees an empty request and drops it
+	return 1;
+}
+
+int broker_sign(const char* socketPath, const unsigned char* message, unsigned char* signature) {
+	int sock = broker_connect(socketPath);
+	if (sock == -1) {
+		// no broker running
+		return -2;
+	}
+
+	// bound total wait (queue + signing)
+	struct timeval tv;
+	tv.tv_sec = BROKER_TIMEOUT_MS/1000;
+	tv.tv_usec = (BROKER_TIMEOUT_MS%1000)*1000;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	unsigned char response[KEY_LEN_BYTE+1];
+	int ret = -1;
+	if (broker_io(sock, (unsigned char*) message, KEY_LEN_BYTE, 1) == KEY_LEN_BYTE
+		&& broker_io(sock, response, KEY_LEN_BYTE+1, 0) == KEY_LEN_BYTE+1) {
+		if (response[0] == 0) {
+			memcpy(signature, response+1, KEY_LEN_BYTE);
+			ret = 0;
+		}
+	} else {
+		fprintf(stderr,"Token broker did not answer\n");
+	}
+	close(sock);
+	return ret;
+}
@@ -15,6 +15,9 @@
 
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <unistd.h>
 #include "header.h"
 
@@ -22,12 +25,117 @@
  * Change public_key_file to your public.pem file
  * (public RSA key, as generated by create_rsa_files.sh)
  */
-char *public_key_file = "/home/user/Desktop/koddosa_git/koddosa/PAM_directory/ver_B/data/public512.pem";
+char *public_key_file = "/home/user/Desktop/koddosa_git/koddosa/PAM_directory/ver_B/data/public" KEY_STR(KEY_BITS) ".pem";
 
-const unsigned char* public_decrypt(const unsigned char* ciphertext){
+/* Public key cache
+ * The key is parsed once per process and kept as an EVP_PKEY,
+ * OpenSSL then also keeps its Montgomery context between calls.
+ * The file is stat:ed on every call and reloaded if it changed
+ * (new inode, size or mtime), so keys can be rotated without restart.
+ * Keys that rsa_fixed.c can handle also get their rsa_fixed_key, and
+ * their rsa_batch_key once public_verify_batch asks for it.
+ */
+static pthread_mutex_t keyCache_lock = PTHREAD_MUTEX_INITIALIZER;
+static EVP_PKEY *keyCache_pkey = NULL;
+static struct stat keyCache_stat;
+static struct rsa_fixed_key keyCache_fixed;
+static int keyCache_fixedOk = 0;
+static struct rsa_batch_key keyCache_batch;
+static int keyCache_batchOk = 0;
+
+static int keyCache_isStale(const struct stat *st) {
+	return (keyCache_pkey == NULL
+		|| st->st_dev != keyCache_stat.st_dev
+		|| st->st_ino != keyCache_stat.st_ino
+		|| st->st_size != keyCache_stat.st_size
+		|| st->st_mtim.tv_sec != keyCache_stat.st_mtim.tv_sec
+		|| st->st_mtim.tv_nsec != keyCache_stat.st_mtim.tv_nsec);
+}
+
+// 0 if key is KEY_LEN_BYTE long with e=65537
+static int public_key_fixed(const RSA *rsa, struct rsa_fixed_key *key) {
+	const BIGNUM *n, *e;
+	unsigned char modulus[KEY_LEN_BYTE];
+
+	RSA_get0_key(rsa, &n, &e, NULL);
+	if (BN_num_bytes(n) != KEY_LEN_BYTE
+		|| BN_bn2binpad(n, modulus, KEY_LEN_BYTE) != KEY_LEN_BYTE) {
+		return -1;
+	}
+	return rsa_fixed_init(key, modulus, BN_get_word(e));
+}
+
+/* Returns a new reference to the cached key (free with EVP_PKEY_free),
+ * or NULL if the key file cannot be read
+ * fixed (may be NULL) gets a copy of the rsa_fixed_key, batch (may
+ * be NULL) of the rsa_batch_key, fixedOk is set if there is one
+ */
+static EVP_PKEY* public_key_get(struct rsa_fixed_key *fixed, struct rsa_batch_key *batch, int *fixedOk) {
+	struct stat st;
+	EVP_PKEY *pkey = NULL;
+
+	if (stat(public_key_file, &st) == -1 || access(public_key_file, R_OK) == -1) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&keyCache_lock);
+	if (keyCache_isStale(&st)) {
+		FILE *fp0 = fopen(public_key_file, "r");
+		RSA *rsa = NULL;
+		if (fp0 != NULL) {
+			rsa = PEM_read_RSAPublicKey(fp0, NULL, NULL, NULL);
+			fclose(fp0);
+		}
+
+		if (rsa != NULL && RSA_size(rsa) != KEY_LEN_BYTE) {
+			// signatures would not fit the buffers of this build
+			fprintf(stderr, "Key is %i bit, this build is for %i bit keys (KEY_BITS)\n", RSA_bits(rsa), KEY_BITS);
+			RSA_free(rsa);
+			rsa = NULL;
+		}
+		if (rsa != NULL) {
+			EVP_PKEY *newKey = EVP_PKEY_new();
+			if (newKey != NULL && EVP_PKEY_set1_RSA(newKey, rsa) == 1) {
+				//replace old key, in-flight users hold their own reference
+				EVP_PKEY_free(keyCache_pkey);
+				keyCache_pkey = newKey;
+				keyCache_stat = st;
+				keyCache_fixedOk = (public_key_fixed(rsa, &keyCache_fixed) == 0);
+				keyCache_batchOk = 0;
+			} else {
+				EVP_PKEY_free(newKey);
+			}
+			RSA_free(rsa);
+		}
+	}
+
+	if (keyCache_pkey != NULL && EVP_PKEY_up_ref(keyCache_pkey) == 1) {
+		pkey = keyCache_pkey;
+		if (fixed != NULL && keyCache_fixedOk) {
+			*fixed = keyCache_fixed;
+			*fixedOk = 1;
+		}
+		if (batch != NULL && keyCache_fixedOk) {
+			if (!keyCache_batchOk) {
+				rsa_fixed_batch_init(&keyCache_batch, &keyCache_fixed);
+				keyCache_batchOk = 1;
+			}
+			*batch = keyCache_batch;
+			*fixedOk = 1;
+		}
+	}
+	pthread_mutex_unlock(&keyCache_lock);
+	return pkey;
+}
+
+static const unsigned char* decrypt(const unsigned char* ciphertext, int useFixed){
   unsigned char * cleartext;
+	struct rsa_fixed_key fixed;
+	int fixedOk = 0;
+	AUTH_PROBE1(decrypt__start, KEY_LEN_BYTE); // bytes
+	EVP_PKEY *pkey = public_key_get(useFixed ? &fixed : NULL, NULL, &fixedOk);
 
-	if( access(public_key_file, R_OK) == -1 ) {
+	if (pkey == NULL) {
    	fprintf(stderr, "\nCannot read public key:\n '%s'\n", public_key_file);
 
     //To avoid seg fault, return zeroed cleartext
@@ -36,23 +144,33 @@ const unsigned char* public_decrypt(const unsigned char* ciphertext){
     cleartext[keyLen] = '\0';
   }
 
+  else if (fixedOk) {
+		// fixed-width verifier, rsa_fixed.c
+		cleartext = calloc(1, keyLen+1);
+		if (rsa_fixed_public(&fixed, ciphertext, cleartext) != 0) {
+			fprintf(stderr, "Decryption fail!\n");
+			memset(cleartext, '\0', keyLen);
+		}
+		EVP_PKEY_free(pkey);
+	}
+
   else {
-  // file is readable
+  // key is loaded
 		int rsa_inLen = KEY_LEN_BYTE; //strlen((char*) ciphertext);
-		FILE *fp0 = fopen(public_key_file, "r");
+		size_t rsa_outLen = EVP_PKEY_size(pkey);
+		cleartext = calloc(1, rsa_outLen+1);
 
-		/* init RSA struct and read public key */
-		RSA *rsa;
-		rsa = PEM_read_RSAPublicKey(fp0, NULL, NULL, NULL);
-		fclose(fp0);
-
-		int rsaSize = RSA_size(rsa);
-		cleartext = malloc(rsaSize+1);
-	
-		RSA_public_decrypt(
-			rsa_inLen, ciphertext, cleartext,
-			rsa, RSA_NO_PADDING
-		);
+		/* raw RSA (no padding), same as RSA_public_decrypt */
+		EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
+		if (ctx == NULL
+			|| EVP_PKEY_verify_recover_init(ctx) != 1
+			|| EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_NO_PADDING) != 1
+			|| EVP_PKEY_verify_recover(ctx, cleartext, &rsa_outLen,
+			                           ciphertext, rsa_inLen) != 1) {
+			fprintf(stderr, "Decryption fail!\n");
+			memset(cleartext, '\0', rsa_inLen);
+		}
+		EVP_PKEY_CTX_free(ctx);
 
 		cleartext[rsa_inLen] = '\0'; //prob. necessary
 
@@ -68,10 +186,71 @@ const unsigned char* public_decrypt(const unsigned char* ciphertext){
 		// ------- DEBUG -------
 		*/
 
-		//clear key from memory
-		RSA_free(rsa);
+		//drop our reference, the cache keeps the key
+		EVP_PKEY_free(pkey);
 	}
+	AUTH_PROBE2(decrypt__done, KEY_LEN_BYTE, fixedOk); // bytes, rsa_fixed.c used
 	return cleartext;
 }
 
+int public_key_load(void){
+	EVP_PKEY *pkey = public_key_get(NULL, NULL, NULL);
+	if (pkey == NULL) {
+		fprintf(stderr, "\nCannot read public key:\n '%s'\n", public_key_file);
+		return -1;
+	}
+	EVP_PKEY_free(pkey);
+	return 0;
+}
+
+const unsigned char* public_decrypt(const unsigned char* ciphertext){
+	return decrypt(ciphertext, RSA_FIXED_VERIFY);
+}
 
+const unsigned char* public_decrypt_generic(const unsigned char* ciphertext){
+	return decrypt(ciphertext, 0);
+}
+
+#define VERIFY_BATCH_LEN 16 //signatures per rsa_fixed_public_batch
+
+int public_verify_batch(const unsigned char** ciphertexts, const unsigned char** expected, int count, int* results){
+	struct rsa_batch_key batch;
+	int fixedOk = 0;
+	int verified = 0;
+	int i, j;
+	EVP_PKEY *pkey = public_key_get(NULL, RSA_FIXED_VERIFY ? &batch : NULL, &fixedOk);
+
+	if (pkey == NULL) {
+		fprintf(stderr, "\nCannot read public key:\n '%s'\n", public_key_file);
+		memset(results, 0, count*sizeof(int));
+		return -1;
+	}
+	EVP_PKEY_free(pkey);
+
+	for (i = 0; i < count; i += VERIFY_BATCH_LEN) {
+		int len = (count - i < VERIFY_BATCH_LEN) ? count - i : VERIFY_BATCH_LEN;
+		unsigned char cleartext[VERIFY_BATCH_LEN][KEY_LEN_BYTE];
+		unsigned char* cleartexts[VERIFY_BATCH_LEN];
+
+		if (fixedOk) {
+			for (j = 0; j < len; j++) {
+				cleartexts[j] = cleartext[j];
+			}
+			rsa_fixed_public_batch(&batch, ciphertexts+i, cleartexts, len, results+i);
+		} else {
+			// OpenSSL, one by one
+			for (j = 0; j < len; j++) {
+				const unsigned char* verifiedMessage = public_decrypt_generic(ciphertexts[i+j]);
+				memcpy(cleartext[j], verifiedMessage, KEY_LEN_BYTE);
+				free((unsigned char*) verifiedMessage);
+				results[i+j] = 1;
+			}
+		}
+
+		for (j = 0; j < len; j++) {
+			results[i+j] = results[i+j] && memcmp(cleartext[j], expected[i+j], ciphertextLen) == 0;
+			verified += results[i+j];
+		}
+	}
+	return verified;
+}
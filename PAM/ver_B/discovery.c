@@ -0,0 +1,441 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "header.h"
+
+/* Token discovery
+ *
+ * Finds tokens on the ports matching patterns (e.g. /dev/ttyACM*) and
+ * keeps a table of the ones that answered *I. The watching process
+ * (token_broker) publishes it in the DISCOVERY_SHM segment, so a login
+ * takes one (discovery_pick) without opening or even looking for a
+ * port: foreign devices on a matching port are asked *I by the broker
+ * only, once, and at the power on baud only. Hot-plug
+ * is seen with inotify on the directory of each pattern: udev creates
+ * the node and sets its permissions after the kernel (netlink) event, so
+ * that is when the port can be opened. A new port is asked *I again every
+ * DISCOVERY_RETRY_MS while the token starts up, at most DISCOVERY_TRIES
+ * times. Tokens are told apart by their ID, not by the name their port
+ * got (enumeration order). A port another process keeps (TIOCEXCL:
+ * token_broker, a persistent session) is not opened, even as root:
+ * termios is per tty, usb_open alone would change its line. It is
+ * looked at again every DISCOVERY_RETRY_MS until it is free.
+ */
+
+struct port {
+	char device[256];
+	char id[4];             // *I answer
+	dev_t rdev;
+	int ready;              // answered *I
+	int tries;              // *I asked, DISCOVERY_TRIES = given up
+	long long retryAt;      // ms, next *I
+};
+
+struct pattern {
+	char pattern[256];
+	int wd;                 // inotify watch of its directory
+};
+
+// ports, patterns and the published table are changed with scanLock
+// held (watcher thread, discovery_start)
+static pthread_mutex_t scanLock = PTHREAD_MUTEX_INITIALIZER;
+static struct port ports[DISCOVERY_PORTS_MAX];
+static int nPorts = 0;
+static struct pattern patterns[DISCOVERY_PATTERNS_MAX];
+static int nPatterns = 0;
+static int inotifyFd = -1;
+static int watching = 0;
+static void (*discovered)(const char* device, const char* id, int ready) = NULL;
+static struct discovery_shm* table = NULL;      // published, NULL if it cannot be
+
+// discovery_pick side, the table of the watching process
+static pthread_once_t pickOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pickLock = PTHREAD_MUTEX_INITIALIZER;
+static const struct discovery_shm* pickTable = NULL;
+static char picked[256];                        // port given last time
+
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+// publishes the ports with a token, scanLock must be held
+static void ready_update(void) {
+	uint64_t count = 0;
+	int i;
+	if (table == NULL) {
+		return;
+	}
+	__atomic_add_fetch(&table->seq, 1, __ATOMIC_ACQ_REL); // odd, readers retry
+	for (i = 0; i < nPorts; i++) {
+		if (ports[i].ready) {
+			memcpy(table->tokens[count].device, ports[i].device, sizeof(ports[i].device));
+			memcpy(table->tokens[count].id, ports[i].id, sizeof(ports[i].id));
+			count++;
+		}
+	}
+	table->count = count;
+	__atomic_add_fetch(&table->seq, 1, __ATOMIC_RELEASE);
+}
+
+// 1 if another process keeps the port, looked at without touching its line
+static int port_taken(const char* device) {
+	int excl = 0;
+	int fd = open(device, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		return (errno == EBUSY);
+	}
+	if (ioctl(fd, TIOCGEXCL, &excl) == -1) {
+		excl = 0;
+	}
+	close(fd);
+	return excl;
+}
+
+// *I on the port at power on baud, nothing else is sent to a device
+// that does not answer (a token left at another baud by a crashed host
+// is found once replugged, or given to token_broker by name)
+// returns 0 if a token answered, 1 if the port is taken, else -1
+static int port_identify(struct port* p) {
+	struct termios ttyOld;
+	if (port_taken(p->device)) {
+		return 1;
+	}
+	int usb = usb_open(p->device, &ttyOld);
+	if (usb == -1) {
+		return usb_in_use() ? 1 : -1;
+	}
+	// ours while asking
+	ioctl(usb, TIOCEXCL);
+	int ret = usb_probe(usb, p->id);
+	ioctl(usb, TIOCNXCL);
+	usb_close(usb, &ttyOld);
+	if (ret == 0 && USB_TOKEN_ID[0] != '\0' && strcmp(p->id, USB_TOKEN_ID) != 0) {
+		fprintf(stderr,"Token %s on %s is not %s, not used\n", p->id, p->device, USB_TOKEN_ID);
+		p->tries = DISCOVERY_TRIES;
+		return -1;
+	}
+	return ret;
+}
+
+// new port on device, or one to ask again (udev changed it)
+static void port_seen(const char* device) {
+	struct stat st;
+	int i;
+	if (stat(device, &st) == -1 || !S_ISCHR(st.st_mode)) {
+		return;
+	}
+	for (i = 0; i < nPorts; i++) {
+		if (ports[i].rdev == st.st_rdev) {
+			// known port, or the same by another name (/dev/serial/by-id)
+			if (!ports[i].ready && strcmp(ports[i].device, device) == 0) {
+				ports[i].tries = 0;
+				ports[i].retryAt = now_ms();
+			}
+			return;
+		}
+	}
+	if (nPorts == DISCOVERY_PORTS_MAX) {
+		fprintf(stderr,"More than %i ports, %s not used\n", DISCOVERY_PORTS_MAX, device);
+		return;
+	}
+	struct port* p = &ports[nPorts++];
+	memset(p, 0, sizeof(struct port));
+	strncpy(p->device, device, sizeof(p->device)-1);
+	p->rdev = st.st_rdev;
+	p->retryAt = now_ms();
+}
+
+static void port_gone(const char* device) {
+	int i;
+	for (i = 0; i < nPorts; i++) {
+		if (strcmp(ports[i].device, device) == 0) {
+			struct port gone = ports[i];
+			ports[i] = ports[--nPorts];
+			ready_update();
+			if (gone.ready) {
+				fprintf(stderr,"Token %s on %s unplugged\n", gone.id, gone.device);
+				if (discovered != NULL) {
+					discovered(gone.device, gone.id, 0);
+				}
+			}
+			return;
+		}
+	}
+}
+
+// asks *I on ports that are due, returns ms until the next one is, -1 if none
+static int ports_identify(void) {
+	long long next = -1;
+	int i;
+	for (i = 0; i < nPorts; i++) {
+		struct port* p = &ports[i];
+		if (p->ready || p->tries >= DISCOVERY_TRIES) {
+			continue;
+		}
+		long long now = now_ms();
+		if (p->retryAt > now) {
+			next = (next == -1 || p->retryAt - now < next) ? p->retryAt - now : next;
+			continue;
+		}
+		int ret = port_identify(p);
+		if (ret == 1) {
+			// not asked, no try used
+			p->retryAt = now_ms() + DISCOVERY_RETRY_MS;
+			next = (next == -1 || DISCOVERY_RETRY_MS < next) ? DISCOVERY_RETRY_MS : next;
+			continue;
+		}
+		p->tries++;
+		if (ret == 0) {
+			p->ready = 1;
+			ready_update();
+			fprintf(stderr,"Token %s on %s\n", p->id, p->device);
+			if (discovered != NULL) {
+				discovered(p->device, p->id, 1);
+			}
+		} else if (p->tries < DISCOVERY_TRIES) {
+			p->retryAt = now_ms() + DISCOVERY_RETRY_MS;
+			next = (next == -1 || DISCOVERY_RETRY_MS < next) ? DISCOVERY_RETRY_MS : next;
+		}
+	}
+	return (int) next;
+}
+
+static void patterns_event(const struct inotify_event* ev) {
+	char device[512];
+	int i;
+	for (i = 0; i < nPatterns; i++) {
+		if (patterns[i].wd != ev->wd) {
+			continue;
+		}
+		// directory of the pattern + name
+		const char* slash = strrchr(patterns[i].pattern, '/');
+		snprintf(device, sizeof(device), "%.*s/%s", (int) (slash - patterns[i].pattern),
+			patterns[i].pattern, ev->name);
+		if (fnmatch(patterns[i].pattern, device, FNM_PATHNAME) != 0) {
+			continue;
+		}
+		if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			port_gone(device);
+		} else {
+			port_seen(device);
+		}
+	}
+}
+
+static void* discovery_watch(void* arg) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd;
+	int timeout = -1;
+
+	pthread_mutex_lock(&scanLock);
+	pfd.fd = inotifyFd;
+	pfd.events = POLLIN;
+	pthread_mutex_unlock(&scanLock);
+
+	for (;;) {
+		if (poll(&pfd, 1, timeout) == -1 && errno != EINTR) {
+			fprintf(stderr,"Discovery stopped\n");
+			return NULL;
+		}
+		pthread_mutex_lock(&scanLock);
+		ssize_t len;
+		while ((len = read(inotifyFd, buf, sizeof(buf))) > 0) {
+			char* pos;
+			for (pos = buf; pos < buf + len; ) {
+				const struct inotify_event* ev = (const struct inotify_event*) pos;
+				if (ev->len > 0) {
+					patterns_event(ev);
+				}
+				pos += sizeof(struct inotify_event) + ev->len;
+			}
+		}
+		timeout = ports_identify();
+		pthread_mutex_unlock(&scanLock);
+	}
+	return NULL;
+}
+
+// after fork() the child has no watcher thread, it starts over
+static void discovery_atfork_child(void) {
+	pthread_mutex_init(&scanLock, NULL);
+	if (inotifyFd != -1) {
+		close(inotifyFd);
+	}
+	inotifyFd = -1;
+	watching = 0;
+	nPorts = 0;
+	nPatterns = 0;
+	table = NULL; // the parent keeps publishing
+}
+
+static void discovery_init(void) {
+	pthread_atfork(NULL, NULL, discovery_atfork_child);
+}
+
+int discovery_start(const char* pattern, void (*cb)(const char* device, const char* id, int ready)) {
+	static pthread_once_t atforkOnce = PTHREAD_ONCE_INIT;
+	char dir[256];
+	glob_t g;
+	size_t i;
+	int ret = 0;
+
+	const char* slash = strrchr(pattern, '/');
+	if (slash == NULL || slash - pattern >= (long) sizeof(dir)) {
+		fprintf(stderr,"Pattern '%s' needs a directory\n", pattern);
+		return -1;
+	}
+	pthread_once(&atforkOnce, discovery_init);
+
+	pthread_mutex_lock(&scanLock);
+	if (cb != NULL) {
+		discovered = cb;
+	}
+	if (table == NULL && nPatterns == 0) {
+		table = (struct discovery_shm*) shm_map(DISCOVERY_SHM, sizeof(struct discovery_shm), DISCOVERY_MAGIC, 1);
+		if (table == NULL && DISCOVERY_SHM[0] != '\0') {
+			fprintf(stderr,"Tokens found are not published (%s)\n", DISCOVERY_SHM);
+		}
+		ready_update(); // none yet, drop the table of an earlier run
+	}
+	for (i = 0; i < (size_t) nPatterns; i++) {
+		if (strcmp(patterns[i].pattern, pattern) == 0) {
+			pthread_mutex_unlock(&scanLock);
+			return 0;
+		}
+	}
+	if (nPatterns == DISCOVERY_PATTERNS_MAX) {
+		fprintf(stderr,"More than %i patterns, '%s' not used\n", DISCOVERY_PATTERNS_MAX, pattern);
+		pthread_mutex_unlock(&scanLock);
+		return -1;
+	}
+	if (inotifyFd == -1) {
+		inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	}
+	memcpy(dir, pattern, slash - pattern);
+	dir[(slash == pattern) ? 1 : slash - pattern] = '\0';
+	int wd = (inotifyFd == -1) ? -1 : inotify_add_watch(inotifyFd, dir,
+		IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM);
+	if (wd == -1) {
+		fprintf(stderr,"Unable to watch '%s'\n", dir);
+		pthread_mutex_unlock(&scanLock);
+		return -1;
+	}
+	strncpy(patterns[nPatterns].pattern, pattern, sizeof(patterns[nPatterns].pattern)-1);
+	patterns[nPatterns].wd = wd;
+	nPatterns++;
+
+	// tokens plugged in already, ready when this returns
+	if (glob(pattern, 0, NULL, &g) == 0) {
+		for (i = 0; i < g.gl_pathc; i++) {
+			port_seen(g.gl_pathv[i]);
+		}
+		globfree(&g);
+	}
+	ports_identify();
+
+	if (!watching) {
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, discovery_watch, NULL) == 0) {
+			watching = 1;
+		} else {
+			fprintf(stderr,"Unable to start discovery\n");
+			ret = -1;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	pthread_mutex_unlock(&scanLock);
+	return ret;
+}
+
+static void discovery_map(void) {
+	pickTable = (const struct discovery_shm*) shm_map(DISCOVERY_SHM, sizeof(struct discovery_shm), DISCOVERY_MAGIC, 0);
+	if (pickTable == NULL) {
+		fprintf(stderr,"No token table, token_broker not started yet? (%s)\n", DISCOVERY_SHM);
+	}
+}
+
+int discovery_pick(const char* pattern, char* device, char* id) {
+	struct discovery_token tokens[DISCOVERY_PORTS_MAX];
+	uint64_t seq, count = 0;
+	int pick = -1;
+	int i, tries;
+
+	pthread_once(&pickOnce, discovery_map);
+	if (pickTable == NULL) {
+		return -1;
+	}
+	// copy until the writer was not in between, a writer that died
+	// while writing leaves seq odd: no table
+	for (tries = 0; ; tries++) {
+		if (tries == 1000) {
+			fprintf(stderr,"Token table is being written for too long\n");
+			return -1;
+		}
+		seq = __atomic_load_n(&pickTable->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		count = pickTable->count;
+		if (count > DISCOVERY_PORTS_MAX) {
+			count = DISCOVERY_PORTS_MAX;
+		}
+		memcpy(tokens, pickTable->tokens, count*sizeof(struct discovery_token));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&pickTable->seq, __ATOMIC_RELAXED) == seq) {
+			break;
+		}
+	}
+
+	// the port picked so far stays picked while it is there
+	pthread_mutex_lock(&pickLock);
+	for (i = 0; i < (int) count; i++) {
+		tokens[i].device[sizeof(tokens[i].device)-1] = '\0';
+		tokens[i].id[sizeof(tokens[i].id)-1] = '\0';
+		if (fnmatch(pattern, tokens[i].device, FNM_PATHNAME) != 0) {
+			continue;
+		}
+		if (pick == -1 || strcmp(tokens[i].device, picked) == 0) {
+			pick = i;
+		}
+	}
+	if (pick != -1) {
+		strcpy(picked, tokens[pick].device);
+		strcpy(device, tokens[pick].device);
+		if (id != NULL) {
+			memcpy(id, tokens[pick].id, sizeof(tokens[pick].id));
+		}
+	}
+	pthread_mutex_unlock(&pickLock);
+	return (pick == -1) ? -1 : 0;
+}
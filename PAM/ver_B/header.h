@@ -21,15 +21,89 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <termios.h>
+#include <stdint.h>
 
 /* ---- GLOBAL VARS ---- */
 // These can be changed (if you know what you're doing)
-#define CLEARTEXT_LEN 63  //Hexchars (should be less than KEY_LEN_BYTE)
-#define KEY_LEN_BYTE  64	 //Blocks of 8-bit
+// RSA key size, one build per size: -DKEY_BITS=1024 (KEY_BITS=1024 ./compile_all.sh)
+#ifndef KEY_BITS
+#define KEY_BITS 512
+#endif
+#define CLEARTEXT_LEN (KEY_LEN_BYTE-1)  //Hexchars (should be less than KEY_LEN_BYTE)
+#define KEY_LEN_BYTE  (KEY_BITS/8)	 //Blocks of 8-bit
+
+#define USB_DEVICE "/dev/ttyACM0"
+#define USB_TOKEN_ID ""          //*I answer of a token found by discovery.c, empty: any
+// Deadlines (ms) for each phase of the token exchange
+#define USB_ACK_TIMEOUT_MS  2000 //*W until *D (incl. resend after *T), again after each *B
+#define USB_PIN_TIMEOUT_MS  60000 //*W until *D while the token answers *B (PIN not entered yet)
+#define USB_SIGN_TIMEOUT_MS 5000 //*R until *M (RSA on the FPGA)
+#define USB_RETRY_MS        1    //pause before next *R after *B
+#define USB_PIN_POLL_MS     50   //pause before next *W after *B, once past USB_ACK_TIMEOUT_MS
+#define USB_BATCH_MAX       4    //messages per *K and *w slots, BATCH_MAX of the token
+// Bauds of *S0 to *S3 (BAUD to BAUD_3 of the token), *S0 is the power on baud
+#define USB_BAUD_RATES      {115200, 921600, 1000000, 2500000}
+#define USB_BAUD_CONFIRM_MS 500  //token goes back to *S0 unless a command follows *S within
+#define USB_PROBE_TIMEOUT_MS 100 //*I or *S answer when looking for the baud of the token
+#define USB_SESSION_WAIT_MS (USB_PIN_TIMEOUT_MS+USB_SIGN_TIMEOUT_MS) //for the persistent port, used by another login
+
+// Finding tokens on ports matching a pattern (discovery.c)
+#define DISCOVERY_PORTS_MAX    16   //ports watched
+#define DISCOVERY_PATTERNS_MAX 4
+#define DISCOVERY_RETRY_MS     250  //next *I on a new port that did not answer
+#define DISCOVERY_TRIES        12   //*I on a new port before it is given up
+#define DISCOVERY_SHM "/pam_cthAuth_tokens" //ports with a token, written by token_broker, read by the module
+
+// Circuit breaker (breaker.c), shared by all processes using the module.
+// Empty BREAKER_SHM: per process
+#define BREAKER_SHM         "/pam_cthAuth_breaker"
+#define BREAKER_FAILURES    3     //token failures in a row until logins fail at once
+#define BREAKER_COOLDOWN_MS 30000 //failing at once for, then one login probes the token (*I)
+
+// Token broker (token_broker.c), used by PAM module when running
+#define BROKER_SOCKET "/run/pam_cthAuth.sock"
+#define BROKER_QUEUE_LEN       64    //max waiting clients
+#define BROKER_TIMEOUT_MS      30000 //client wait incl. queue
+#define BROKER_READ_TIMEOUT_MS 1000  //broker wait for client request
+#define BROKER_TOKENS_MAX      16    //tokens served by one broker
+#define BROKER_TRIES           3     //tokens tried per request
+#define BROKER_BACKOFF_MS      100   //first pause of a failing token
+#define BROKER_BACKOFF_MAX_MS  10000 //longest pause, doubled per failure
+#define BROKER_BUSY_MS         50    //pause of a token answering *B (no PIN yet)
+
+// Pre-generated challenges (pam_helper.c)
+#define CHALLENGE_POOL_LEN 64 //power of 2
+#define CHALLENGE_POOL_LOW 16 //refill when fewer left
+
+// Challenge sent to the token ahead of pam_sm_authenticate (prefetch
+// argument, persistent session)
+#define PREFETCH_TTL_MS  30000 //an unused challenge sent ahead is dropped after
+
+// Counters and latency histograms of pam_sm_authenticate (metrics.c),
+// shared memory read by metrics_dump. Empty: no metrics
+#define METRICS_SHM "/pam_cthAuth_metrics"
+
+// Verify with rsa_fixed.c (KEY_LEN_BYTE keys, e=65537), 0: always OpenSSL
+// (bench_verify, decrypt p50: 3.4 against 7.8 us at 512 bit, at 1024 bit
+// no gain, 22.7-27.2 against 20.0-21.1 us). Needs -O2 as compile_all.sh
+// and get_ready.sh build the module, at -O0 it is slower than OpenSSL
+#define RSA_FIXED_VERIFY (KEY_BITS <= 512)
+
+// Model of the RSA core of the token (rsa_model.c)
+#define RSA_MODEL_CLOCK_HZ   100000000 //clock of the token (USB_TOP.vhd), cycles to time
+#define RSA_MODEL_MAX_CYCLES 4000000   //gives up if the core has not answered by then
 /* ---- GLOBAL VARS ---- */
 
 
 // ----  DO NOT CHANGE ----------------------------------
+#if KEY_BITS != 512 && KEY_BITS != 1024 && KEY_BITS != 2048
+#error KEY_BITS must be 512, 1024 or 2048
+#endif
+// KEY_BITS as a string, e.g. for key file names
+#define KEY_STR_(x) #x
+#define KEY_STR(x) KEY_STR_(x)
+
 // Length of RSA key (and thus ciphertext) data bytes
 // Ciphertext sent to PC
 static const int keyLen = KEY_LEN_BYTE;
@@ -38,20 +112,243 @@ static const int ciphertextLen = KEY_LEN_BYTE;
 // Amount of data bytes (chars) to generate
 // Cleartext sent to FPGA
 static const int cleartextLen = CLEARTEXT_LEN;
- 
-// Random data generated
-// Checked by verify_rsa to ensure signed message is correct
-// Note: these are NOT printable characters
-unsigned char randData_orig[(CLEARTEXT_LEN+2)];
+
+// 64-bit limbs of a KEY_LEN_BYTE number (rsa_fixed.c)
+#define RSA_FIXED_LIMBS ((KEY_LEN_BYTE+7)/8)
+// 28-bit limbs for the batch functions, 2^(28*RSA_BATCH_LIMBS) > 4*modulus
+#define RSA_BATCH_LIMBS ((KEY_LEN_BYTE*8+2+27)/28)
+
+// rsa_512 core of the token (rsa_model.c): 16-bit words of a 512 bit
+// number, cycles between start_in and valid_in for n_c_core
+#define RSA_MODEL_WORDS 32
+#define RSA_MODEL_BYTES (RSA_MODEL_WORDS*2)
+#define RSA_MODEL_SETUP 7
+// Cycles of rsa_top from the first word in to the last out for a
+// bit_size, the same for any data (rsa_model_exp_rtl), with the words
+// port of rsa_top (a multiple of 8). With the WIDTH generic of rsa_top
+// at 32 or 64 the words are 512/WIDTH, the cycles per word the same
+#define RSA_MODEL_CYCLES_W(words, bits) (28 + 45L*(words)/2 + (20 + 45L*(words)/4)*(bits))
+#define RSA_MODEL_CYCLES(bits) RSA_MODEL_CYCLES_W(RSA_MODEL_WORDS, bits)
+
+// Name of the auth_ctx in the PAM handle (pam_set_data)
+#define AUTH_CTX_NAME "pam_cthAuth_ctx"
+
+// Histogram buckets of metrics.c, upper bounds (us) in metrics.c
+#define METRICS_BUCKETS 18
+#define METRICS_MAGIC   0x63746833 //layout of metrics_shm, change with it
+#define BREAKER_MAGIC   0x63746231 //layout of breaker_shm, change with it
+#define DISCOVERY_MAGIC 0x63746431 //layout of discovery_shm, change with it
 // ----  DO NOT CHANGE ----------------------------------
 
 
 
+/* ---- PROBES ---- */
+// USDT probes (provider pam_cthAuth) for bpftrace/perf on running
+// processes, see script/trace_auth.bt. Each is a nop until attached.
+// Needs sys/sdt.h (systemtap-sdt-devel) at compile time, without it
+// (or with -DNO_AUTH_PROBES) they are left out
+#if !defined(NO_AUTH_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define AUTH_PROBES 1
+#endif
+#endif
+
+#ifdef AUTH_PROBES
+#define AUTH_PROBE(name)             DTRACE_PROBE(pam_cthAuth, name)
+#define AUTH_PROBE1(name, a)         DTRACE_PROBE1(pam_cthAuth, name, a)
+#define AUTH_PROBE2(name, a, b)      DTRACE_PROBE2(pam_cthAuth, name, a, b)
+#define AUTH_PROBE3(name, a, b, c)   DTRACE_PROBE3(pam_cthAuth, name, a, b, c)
+#else
+#define AUTH_PROBE(name)             ((void) 0)
+#define AUTH_PROBE1(name, a)         ((void) 0)
+#define AUTH_PROBE2(name, a, b)      ((void) 0)
+#define AUTH_PROBE3(name, a, b, c)   ((void) 0)
+#endif
+
+
+/* ---- TYPES ---- */
+
+/* auth_timing
+ *
+ * Time (ns) spent in each phase of one authentication
+ * filled in by usb_* functions when given (may be NULL)
+ */
+struct auth_timing {
+	long long open;     // usb_open + usb_close
+	long long rng;      // genNumber_raw
+	long long write;    // writing *W[message] (incl. resends)
+	long long ack;      // waiting for *D
+	long long sign;     // *R polling until *M
+	long long decrypt;  // public_decrypt
+	long long compare;  // compare with the challenge
+	long long broker;   // broker_sign (instead of open to sign)
+	int resends;        // *W written again after *T or *B
+	int timeouts;       // *T (or no answer) after *W
+	int busy;           // *B after *W or *R
+	int polls;          // *R written
+};
+
+/* challenge
+ *
+ * One challenge for the token, see challenge_next
+ */
+struct challenge {
+	unsigned char message[KEY_LEN_BYTE];   // reversed, ready for *W (as from genNumber_raw)
+	unsigned char orig[CLEARTEXT_LEN+2];   // not reversed, to compare with the verified signature
+};
+
+/* auth_ctx
+ *
+ * State of one authentication (pam_sm_authenticate call),
+ * kept with its PAM handle (pam_set_data), never shared between
+ * calls or threads
+ */
+struct auth_ctx {
+	struct challenge challenge;               // sent to token, expected back after verify
+	unsigned char response[KEY_LEN_BYTE+1];   // signature as sent by FPGA
+	int usb;                                  // port opened by this call, -1 if none
+	struct termios ttyOld;                    // settings to restore on usb
+};
+
+
+/* rsa_fixed_key
+ *
+ * Public key for rsa_fixed_public, see rsa_fixed_init
+ * limbs least significant first
+ */
+struct rsa_fixed_key {
+	uint64_t n[RSA_FIXED_LIMBS];    // modulus
+	uint64_t rr[RSA_FIXED_LIMBS];   // R^2 mod n, R = 2^(64*RSA_FIXED_LIMBS)
+	uint64_t n0inv;                 // -n^-1 mod 2^64
+};
+
+/* rsa_batch_key
+ *
+ * Public key for rsa_fixed_public_batch, see rsa_fixed_batch_init
+ * 28-bit limbs, R = 2^(28*RSA_BATCH_LIMBS)
+ */
+struct rsa_batch_key {
+	struct rsa_fixed_key fixed;
+	uint32_t n28[RSA_BATCH_LIMBS];  // modulus
+	uint32_t rr28[RSA_BATCH_LIMBS]; // R^2 mod n
+	uint32_t n0inv28;               // -n^-1 mod 2^28
+};
+
+/* rsa_model_key
+ *
+ * Inputs of the RSA core for one key, see rsa_model_init
+ * words least significant first, as on the ports of rsa_top
+ */
+struct rsa_model_key {
+	uint16_t m[RSA_MODEL_WORDS];   // modulus
+	uint16_t y[RSA_MODEL_WORDS];   // exponent
+	uint16_t r_c[RSA_MODEL_WORDS]; // 2^(32*(words+1)) mod m
+	int bitSize;                   // bit_size, bits of y from the top one used
+	int words;                     // words port of rsa_top, RSA_MODEL_WORDS after rsa_model_init
+};
+
+/* rsa_model_crt_key
+ *
+ * Generics of rsa_crt (CRT signature on rsa_top cores) for one key, see
+ * rsa_model_crt_init. Words least significant first, 0 above the
+ * RSA_MODEL_WORDS/2 words of p, q and the numbers mod p or q
+ */
+struct rsa_model_crt_key {
+	uint16_t n[RSA_MODEL_WORDS];       // MODULO
+	uint16_t rcN[RSA_MODEL_WORDS];     // R_C, as r_c of rsa_model_key
+	uint16_t p[RSA_MODEL_WORDS];       // PRIME_P
+	uint16_t q[RSA_MODEL_WORDS];       // PRIME_Q
+	uint16_t dp[RSA_MODEL_WORDS];      // EXP_P, d mod p-1
+	uint16_t dq[RSA_MODEL_WORDS];      // EXP_Q, d mod q-1
+	uint16_t qInv[RSA_MODEL_WORDS];    // Q_INV, q^-1 mod p
+	uint16_t rcP[RSA_MODEL_WORDS];     // R_C_P, 2^(32*(RSA_MODEL_WORDS+1)) mod p
+	uint16_t rcQ[RSA_MODEL_WORDS];     // R_C_Q
+	uint16_t rcPHalf[RSA_MODEL_WORDS]; // R_C_P_HALF, 2^(32*(RSA_MODEL_WORDS/2+1)) mod p
+	uint16_t rcQHalf[RSA_MODEL_WORDS]; // R_C_Q_HALF
+	uint16_t e[RSA_MODEL_WORDS];       // PUB_EXP, the check of s
+	int eBits;                         // bits of e, bit_size of that run
+	int cores;                         // CORES, 1 or 2
+};
+
+/* metrics_phase, metrics_result
+ *
+ * Histograms and verdicts of metrics_shm
+ */
+enum metrics_phase { METRICS_OPEN, METRICS_RNG, METRICS_WRITE, METRICS_ACK, METRICS_SIGN,
+	METRICS_BROKER, METRICS_DECRYPT, METRICS_TOTAL, METRICS_PHASES };
+enum metrics_result { METRICS_SUCCESS, METRICS_MISMATCH, METRICS_TOKEN_FAIL,
+	METRICS_DECRYPT_FAIL, METRICS_ERROR, METRICS_FAIL_FAST, METRICS_NO_PIN, METRICS_RESULTS };
+
+/* metrics_histogram
+ *
+ * Latencies of one phase, buckets[i] counts the ones up to bound i
+ * (not cumulative), buckets[METRICS_BUCKETS] the rest
+ */
+struct metrics_histogram {
+	uint64_t buckets[METRICS_BUCKETS+1];
+	uint64_t sumNs;
+};
+
+/* metrics_shm
+ *
+ * Layout of the METRICS_SHM segment. Updated with atomic adds only,
+ * by every process running the PAM module, no locks
+ */
+struct metrics_shm {
+	uint64_t magic;                                   // METRICS_MAGIC once initialized
+	uint64_t results[METRICS_RESULTS];                // authentications by verdict
+	uint64_t resends;                                 // auth_timing counters, summed
+	uint64_t timeouts;
+	uint64_t busy;
+	uint64_t polls;
+	struct metrics_histogram phases[METRICS_PHASES];
+};
+
+/* discovery_shm
+ *
+ * Ports with a token, as found by the watching process (token_broker),
+ * in the DISCOVERY_SHM segment. One writer, seq is odd while it writes
+ */
+struct discovery_token {
+	char device[256];
+	char id[4];              // *I answer
+};
+
+struct discovery_shm {
+	uint64_t magic;          // DISCOVERY_MAGIC once initialized
+	uint64_t seq;
+	uint64_t count;
+	struct discovery_token tokens[DISCOVERY_PORTS_MAX];
+};
+
+/* breaker_state, breaker_shm
+ *
+ * Circuit breaker of the token (breaker.c), in the BREAKER_SHM segment.
+ * Times are CLOCK_MONOTONIC ms, the same in every process
+ */
+enum breaker_state { BREAKER_FAIL_FAST, BREAKER_PASS, BREAKER_PROBE };
+
+struct breaker_shm {
+	uint64_t magic;          // BREAKER_MAGIC once initialized
+	int64_t failures;        // token failures in a row
+	int64_t openUntil;       // logins fail at once until, 0 = closed
+	int64_t probeUntil;      // one login probes the token until, 0 = none
+	uint64_t trips;          // times opened
+};
+
+
 /* ---- FUNCTIONS ---- */
 
 // ___________________________
 // crypto.c 
 
+/* public_key_file
+ *
+ * path to public key (PEM), see crypto.c
+ */
+extern char *public_key_file;
+
 /* public_decrypt
  *
  * raw data -> raw data 
@@ -59,6 +356,146 @@ unsigned char randData_orig[(CLEARTEXT_LEN+2)];
  */
 const unsigned char* public_decrypt(const unsigned char*);
 
+/* public_decrypt_generic
+ *
+ * public_decrypt always through OpenSSL (EVP), also when
+ * RSA_FIXED_VERIFY is set. For comparison (bench_verify.c)
+ */
+const unsigned char* public_decrypt_generic(const unsigned char*);
+
+/* public_verify_batch
+ *
+ * Verifies count signatures at once (rsa_fixed_public_batch, or
+ * public_decrypt_generic one by one if the key is not for rsa_fixed.c)
+ * results[i] = 1 if public_decrypt(ciphertexts[i]) equals
+ * expected[i] (ciphertextLen B, as challenge.orig), else 0
+ * returns number verified, -1 if the key cannot be read
+ */
+int public_verify_batch(const unsigned char** ciphertexts, const unsigned char** expected, int count, int* results);
+
+/* public_key_load
+ *
+ * Reads the public key into the cache of public_decrypt ahead of
+ * the first signature (prefetch), also initializes OpenSSL
+ * returns 0 on success, -1 if the key cannot be read
+ */
+int public_key_load(void);
+
+
+// ___________________________
+// rsa_fixed.c
+
+/* rsa_fixed_init
+ *
+ * Precomputes the Montgomery context of a public key
+ * modulus KEY_LEN_BYTE big endian bytes (top byte not 0)
+ * returns 0 on success, -1 if e is not 65537 or modulus is even
+ */
+int rsa_fixed_init(struct rsa_fixed_key* key, const unsigned char* modulus, unsigned long e);
+
+/* rsa_fixed_public
+ *
+ * raw RSA public operation (no padding) without allocation,
+ * same result as public_decrypt. KEY_LEN_BYTE big endian in and out
+ * returns 0 on success, -1 if ciphertext is not less than modulus
+ */
+int rsa_fixed_public(const struct rsa_fixed_key* key, const unsigned char* ciphertext, unsigned char* cleartext);
+
+/* rsa_fixed_batch_init
+ *
+ * Precomputes the batch context of a key from rsa_fixed_init, only
+ * needed for rsa_fixed_public_batch
+ */
+void rsa_fixed_batch_init(struct rsa_batch_key* key, const struct rsa_fixed_key* fixed);
+
+/* rsa_fixed_public_batch
+ *
+ * rsa_fixed_public of count ciphertexts, several at once in SIMD
+ * lanes (AVX-512F: 8, AVX2: 4), one by one on other CPUs
+ * ok[i] = 1 if cleartexts[i] is set, 0 if ciphertexts[i] is not
+ * less than modulus (cleartexts[i] zeroed)
+ * returns number of ok
+ */
+int rsa_fixed_public_batch(const struct rsa_batch_key* key, const unsigned char** ciphertexts, unsigned char** cleartexts, int count, int* ok);
+
+/* rsa_fixed_batch_lanes
+ *
+ * Lanes used by rsa_fixed_public_batch: the most the CPU has (8, 4
+ * or 1), at most max if max > 0. Not thread safe, call before batches
+ * returns lanes used
+ */
+int rsa_fixed_batch_lanes(int max);
+
+
+// ___________________________
+// rsa_model.c
+
+/* rsa_model_init
+ *
+ * Inputs of the RSA core for a key, r_c as constant_gen.c
+ * modulus RSA_MODEL_BYTES big endian bytes, exponent expLen big endian
+ * bytes, bitSize the bit_size port, 0: bits of the exponent
+ * (Security_Token_Top_USB.vhd: 512)
+ * returns 0 on success, -1 if modulus is even or a length is wrong
+ */
+int rsa_model_init(struct rsa_model_key* key, const unsigned char* modulus, const unsigned char* exponent, int expLen, int bitSize);
+
+/* rsa_model_exp
+ *
+ * s = x^y mod m as the RSA core computes it, word by word: Montgomery
+ * products of the PE ring and the ladder of rsa_top, without the cycles.
+ * x and s RSA_MODEL_WORDS words, least significant first.
+ * s is what the core puts out, bit for bit (same as rsa_model_exp_rtl)
+ * returns cycles of the core, RSA_MODEL_CYCLES(bitSize)
+ */
+long rsa_model_exp(const struct rsa_model_key* key, const uint16_t* x, uint16_t* s);
+
+/* rsa_model_exp_rtl
+ *
+ * rsa_model_exp clock by clock: the registers of rsa_top and all its
+ * entities on each rising edge, driven as in RSA_512_tb.vhd
+ * returns cycles from the first word in (valid_in) to the last word
+ * out (valid_out), -1 if none within RSA_MODEL_MAX_CYCLES
+ */
+long rsa_model_exp_rtl(const struct rsa_model_key* key, const uint16_t* x, uint16_t* s);
+
+/* rsa_model_sign
+ *
+ * Signature of the token on its RAM contents: RSA_MODEL_BYTES little
+ * endian bytes (byte 0 lowest), result the same way, may be ram
+ * returns cycles of the core (rsa_model_exp)
+ */
+long rsa_model_sign(const struct rsa_model_key* key, const unsigned char* ram, unsigned char* result);
+
+/* rsa_model_crt_init
+ *
+ * Generics of rsa_crt for a key, the constants as crt_constants.sh
+ * modulus RSA_MODEL_BYTES big endian bytes, p, q, dp, dq and qInv
+ * (the CRT numbers of the private key) RSA_MODEL_BYTES/2 big endian
+ * bytes, e the public exponent (PUB_EXP), cores the generic CORES
+ * returns 0 on success, -1 if p or q is not odd and of RSA_MODEL_BYTES*4
+ * bits, the rest is not below them or e is 0
+ */
+int rsa_model_crt_init(struct rsa_model_crt_key* key, const unsigned char* modulus, const unsigned char* p, const unsigned char* q,
+	const unsigned char* dp, const unsigned char* dq, const unsigned char* qInv, uint32_t e, int cores);
+
+/* rsa_model_crt
+ *
+ * s = x^d mod n as rsa_crt computes it: x^dp mod p and x^dq mod q on
+ * rsa_top with 16 words, put together on it with 32 (rsa_model_exp),
+ * then s^e mod n on it. s is 0 and *fault 1 if that is not x (x below n)
+ * returns cycles from the first word of x in to the last of s out
+ */
+long rsa_model_crt(const struct rsa_model_crt_key* key, const uint16_t* x, uint16_t* s, int* fault);
+
+/* rsa_model_crt_rtl
+ *
+ * rsa_model_crt clock by clock, rsa_crt and its cores
+ * returns cycles as rsa_model_crt, -1 if no result within
+ * RSA_MODEL_MAX_CYCLES
+ */
+long rsa_model_crt_rtl(const struct rsa_model_crt_key* key, const uint16_t* x, uint16_t* s, int* fault);
+
 
 // ___________________________
 //Used in file pam_helper.c
@@ -67,11 +504,20 @@ const unsigned char* public_decrypt(const unsigned char*);
  *
  * Generates random sequence for two-factor device
  * In bytes, cleartextLen long (+ 1 Byte, null termination)
+ * orig (cleartextLen+2 B) gets the not reversed data to compare with
  *
- * void -> Random raw data 
+ * orig -> Random raw data 
  * utilizes <openssl/rand.h>
  */
-unsigned char* genNumber_raw(void);
+unsigned char* genNumber_raw(unsigned char* orig);
+
+/* challenge_next
+ *
+ * Takes a pre-generated challenge from the pool (refilled by a
+ * background thread), generates one directly if the pool is empty
+ * returns 0 on success, -1 if random data generation failed
+ */
+int challenge_next(struct challenge* c);
 
 /* reverseStr
  *
@@ -81,6 +527,326 @@ unsigned char* genNumber_raw(void);
 unsigned char* reverseStr(unsigned char*);
 
 
+// ___________________________
+// usb_transport.c
+
+/* usb_open
+ *
+ * Opens and configures serial port to token (raw, non-blocking)
+ * previous port settings are saved in tty_old
+ * returns fd, -1 on error
+ */
+int usb_open(const char* device, struct termios* tty_old);
+
+/* usb_in_use
+ *
+ * After usb_open failed: 1 if the port is held by another process
+ * (TIOCEXCL) or not ours to open, i.e. the token was not asked
+ */
+int usb_in_use(void);
+
+/* usb_close
+ *
+ * Puts the token back to its power on baud (*S0) if usb_configure
+ * changed it, restores port settings and closes port
+ */
+void usb_close(int usb, const struct termios* tty_old);
+
+/* usb_write
+ *
+ * Writes len bytes, waits at most timeout_ms for the port
+ * returns bytes written, -1 on error/timeout
+ */
+int usb_write(int usb, const unsigned char* buf, int len, int timeout_ms);
+
+/* usb_read_frame
+ *
+ * Waits at most timeout_ms for one frame from token ('*' + opcode)
+ * payload gets the data of *M (ciphertextLen B), *Q (1B count +
+ * count*ciphertextLen B), *I (3B) or *S (1B), may be NULL
+ * returns opcode ('D','M','Q','B','T','I','S'), 0 on timeout, -1 on error
+ */
+int usb_read_frame(int usb, unsigned char* payload, int timeout_ms);
+
+/* usb_send_message
+ *
+ * *W[message] until *D, resends after *T or *B within USB_ACK_TIMEOUT_MS,
+ * which starts again with each *B (no PIN entered yet) up to USB_PIN_TIMEOUT_MS
+ * message as from genNumber_raw (reversed)
+ * returns 0 on success, 'B' if the token was still busy (no PIN) at
+ * USB_PIN_TIMEOUT_MS, -1 on error/timeout
+ */
+int usb_send_message(int usb, const unsigned char* message, struct auth_timing* timing);
+
+/* usb_get_signature
+ *
+ * *R until *M[signature], resends after *B within USB_SIGN_TIMEOUT_MS
+ * signature (ciphertextLen B) as sent by FPGA (reversed)
+ * returns 0 on success, -1 on error/timeout
+ */
+int usb_get_signature(int usb, unsigned char* signature, struct auth_timing* timing);
+
+/* usb_sign
+ *
+ * Full exchange with token, usb_send_message + usb_get_signature
+ * returns 0 on success, 'B' as usb_send_message, -1 on error/timeout
+ */
+int usb_sign(int usb, const unsigned char* message, unsigned char* signature, struct auth_timing* timing);
+
+/* usb_send_batch
+ *
+ * *K[count][messages] until *D, like usb_send_message
+ * count (1 to USB_BATCH_MAX) messages as from genNumber_raw
+ * returns 0 on success, 'B' as usb_send_message, -1 on error/timeout
+ */
+int usb_send_batch(int usb, const unsigned char** messages, int count, struct auth_timing* timing);
+
+/* usb_get_batch
+ *
+ * *Q until *Q[count][signatures], resends after *B
+ * within count*USB_SIGN_TIMEOUT_MS
+ * returns 0 on success, -1 on error/timeout
+ */
+int usb_get_batch(int usb, unsigned char** signatures, int count, struct auth_timing* timing);
+
+/* usb_sign_batch
+ *
+ * Signs count messages in one exchange, the token runs them
+ * back to back. usb_send_batch + usb_get_batch
+ * returns 0 on success, -1 on error/timeout
+ */
+int usb_sign_batch(int usb, const unsigned char** messages, int count, unsigned char** signatures, struct auth_timing* timing);
+
+/* usb_send_tagged
+ *
+ * *w[tag][message] until *D, like usb_send_message. The token starts
+ * signing slot tag (0 to USB_BATCH_MAX-1) on a free RSA core
+ * returns 0 on success, -1 on error/timeout
+ */
+int usb_send_tagged(int usb, int tag, const unsigned char* message, struct auth_timing* timing);
+
+/* usb_get_tagged
+ *
+ * *r[t] for slots 0 to count-1 in turn until each answered
+ * *m[t][signature], in the order the cores finish, within
+ * count*USB_SIGN_TIMEOUT_MS. signatures[t] is the one of slot t
+ * returns 0 on success, -1 on error/timeout
+ */
+int usb_get_tagged(int usb, unsigned char** signatures, int count, struct auth_timing* timing);
+
+/* usb_sign_tagged
+ *
+ * Signs count messages on the RSA cores of the token at once,
+ * message i in slot i. usb_send_tagged for each + usb_get_tagged
+ * timing: write and ack of the last *w
+ * returns 0 on success, 'B' as usb_send_message, -1 on error/timeout
+ */
+int usb_sign_tagged(int usb, const unsigned char** messages, int count, unsigned char** signatures, struct auth_timing* timing);
+
+/* usb_offer
+ *
+ * Writes *W (count 1) or *K once, no resend. resend: resend after *T
+ * within USB_ACK_TIMEOUT_MS, but still not after *B (no PIN entered yet)
+ * returns 0 on *D, 'B' or 'T' if the token is busy or timed out
+ * (or did not answer within USB_ACK_TIMEOUT_MS), -1 on error
+ */
+int usb_offer(int usb, const unsigned char** messages, int count, int resend);
+
+/* usb_identify
+ *
+ * *I, id (4 B) gets the 3 byte ID of the token (token_id, "HEJ"
+ * unless set) and a null termination
+ * returns 0 on success, -1 if no token answered
+ */
+int usb_identify(int usb, char* id);
+
+/* usb_probe
+ *
+ * usb_identify within USB_PROBE_TIMEOUT_MS, is the token there at all
+ */
+int usb_probe(int usb, char* id);
+
+
+/* usb_configure
+ *
+ * Line settings of an open port: baud (one of USB_BAUD_RATES, 0 for
+ * the power on baud, set on the token with *S) and RTS/CTS flow control if rtscts. Finds the
+ * token at any baud of USB_BAUD_RATES (left there by a crashed host)
+ * returns 0 on success, -1 if the baud could not be set, the port is
+ * then at the power on baud
+ */
+int usb_configure(int usb, int baud, int rtscts);
+
+
+/* usb_session_open
+ *
+ * Persistent session: port opened and configured once per process
+ * (exclusive), reopened if the token was unplugged or the device changed
+ * returns fd, -1 on error. Do not close it, use usb_session_close
+ */
+int usb_session_open(const char* device);
+
+/* usb_session_configure
+ *
+ * baud and rtscts (see usb_configure) of the persistent session,
+ * used from the next usb_session_open or usb_session_sign
+ */
+void usb_session_configure(int baud, int rtscts);
+
+/* usb_session_close
+ *
+ * Restores port settings and closes the persistent session
+ */
+void usb_session_close(void);
+
+/* usb_session_sign
+ *
+ * usb_sign on the persistent session, reconnects and retries once
+ * if the token is gone. Serialized between threads, waits at most
+ * USB_SESSION_WAIT_MS for another login on the port
+ * returns 0 on success, 'B' as usb_send_message, -1 on error/timeout,
+ * -2 if the port stayed with another login or is in use (usb_in_use),
+ * token not asked
+ */
+int usb_session_sign(const char* device, const unsigned char* message, unsigned char* signature, struct auth_timing* timing);
+
+/* usb_session_send
+ *
+ * Sends message (*W, until *D) on the persistent session without
+ * waiting for the signature. usb_session_sign with the same message
+ * within PREFETCH_TTL_MS then only fetches it (*R), any other
+ * usb_session_sign makes the token sign its own message instead
+ * returns 0 on success, -1 on error/timeout
+ */
+int usb_session_send(const char* device, const unsigned char* message);
+
+/* usb_session_probe
+ *
+ * usb_probe on the persistent session
+ * returns 0 on success, -1 on error/timeout, -2 as usb_session_sign
+ */
+int usb_session_probe(const char* device, char* id);
+
+
+// ___________________________
+// discovery.c
+
+/* discovery_start
+ *
+ * Finds tokens on the ports matching pattern (glob, e.g. /dev/ttyACM*,
+ * in one directory) and keeps watching for ports coming and going
+ * (inotify, thread). Ports plugged in already are asked *I before it
+ * returns. cb (may be NULL) is called for each token found (ready 1) or
+ * unplugged (ready 0), from the watching thread. The tokens found are
+ * published in DISCOVERY_SHM for discovery_pick. Can be called for more
+ * patterns, again with the same pattern does nothing. For a long lived
+ * process (token_broker), it opens every matching port
+ * returns 0 on success, -1 if the directory cannot be watched
+ */
+int discovery_start(const char* pattern, void (*cb)(const char* device, const char* id, int ready));
+
+/* discovery_pick
+ *
+ * A token on a port matching pattern from the DISCOVERY_SHM table of
+ * the watching process, the same as last time while it is listed, no
+ * port is touched. device (256 B) gets its port, id (4 B, may be NULL)
+ * its *I answer
+ * returns 0, -1 if no such token is listed (or there is no table)
+ */
+int discovery_pick(const char* pattern, char* device, char* id);
+
+
+// ___________________________
+// broker_client.c
+
+/* broker_sign
+ *
+ * Lets token_broker (on socketPath) sign message
+ * message as from genNumber_raw, signature as sent by FPGA
+ * returns 0 on success, -1 on failure, -2 if no broker is running
+ */
+int broker_sign(const char* socketPath, const unsigned char* message, unsigned char* signature);
+
+/* broker_running
+ *
+ * 1 if token_broker accepts connections on socketPath, else 0
+ */
+int broker_running(const char* socketPath);
+
+
+// ___________________________
+// metrics.c
+
+/* metrics_phase_names, metrics_result_names, metrics_bounds_us
+ *
+ * Labels of the enums and upper bounds of the histogram buckets
+ */
+extern const char* const metrics_phase_names[METRICS_PHASES];
+extern const char* const metrics_result_names[METRICS_RESULTS];
+extern const long long metrics_bounds_us[METRICS_BUCKETS];
+
+/* metrics_open
+ *
+ * Maps the METRICS_SHM segment, created if writable and missing
+ * returns the segment, NULL if it cannot be used (other layout)
+ */
+struct metrics_shm* metrics_open(int writable);
+
+/* shm_map
+ *
+ * Maps shared memory segment name of size bytes starting with a
+ * uint64_t magic, created (zero filled, stamped, mode 0600) if writable
+ * and missing. An existing one must belong to our effective user and
+ * not be writable by group or others
+ * returns the segment, NULL if it cannot be used (other layout, owner)
+ */
+void* shm_map(const char* name, size_t size, uint64_t magic, int writable);
+
+/* metrics_record
+ *
+ * Adds one authentication: its verdict, the phases of t (phases at 0
+ * were not run) and total ns. Maps the segment on first use, does
+ * nothing if it cannot. Thread safe
+ */
+void metrics_record(const struct auth_timing* t, long long total, enum metrics_result result);
+
+
+// ___________________________
+// breaker.c
+
+/* breaker_open
+ *
+ * Maps the BREAKER_SHM segment, see shm_map
+ */
+struct breaker_shm* breaker_open(int writable);
+
+/* breaker_allow
+ *
+ * Asked before a login uses the token
+ * returns BREAKER_PASS (closed), BREAKER_FAIL_FAST (open, or another
+ * login probes) or BREAKER_PROBE (cooldown over, this login probes
+ * with *I first). Thread safe
+ */
+enum breaker_state breaker_allow(void);
+
+/* breaker_record
+ *
+ * Result of the token for a login breaker_allow let through, ok = 0 if
+ * the token failed, did not answer or signed wrong, probe if it was
+ * BREAKER_PROBE. Opens the breaker after BREAKER_FAILURES failures in a
+ * row (or a failed probe), any success closes it. Thread safe
+ */
+void breaker_record(int ok, int probe);
+
+/* breaker_release
+ *
+ * A login breaker_allow let through did not get to ask the token (port
+ * in use, local error): nothing is recorded, a probe is given back for
+ * the next login. Thread safe
+ */
+void breaker_release(int probe);
+
+
 // ___________________________
 // pam_module.c
 
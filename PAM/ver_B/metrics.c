@@ -0,0 +1,147 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "header.h"
+
+/* Metrics of pam_sm_authenticate
+ *
+ * One shared memory segment (METRICS_SHM) for every process using the
+ * module (sshd, login, ...), so where login latency goes can be seen on
+ * a host without a debugger, metrics_dump prints it for Prometheus.
+ * Only relaxed atomic adds, no locks: a process dying in the middle
+ * holds nothing, a reader may see an authentication half added.
+ */
+
+const char* const metrics_phase_names[METRICS_PHASES] = {
+	"open", "rng", "write", "ack", "sign", "broker", "decrypt", "total"
+};
+
+const char* const metrics_result_names[METRICS_RESULTS] = {
+	"success", "mismatch", "token_fail", "decrypt_fail", "error", "fail_fast", "no_pin"
+};
+
+const long long metrics_bounds_us[METRICS_BUCKETS] = {
+	10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+static pthread_once_t metricsOnce = PTHREAD_ONCE_INIT;
+static struct metrics_shm* metrics = NULL;
+static struct metrics_shm metricsLocal; // no shared segment
+
+void* shm_map(const char* name, size_t size, uint64_t magic, int writable) {
+	struct stat st;
+	if (name[0] == '\0') {
+		return NULL;
+	}
+	// /dev/shm is writable by everyone: create it ours only, or use one
+	// made by our user that nobody else can write
+	int fd = writable ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : -1;
+	if (fd == -1 && (!writable || errno == EEXIST)) {
+		fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+	}
+	if (fd == -1) {
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		fprintf(stderr,"%s is not ours or writable by others, not used\n", name);
+		close(fd);
+		return NULL;
+	}
+	// new segment (or its creator is about to size it), zero filled
+	if (writable && st.st_size == 0) {
+		if (ftruncate(fd, size) != 0) {
+			close(fd);
+			return NULL;
+		}
+	}
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size != size) {
+		fprintf(stderr,"%s has another layout, not used\n", name);
+		close(fd);
+		return NULL;
+	}
+	void* mem = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		return NULL;
+	}
+
+	uint64_t* stamp = (uint64_t*) mem;
+	if (writable) {
+		// first user stamps the layout
+		uint64_t unset = 0;
+		__atomic_compare_exchange_n(stamp, &unset, magic, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	}
+	if (__atomic_load_n(stamp, __ATOMIC_ACQUIRE) != magic) {
+		munmap(mem, size);
+		return NULL;
+	}
+	return mem;
+}
+
+struct metrics_shm* metrics_open(int writable) {
+	return (struct metrics_shm*) shm_map(METRICS_SHM, sizeof(struct metrics_shm), METRICS_MAGIC, writable);
+}
+
+static void metrics_map(void) {
+	metrics = metrics_open(1);
+	if (metrics == NULL && METRICS_SHM[0] != '\0') {
+		fprintf(stderr,"Metrics of this process only\n");
+		metrics = &metricsLocal;
+	}
+}
+
+static void metrics_add(uint64_t* counter, uint64_t n) {
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static void histogram_add(struct metrics_histogram* h, long long ns) {
+	int i;
+	for (i = 0; i < METRICS_BUCKETS && ns > metrics_bounds_us[i]*1000; i++);
+	metrics_add(&h->buckets[i], 1);
+	metrics_add(&h->sumNs, ns);
+}
+
+void metrics_record(const struct auth_timing* t, long long total, enum metrics_result result) {
+	int p;
+	pthread_once(&metricsOnce, metrics_map);
+	if (metrics == NULL) {
+		return;
+	}
+
+	metrics_add(&metrics->results[result], 1);
+	if (t != NULL) {
+		const long long phases[METRICS_TOTAL] = {
+			t->open, t->rng, t->write, t->ack, t->sign, t->broker, t->decrypt
+		};
+		for (p = 0; p < METRICS_TOTAL; p++) {
+			if (phases[p] > 0) {
+				histogram_add(&metrics->phases[p], phases[p]);
+			}
+		}
+		metrics_add(&metrics->resends, t->resends);
+		metrics_add(&metrics->timeouts, t->timeouts);
+		metrics_add(&metrics->busy, t->busy);
+		metrics_add(&metrics->polls, t->polls);
+	}
+	histogram_add(&metrics->phases[METRICS_TOTAL], total);
+}
@@ -0,0 +1,82 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include "header.h"
+
+/* Prints the metrics of the PAM module (METRICS_SHM, see metrics.c, and
+ * BREAKER_SHM, see breaker.c) in Prometheus text format, e.g. for the
+ * textfile collector of node_exporter or behind inetd
+ *
+ * usage: metrics_dump
+ */
+
+static uint64_t load(const uint64_t* counter) {
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void counter(const char* name, const char* help, uint64_t value) {
+	printf("# HELP pam_cthauth_%s %s\n", name, help);
+	printf("# TYPE pam_cthauth_%s counter\n", name);
+	printf("pam_cthauth_%s %llu\n", name, (unsigned long long) value);
+}
+
+int main(void) {
+	const struct metrics_shm* m = metrics_open(0);
+	int p, r, i;
+	if (m == NULL) {
+		fprintf(stderr,"No metrics in %s (no authentication yet?)\n", METRICS_SHM);
+		return 1;
+	}
+
+	printf("# HELP pam_cthauth_auths_total Authentications by verdict\n");
+	printf("# TYPE pam_cthauth_auths_total counter\n");
+	for (r = 0; r < METRICS_RESULTS; r++) {
+		printf("pam_cthauth_auths_total{result=\"%s\"} %llu\n", metrics_result_names[r],
+			(unsigned long long) load(&m->results[r]));
+	}
+	counter("resends_total", "*W written again after *T or *B", load(&m->resends));
+	counter("timeouts_total", "*T or no answer after *W", load(&m->timeouts));
+	counter("busy_total", "*B after *W or *R", load(&m->busy));
+	counter("polls_total", "*R written", load(&m->polls));
+
+	// circuit breaker (breaker.c), when any login has used it
+	const struct breaker_shm* b = breaker_open(0);
+	if (b != NULL) {
+		printf("# HELP pam_cthauth_breaker_open 1 while logins fail at once (token failing)\n");
+		printf("# TYPE pam_cthauth_breaker_open gauge\n");
+		printf("pam_cthauth_breaker_open %i\n", __atomic_load_n(&b->openUntil, __ATOMIC_RELAXED) != 0);
+		counter("breaker_trips_total", "Times the breaker opened", load(&b->trips));
+	}
+
+	printf("# HELP pam_cthauth_phase_seconds Time of each phase of an authentication\n");
+	printf("# TYPE pam_cthauth_phase_seconds histogram\n");
+	for (p = 0; p < METRICS_PHASES; p++) {
+		const struct metrics_histogram* h = &m->phases[p];
+		uint64_t cumulative = 0;
+		for (i = 0; i < METRICS_BUCKETS; i++) {
+			cumulative += load(&h->buckets[i]);
+			printf("pam_cthauth_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %llu\n", metrics_phase_names[p],
+				metrics_bounds_us[i] / 1e6, (unsigned long long) cumulative);
+		}
+		cumulative += load(&h->buckets[METRICS_BUCKETS]);
+		printf("pam_cthauth_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n", metrics_phase_names[p],
+			(unsigned long long) cumulative);
+		printf("pam_cthauth_phase_seconds_sum{phase=\"%s\"} %.9f\n", metrics_phase_names[p], load(&h->sumNs) / 1e9);
+		// count from the buckets, consistent with +Inf while others add
+		printf("pam_cthauth_phase_seconds_count{phase=\"%s\"} %llu\n", metrics_phase_names[p],
+			(unsigned long long) cumulative);
+	}
+	return 0;
+}
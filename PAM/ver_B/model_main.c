@@ -0,0 +1,306 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <openssl/pem.h>
+#include <openssl/evp.h>
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <unistd.h>
+#include <time.h>
+#include "header.h"
+
+/* Golden vectors and latency of the RSA core of the token (rsa_model.c)
+ *
+ * Signs random messages below the modulus with the private key as the
+ * core would (rsa_model_exp) and checks them against OpenSSL. Each
+ * vector is written as one line of big endian hex numbers, ready for
+ * x"..." constants of a testbench such as RSA_512_tb.vhd:
+ *   x y m r_c bit_size s cycles
+ * -r also runs every vector clock by clock (rsa_model_exp_rtl), fails
+ * if the two differ. -t checks the vectors of RSA_512_tb.vhd first.
+ * -c signs with rsa_crt on that many cores (generic CORES, 1 or 2)
+ * instead of rsa_top, from the CRT numbers of the key. -f flips a bit of
+ * dp for it, a fault in x^dp mod p: then no signature may come out of
+ * the check of rsa_crt (s 0 and fault), one that does is a mismatch.
+ * Prints the latency of the key (mean over the vectors) and the time per
+ * vector as JSON.
+ *
+ * usage: rsa_model [-k private.pem] [-n vectors] [-b bit_size] [-c cores] [-f] [-s seed] [-o vectors.txt] [-r] [-t]
+ *  bit_size 0: bits of the private exponent, default 512 (Security_Token_Top_USB.vhd)
+ */
+
+#define MODEL_TB_VECTORS 3
+
+// RSA_512_tb.vhd: x, y, m, r_c and the expected s
+static const char* tbVectors[MODEL_TB_VECTORS][5] = {
+	{ "1",
+	  "b15f20094a5fbcd7605b23bb7dbe7d421556df00d266c649d019cfc87eae543f703f6870013851130d3a2ed993ef76a1c377a96b95fe326f7326a319bae5fe01",
+	  "bb847f2d87e8030926eea2a0a3f89877e6f63c1e2f65f3791e9c85549f48863a1dcc9f8b477c36dfea2573c49fc59259efe83b9996d093b4be09666e904cb17f",
+	  "8F80651391C778113C509FDD5C205AE6648A94DBC225A1ECA53F149BCF135AFCAC7E47DF209AC030325E1904AD7D260E236CE56D6753F488E3E489D50A6C2B0E",
+	  "1" },
+	{ "abc123abc123abc123abc123abc123abc123abc123abc123abc123abc123abcabc123abc123abc123abc123abc123abc123abc123abc123abc123abc123abc12",
+	  "b15f20094a5fbcd7605b23bb7dbe7d421556df00d266c649d019cfc87eae543f703f6870013851130d3a2ed993ef76a1c377a96b95fe326f7326a319bae5fe01",
+	  "bb847f2d87e8030926eea2a0a3f89877e6f63c1e2f65f3791e9c85549f48863a1dcc9f8b477c36dfea2573c49fc59259efe83b9996d093b4be09666e904cb17f",
+	  "8F80651391C778113C509FDD5C205AE6648A94DBC225A1ECA53F149BCF135AFCAC7E47DF209AC030325E1904AD7D260E236CE56D6753F488E3E489D50A6C2B0E",
+	  "AF42E73EE103ED7F96C40FB6FC14B483031239E4FC813C30B208C68042C9E08789E5D22E59163194498D3DB158AC6F5282943D81D5E59F518086A19BC0B33D9D" },
+	{ "AF42E73EE103ED7F96C40FB6FC14B483031239E4FC813C30B208C68042C9E08789E5D22E59163194498D3DB158AC6F5282943D81D5E59F518086A19BC0B33D9D",
+	  "10001",
+	  "bb847f2d87e8030926eea2a0a3f89877e6f63c1e2f65f3791e9c85549f48863a1dcc9f8b477c36dfea2573c49fc59259efe83b9996d093b4be09666e904cb17f",
+	  "8F80651391C778113C509FDD5C205AE6648A94DBC225A1ECA53F149BCF135AFCAC7E47DF209AC030325E1904AD7D260E236CE56D6753F488E3E489D50A6C2B0E",
+	  "abc123abc123abc123abc123abc123abc123abc123abc123abc123abc123abcabc123abc123abc123abc123abc123abc123abc123abc123abc123abc123abc12" }
+};
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// hex (any length up to RSA_MODEL_WORDS words) -> words least significant first
+static void hex_to_words(uint16_t* w, const char* hex) {
+	int len = strlen(hex);
+	int i;
+	memset(w, 0, RSA_MODEL_WORDS*sizeof(uint16_t));
+	for (i = 0; i < len && i < 4*RSA_MODEL_WORDS; i++) {
+		char c = hex[len-1-i];
+		int v = (c >= '0' && c <= '9') ? c-'0' : (c|0x20)-'a'+10;
+		w[i/4] |= (uint16_t) (v << (4*(i%4)));
+	}
+}
+
+static void words_to_bytes(unsigned char* bytes, const uint16_t* w) {
+	int i;
+	for (i = 0; i < RSA_MODEL_WORDS; i++) {
+		bytes[RSA_MODEL_BYTES-1-2*i] = (unsigned char) w[i];
+		bytes[RSA_MODEL_BYTES-2-2*i] = (unsigned char) (w[i] >> 8);
+	}
+}
+
+static void print_words(FILE* out, const uint16_t* w) {
+	int i;
+	for (i = RSA_MODEL_WORDS-1; i >= 0; i--) {
+		fprintf(out, "%04x", w[i]);
+	}
+}
+
+// both engines on the vectors of RSA_512_tb.vhd, returns failures
+static int model_selftest(void) {
+	int failed = 0;
+	int i;
+	for (i = 0; i < MODEL_TB_VECTORS; i++) {
+		struct rsa_model_key key;
+		uint16_t x[RSA_MODEL_WORDS], want[RSA_MODEL_WORDS], s[RSA_MODEL_WORDS], sRtl[RSA_MODEL_WORDS];
+		hex_to_words(x, tbVectors[i][0]);
+		hex_to_words(key.y, tbVectors[i][1]);
+		hex_to_words(key.m, tbVectors[i][2]);
+		hex_to_words(key.r_c, tbVectors[i][3]);
+		hex_to_words(want, tbVectors[i][4]);
+		key.bitSize = RSA_MODEL_WORDS*16;
+		key.words = RSA_MODEL_WORDS;
+		long cycles = rsa_model_exp(&key, x, s);
+		long cyclesRtl = rsa_model_exp_rtl(&key, x, sRtl);
+		if (memcmp(s, want, sizeof(s)) != 0 || memcmp(sRtl, want, sizeof(s)) != 0 || cycles != cyclesRtl) {
+			fprintf(stderr,"RSA_512_tb.vhd vector %i failed (cycles %li, clock by clock %li)\n", i, cycles, cyclesRtl);
+			failed++;
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char **argv) {
+	const char* keyFile = "data/private512.pem";
+	const char* outFile = NULL;
+	int n = 100;
+	int bitSize = RSA_MODEL_WORDS*16;
+	int cores = 0, inject = 0;
+	int rtl = 0, selftest = 0;
+	unsigned seed = 1;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "k:n:b:c:fs:o:rt")) != -1) {
+		switch (opt) {
+			case 'k': keyFile = optarg; break;
+			case 'n': n = atoi(optarg); break;
+			case 'b': bitSize = atoi(optarg); break;
+			case 'c': cores = atoi(optarg); break;
+			case 'f': inject = 1; break;
+			case 's': seed = (unsigned) atoi(optarg); break;
+			case 'o': outFile = optarg; break;
+			case 'r': rtl = 1; break;
+			case 't': selftest = 1; break;
+			default:
+				fprintf(stderr,"usage: %s [-k private.pem] [-n vectors] [-b bit_size] [-c cores] [-f] [-s seed] [-o vectors.txt] [-r] [-t]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (n < 0) {
+		n = 0;
+	}
+	if (cores < 0 || cores > 2 || (cores && bitSize != RSA_MODEL_WORDS*16)) {
+		fprintf(stderr,"cores %i is not 1 or 2, or not with -b (rsa_crt uses all of d)\n", cores);
+		return 1;
+	}
+	if (inject && !cores) {
+		fprintf(stderr,"-f is for rsa_crt, with -c\n");
+		return 1;
+	}
+	if (selftest && model_selftest() != 0) {
+		return 1;
+	}
+
+	// n and d of the key, as in the generics of the token, and the CRT
+	// numbers for rsa_crt
+	unsigned char modulus[RSA_MODEL_BYTES], exponent[RSA_MODEL_BYTES];
+	unsigned char crt[5][RSA_MODEL_BYTES/2];
+	static const char* crtParams[5] = { OSSL_PKEY_PARAM_RSA_FACTOR1, OSSL_PKEY_PARAM_RSA_FACTOR2,
+		OSSL_PKEY_PARAM_RSA_EXPONENT1, OSSL_PKEY_PARAM_RSA_EXPONENT2, OSSL_PKEY_PARAM_RSA_COEFFICIENT1 };
+	int crtOk = 1;
+	BIGNUM *bn_n = NULL, *bn_d = NULL, *bn_e = NULL;
+	FILE* fp = fopen(keyFile, "r");
+	EVP_PKEY* pkey = (fp != NULL) ? PEM_read_PrivateKey(fp, NULL, NULL, NULL) : NULL;
+	if (fp != NULL) {
+		fclose(fp);
+	}
+	if (pkey == NULL
+		|| EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_RSA_N, &bn_n) != 1
+		|| EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_RSA_D, &bn_d) != 1
+		|| EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_RSA_E, &bn_e) != 1) {
+		fprintf(stderr,"Cannot read private key '%s'\n", keyFile);
+		return 1;
+	}
+	for (i = 0; i < 5; i++) {
+		BIGNUM* bn = NULL;
+		if (EVP_PKEY_get_bn_param(pkey, crtParams[i], &bn) != 1
+			|| BN_bn2binpad(bn, crt[i], RSA_MODEL_BYTES/2) != RSA_MODEL_BYTES/2) {
+			crtOk = 0;
+		}
+		BN_free(bn);
+	}
+	EVP_PKEY_free(pkey);
+	struct rsa_model_key key;
+	if (BN_num_bytes(bn_n) != RSA_MODEL_BYTES
+		|| BN_bn2binpad(bn_n, modulus, RSA_MODEL_BYTES) != RSA_MODEL_BYTES
+		|| BN_bn2binpad(bn_d, exponent, RSA_MODEL_BYTES) != RSA_MODEL_BYTES
+		|| rsa_model_init(&key, modulus, exponent, RSA_MODEL_BYTES, bitSize) != 0) {
+		fprintf(stderr,"Key is not %i bytes or bit_size %i is not 0 to %i\n", RSA_MODEL_BYTES, bitSize, RSA_MODEL_WORDS*16);
+		return 1;
+	}
+	// the core uses the bit_size low bits of d
+	BN_mask_bits(bn_d, key.bitSize);
+	struct rsa_model_crt_key crtKey;
+	if (cores && (!crtOk || BN_num_bits(bn_e) > 32
+		|| rsa_model_crt_init(&crtKey, modulus, crt[0], crt[1], crt[2], crt[3], crt[4], (uint32_t) BN_get_word(bn_e), cores) != 0)) {
+		fprintf(stderr,"Key has no CRT numbers, p and q are not of %i bits or e is above 32 bits\n", RSA_MODEL_BYTES*4);
+		return 1;
+	}
+	BN_free(bn_e);
+	if (inject) {
+		crtKey.dp[0] ^= 1;
+	}
+
+	FILE* out = NULL;
+	if (outFile != NULL && (out = fopen(outFile, "w")) == NULL) {
+		fprintf(stderr,"Cannot write '%s'\n", outFile);
+		return 1;
+	}
+
+	int mismatches = 0, rtlMismatches = 0, faults = 0;
+	long cycles = RSA_MODEL_CYCLES(key.bitSize);
+	long long modelNs = 0, rtlNs = 0;
+	BN_CTX* ctx = BN_CTX_new();
+	BIGNUM* bn_x = BN_new();
+	BIGNUM* bn_s = BN_new();
+	int j;
+	srand(seed);
+	for (i = 0; i < n; i++) {
+		uint16_t x[RSA_MODEL_WORDS], s[RSA_MODEL_WORDS], sRtl[RSA_MODEL_WORDS];
+		unsigned char in[RSA_MODEL_BYTES], want[RSA_MODEL_BYTES], got[RSA_MODEL_BYTES];
+		int fault = 0, faultRtl = 0;
+
+		// random message below the modulus
+		for (j = 0; j < RSA_MODEL_BYTES; j++) {
+			in[j] = rand();
+		}
+		in[0] %= modulus[0];
+		for (j = 0; j < RSA_MODEL_WORDS; j++) {
+			x[j] = (uint16_t) ((in[RSA_MODEL_BYTES-2-2*j] << 8) | in[RSA_MODEL_BYTES-1-2*j]);
+		}
+
+		long long start = now_ns();
+		cycles = cores ? rsa_model_crt(&crtKey, x, s, &fault) : rsa_model_exp(&key, x, s);
+		modelNs += now_ns() - start;
+		if (rtl) {
+			start = now_ns();
+			long cyclesRtl = cores ? rsa_model_crt_rtl(&crtKey, x, sRtl, &faultRtl) : rsa_model_exp_rtl(&key, x, sRtl);
+			rtlNs += now_ns() - start;
+			if (cyclesRtl != cycles || memcmp(s, sRtl, sizeof(s)) != 0 || faultRtl != fault) {
+				rtlMismatches++;
+			}
+		}
+
+		// what the core should give, nothing with -f
+		words_to_bytes(got, s);
+		faults += fault;
+		if (inject) {
+			memset(want, 0, RSA_MODEL_BYTES);
+			if (!fault || memcmp(got, want, RSA_MODEL_BYTES) != 0) {
+				mismatches++;
+			}
+		} else if (fault || BN_bin2bn(in, RSA_MODEL_BYTES, bn_x) == NULL
+			|| BN_mod_exp(bn_s, bn_x, bn_d, bn_n, ctx) != 1
+			|| BN_bn2binpad(bn_s, want, RSA_MODEL_BYTES) != RSA_MODEL_BYTES
+			|| memcmp(got, want, RSA_MODEL_BYTES) != 0) {
+			mismatches++;
+		}
+
+		if (out != NULL) {
+			print_words(out, x);
+			fputc(' ', out);
+			print_words(out, key.y);
+			fputc(' ', out);
+			print_words(out, key.m);
+			fputc(' ', out);
+			print_words(out, key.r_c);
+			fprintf(out, " %04x ", key.bitSize);
+			print_words(out, s);
+			fprintf(out, " %li\n", cycles);
+		}
+	}
+	if (out != NULL) {
+		fclose(out);
+	}
+	BN_free(bn_x);
+	BN_free(bn_s);
+	BN_free(bn_n);
+	BN_free(bn_d);
+	BN_CTX_free(ctx);
+
+	printf("{\n");
+	printf("  \"vectors\": %i,\n", n);
+	printf("  \"bit_size\": %i,\n", key.bitSize);
+	printf("  \"crt_cores\": %i,\n", cores);
+	printf("  \"faults\": %i,\n", faults);
+	printf("  \"cycles\": %li,\n", cycles);
+	printf("  \"latency_us\": %.1f,\n", cycles*1e6/RSA_MODEL_CLOCK_HZ);
+	printf("  \"mismatches\": %i,\n", mismatches);
+	printf("  \"model_us\": %.1f", n > 0 ? modelNs/1000.0/n : 0.0);
+	if (rtl) {
+		printf(",\n  \"rtl_mismatches\": %i,\n", rtlMismatches);
+		printf("  \"rtl_us\": %.1f,\n", n > 0 ? rtlNs/1000.0/n : 0.0);
+		printf("  \"rtl_cycles_per_s\": %.0f", rtlNs > 0 ? (double) cycles*n*1e9/rtlNs : 0.0);
+	}
+	printf("\n}\n");
+	return (mismatches == 0 && rtlMismatches == 0) ? 0 : 1;
+}
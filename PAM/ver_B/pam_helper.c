@@ -16,46 +16,211 @@
 #include <time.h>
 #include <openssl/rand.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include "header.h"
 
+/* Challenge pool
+ *
+ * Bounded lock-free ring (multi producer/consumer, per-slot sequence
+ * numbers) of ready challenges. A background thread fills it from the
+ * OpenSSL DRBG and is woken when it runs low, so challenge_next only
+ * copies one slot and never waits for RAND_bytes.
+ * After fork() the child starts with an empty pool and its own thread,
+ * parent and child never hand out the same challenge.
+ */
+#if (CHALLENGE_POOL_LEN & (CHALLENGE_POOL_LEN-1)) != 0
+#error CHALLENGE_POOL_LEN must be a power of 2
+#endif
+
+struct pool_slot {
+	atomic_size_t seq;        // == pos: free to fill, == pos+1: ready to take
+	struct challenge c;
+};
+
+static struct pool_slot pool[CHALLENGE_POOL_LEN];
+static atomic_size_t poolHead;    // next to take
+static atomic_size_t poolTail;    // next to fill
+static atomic_int poolState;      // 0 = not started, 1 = starting, 2 = running
+static atomic_int poolWake;       // refill already requested
+static sem_t poolSem;
+
+// random challenge, 0 on success, -1 if RAND_bytes failed
+static int challenge_fill(struct challenge* c) {
+	int i;
+	//by default cleartext 63 len out of 64 possible
+	// shift right one char, add 0 left-most
+	c->orig[0] = 0;
+	if (RAND_bytes(c->orig+1, cleartextLen) != 1) {
+		return -1;
+	}
+	//null terminate
+	c->orig[cleartextLen+1] = '\0';
+
+	//FPGA wants reversed
+	for (i = 0; i < keyLen; i++) {
+		c->message[i] = c->orig[keyLen-1-i];
+	}
+	return 0;
+}
+
+static void pool_reset(void) {
+	size_t i;
+	for (i = 0; i < CHALLENGE_POOL_LEN; i++) {
+		atomic_init(&pool[i].seq, i);
+	}
+	atomic_init(&poolHead, 0);
+	atomic_init(&poolTail, 0);
+	atomic_init(&poolWake, 0);
+}
+
+// fills next free slot, -1 if pool is full or RAND_bytes failed
+static int pool_push(void) {
+	size_t pos = atomic_load_explicit(&poolTail, memory_order_relaxed);
+	struct pool_slot* slot;
+	for (;;) {
+		slot = &pool[pos & (CHALLENGE_POOL_LEN-1)];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&poolTail, &pos, pos+1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return -1; // full
+		} else {
+			pos = atomic_load_explicit(&poolTail, memory_order_relaxed);
+		}
+	}
+	// slot is ours, a failed fill is retried in the same slot
+	while (challenge_fill(&slot->c) != 0) {
+		fprintf(stderr,"\nRandom data generation fail!\n");
+		sleep(1); //second
+	}
+	atomic_store_explicit(&slot->seq, pos+1, memory_order_release);
+	return 0;
+}
+
+// takes oldest challenge, -1 if pool is empty
+static int pool_pop(struct challenge* c) {
+	size_t pos = atomic_load_explicit(&poolHead, memory_order_relaxed);
+	struct pool_slot* slot;
+	for (;;) {
+		slot = &pool[pos & (CHALLENGE_POOL_LEN-1)];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) (pos+1);
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&poolHead, &pos, pos+1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return -1; // empty
+		} else {
+			pos = atomic_load_explicit(&poolHead, memory_order_relaxed);
+		}
+	}
+	*c = slot->c;
+	// used challenge is not left in memory
+	memset(&slot->c, 0, sizeof(slot->c));
+	atomic_store_explicit(&slot->seq, pos+CHALLENGE_POOL_LEN, memory_order_release);
+	return 0;
+}
+
+static void* pool_refill(void* arg) {
+	(void) arg;
+	for (;;) {
+		AUTH_PROBE(rng__refill);
+		while (pool_push() == 0);
+		atomic_store(&poolWake, 0);
+		while (sem_wait(&poolSem) != 0); // EINTR
+	}
+	return NULL;
+}
+
+// child of fork: parent's challenges and thread are not ours
+static void pool_atfork_child(void) {
+	pool_reset();
+	sem_destroy(&poolSem);
+	atomic_store(&poolState, 0);
+}
+
+static void pool_start(void) {
+	static atomic_int atforkDone;
+	int expected = 0;
+	if (!atomic_compare_exchange_strong(&poolState, &expected, 1)) {
+		return; // running, or another thread is starting it
+	}
+	if (atomic_exchange(&atforkDone, 1) == 0) {
+		pthread_atfork(NULL, NULL, pool_atfork_child);
+	}
+	pool_reset();
+	sem_init(&poolSem, 0, 0);
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, pool_refill, NULL) != 0) {
+		fprintf(stderr,"Unable to start challenge pool\n");
+		sem_destroy(&poolSem);
+		atomic_store(&poolState, 0);
+	} else {
+		atomic_store(&poolState, 2);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+int challenge_next(struct challenge* c) {
+	AUTH_PROBE(rng__start);
+	if (atomic_load(&poolState) != 2) {
+		pool_start();
+	}
+	if (atomic_load(&poolState) == 2) {
+		if (pool_pop(c) == 0) {
+			size_t level = atomic_load_explicit(&poolTail, memory_order_relaxed)
+				- atomic_load_explicit(&poolHead, memory_order_relaxed);
+			if (level < CHALLENGE_POOL_LOW && atomic_exchange(&poolWake, 1) == 0) {
+				sem_post(&poolSem);
+			}
+			AUTH_PROBE2(rng__done, cleartextLen, 1); // bytes, from pool
+			return 0;
+		}
+		// drained faster than refilled
+		if (atomic_exchange(&poolWake, 1) == 0) {
+			sem_post(&poolSem);
+		}
+	}
+	if (challenge_fill(c) != 0) {
+		fprintf(stderr,"\nRandom data generation fail!\n");
+		return -1;
+	}
+	AUTH_PROBE2(rng__done, cleartextLen, 0);
+	return 0;
+}
+
 /*
  * using global variables:
  *  static const int cleartextLen
- *  unsigned char randData_orig[(CLEARTEXT_LEN+1)];		
  */
-unsigned char* genNumber_raw(void) {
-	//half size cleartextLen since different data per printable char
-	//data (8bit) , hex (4bit) per visable char for user
-	unsigned char* randData  =  malloc(cleartextLen+1);
-	
-	//randData fills with random data
-	while(RAND_bytes(randData, (cleartextLen)) != 1 ){
+unsigned char* genNumber_raw(unsigned char* orig) {
+	struct challenge c;
+	while (challenge_next(&c) != 0) {
 		//RAND_bytes failed (UNLIKELY!)
-		fprintf(stderr,"\nRandom data generation fail!\n");
 		sleep(1); //second
 		fprintf(stderr,"Retrying..\n");
-		sleep(1);
 	}
 
-	//null terminate
-	randData[cleartextLen] = '\0';	
-	
-	//by default cleartext 63 len out of 64 possible
-	// shift right one char, add 0 left-most
-	unsigned char *randDataShifted = malloc(cleartextLen+2);
-	randDataShifted[0] = 0;	
-	int i;
-	for (i = 0; i < cleartextLen+1; i++) {
-	  randDataShifted[i+1] = randData[i];
-	}
-
-	free(randData);
-	
-	//not reversed, randData_orig used for local verify later
-	memcpy(randData_orig, randDataShifted, (cleartextLen+2));
+	//not reversed, orig used for local verify later
+	memcpy(orig, c.orig, (cleartextLen+2));
 
 	//FPGA wants reversed
-	reverseStr(randDataShifted);
+	unsigned char *randDataShifted = malloc(cleartextLen+2);
+	memcpy(randDataShifted, c.message, keyLen);
+	randDataShifted[cleartextLen+1] = '\0';
 	return randDataShifted;
 }
 
@@ -41,15 +41,12 @@
 
 //#define PAM_SM_AUTH
 
+#include <time.h>
+#include <pthread.h>
 #include <security/pam_appl.h>
 #include <security/pam_modules.h>
 #include "header.h"
 
-#include <unistd.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <termios.h>
-
 
 
 // Does NOT check user please use pam_unix too
@@ -62,147 +59,328 @@ PAM_EXTERN int pam_sm_acct_mgmt(pam_handle_t *pamh, int flags, int argc, const c
   return (PAM_SUCCESS);
 }
 
+// pam_set_data cleanup, at pam_end or next pam_sm_authenticate
+static void auth_ctx_cleanup(pam_handle_t *pamh, void *data, int error_status) {
+	struct auth_ctx *ctx = (struct auth_ctx*) data;
+	if (ctx->usb != -1) {
+		usb_close(ctx->usb, &ctx->ttyOld);
+	}
+	memset(ctx, 0, sizeof(struct auth_ctx));
+	free(ctx);
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/* Prefetch (prefetch argument)
+ * A challenge sent to the token on the persistent session before
+ * pam_sm_authenticate needs it, so its signature is waiting. Taken by
+ * one authentication only, dropped after PREFETCH_TTL_MS and in the
+ * parent on fork() (the child has it). prefetchLock is never held
+ * while talking to the token, fork() does not wait for it
+ */
+static pthread_mutex_t prefetchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetchCond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t prefetchOnce = PTHREAD_ONCE_INIT;
+static struct challenge prefetchChallenge;
+static long long prefetchAt = 0;      // now_ns when sent, 0 = none
+static char prefetchDevice[256];
+static int prefetchRunning = 0;       // prefetch_run sending
+static unsigned prefetchGen = 0;      // prefetch_drop count, a send started before is not kept
+
+static void prefetch_drop(void) {
+	memset(&prefetchChallenge, 0, sizeof(prefetchChallenge));
+	prefetchAt = 0;
+	prefetchGen++;
+}
+
+static void prefetch_atfork_prepare(void) {
+	pthread_mutex_lock(&prefetchLock);
+}
+
+static void prefetch_atfork_parent(void) {
+	prefetch_drop();
+	pthread_mutex_unlock(&prefetchLock);
+}
+
+static void prefetch_atfork_child(void) {
+	// a prefetch_run in progress is a thread of the parent
+	prefetchRunning = 0;
+	pthread_mutex_unlock(&prefetchLock);
+}
+
+static void prefetch_init(void) {
+	pthread_atfork(prefetch_atfork_prepare, prefetch_atfork_parent, prefetch_atfork_child);
+}
+
+// thread: key, port and challenge ready before the next authentication
+static void* prefetch_run(void* arg) {
+	struct challenge c;
+	char device[256];
+
+	public_key_load();
+	pthread_mutex_lock(&prefetchLock);
+	if (prefetchAt != 0 || prefetchRunning) {
+		pthread_mutex_unlock(&prefetchLock);
+		return NULL;
+	}
+	prefetchRunning = 1;
+	unsigned gen = prefetchGen;
+	memcpy(device, prefetchDevice, sizeof(device));
+	pthread_mutex_unlock(&prefetchLock);
+
+	// the broker owns the port when running
+	int sent = !broker_running(BROKER_SOCKET) && challenge_next(&c) == 0
+		&& usb_session_send(device, c.message) == 0;
+
+	pthread_mutex_lock(&prefetchLock);
+	if (sent && gen == prefetchGen) {
+		prefetchChallenge = c;
+		prefetchAt = now_ns();
+	}
+	prefetchRunning = 0;
+	pthread_cond_broadcast(&prefetchCond);
+	pthread_mutex_unlock(&prefetchLock);
+	memset(&c, 0, sizeof(c));
+	return NULL;
+}
+
+static void prefetch_start(const char* device) {
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	pthread_once(&prefetchOnce, prefetch_init);
+	pthread_mutex_lock(&prefetchLock);
+	if (strcmp(device, prefetchDevice) != 0) {
+		prefetch_drop();
+		strncpy(prefetchDevice, device, sizeof(prefetchDevice)-1);
+	}
+	pthread_mutex_unlock(&prefetchLock);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, prefetch_run, NULL) != 0) {
+		fprintf(stderr,"Unable to start prefetch\n");
+	}
+	pthread_attr_destroy(&attr);
+}
+
+// 1 and c if a challenge was sent ahead on device, it is then gone
+static int prefetch_take(const char* device, struct challenge* c) {
+	int taken = 0;
+	pthread_mutex_lock(&prefetchLock);
+	// a prefetch_run in progress has the port (sessionLock), we would wait for it anyway
+	while (prefetchRunning) {
+		pthread_cond_wait(&prefetchCond, &prefetchLock);
+	}
+	if (prefetchAt != 0 && strcmp(device, prefetchDevice) == 0
+		&& now_ns() - prefetchAt < (long long) PREFETCH_TTL_MS*1000000) {
+		*c = prefetchChallenge;
+		taken = 1;
+	}
+	prefetch_drop();
+	pthread_mutex_unlock(&prefetchLock);
+	return taken;
+}
+
+// verdict and phases to metrics.c and the probes, returns pamResult
+static int auth_done(const struct auth_timing* t, long long start, enum metrics_result result, int pamResult) {
+	long long total = now_ns() - start;
+	metrics_record(t, total, result);
+#ifdef AUTH_PROBES
+	if (t != NULL) {
+		const long long phases[METRICS_TOTAL] = {
+			t->open, t->rng, t->write, t->ack, t->sign, t->broker, t->decrypt
+		};
+		int p;
+		for (p = 0; p < METRICS_TOTAL; p++) {
+			if (phases[p] > 0) {
+				AUTH_PROBE2(auth__phase, p, phases[p]); // metrics_phase, ns
+			}
+		}
+	}
+#endif
+	AUTH_PROBE3(auth__done, result, total, (t != NULL) ? t->resends + t->busy : 0);
+	return pamResult;
+}
+
 // Does NOT check user please use pam_unix too
 // Authenticate using two-factor device
 PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv) {
+	long long start = now_ns();
+	long long phaseStart;
+	struct auth_timing timing;
+	memset(&timing, 0, sizeof(timing));
+	AUTH_PROBE(auth__start);
 
-  // Send and recieve USB-data
-  // open port
-  int usb = open("/dev/ttyACM0", O_RDWR | O_NOCTTY | O_NDELAY);
-  if (usb == -1) {
-		fprintf(stderr,"Unable to open port\n");
-    return PAM_AUTH_ERR;
-  } else {
-    fcntl(usb, F_SETFL, 0);
-  }
+	// module arguments (see pam.d config): device=/dev/ttyXXX persistent baud=N rtscts prefetch
+	const char *device = USB_DEVICE;
+	char discovered[256];
+	int persistent = 0;
+	int prefetch = 0; // next challenge sent ahead, persistent session
+	int baud = 0;    // 0: power on baud of the token
+	int rtscts = 0;
+  int i;
+	for (i = 0; i < argc; i++) {
+		if (strncmp(argv[i], "device=", 7) == 0) {
+			device = argv[i]+7;
+		} else if (strcmp(argv[i], "persistent") == 0) {
+			persistent = 1;
+		} else if (strncmp(argv[i], "baud=", 5) == 0) {
+			baud = atoi(argv[i]+5);
+		} else if (strcmp(argv[i], "rtscts") == 0) {
+			rtscts = 1;
+		} else if (strcmp(argv[i], "prefetch") == 0) {
+			prefetch = 1;
+		}
+	}
+	persistent |= prefetch;
 
-  // Set parameters
-  struct termios tty;
-  struct termios tty_old;
-  memset (&tty, 0, sizeof(tty));
-  if (tcgetattr (usb, &tty) != 0) {
-    fprintf(stderr,"error from tcgetattr\n");
-    return PAM_AUTH_ERR;
-  }
+	// device pattern (device=/dev/ttyACM*): a port token_broker found a
+	// token on (its table, discovery.c), none is opened or asked here.
+	// A running broker owns the ports and signs, nothing to look up
+	if (strpbrk(device, "*?[") != NULL && !broker_running(BROKER_SOCKET)) {
+		persistent = 1;
+		if (discovery_pick(device, discovered, NULL) != 0) {
+			return auth_done(NULL, start, METRICS_TOKEN_FAIL, PAM_AUTH_ERR);
+		}
+		device = discovered;
+	}
 
-  // save old params for after close
-  tty_old = tty;
-
-  // set baud rate (in / out)
-  cfsetospeed (&tty, (speed_t)B115200);
-  cfsetispeed (&tty, (speed_t)B115200);
-
-  /* ---- other port configs ---- */
-	// set lflag constants to 0 => non-canonical etc
-  tty.c_lflag = 0;
-	// set oflag constants to 0 => no remapping, no delays
-	tty.c_oflag = 0;
-  tty.c_cc[VMIN] = 0;   // no read block
-  tty.c_cc[VTIME] = 5;  // 0.5s timeout
-	//block size
-  tty.c_cflag &= ~CSIZE;
-  tty.c_cflag |= CS8;
-  tty.c_cflag |= (CLOCAL | CREAD);
-
-	// set specified configs	
-  if (tcsetattr(usb, TCSANOW, &tty) != 0) {
-    fprintf(stderr, "error from tcsetattr\n");
-    return PAM_AUTH_ERR;
-  }
+	// token failed BREAKER_FAILURES times in a row: fail at once, not
+	// after its deadlines, until one login found it working again
+	enum breaker_state breaker = breaker_allow();
+	if (breaker == BREAKER_FAIL_FAST) {
+		return auth_done(NULL, start, METRICS_FAIL_FAST, PAM_AUTH_ERR);
+	}
+	int probe = (breaker == BREAKER_PROBE);
+	char tokenId[4];
 
-	// init data to 0 ('\0')
-  int bytes_written;
-  unsigned char usbOpCode[3];
-	
-	// 2B header + 1B not used (null) + 63B cleartext_len
-  unsigned char usbMessageBuf[cleartextLen+3];
-
-	// 2B header + 64B message (ciphertext)
-  unsigned char usbReceiveBuf[ciphertextLen+2];
-
-  memset(usbOpCode, 0, sizeof(usbOpCode));
-	memset(usbMessageBuf, 0, sizeof(usbMessageBuf));
-  memset(usbReceiveBuf, 0, sizeof(usbReceiveBuf));
-  
-	unsigned char *usbMessage = genNumber_raw();
-
-	// *W = Write operation
-  usbMessageBuf[0] = '*';
-  usbMessageBuf[1] = 'W';
-  
-	//copy message after 2 char header
-  int i;
-  for (i = 2; i < cleartextLen+2; i++) {
-    usbMessageBuf[i] = usbMessage[i-2];
-  }
-   
-  // Write random generated message to USB
-  bytes_written = write(usb, usbMessageBuf, cleartextLen+3);
-  if (bytes_written < cleartextLen+3) {
-    fprintf(stderr,"Write failed\n");
-  }
+	// everything of this call lives with pamh, nothing is shared
+	// between concurrent calls (thread pooled PAM consumers)
+	struct auth_ctx *ctx = calloc(1, sizeof(struct auth_ctx));
+	if (ctx == NULL) {
+		breaker_release(probe);
+		return auth_done(NULL, start, METRICS_ERROR, PAM_BUF_ERR);
+	}
+	ctx->usb = -1;
+	if (pam_set_data(pamh, AUTH_CTX_NAME, ctx, auth_ctx_cleanup) != PAM_SUCCESS) {
+		free(ctx);
+		breaker_release(probe);
+		return auth_done(NULL, start, METRICS_ERROR, PAM_SYSTEM_ERR);
+	}
 
-  // Wait for *D response (msg received)
-  int chars_read;
-  while (!(usbOpCode[0] == '*' && usbOpCode[1] == 'D')) {
-    chars_read = read (usb, usbOpCode, 2);
-   
-	 	// if *T (time out), write again 
-    if (usbOpCode[0] == '*' && usbOpCode[1] == 'T') {
-      bytes_written = write(usb, usbMessageBuf, cleartextLen+3);
-			if (bytes_written < cleartextLen+3) {
-				fprintf(stderr,"ReWrite failed\n");
-      }
-    }
-  } //End while
-
-	usbOpCode[0] = 0;
-  usbOpCode[1] = 0;
-  // Request signed message *R
-  while (!(usbOpCode[0] == '*' && usbOpCode[1] == 'M')) {
-    bytes_written = write(usb, "*R", 2);
-    usleep ((100 + 25) * 100); //delay
-    
-		if (bytes_written != 2) {
-      fprintf(stderr,"Write *R failed\n");
-    }
-    chars_read = read (usb, usbOpCode, 2);
-    if (chars_read == -1) {
-      fprintf(stderr,"Read *M or *B failed\n");
-    }
-  }
-  
-  // *M received, request again and save in usbReceiveBuf
-  // FPGA communication uses 64B messages
-	for (i = 0; i < 64; i++) {
-    usbReceiveBuf[i] = 0;
-  }
-  
-	chars_read = read(usb, usbReceiveBuf, 64);
-  if (chars_read == -1) { 
-    fprintf(stderr,"Failed to read message\n");
-  }
-  usbReceiveBuf[64] = '\0';
+	// challenge sent ahead (already on the token), else from pool,
+	// no waiting for random data
+	phaseStart = now_ns();
+	int prefetched = prefetch && prefetch_take(device, &ctx->challenge);
+	if (!prefetched && challenge_next(&ctx->challenge) != 0) {
+		breaker_release(probe);
+		return auth_done(NULL, start, METRICS_ERROR, PAM_AUTH_ERR);
+	}
+	timing.rng = now_ns() - phaseStart;
+	const unsigned char *usbMessage = ctx->challenge.message;
+	// 64B message (ciphertext) as sent by FPGA
+	unsigned char *usbReceiveBuf = ctx->response;
+
+	// Let token broker sign if running (it owns the port)
+	int ret = -2;
+	if (!prefetched) {
+		phaseStart = now_ns();
+		ret = broker_sign(BROKER_SOCKET, usbMessage, usbReceiveBuf);
+		if (ret != -2) {
+			timing.broker = now_ns() - phaseStart;
+		}
+	}
+	// broker gone since we looked, no port discovered to sign on ourself
+	if (ret == -2 && strpbrk(device, "*?[") != NULL) {
+		breaker_release(probe);
+		return auth_done(&timing, start, METRICS_ERROR, PAM_AUTH_ERR);
+	}
+
+	if (ret == -2 && persistent) {
+		// No broker, port stays open for the life of this process
+		if (baud != 0 || rtscts) {
+			usb_session_configure(baud, rtscts);
+		}
+		ret = probe ? usb_session_probe(device, tokenId) : 0;
+		if (ret == 0) {
+			ret = usb_session_sign(device, usbMessage, usbReceiveBuf, &timing);
+		}
+		if (prefetch && ret == 0) {
+			// token is free again, next challenge while we verify
+			prefetch_start(device);
+		}
+	}
+	else if (ret == -2) {
+		// No broker, send and recieve USB-data ourself
+		// open port
+		phaseStart = now_ns();
+		ctx->usb = usb_open(device, &ctx->ttyOld);
+		if (ctx->usb == -1) {
+			ret = usb_in_use() ? -2 : -1;
+		} else {
+			// faster line for the 64B frames, works at power on baud if not
+			if (baud != 0 || rtscts) {
+				usb_configure(ctx->usb, baud, rtscts);
+			}
+			timing.open = now_ns() - phaseStart;
+
+			// *W message, wait for *D, poll *R until *M
+			ret = -1;
+			if (!probe || usb_probe(ctx->usb, tokenId) == 0) {
+				ret = usb_sign(ctx->usb, usbMessage, usbReceiveBuf, &timing);
+			}
+
+			// close port 
+			phaseStart = now_ns();
+			usb_close(ctx->usb, &ctx->ttyOld);
+			ctx->usb = -1;
+			timing.open += now_ns() - phaseStart;
+		}
+	}
+	// port with another login or process here, says nothing about the token
+	if (ret == -2) {
+		breaker_release(probe);
+		return auth_done(&timing, start, METRICS_ERROR, PAM_AUTH_ERR);
+	}
+	// token answered *B until USB_PIN_TIMEOUT_MS, no PIN entered: it works
+	if (ret == 'B') {
+		breaker_release(probe);
+		return auth_done(&timing, start, METRICS_NO_PIN, PAM_AUTH_ERR);
+	}
+	if (ret != 0) {
+		breaker_record(0, probe);
+		return auth_done(&timing, start, METRICS_TOKEN_FAIL, PAM_AUTH_ERR);
+	}
 
 	//reverse because FPGA mem handling
   reverseStr(usbReceiveBuf);
 	
 	// decrypt ciphertext received
-  const unsigned char *verifiedMessage = malloc(cleartextLen+2);
-  verifiedMessage = public_decrypt(usbReceiveBuf);
- 
-  // close port 
-  tcsetattr(usb, TCSANOW, &tty_old);
-  close(usb);
+	phaseStart = now_ns();
+  const unsigned char *verifiedMessage = public_decrypt(usbReceiveBuf);
+	timing.decrypt = now_ns() - phaseStart;
+	if (verifiedMessage == NULL) {
+		breaker_record(0, probe);
+		return auth_done(&timing, start, METRICS_DECRYPT_FAIL, PAM_AUTH_ERR);
+	}
 
 	//compare cleartexts, fail if not equal
+  int result = PAM_SUCCESS;
   for (i = 0; i < ciphertextLen; i++) {
-    if (verifiedMessage[i] != randData_orig[i]) {
-      return PAM_AUTH_ERR;
+    if (verifiedMessage[i] != ctx->challenge.orig[i]) {
+      result = PAM_AUTH_ERR;
     }
   }
+  free((unsigned char*) verifiedMessage);
+	// a token signing wrong fails like one not answering
+	breaker_record(result == PAM_SUCCESS, probe);
 
-  return PAM_SUCCESS;
+  return auth_done(&timing, start, (result == PAM_SUCCESS) ? METRICS_SUCCESS : METRICS_MISMATCH, result);
 }
 
 
@@ -0,0 +1,451 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <stdint.h>
+#include "header.h"
+
+/* Fixed-width raw RSA public operation, m = c^65537 mod n
+ *
+ * Width is set at compile time from KEY_LEN_BYTE (RSA_FIXED_LIMBS
+ * 64-bit limbs, least significant first), so every loop has a constant
+ * trip count and nothing is allocated. Montgomery multiplication (CIOS),
+ * n0inv and R^2 mod n are computed once per key in rsa_fixed_init.
+ *
+ * c^65537 = c^(2^16) * c: c is taken into Montgomery form, squared
+ * 16 times and multiplied once with plain c, which also takes the
+ * result out of Montgomery form.
+ *
+ * Not constant time, only for public data (signature verification).
+ */
+
+typedef unsigned __int128 uint128_t;
+
+#define RADIX28_MASK 0xfffffffu
+
+// big endian bytes (KEY_LEN_BYTE) -> limbs
+static void bytes_to_limbs(uint64_t* a, const unsigned char* bytes) {
+	int i;
+	memset(a, 0, RSA_FIXED_LIMBS*sizeof(uint64_t));
+	for (i = 0; i < KEY_LEN_BYTE; i++) {
+		int pos = KEY_LEN_BYTE-1-i;
+		a[pos/8] |= (uint64_t) bytes[i] << (8*(pos%8));
+	}
+}
+
+// limbs -> big endian bytes (KEY_LEN_BYTE)
+static void limbs_to_bytes(unsigned char* bytes, const uint64_t* a) {
+	int i;
+	for (i = 0; i < KEY_LEN_BYTE; i++) {
+		int pos = KEY_LEN_BYTE-1-i;
+		bytes[i] = (unsigned char) (a[pos/8] >> (8*(pos%8)));
+	}
+}
+
+// returns 1 if a >= b
+static int limbs_geq(const uint64_t* a, const uint64_t* b) {
+	int i;
+	for (i = RSA_FIXED_LIMBS-1; i >= 0; i--) {
+		if (a[i] != b[i]) {
+			return a[i] > b[i];
+		}
+	}
+	return 1;
+}
+
+// a -= b, returns borrow
+static uint64_t limbs_sub(uint64_t* a, const uint64_t* b) {
+	uint64_t borrow = 0;
+	int i;
+	for (i = 0; i < RSA_FIXED_LIMBS; i++) {
+		uint128_t d = (uint128_t) a[i] - b[i] - borrow;
+		a[i] = (uint64_t) d;
+		borrow = (uint64_t) (d >> 64) & 1;
+	}
+	return borrow;
+}
+
+// r = 2^bits mod n, by doubling 1
+static void pow2_mod(uint64_t* r, int bits, const uint64_t* n) {
+	int i, j;
+	memset(r, 0, RSA_FIXED_LIMBS*sizeof(uint64_t));
+	r[0] = 1;
+	for (i = 0; i < bits; i++) {
+		uint64_t carry = r[RSA_FIXED_LIMBS-1] >> 63;
+		for (j = RSA_FIXED_LIMBS-1; j > 0; j--) {
+			r[j] = (r[j] << 1) | (r[j-1] >> 63);
+		}
+		r[0] <<= 1;
+		if (carry || limbs_geq(r, n)) {
+			limbs_sub(r, n);
+		}
+	}
+}
+
+// limbs (64 bit) -> RSA_BATCH_LIMBS limbs of 28 bits
+static void limbs_to_radix28(uint32_t* out, const uint64_t* a) {
+	int i;
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		int bit = 28*i;
+		uint64_t v = 0;
+		if (bit/64 < RSA_FIXED_LIMBS) {
+			v = a[bit/64] >> (bit%64);
+			if (bit%64 > 36 && bit/64+1 < RSA_FIXED_LIMBS) {
+				v |= a[bit/64+1] << (64 - bit%64);
+			}
+		}
+		out[i] = (uint32_t) v & RADIX28_MASK;
+	}
+}
+
+// RSA_BATCH_LIMBS limbs of 28 bits (may be above 28 bits) -> limbs (64 bit)
+static void radix28_to_limbs(uint64_t* a, const uint64_t* in) {
+	uint64_t carry = 0;
+	int i;
+	memset(a, 0, RSA_FIXED_LIMBS*sizeof(uint64_t));
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		uint64_t v = in[i] + carry;
+		uint64_t limb = v & RADIX28_MASK;
+		int bit = 28*i;
+		carry = v >> 28;
+		if (bit/64 < RSA_FIXED_LIMBS) {
+			a[bit/64] |= limb << (bit%64);
+			if (bit%64 > 36 && bit/64+1 < RSA_FIXED_LIMBS) {
+				a[bit/64+1] |= limb >> (64 - bit%64);
+			}
+		}
+	}
+}
+
+/* r = a*b/R mod n (a, b < n), r may be a or b */
+static void mont_mul(uint64_t* r, const uint64_t* a, const uint64_t* b, const struct rsa_fixed_key* key) {
+	uint64_t t[RSA_FIXED_LIMBS+2];
+	int i, j;
+	memset(t, 0, sizeof(t));
+
+	for (i = 0; i < RSA_FIXED_LIMBS; i++) {
+		// t += a*b[i]
+		uint128_t c = 0;
+		for (j = 0; j < RSA_FIXED_LIMBS; j++) {
+			c = (uint128_t) a[j]*b[i] + t[j] + (uint64_t) (c >> 64);
+			t[j] = (uint64_t) c;
+		}
+		c = (uint128_t) t[RSA_FIXED_LIMBS] + (uint64_t) (c >> 64);
+		t[RSA_FIXED_LIMBS] = (uint64_t) c;
+		t[RSA_FIXED_LIMBS+1] = (uint64_t) (c >> 64);
+
+		// t = (t + m*n) / 2^64
+		uint64_t m = t[0]*key->n0inv;
+		c = (uint128_t) m*key->n[0] + t[0];
+		for (j = 1; j < RSA_FIXED_LIMBS; j++) {
+			c = (uint128_t) m*key->n[j] + t[j] + (uint64_t) (c >> 64);
+			t[j-1] = (uint64_t) c;
+		}
+		c = (uint128_t) t[RSA_FIXED_LIMBS] + (uint64_t) (c >> 64);
+		t[RSA_FIXED_LIMBS-1] = (uint64_t) c;
+		t[RSA_FIXED_LIMBS] = t[RSA_FIXED_LIMBS+1] + (uint64_t) (c >> 64);
+	}
+
+	// t < 2n
+	if (t[RSA_FIXED_LIMBS] != 0 || limbs_geq(t, key->n)) {
+		limbs_sub(t, key->n);
+	}
+	memcpy(r, t, RSA_FIXED_LIMBS*sizeof(uint64_t));
+}
+
+int rsa_fixed_init(struct rsa_fixed_key* key, const unsigned char* modulus, unsigned long e) {
+	int i;
+
+	if (e != 65537 || modulus[0] == 0 || (modulus[KEY_LEN_BYTE-1] & 1) == 0) {
+		return -1;
+	}
+	bytes_to_limbs(key->n, modulus);
+
+	// n0inv = -n^-1 mod 2^64 (Newton, each step doubles the correct bits)
+	uint64_t inv = key->n[0];
+	for (i = 0; i < 6; i++) {
+		inv *= 2 - key->n[0]*inv;
+	}
+	key->n0inv = -inv;
+
+	// rr = R^2 mod n, R = 2^(64*RSA_FIXED_LIMBS)
+	pow2_mod(key->rr, 2*64*RSA_FIXED_LIMBS, key->n);
+	return 0;
+}
+
+int rsa_fixed_public(const struct rsa_fixed_key* key, const unsigned char* ciphertext, unsigned char* cleartext) {
+	uint64_t c[RSA_FIXED_LIMBS];
+	uint64_t x[RSA_FIXED_LIMBS];
+	int i;
+
+	bytes_to_limbs(c, ciphertext);
+	if (limbs_geq(c, key->n)) {
+		// as OpenSSL: data too large for modulus
+		return -1;
+	}
+
+	mont_mul(x, c, key->rr, key);      // c*R
+	for (i = 0; i < 16; i++) {
+		mont_mul(x, x, x, key);          // c^(2^(i+1))*R
+	}
+	mont_mul(x, x, c, key);            // c^65537
+
+	limbs_to_bytes(cleartext, x);
+	return 0;
+}
+
+
+/* Batch (multi-buffer)
+ *
+ * Signatures with the same key, one per SIMD lane: vector j holds limb j
+ * of every signature. Limbs are 28 bits, so the 64-bit lanes can sum
+ * all 32x32 bit products (vpmuludq) of one Montgomery multiplication
+ * without carrying in between. R = 2^(28*RSA_BATCH_LIMBS) > 4n, so
+ * values are only kept below 2n and reduced once at the end.
+ */
+
+#define BATCH_LANES_MAX 8
+
+static int batchLanes = 0; //0: not detected yet
+
+void rsa_fixed_batch_init(struct rsa_batch_key* key, const struct rsa_fixed_key* fixed) {
+	uint64_t rr[RSA_FIXED_LIMBS];
+
+	key->fixed = *fixed;
+	// rr = R^2 mod n, R = 2^(28*RSA_BATCH_LIMBS)
+	pow2_mod(rr, 2*28*RSA_BATCH_LIMBS, fixed->n);
+	limbs_to_radix28(key->n28, fixed->n);
+	limbs_to_radix28(key->rr28, rr);
+	key->n0inv28 = (uint32_t) fixed->n0inv & RADIX28_MASK;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// r = a*b/R mod 2n (a, b < 2n), r may be a or b
+__attribute__((target("avx2")))
+static void mont_mul_avx2(__m256i* r, const __m256i* a, const __m256i* b, const __m256i* n, __m256i n0inv) {
+	const __m256i mask = _mm256_set1_epi64x(RADIX28_MASK);
+	__m256i t[2*RSA_BATCH_LIMBS];
+	int i, j;
+
+	for (i = 0; i < 2*RSA_BATCH_LIMBS; i++) {
+		t[i] = _mm256_setzero_si256();
+	}
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		__m256i* ti = t+i;
+		for (j = 0; j < RSA_BATCH_LIMBS; j++) {
+			ti[j] = _mm256_add_epi64(ti[j], _mm256_mul_epu32(a[j], b[i]));
+		}
+		__m256i m = _mm256_and_si256(_mm256_mul_epu32(ti[0], n0inv), mask);
+		for (j = 0; j < RSA_BATCH_LIMBS; j++) {
+			ti[j] = _mm256_add_epi64(ti[j], _mm256_mul_epu32(m, n[j]));
+		}
+		ti[1] = _mm256_add_epi64(ti[1], _mm256_srli_epi64(ti[0], 28));
+	}
+
+	__m256i carry = _mm256_setzero_si256();
+	for (j = 0; j < RSA_BATCH_LIMBS; j++) {
+		__m256i v = _mm256_add_epi64(t[RSA_BATCH_LIMBS+j], carry);
+		r[j] = _mm256_and_si256(v, mask);
+		carry = _mm256_srli_epi64(v, 28);
+	}
+}
+
+// out = in^65537 mod 2n, 4 lanes, in/out limb j of lane l at [4*j+l]
+__attribute__((target("avx2")))
+static void batch_avx2(const struct rsa_batch_key* key, const uint64_t* in, uint64_t* out) {
+	__m256i n[RSA_BATCH_LIMBS], rr[RSA_BATCH_LIMBS];
+	__m256i c[RSA_BATCH_LIMBS], x[RSA_BATCH_LIMBS];
+	const __m256i n0inv = _mm256_set1_epi64x(key->n0inv28);
+	int i;
+
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		n[i] = _mm256_set1_epi64x(key->n28[i]);
+		rr[i] = _mm256_set1_epi64x(key->rr28[i]);
+		c[i] = _mm256_loadu_si256((const __m256i*) (in + 4*i));
+	}
+	mont_mul_avx2(x, c, rr, n, n0inv);
+	for (i = 0; i < 16; i++) {
+		mont_mul_avx2(x, x, x, n, n0inv);
+	}
+	mont_mul_avx2(x, x, c, n, n0inv);
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		_mm256_storeu_si256((__m256i*) (out + 4*i), x[i]);
+	}
+}
+
+// as mont_mul_avx2, 8 lanes
+__attribute__((target("avx512f")))
+static void mont_mul_avx512(__m512i* r, const __m512i* a, const __m512i* b, const __m512i* n, __m512i n0inv) {
+	const __m512i mask = _mm512_set1_epi64(RADIX28_MASK);
+	__m512i t[2*RSA_BATCH_LIMBS];
+	int i, j;
+
+	for (i = 0; i < 2*RSA_BATCH_LIMBS; i++) {
+		t[i] = _mm512_setzero_si512();
+	}
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		__m512i* ti = t+i;
+		for (j = 0; j < RSA_BATCH_LIMBS; j++) {
+			ti[j] = _mm512_add_epi64(ti[j], _mm512_mul_epu32(a[j], b[i]));
+		}
+		__m512i m = _mm512_and_si512(_mm512_mul_epu32(ti[0], n0inv), mask);
+		for (j = 0; j < RSA_BATCH_LIMBS; j++) {
+			ti[j] = _mm512_add_epi64(ti[j], _mm512_mul_epu32(m, n[j]));
+		}
+		ti[1] = _mm512_add_epi64(ti[1], _mm512_srli_epi64(ti[0], 28));
+	}
+
+	__m512i carry = _mm512_setzero_si512();
+	for (j = 0; j < RSA_BATCH_LIMBS; j++) {
+		__m512i v = _mm512_add_epi64(t[RSA_BATCH_LIMBS+j], carry);
+		r[j] = _mm512_and_si512(v, mask);
+		carry = _mm512_srli_epi64(v, 28);
+	}
+}
+
+// as batch_avx2, 8 lanes
+__attribute__((target("avx512f")))
+static void batch_avx512(const struct rsa_batch_key* key, const uint64_t* in, uint64_t* out) {
+	__m512i n[RSA_BATCH_LIMBS], rr[RSA_BATCH_LIMBS];
+	__m512i c[RSA_BATCH_LIMBS], x[RSA_BATCH_LIMBS];
+	const __m512i n0inv = _mm512_set1_epi64(key->n0inv28);
+	int i;
+
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		n[i] = _mm512_set1_epi64(key->n28[i]);
+		rr[i] = _mm512_set1_epi64(key->rr28[i]);
+		c[i] = _mm512_loadu_si512((const void*) (in + 8*i));
+	}
+	mont_mul_avx512(x, c, rr, n, n0inv);
+	for (i = 0; i < 16; i++) {
+		mont_mul_avx512(x, x, x, n, n0inv);
+	}
+	mont_mul_avx512(x, x, c, n, n0inv);
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		_mm512_storeu_si512((void*) (out + 8*i), x[i]);
+	}
+}
+
+static int batch_lanes_cpu(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return 8;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return 4;
+	}
+	return 1;
+}
+#else
+static int batch_lanes_cpu(void) {
+	return 1;
+}
+#endif
+
+int rsa_fixed_batch_lanes(int max) {
+	int lanes = batch_lanes_cpu();
+	while (max > 0 && lanes > max) {
+		lanes /= 2;
+	}
+	if (lanes == 2) {
+		lanes = 1;
+	}
+	batchLanes = lanes;
+	return lanes;
+}
+
+// a (RSA_BATCH_LIMBS limbs of 28 bits, < 2n) -= n if a >= n
+static void radix28_reduce(uint64_t* a, const uint32_t* n) {
+	int i;
+	for (i = RSA_BATCH_LIMBS-1; i >= 0; i--) {
+		if (a[i] != n[i]) {
+			break;
+		}
+	}
+	if (i >= 0 && a[i] < n[i]) {
+		return;
+	}
+	uint64_t borrow = 0;
+	for (i = 0; i < RSA_BATCH_LIMBS; i++) {
+		uint64_t d = a[i] - n[i] - borrow;
+		a[i] = d & RADIX28_MASK;
+		borrow = d >> 63;
+	}
+}
+
+int rsa_fixed_public_batch(const struct rsa_batch_key* key, const unsigned char** ciphertexts, unsigned char** cleartexts, int count, int* ok) {
+	uint64_t in[RSA_BATCH_LIMBS*BATCH_LANES_MAX];
+	uint64_t out[RSA_BATCH_LIMBS*BATCH_LANES_MAX];
+	int lanes = batchLanes;
+	int done = 0;
+	int i, j, l;
+
+	if (lanes == 0) {
+		lanes = rsa_fixed_batch_lanes(0);
+	}
+
+	for (i = 0; i < count; i += lanes) {
+		int group = (count - i < lanes) ? count - i : lanes;
+		if (group == 1) {
+			ok[i] = (rsa_fixed_public(&key->fixed, ciphertexts[i], cleartexts[i]) == 0);
+			if (!ok[i]) {
+				memset(cleartexts[i], 0, KEY_LEN_BYTE);
+			}
+			done += ok[i];
+			continue;
+		}
+
+		// transpose into lanes, unused or invalid lanes get 0
+		memset(in, 0, sizeof(in));
+		for (l = 0; l < group; l++) {
+			uint64_t c[RSA_FIXED_LIMBS];
+			uint32_t c28[RSA_BATCH_LIMBS];
+			bytes_to_limbs(c, ciphertexts[i+l]);
+			ok[i+l] = !limbs_geq(c, key->fixed.n);
+			if (ok[i+l]) {
+				limbs_to_radix28(c28, c);
+				for (j = 0; j < RSA_BATCH_LIMBS; j++) {
+					in[lanes*j+l] = c28[j];
+				}
+			}
+		}
+
+#if defined(__x86_64__)
+		if (lanes == 8) {
+			batch_avx512(key, in, out);
+		} else {
+			batch_avx2(key, in, out);
+		}
+#endif
+
+		for (l = 0; l < group; l++) {
+			uint64_t x28[RSA_BATCH_LIMBS];
+			uint64_t x[RSA_FIXED_LIMBS];
+			if (!ok[i+l]) {
+				memset(cleartexts[i+l], 0, KEY_LEN_BYTE);
+				continue;
+			}
+			for (j = 0; j < RSA_BATCH_LIMBS; j++) {
+				x28[j] = out[lanes*j+l];
+			}
+			radix28_reduce(x28, key->n28);
+			radix28_to_limbs(x, x28);
+			limbs_to_bytes(cleartexts[i+l], x);
+			done++;
+		}
+	}
+	return done;
+}
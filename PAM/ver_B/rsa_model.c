@@ -0,0 +1,1240 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <stdint.h>
+#include "header.h"
+
+/* Cycle-accurate model of the RSA core of the token
+ *
+ * rsa_top, montgomery_mult, montgomery_step, pe_wrapper, pe, m_calc and
+ * n_c_core of VHDL_code/ver_B/.../rsa_512/trunk/rtl, one C struct per
+ * entity with the same registers. Each call to top_clock is one rising
+ * edge: the combinational processes are evaluated on the registers
+ * before the edge, then every register takes its next value.
+ * Everything is 16-bit words as in the RTL (widths and wrap-around
+ * included), so the words out are the ones of the core, reduced or not.
+ *
+ * The memory cores are the ones of the data sheet (doc/rsa 512.pdf):
+ * Mem_b single port write first, the three FIFOs standard (not first
+ * word fall through) with read latency 1, empty and full registered,
+ * a read of an empty FIFO or a write to a full one ignored.
+ * Registers without reset start at 0 instead of 'U'.
+ *
+ * rsa_model_exp is the same computation a word at a time, one pass of
+ * the multiplier per product, for when only the result and the cycle
+ * count (data independent, RSA_MODEL_CYCLES) are needed.
+ *
+ * The words port of rsa_top (key->words) is the word count of the
+ * operands, a multiple of PES up to RSA_MODEL_WORDS.
+ */
+
+#define PES      8                   //montgomery_step instances per montgomery_mult
+#define W_NUMB(words)  ((words)+3)   //x"23" with 32 words, words through a multiplier
+#define PE_LAST(words) ((words)+2)   //x"22", last word of a montgomery_step
+
+#define FIFO_MAX 64
+
+// res_out_fifo (64), fifo_512_bram (64), fifo_256_feedback (32)
+struct fifo {
+	uint64_t mem[FIFO_MAX];
+	int depth, head, count;
+	uint64_t dout;
+};
+
+// Mem_b, 6-bit address
+struct ram {
+	uint16_t mem[64];
+	uint16_t dout;
+};
+
+// pe_wrapper: pe and m_calc
+struct pe {
+	uint32_t prodAB, prodNM, sum1, sum2;
+	uint16_t nReg, sPrevReg, abOut;
+	uint8_t abValid, valid1, valid2, valid3;
+	uint16_t sumRes;                  // m_calc
+	uint8_t multValid1, multValid2;
+	uint16_t m;                       // pe_wrapper
+	uint8_t validMReg;
+};
+
+enum step_state { STEP_WAIT_VALID, STEP_WAIT_M, STEP_MONT_PROC, STEP_GETTING_RESULTS, STEP_PREP_M, STEP_B_STABLE };
+
+// montgomery_step, one word of b per pass
+struct step {
+	enum step_state state;
+	uint8_t counter;
+	uint64_t regConstant;             // a & n & s_prev, 48 bits
+	uint64_t regInput[6];             // reg_input, reg_input_1 to _5
+	uint32_t regOut[5];               // reg_out, reg_out_1 to _4
+	struct pe pe;
+};
+
+// outputs of a montgomery_step that come from its registers
+struct step_out {
+	uint16_t a, n, s;
+	int valid, busy, cStep;
+};
+
+enum mult_state { MULT_WAIT_START, MULT_PROCESS_DATA, MULT_DUMP_FEED };
+
+// montgomery_mult, PES steps in a ring through fifo_feed
+struct mult {
+	enum mult_state state;
+	uint16_t countFeedback;
+	uint8_t count, regBusy, regCStep;
+	uint16_t b[PES];
+	uint8_t reqs[PES];
+	struct fifo fifoB, fifoFeed;
+	struct step steps[PES];
+};
+
+enum nc_state { NC_IDLE, NC_STEP1, NC_STEP2, NC_STEP3, NC_STEP4, NC_FIN };
+
+enum top_state { TOP_WAIT_START, TOP_PREPARE_DATA, TOP_WAIT_CONSTANTS, TOP_WRITTING_CTS_FIFO,
+	TOP_PROCESSING_DATA_0, TOP_PROCESSING_DATA_1, TOP_WAIT_RESULTS, TOP_TRANSITION,
+	TOP_PREPARE_NEXT, TOP_WRITTING_RESULTS, TOP_FINAL_MULT, TOP_SHOW_FINAL,
+	TOP_PREPARE_FINAL, TOP_WAIT_FINAL };
+
+// n_c_core
+struct nc {
+	enum nc_state state;
+	uint16_t lswM, t, out;
+	uint8_t start, complete, done;
+};
+
+// rsa_top, two multipliers (x^y and the ladder partner)
+struct top {
+	enum top_state state;
+	uint16_t ncReg, nc, countInput, bitCounter, bsize;
+	uint8_t wNumb, words, addrExp, addrN;
+	struct mult mon[2];
+	struct fifo fifo;
+	struct ram exp, mod;
+	struct nc ncCore;
+};
+
+// ports of rsa_top
+struct top_in {
+	int validIn, startIn, loSel;
+	uint16_t x, y, m, r_c, bitSize, loIn;
+	uint8_t words;
+};
+
+static const uint8_t ncX0[8] = { 0xF, 0x5, 0x3, 0x9, 0x7, 0xD, 0xB, 0x1 };
+static const uint8_t ncZ0[8] = { 0xF, 0x5, 0x3, 0x4, 0xC, 0x5, 0x3, 0x1 };
+
+static void fifo_clock(struct fifo* f, int rd, int wr, uint64_t din) {
+	int empty = (f->count == 0);
+	int full = (f->count == f->depth);
+	if (wr && !full) {
+		f->mem[(f->head + f->count) % f->depth] = din;
+		f->count++;
+	}
+	if (rd && !empty) {
+		f->dout = f->mem[f->head];
+		f->head = (f->head + 1) % f->depth;
+		f->count--;
+	}
+}
+
+static void ram_clock(struct ram* r, int we, uint8_t addr, uint16_t din) {
+	if (we) {
+		r->mem[addr & 0x3f] = din;
+		r->dout = din;
+	} else {
+		r->dout = r->mem[addr & 0x3f];
+	}
+}
+
+/* pe_wrapper (pe and m_calc), a_j b_i s_prev n_j and the valids are
+ * the inputs during the cycle */
+static void pe_clock(struct pe* p, uint16_t a, uint16_t b, uint16_t s, uint16_t n, int abValid, int valid, uint16_t nCons) {
+	uint32_t multAB = (uint32_t) a*b;
+	uint32_t multNM = (uint32_t) p->nReg*p->m;
+	uint16_t mOut = (uint16_t) ((uint32_t) p->sumRes*nCons);
+	int validM = p->multValid2;
+
+	// pe_wrapper: m is taken on the rising m_valid
+	if (validM && !p->validMReg) {
+		p->m = mOut;
+	}
+	p->validMReg = (uint8_t) validM;
+
+	// m_calc, t is the s_prev input
+	p->sumRes = (uint16_t) (p->abOut + s);
+	p->multValid2 = p->multValid1;
+	p->multValid1 = p->abValid;
+
+	// pe
+	if (valid) {
+		uint32_t sum1 = p->sum1;
+		p->sum1 = p->prodAB + (sum1 >> 16) + p->sPrevReg;
+		p->sum2 = p->prodNM + (p->sum2 >> 16) + (sum1 & 0xffff);
+		p->sPrevReg = s;
+		p->nReg = n;
+		p->prodAB = multAB;
+		p->prodNM = multNM;
+	} else {
+		p->sum1 = p->sum2 = p->prodAB = p->prodNM = 0;
+		p->sPrevReg = p->nReg = 0;
+	}
+	p->abValid = (uint8_t) abValid;
+	p->abOut = (uint16_t) multAB;
+	p->valid3 = p->valid2;
+	p->valid2 = p->valid1;
+	p->valid1 = (uint8_t) valid;
+}
+
+static void step_out(const struct step* st, struct step_out* out, uint8_t words) {
+	out->a = (uint16_t) (st->regOut[4] >> 16);
+	out->n = (uint16_t) st->regOut[4];
+	out->s = (uint16_t) st->pe.sum2;
+	out->valid = (st->state == STEP_GETTING_RESULTS);
+	out->busy = (st->state != STEP_WAIT_VALID);
+	out->cStep = (st->state == STEP_GETTING_RESULTS && st->counter == PE_LAST(words));
+}
+
+static uint64_t pack48(uint16_t a, uint16_t n, uint16_t s) {
+	return ((uint64_t) a << 32) | ((uint64_t) n << 16) | s;
+}
+
+static void step_clock(struct step* st, int validIn, uint16_t a, uint16_t n, uint16_t sPrev, uint16_t b, int stop, uint16_t nCons, uint8_t words) {
+	enum step_state next = st->state;
+	uint64_t mont = 0;   // a & n & s into the pe
+	int abValid = 0, validMont = 0;
+	int i;
+
+	switch (st->state) {
+		case STEP_WAIT_VALID:
+			if (validIn) {
+				next = STEP_B_STABLE;
+				st->regConstant = pack48(a, n, sPrev);
+			}
+			break;
+		case STEP_B_STABLE:
+			next = STEP_PREP_M;
+			break;
+		case STEP_PREP_M:
+			mont = st->regConstant;
+			abValid = 1;
+			next = STEP_WAIT_M;
+			break;
+		case STEP_WAIT_M:
+			mont = st->regConstant;
+			if (st->pe.validMReg) {
+				validMont = 1;
+				next = STEP_MONT_PROC;
+				mont = st->regInput[5];
+			}
+			break;
+		case STEP_MONT_PROC:
+			validMont = 1;
+			mont = st->regInput[5];
+			if (st->pe.valid3) {
+				st->counter = 0;
+				next = STEP_GETTING_RESULTS;
+			}
+			break;
+		case STEP_GETTING_RESULTS:
+			validMont = 1;
+			mont = st->regInput[5];
+			if (st->counter == PE_LAST(words)) {
+				next = STEP_WAIT_VALID;
+			}
+			st->counter++;
+			break;
+	}
+	if (stop) {
+		next = STEP_WAIT_VALID;
+	}
+
+	pe_clock(&st->pe, (uint16_t) (mont >> 32), b, (uint16_t) mont, (uint16_t) (mont >> 16), abValid, validMont, nCons);
+
+	// a and n are delayed to the next step, s comes from the pe
+	for (i = 4; i > 0; i--) {
+		st->regOut[i] = st->regOut[i-1];
+	}
+	st->regOut[0] = (uint32_t) (st->regInput[4] >> 16);
+	for (i = 5; i > 0; i--) {
+		st->regInput[i] = st->regInput[i-1];
+	}
+	st->regInput[0] = pack48(a, n, sPrev);
+	st->state = next;
+}
+
+// s and valid_out of a montgomery_mult, from its registers
+static void mult_out(const struct mult* mu, uint16_t* s, int* valid, uint8_t words) {
+	*s = 0;
+	*valid = 0;
+	if (mu->count == words) {
+		struct step_out out;
+		step_out(&mu->steps[0], &out, words);
+		*s = out.s;
+		*valid = out.valid;
+	}
+}
+
+static void mult_clock(struct mult* mu, int validIn, uint16_t a, uint16_t b, uint16_t n, uint16_t sPrev, uint16_t nCons, uint8_t words) {
+	struct step_out out[PES];
+	enum mult_state next = mu->state;
+	uint8_t nextCount = mu->regCStep ? (uint8_t) (mu->count + 8) : mu->count;
+	uint16_t nextFeedback = mu->countFeedback;
+	int emptyFeed = (mu->fifoFeed.count == 0);
+	uint64_t feed = mu->fifoFeed.dout;
+	int rdFeed = 0, wrFeed = 0, wrB = 0, rdB = 0, stop = 0;
+	int fValid = validIn;
+	uint16_t aIn = a, nIn = n, sIn = sPrev;
+	int breq[PES];
+	int i;
+
+	for (i = 0; i < PES; i++) {
+		step_out(&mu->steps[i], &out[i], words);
+	}
+
+	switch (mu->state) {
+		case MULT_WAIT_START:
+			if (validIn) {
+				next = MULT_PROCESS_DATA;
+			}
+			break;
+		case MULT_PROCESS_DATA:
+			wrFeed = out[PES-1].valid;
+			wrB = validIn;
+			// next pass of the ring, the words of the last step back to the first
+			if (!emptyFeed && !mu->regBusy) {
+				rdFeed = 1;
+				next = MULT_DUMP_FEED;
+				nextFeedback = 0;
+			}
+			if (mu->count > W_NUMB(words)) {
+				next = MULT_WAIT_START;
+				stop = 1;
+				nextCount = 0;
+			}
+			break;
+		case MULT_DUMP_FEED:
+			if (!emptyFeed) {
+				nextFeedback++;
+			}
+			wrFeed = out[PES-1].valid;
+			rdFeed = 1;
+			aIn = (uint16_t) (feed >> 33);
+			nIn = (uint16_t) (feed >> 17);
+			sIn = (uint16_t) (feed >> 1);
+			fValid = (int) (feed & 1);
+			if (emptyFeed) {
+				next = MULT_PROCESS_DATA;
+			}
+			if (mu->countFeedback == PE_LAST(words)) {
+				rdFeed = 0;
+				next = MULT_PROCESS_DATA;
+			}
+			break;
+	}
+
+	// a step asks for its word of b when it starts
+	for (i = 0; i < PES; i++) {
+		int v = (i == 0) ? fValid : out[i-1].valid;
+		breq[i] = (mu->steps[i].state == STEP_WAIT_VALID && v);
+		rdB |= breq[i];
+	}
+
+	step_clock(&mu->steps[0], fValid, aIn, nIn, sIn, mu->b[0], stop, nCons, words);
+	for (i = 1; i < PES; i++) {
+		step_clock(&mu->steps[i], out[i-1].valid, out[i-1].a, out[i-1].n, out[i-1].s, mu->b[i], stop, nCons, words);
+	}
+
+	for (i = 0; i < PES; i++) {
+		if (mu->state == MULT_WAIT_START) {
+			mu->b[i] = (i == 0) ? b : 0;
+			mu->reqs[i] = 0;
+		} else {
+			if (mu->reqs[i] && mu->fifoB.count != 0) {
+				mu->b[i] = (uint16_t) mu->fifoB.dout;
+			}
+			mu->reqs[i] = (uint8_t) breq[i];
+		}
+	}
+
+	fifo_clock(&mu->fifoB, rdB, wrB, b);
+	fifo_clock(&mu->fifoFeed, rdFeed, wrFeed, ((uint64_t) out[PES-1].a << 33) | ((uint64_t) out[PES-1].n << 17)
+		| ((uint64_t) out[PES-1].s << 1) | (uint64_t) out[PES-1].valid);
+
+	mu->regBusy = (uint8_t) out[0].busy;
+	mu->regCStep = (uint8_t) out[0].cStep;
+	mu->state = next;
+	mu->count = nextCount;
+	mu->countFeedback = nextFeedback;
+}
+
+// n_c_core: n_c = -m^-1 mod 2^16 from the least significant word of m
+static void nc_clock(struct nc* c, int ce, uint16_t mLsw) {
+	uint16_t lsw = c->lswM;
+	int complete = c->complete;
+
+	if (!c->start) {
+		c->complete = 0;
+		c->state = NC_IDLE;
+		c->done = 0;
+	} else {
+		uint16_t tFor = (uint16_t) ((uint32_t) c->t*lsw);
+		uint16_t tOut = (uint16_t) ((uint32_t) c->t*(uint16_t) (~tFor + 3));
+		int adr = (lsw >> 1) & 7;
+		int x1;
+		switch (c->state) {
+			case NC_IDLE:
+				if (((lsw >> 5) ^ (lsw >> 6)) & 1) {
+					x1 = ((((lsw >> 4) & 1) << 3) + ((lsw >> 4) & 0xf) + ncZ0[adr]) & 0xf;
+				} else {
+					x1 = (((lsw >> 4) & 0xf) + ncZ0[adr]) & 0xf;
+				}
+				c->done = 0;
+				c->state = NC_STEP1;
+				c->t = (uint16_t) ((x1 << 4) | ncX0[adr]);
+				break;
+			case NC_STEP1:
+			case NC_STEP2:
+			case NC_STEP3:
+			case NC_STEP4:
+				c->t = tOut;
+				c->state++;
+				break;
+			case NC_FIN:
+				c->complete = 1;
+				c->done = 1;
+				c->state = NC_IDLE;
+				c->out = (uint16_t) ((~c->t & 0xfffe) | 1);
+				break;
+		}
+	}
+
+	// NC_complete clears NC_start asynchronously
+	if (complete) {
+		c->start = 0;
+	} else if (ce) {
+		c->lswM = mLsw;
+		c->start = 1;
+	}
+	if (c->complete) {
+		c->start = 0;
+	}
+}
+
+// n_c of n_c_core for the least significant word of m
+static uint16_t nc_value(uint16_t mLsw) {
+	struct nc c;
+	int i;
+	memset(&c, 0, sizeof(c));
+	for (i = 0; i <= RSA_MODEL_SETUP && !c.done; i++) {
+		nc_clock(&c, i == 0, mLsw);
+	}
+	return c.out;
+}
+
+/* one rising edge of rsa_top, *s and *validOut are the outputs during
+ * the cycle before it */
+static void top_clock(struct top* t, const struct top_in* in, uint16_t* s, int* validOut) {
+	uint16_t s1, s2;
+	int valid1, valid2;
+	int v1 = 0, v2 = 0;
+	uint16_t a1 = 0, b1 = 0, n1 = 0, a2 = 0, b2 = 0, n2 = 0;
+	int fifoRd = 0, fifoWr = 0, writeBN = 0;
+	uint32_t fifoIn = 0;
+	uint32_t fifoOut = (uint32_t) t->fifo.dout;
+	uint16_t hi = (uint16_t) (fifoOut >> 16), lo = (uint16_t) fifoOut;
+	uint16_t nOut = t->mod.dout;
+	uint16_t nCons = t->ncReg;
+	enum top_state next = t->state;
+	uint16_t nextCount = t->countInput;
+	uint16_t nextBitCounter = t->bitCounter;
+	uint8_t nextAddrExp = t->addrExp, nextAddrN = t->addrN;
+	uint8_t nextWords = t->words;
+	uint16_t yMem = in->y, mMem = in->m;
+
+	mult_out(&t->mon[0], &s1, &valid1, t->words);
+	mult_out(&t->mon[1], &s2, &valid2, t->words);
+	*s = 0;
+	*validOut = 0;
+
+	switch (t->state) {
+		case TOP_WAIT_START:
+			v1 = v2 = in->validIn;
+			if (in->validIn) {
+				// x*r_c and 1*r_c (lo_in*r_c): x and 1 into Montgomery form
+				a1 = in->x;
+				b1 = in->r_c;
+				n1 = in->m;
+				a2 = in->loSel ? in->loIn : 1;
+				b2 = in->r_c;
+				n2 = in->m;
+				t->wNumb = W_NUMB(in->words);
+				nextWords = in->words;
+				t->ncReg = t->nc;
+				next = TOP_PREPARE_DATA;
+				nextCount = 1;
+				writeBN = 1;
+				nextAddrExp = 1;
+				nextAddrN = 1;
+				t->bsize = (uint16_t) (in->bitSize - 1);
+			}
+			break;
+
+		case TOP_PREPARE_DATA:
+			nextCount = (uint16_t) (t->countInput + 1);
+			v1 = v2 = 1;
+			// zeros once the input ends, the 3 extra words
+			if (in->validIn) {
+				a1 = in->x;
+				b1 = in->r_c;
+				n1 = in->m;
+				if (in->loSel) {
+					a2 = in->loIn;
+				}
+				b2 = in->r_c;
+				n2 = in->m;
+				writeBN = 1;
+				nextAddrExp = (uint8_t) (t->addrExp + 1);
+				nextAddrN = (uint8_t) (t->addrN + 1);
+			} else {
+				// fewer words: the rest of the modulus 0, the multipliers read it
+				writeBN = 1;
+				yMem = mMem = 0;
+				nextAddrExp = (uint8_t) (t->addrExp + 1);
+				nextAddrN = (uint8_t) (t->addrN + 1);
+			}
+			if (t->countInput == t->wNumb) {
+				next = TOP_WAIT_CONSTANTS;
+				nextAddrN = 0;
+				nextAddrExp = (uint8_t) ((t->bsize >> 4) & 0x3f);
+				nextBitCounter = (uint16_t) (1 << (t->bsize & 0xf));
+				nextCount = 0;
+			}
+			break;
+
+		case TOP_WAIT_CONSTANTS:
+			if (valid1) {
+				fifoWr = 1;
+				fifoIn = ((uint32_t) s1 << 16) | s2;
+				nextCount = (uint16_t) (t->countInput + 1);
+				next = TOP_WRITTING_CTS_FIFO;
+			}
+			break;
+
+		case TOP_WRITTING_CTS_FIFO:
+			fifoWr = valid1;
+			nextCount = (uint16_t) (t->countInput + 1);
+			if (t->countInput < t->words) {
+				fifoIn = ((uint32_t) s1 << 16) | s2;
+			}
+			if (!valid1) {
+				nextCount = 0;
+				next = TOP_TRANSITION;
+			}
+			break;
+
+		case TOP_TRANSITION:
+			nextCount = (uint16_t) (t->countInput + 1);
+			if (t->countInput > 2) {
+				nextCount = 0;
+				next = (t->bitCounter & t->exp.dout) ? TOP_PROCESSING_DATA_1 : TOP_PROCESSING_DATA_0;
+			}
+			break;
+
+		// ladder step, the FIFO holds hi & lo
+		case TOP_PROCESSING_DATA_1:
+		case TOP_PROCESSING_DATA_0:
+			if (t->countInput > 0) {
+				v1 = v2 = 1;
+			}
+			fifoRd = 1;
+			if (t->state == TOP_PROCESSING_DATA_1) {
+				a1 = hi;   // lo*hi, hi*hi
+				b1 = lo;
+				a2 = hi;
+				b2 = hi;
+			} else {
+				a1 = lo;   // lo*lo, hi*lo
+				b1 = lo;
+				a2 = hi;
+				b2 = lo;
+			}
+			n1 = n2 = nOut;
+			nextAddrN = (uint8_t) (t->addrN + 1);
+			nextCount = (uint16_t) (t->countInput + 1);
+			if (t->countInput == t->wNumb) {
+				next = TOP_WAIT_RESULTS;
+				if (t->state == TOP_PROCESSING_DATA_0) {
+					nextCount = 0;
+				}
+			}
+			break;
+
+		case TOP_WAIT_RESULTS:
+			if (valid1) {
+				fifoWr = 1;
+				fifoIn = ((uint32_t) s2 << 16) | s1;
+				nextCount = 1;
+				next = TOP_WRITTING_RESULTS;
+			}
+			break;
+
+		case TOP_WRITTING_RESULTS:
+			nextAddrN = 0;
+			fifoWr = valid1;
+			nextCount = (uint16_t) (t->countInput + 1);
+			if (t->countInput < t->words) {
+				fifoIn = ((uint32_t) s2 << 16) | s1;
+			}
+			if (!valid1) {
+				// next bit of the exponent
+				nextCount = 0;
+				next = TOP_PREPARE_NEXT;
+				nextBitCounter = (uint16_t) (t->bitCounter >> 1);
+				if (t->bitCounter == 1) {
+					nextAddrExp = (uint8_t) ((t->addrExp - 1) & 0x3f);
+					nextBitCounter = 0x8000;
+				}
+				if (t->bitCounter == 1 && t->addrExp == 0) {
+					next = TOP_FINAL_MULT;
+					nextCount = 0;
+					nextAddrExp = 0;
+				}
+			}
+			break;
+
+		case TOP_PREPARE_NEXT:
+			next = TOP_TRANSITION;
+			nextCount = 0;
+			break;
+
+		case TOP_FINAL_MULT:
+			nextCount = (uint16_t) (t->countInput + 1);
+			if (t->countInput > 2) {
+				nextCount = 0;
+				next = TOP_PREPARE_FINAL;
+			}
+			break;
+
+		// lo*1, out of Montgomery form
+		case TOP_PREPARE_FINAL:
+			if (t->countInput > 0) {
+				v1 = 1;
+			}
+			fifoRd = 1;
+			a1 = lo;
+			if (t->countInput == 1) {
+				b1 = 1;
+			}
+			n1 = nOut;
+			nextAddrN = (uint8_t) (t->addrN + 1);
+			nextCount = (uint16_t) (t->countInput + 1);
+			if (t->countInput == t->wNumb) {
+				next = TOP_WAIT_FINAL;
+				nextCount = 0;
+			}
+			break;
+
+		case TOP_WAIT_FINAL:
+			if (valid1) {
+				*validOut = 1;
+				*s = s1;
+				next = TOP_SHOW_FINAL;
+				nextCount = (uint16_t) (t->countInput + 1);
+			}
+			break;
+
+		case TOP_SHOW_FINAL:
+			*validOut = 1;
+			*s = s1;
+			nextCount = (uint16_t) (t->countInput + 1);
+			if (t->countInput == t->words) {
+				*validOut = 0;
+				next = TOP_WAIT_START;
+				nextAddrN = 0; // wait_start writes word 0 of y and m there
+			}
+			break;
+
+	}
+
+	mult_clock(&t->mon[0], v1, a1, b1, n1, 0, nCons, t->words);
+	mult_clock(&t->mon[1], v2, a2, b2, n2, 0, nCons, t->words);
+
+	fifo_clock(&t->fifo, fifoRd, fifoWr, fifoIn);
+	ram_clock(&t->exp, writeBN, t->addrExp, yMem);
+	ram_clock(&t->mod, writeBN, t->addrN, mMem);
+	if (t->ncCore.done) {
+		t->nc = t->ncCore.out;
+	}
+	nc_clock(&t->ncCore, in->startIn, in->m);
+
+	t->state = next;
+	t->countInput = nextCount;
+	t->bitCounter = nextBitCounter;
+	t->addrExp = nextAddrExp;
+	t->addrN = nextAddrN;
+	t->words = nextWords;
+}
+
+static void top_init(struct top* t) {
+	int i;
+	memset(t, 0, sizeof(*t));
+	t->words = RSA_MODEL_WORDS;
+	t->fifo.depth = 64;
+	for (i = 0; i < 2; i++) {
+		t->mon[i].fifoB.depth = 64;
+		t->mon[i].fifoFeed.depth = 32;
+	}
+}
+
+// r = r*2^bits mod m, by doubling r < m (words least significant first)
+static void words_shl_mod(uint16_t* r, int bits, const uint16_t* m) {
+	int i, j;
+	for (i = 0; i < bits; i++) {
+		int carry = r[RSA_MODEL_WORDS-1] >> 15;
+		int geq = 1;
+		for (j = RSA_MODEL_WORDS-1; j > 0; j--) {
+			r[j] = (uint16_t) ((r[j] << 1) | (r[j-1] >> 15));
+		}
+		r[0] = (uint16_t) (r[0] << 1);
+		for (j = RSA_MODEL_WORDS-1; j >= 0; j--) {
+			if (r[j] != m[j]) {
+				geq = (r[j] > m[j]);
+				break;
+			}
+		}
+		if (carry || geq) {
+			uint32_t borrow = 0;
+			for (j = 0; j < RSA_MODEL_WORDS; j++) {
+				uint32_t d = (uint32_t) r[j] - m[j] - borrow;
+				r[j] = (uint16_t) d;
+				borrow = (d >> 16) & 1;
+			}
+		}
+	}
+}
+
+// r = 2^bits mod m
+static void words_pow2_mod(uint16_t* r, int bits, const uint16_t* m) {
+	memset(r, 0, RSA_MODEL_WORDS*sizeof(uint16_t));
+	r[0] = 1;
+	words_shl_mod(r, bits, m);
+}
+
+// big endian bytes -> words least significant first
+static void bytes_to_words(uint16_t* w, const unsigned char* bytes, int len) {
+	int i;
+	memset(w, 0, RSA_MODEL_WORDS*sizeof(uint16_t));
+	for (i = 0; i < len; i++) {
+		int pos = len-1-i;
+		w[pos/2] |= (uint16_t) (bytes[i] << (8*(pos%2)));
+	}
+}
+
+int rsa_model_init(struct rsa_model_key* key, const unsigned char* modulus, const unsigned char* exponent, int expLen, int bitSize) {
+	int i;
+	if (expLen < 1 || expLen > RSA_MODEL_BYTES || !(modulus[RSA_MODEL_BYTES-1] & 1)) {
+		return -1;
+	}
+	bytes_to_words(key->m, modulus, RSA_MODEL_BYTES);
+	bytes_to_words(key->y, exponent, expLen);
+	words_pow2_mod(key->r_c, 32*(RSA_MODEL_WORDS+1), key->m);
+
+	if (bitSize <= 0) {
+		bitSize = 0;
+		for (i = RSA_MODEL_WORDS*16-1; i >= 0; i--) {
+			if ((key->y[i/16] >> (i%16)) & 1) {
+				bitSize = i+1;
+				break;
+			}
+		}
+	}
+	if (bitSize < 1 || bitSize > RSA_MODEL_WORDS*16) {
+		return -1;
+	}
+	key->bitSize = bitSize;
+	key->words = RSA_MODEL_WORDS;
+	return 0;
+}
+
+long rsa_model_exp_rtl(const struct rsa_model_key* key, const uint16_t* x, uint16_t* s) {
+	struct top t;
+	struct top_in in;
+	long cycle, first = -1, last = -1;
+	int out = 0, i;
+
+	top_init(&t);
+	memset(&in, 0, sizeof(in));
+	in.bitSize = (uint16_t) key->bitSize;
+	in.words = (uint8_t) key->words;
+
+	// as RSA_512_tb.vhd: start_in with the least significant word of m,
+	// RSA_MODEL_SETUP cycles for n_c_core, then the words
+	for (cycle = 0; cycle < RSA_MODEL_MAX_CYCLES && out < key->words; cycle++) {
+		uint16_t word;
+		int valid;
+		long k = cycle - RSA_MODEL_SETUP - 1;
+
+		in.startIn = (cycle == 0);
+		in.validIn = (k >= 0 && k < key->words);
+		i = in.validIn ? (int) k : 0;
+		in.x = in.validIn ? x[i] : 0;
+		in.y = key->y[i];
+		in.m = key->m[i];
+		in.r_c = key->r_c[i];
+		if (in.validIn && first < 0) {
+			first = cycle;
+		}
+
+		top_clock(&t, &in, &word, &valid);
+		if (valid) {
+			s[out++] = word;
+			last = cycle;
+		}
+	}
+	if (out < key->words) {
+		return -1;
+	}
+	memset(s+out, 0, (RSA_MODEL_WORDS-out)*sizeof(uint16_t));
+	return last - first + 1;
+}
+
+/* a*b/2^(16*(words+1)) as montgomery_mult: a pass of the PE ring per
+ * word of b and one more, rows of W_NUMB words, the top word only the
+ * carries. r is what goes into the FIFO of rsa_top, the words from
+ * words on dropped (0 in r) */
+static void mont_words(uint16_t* r, const uint16_t* a, const uint16_t* b, const uint16_t* n, uint16_t nCons, int words) {
+	uint16_t s[W_NUMB(RSA_MODEL_WORDS)], aw[W_NUMB(RSA_MODEL_WORDS)], nw[W_NUMB(RSA_MODEL_WORDS)];
+	int i, j;
+	memset(s, 0, sizeof(s));
+	memset(aw, 0, sizeof(aw));
+	memset(nw, 0, sizeof(nw));
+	memcpy(aw, a, words*sizeof(uint16_t));
+	memcpy(nw, n, words*sizeof(uint16_t));
+
+	for (i = 0; i <= words; i++) {
+		uint16_t bi = (i < words) ? b[i] : 0;
+		uint16_t m = (uint16_t) ((uint16_t) (aw[0]*bi + s[0])*nCons);
+		uint32_t sum1 = (uint32_t) aw[0]*bi + s[0];
+		uint32_t sum2 = (uint32_t) nw[0]*m + (sum1 & 0xffff);
+		// word 0 is 0, the row moves down a word
+		for (j = 1; j < W_NUMB(words); j++) {
+			sum1 = (uint32_t) aw[j]*bi + (sum1 >> 16) + s[j];
+			sum2 = (uint32_t) nw[j]*m + (sum2 >> 16) + (sum1 & 0xffff);
+			s[j-1] = (uint16_t) sum2;
+		}
+		s[W_NUMB(words)-1] = (uint16_t) ((sum1 >> 16) + (sum2 >> 16));
+	}
+	memset(r, 0, RSA_MODEL_WORDS*sizeof(uint16_t));
+	memcpy(r, s, words*sizeof(uint16_t));
+}
+
+/* the ladder of rsa_top from lo = lo_in*R (lo_sel), NULL: from R */
+static long exp_ladder(const struct rsa_model_key* key, const uint16_t* x, const uint16_t* loIn, uint16_t* s) {
+	uint16_t lo[RSA_MODEL_WORDS], hi[RSA_MODEL_WORDS], one[RSA_MODEL_WORDS];
+	uint16_t t0[RSA_MODEL_WORDS], t1[RSA_MODEL_WORDS];
+	uint16_t nCons = nc_value(key->m[0]);
+	int words = key->words;
+	int i;
+
+	memset(one, 0, sizeof(one));
+	one[0] = 1;
+	mont_words(hi, x, key->r_c, key->m, nCons, words);
+	mont_words(lo, loIn != NULL ? loIn : one, key->r_c, key->m, nCons, words);
+
+	// ladder from the top bit of bit_size, as processing_data_0/1
+	for (i = key->bitSize-1; i >= 0; i--) {
+		if ((key->y[i/16] >> (i%16)) & 1) {
+			mont_words(t0, lo, hi, key->m, nCons, words);
+			mont_words(t1, hi, hi, key->m, nCons, words);
+		} else {
+			mont_words(t0, lo, lo, key->m, nCons, words);
+			mont_words(t1, hi, lo, key->m, nCons, words);
+		}
+		memcpy(lo, t0, sizeof(lo));
+		memcpy(hi, t1, sizeof(hi));
+	}
+	mont_words(s, lo, one, key->m, nCons, words);
+	return RSA_MODEL_CYCLES_W(words, key->bitSize);
+}
+
+long rsa_model_exp(const struct rsa_model_key* key, const uint16_t* x, uint16_t* s) {
+	return exp_ladder(key, x, NULL, s);
+}
+
+long rsa_model_sign(const struct rsa_model_key* key, const unsigned char* ram, unsigned char* result) {
+	uint16_t x[RSA_MODEL_WORDS], s[RSA_MODEL_WORDS];
+	long cycles;
+	int i;
+
+	// Security_Token_Top_USB.vhd: word i is RAM bytes 2i (low) and 2i+1
+	for (i = 0; i < RSA_MODEL_WORDS; i++) {
+		x[i] = (uint16_t) (ram[2*i] | (ram[2*i+1] << 8));
+	}
+	cycles = rsa_model_exp(key, x, s);
+	for (i = 0; i < RSA_MODEL_WORDS; i++) {
+		result[2*i] = (unsigned char) s[i];
+		result[2*i+1] = (unsigned char) (s[i] >> 8);
+	}
+	return cycles;
+}
+
+/* rsa_crt: the signature from x^dp mod p and x^dq mod q (Garner) on the
+ * rsa_top cores, seven runs of a core:
+ *   0: a = x mod p        (y = 1, 32 words)
+ *   1: b = x mod q
+ *   2: a = a^dp mod p     (16 words)
+ *   3: b = b^dq mod q
+ *   4: a = (a + 2p - b)*qInv mod p (lo_in = qInv)
+ *   5: s = a*q mod n + b  (lo_in = q, b added on the way out, s to b:a)
+ *   6: s^e mod n          (e = PUB_EXP), compared with x
+ * With two cores 0 and 1, then 2 and 3, run side by side. s goes out
+ * after run 6 only if it gave x, else 0 with fault. */
+
+#define CRT_HALF (RSA_MODEL_WORDS/2)
+#define CRT_RUNS 7
+
+enum crt_state { CRT_WAIT_X, CRT_RUN_START, CRT_RUN_NC, CRT_RUN_FEED, CRT_RUN_WAIT, CRT_SHOW_S };
+
+// rsa_crt, x_reg, a_reg and b_reg by word
+struct crt {
+	enum crt_state state;
+	int run, count, out[2], fail;
+	uint16_t x[RSA_MODEL_WORDS], a[CRT_HALF], b[CRT_HALF];
+	uint8_t dCarry, sCarry;
+	struct top core[2];
+};
+
+// ports of a core for a run: the key, lo_in (NULL: lo_sel '0')
+static void crt_run(const struct rsa_model_crt_key* key, int run, struct rsa_model_key* k, const uint16_t** lo) {
+	memset(k, 0, sizeof(*k));
+	k->y[0] = 1;
+	k->bitSize = 1;
+	k->words = RSA_MODEL_WORDS;
+	*lo = NULL;
+	switch (run) {
+		case 0:
+		case 4:
+			memcpy(k->m, key->p, sizeof(k->m));
+			memcpy(k->r_c, key->rcP, sizeof(k->r_c));
+			if (run == 4) {
+				*lo = key->qInv;
+			}
+			break;
+		case 1:
+			memcpy(k->m, key->q, sizeof(k->m));
+			memcpy(k->r_c, key->rcQ, sizeof(k->r_c));
+			break;
+		case 2:
+		case 3:
+			memcpy(k->m, run == 2 ? key->p : key->q, sizeof(k->m));
+			memcpy(k->y, run == 2 ? key->dp : key->dq, sizeof(k->y));
+			memcpy(k->r_c, run == 2 ? key->rcPHalf : key->rcQHalf, sizeof(k->r_c));
+			k->bitSize = CRT_HALF*16;
+			k->words = CRT_HALF;
+			break;
+		case 5:
+			memcpy(k->m, key->n, sizeof(k->m));
+			memcpy(k->r_c, key->rcN, sizeof(k->r_c));
+			*lo = key->q;
+			break;
+		case 6:
+			memcpy(k->m, key->n, sizeof(k->m));
+			memcpy(k->y, key->e, sizeof(k->y));
+			memcpy(k->r_c, key->rcN, sizeof(k->r_c));
+			k->bitSize = key->eBits;
+			break;
+	}
+}
+
+// word i of 2p
+static uint16_t crt_p2(const struct rsa_model_crt_key* key, int i) {
+	return (uint16_t) ((key->p[i] << 1) | (i > 0 ? key->p[i-1] >> 15 : 0));
+}
+
+/* one rising edge of rsa_crt and its cores, *s, *validOut and *fault are
+ * the outputs during the cycle before it */
+static void crt_clock(struct crt* c, const struct rsa_model_crt_key* key, int validIn, uint16_t x, uint16_t* s, int* validOut, int* fault) {
+	struct rsa_model_key k[2];
+	const uint16_t* lo[2];
+	uint16_t sc[2] = { 0, 0 };
+	int vc[2] = { 0, 0 };
+	int active[2];
+	int i = c->count;
+	enum crt_state next = c->state;
+	int nextCount = c->count;
+	int nextOut[2] = { c->out[0], c->out[1] };
+	uint16_t aw = (i < CRT_HALF) ? c->a[i] : 0;
+	uint16_t bw = (i < CRT_HALF) ? (uint16_t) ~c->b[i] : 0xffff;
+	uint32_t sum = (uint32_t) aw + (i <= CRT_HALF ? crt_p2(key, i) : 0) + bw + c->dCarry;
+	uint16_t d = (i <= CRT_HALF) ? (uint16_t) sum : 0;
+	int j;
+
+	active[0] = 1;
+	active[1] = (key->cores == 2 && (c->run == 0 || c->run == 2));
+	crt_run(key, c->run, &k[0], &lo[0]);
+	crt_run(key, active[1] ? c->run+1 : 1, &k[1], &lo[1]);
+	*s = 0;
+	*validOut = 0;
+	*fault = 0;
+
+	// the cores, their inputs from the registers of rsa_crt
+	for (j = 0; j < key->cores; j++) {
+		struct top_in in;
+		int run = j ? c->run+1 : c->run;
+		memset(&in, 0, sizeof(in));
+		in.startIn = (c->state == CRT_RUN_START && active[j]);
+		in.validIn = (c->state == CRT_RUN_FEED && active[j]);
+		if (i < RSA_MODEL_WORDS) {
+			switch (run) {
+				case 0: case 1: in.x = c->x[i]; break;
+				case 2: in.x = (i < CRT_HALF) ? c->a[i] : 0; break;
+				case 3: in.x = (i < CRT_HALF) ? c->b[i] : 0; break;
+				case 4: in.x = d; break;
+				case 5: in.x = aw; break;
+				case 6: in.x = (i < CRT_HALF) ? c->a[i] : c->b[i-CRT_HALF]; break;
+			}
+			in.y = k[j].y[i];
+			in.m = k[j].m[i];
+			in.r_c = k[j].r_c[i];
+			in.loIn = (lo[j] != NULL) ? lo[j][i] : 0;
+		}
+		in.loSel = (lo[j] != NULL);
+		in.bitSize = (uint16_t) k[j].bitSize;
+		in.words = (uint8_t) k[j].words;
+		top_clock(&c->core[j], &in, &sc[j], &vc[j]);
+	}
+
+	switch (c->state) {
+		case CRT_WAIT_X:
+			if (validIn) {
+				c->x[i] = x;
+				nextCount = i+1;
+				if (i == RSA_MODEL_WORDS-1) {
+					nextCount = 0;
+					c->run = 0;
+					c->fail = 0;
+					next = CRT_RUN_START;
+				}
+			}
+			break;
+
+		case CRT_RUN_START:
+			nextCount = 0;
+			next = CRT_RUN_NC;
+			break;
+
+		// n_c_core
+		case CRT_RUN_NC:
+			nextCount = i+1;
+			if (i == RSA_MODEL_SETUP-1) {
+				nextCount = 0;
+				c->dCarry = 1;
+				c->sCarry = 0;
+				next = CRT_RUN_FEED;
+			}
+			break;
+
+		case CRT_RUN_FEED:
+			nextCount = i+1;
+			c->dCarry = (uint8_t) (sum >> 16);
+			if (i == k[0].words-1) {
+				nextOut[0] = nextOut[1] = 0;
+				next = CRT_RUN_WAIT;
+			}
+			break;
+
+		case CRT_RUN_WAIT:
+			if (vc[0]) {
+				nextOut[0] = c->out[0]+1;
+				if (c->run == 5) {
+					uint32_t t = (uint32_t) sc[0] + (c->out[0] < CRT_HALF ? c->b[c->out[0]] : 0) + c->sCarry;
+					// b_reg & a_reg shift a word in at the top
+					if (c->out[0] < CRT_HALF) {
+						c->a[c->out[0]] = (uint16_t) t;
+					} else {
+						c->b[c->out[0]-CRT_HALF] = (uint16_t) t;
+					}
+					c->sCarry = (uint8_t) (t >> 16);
+				} else if (c->run == 6) {
+					if (sc[0] != c->x[c->out[0]]) {
+						c->fail = 1;
+					}
+				} else if (c->out[0] < CRT_HALF) {
+					if (c->run == 1 || c->run == 3) {
+						c->b[c->out[0]] = sc[0];
+					} else {
+						c->a[c->out[0]] = sc[0];
+					}
+				}
+			}
+			if (vc[1]) {
+				nextOut[1] = c->out[1]+1;
+				if (c->out[1] < CRT_HALF) {
+					c->b[c->out[1]] = sc[1];
+				}
+			}
+			if (c->out[0] == k[0].words && (!active[1] || c->out[1] == k[1].words)) {
+				nextCount = 0;
+				if (c->run == CRT_RUNS-1) {
+					next = CRT_SHOW_S;
+				} else {
+					c->run += active[1] ? 2 : 1;
+					next = CRT_RUN_START;
+				}
+			}
+			break;
+
+		// s from b_reg & a_reg, 0 if run 6 did not give x
+		case CRT_SHOW_S:
+			*validOut = 1;
+			*fault = c->fail;
+			if (!c->fail) {
+				*s = (i < CRT_HALF) ? c->a[i] : c->b[i-CRT_HALF];
+			}
+			nextCount = i+1;
+			if (i == RSA_MODEL_WORDS-1) {
+				nextCount = 0;
+				next = CRT_WAIT_X;
+			}
+			break;
+	}
+
+	c->state = next;
+	c->count = nextCount;
+	c->out[0] = nextOut[0];
+	c->out[1] = nextOut[1];
+}
+
+// big endian bytes of a RSA_MODEL_BYTES/2 byte number, 0 if not below m
+static int crt_words(uint16_t* w, const unsigned char* bytes, const uint16_t* m) {
+	int j;
+	bytes_to_words(w, bytes, RSA_MODEL_BYTES/2);
+	for (j = RSA_MODEL_WORDS-1; j >= 0; j--) {
+		if (w[j] != m[j]) {
+			return w[j] < m[j];
+		}
+	}
+	return 0;
+}
+
+int rsa_model_crt_init(struct rsa_model_crt_key* key, const unsigned char* modulus, const unsigned char* p, const unsigned char* q,
+	const unsigned char* dp, const unsigned char* dq, const unsigned char* qInv, uint32_t e, int cores) {
+	// p and q of exactly half the bits: 2p is above any b
+	if (cores < 1 || cores > 2 || e == 0 || !(modulus[RSA_MODEL_BYTES-1] & 1) || !(p[RSA_MODEL_BYTES/2-1] & 1)
+		|| !(q[RSA_MODEL_BYTES/2-1] & 1) || !(p[0] & 0x80) || !(q[0] & 0x80)) {
+		return -1;
+	}
+	memset(key->e, 0, sizeof(key->e));
+	key->e[0] = (uint16_t) e;
+	key->e[1] = (uint16_t) (e >> 16);
+	for (key->eBits = 0; (e >> key->eBits) != 0 && key->eBits < 32; key->eBits++);
+	bytes_to_words(key->n, modulus, RSA_MODEL_BYTES);
+	bytes_to_words(key->p, p, RSA_MODEL_BYTES/2);
+	bytes_to_words(key->q, q, RSA_MODEL_BYTES/2);
+	if (!crt_words(key->dp, dp, key->p) || !crt_words(key->dq, dq, key->q) || !crt_words(key->qInv, qInv, key->p)) {
+		return -1;
+	}
+	words_pow2_mod(key->rcN, 32*(RSA_MODEL_WORDS+1), key->n);
+	words_pow2_mod(key->rcP, 32*(RSA_MODEL_WORDS+1), key->p);
+	words_pow2_mod(key->rcQ, 32*(RSA_MODEL_WORDS+1), key->q);
+	words_pow2_mod(key->rcPHalf, 32*(CRT_HALF+1), key->p);
+	words_pow2_mod(key->rcQHalf, 32*(CRT_HALF+1), key->q);
+	key->cores = cores;
+	return 0;
+}
+
+long rsa_model_crt(const struct rsa_model_crt_key* key, const uint16_t* x, uint16_t* s, int* fault) {
+	struct rsa_model_key k;
+	const uint16_t* lo;
+	uint16_t a[RSA_MODEL_WORDS], b[RSA_MODEL_WORDS], d[RSA_MODEL_WORDS], t[RSA_MODEL_WORDS];
+	uint32_t carry = 1;
+	long cycles = RSA_MODEL_WORDS;
+	int run, i;
+
+	for (run = 0; run < CRT_RUNS; run++) {
+		long c;
+		crt_run(key, run, &k, &lo);
+		switch (run) {
+			case 0: c = exp_ladder(&k, x, lo, a); break;
+			case 1: c = exp_ladder(&k, x, lo, b); break;
+			case 2: c = exp_ladder(&k, a, lo, a); break;
+			case 3: c = exp_ladder(&k, b, lo, b); break;
+			case 4: c = exp_ladder(&k, d, lo, a); break;
+			case 5: c = exp_ladder(&k, a, lo, t); break;
+			default: c = exp_ladder(&k, s, lo, t); break;
+		}
+		// only the low half is kept (a_reg, b_reg)
+		if (run < 5) {
+			memset((run == 1 || run == 3 ? b : a) + CRT_HALF, 0, CRT_HALF*sizeof(uint16_t));
+		}
+		if (run == 3) {
+			// d = a + 2p - b
+			memset(d, 0, sizeof(d));
+			for (i = 0; i <= CRT_HALF; i++) {
+				carry += (uint32_t) (i < CRT_HALF ? a[i] : 0) + crt_p2(key, i) + (uint16_t) ~(i < CRT_HALF ? b[i] : 0);
+				d[i] = (uint16_t) carry;
+				carry >>= 16;
+			}
+		}
+		// run_start, run_nc, then the run and a cycle to see its end;
+		// 1 and 3 alongside 0 and 2 with two cores
+		if (!(key->cores == 2 && (run == 1 || run == 3))) {
+			cycles += 1 + RSA_MODEL_SETUP + c + 1;
+		}
+		if (run == 5) {
+			carry = 0;
+			for (i = 0; i < RSA_MODEL_WORDS; i++) {
+				carry += (uint32_t) t[i] + (i < CRT_HALF ? b[i] : 0);
+				s[i] = (uint16_t) carry;
+				carry >>= 16;
+			}
+		}
+	}
+	// show_s
+	*fault = (memcmp(t, x, RSA_MODEL_WORDS*sizeof(uint16_t)) != 0);
+	if (*fault) {
+		memset(s, 0, RSA_MODEL_WORDS*sizeof(uint16_t));
+	}
+	return cycles + RSA_MODEL_WORDS;
+}
+
+long rsa_model_crt_rtl(const struct rsa_model_crt_key* key, const uint16_t* x, uint16_t* s, int* fault) {
+	struct crt c;
+	long cycle, last = -1;
+	int out = 0, j;
+
+	*fault = 0;
+	memset(&c, 0, sizeof(c));
+	for (j = 0; j < 2; j++) {
+		top_init(&c.core[j]);
+	}
+	// as Security_Token_Top_USB.vhd: the words one per cycle, then the result
+	for (cycle = 0; cycle < RSA_MODEL_MAX_CYCLES && out < RSA_MODEL_WORDS; cycle++) {
+		uint16_t word;
+		int valid, f;
+		int in = (cycle < RSA_MODEL_WORDS);
+		crt_clock(&c, key, in, in ? x[cycle] : 0, &word, &valid, &f);
+		if (valid) {
+			s[out++] = word;
+			*fault |= f;
+			last = cycle;
+		}
+	}
+	if (out < RSA_MODEL_WORDS) {
+		return -1;
+	}
+	return last + 1;
+}
@@ -1,3 +1,7 @@
 cd ..
-gcc -Wall -I/usr/include/openssl/ -L/gmp_install_lib -lgmp  -lm -lcrypto -g -shared -o pam_cthAuth.so -fPIC crypto.c   pam_helper.c  pam_module.c
+#key size of the build (512, 1024 or 2048), e.g. KEY_BITS=1024 ./compile_all.sh
+KEY_BITS=${KEY_BITS:-512}
+gcc -Wall -DKEY_BITS=$KEY_BITS -I/usr/include/openssl/ -L/gmp_install_lib -lgmp  -lm -lcrypto -pthread -lrt -Wl,-z,nodelete -O2 -g -shared -o pam_cthAuth.so -fPIC crypto.c rsa_fixed.c pam_helper.c  usb_transport.c  broker_client.c  metrics.c  breaker.c  discovery.c  pam_module.c
+gcc -Wall -DKEY_BITS=$KEY_BITS -O2 -g -o token_broker token_broker.c usb_transport.c discovery.c metrics.c -pthread -lrt
+gcc -Wall -DKEY_BITS=$KEY_BITS -O2 -g -o metrics_dump metrics_dump.c metrics.c breaker.c -pthread -lrt
 cd script
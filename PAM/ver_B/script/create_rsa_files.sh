@@ -1,16 +1,19 @@
 #!/bin/bash
 #echo "000000: ffff ffff ffff ffff" | xxd -r > input
 
+#key size as first argument (512, 1024 or 2048), default 512
+BITS=${1:-512}
+
 cd ../data
 
 #rsa key without padding
-openssl genrsa -out private512.pem 512 -nopad
+openssl genrsa -out private$BITS.pem $BITS -nopad
 #echo "private OK"
-openssl rsa -in private512.pem -out public512.pem -outform PEM -pubout
+openssl rsa -in private$BITS.pem -out public$BITS.pem -outform PEM -pubout
 #echo "public OK"
 
 # convert public key from PKCS#8 -> PKCS#1 (RSA key)
-openssl rsa -pubin -in public512.pem -RSAPublicKey_out -out public512.pem
+openssl rsa -pubin -in public$BITS.pem -RSAPublicKey_out -out public$BITS.pem
 
 #openssl rsautl -sign -inkey private.pem -in input -out message.signed -raw
 #echo "encrypt OK"
@@ -18,9 +21,10 @@ openssl rsa -pubin -in public512.pem -RSAPublicKey_out -out public512.pem
 
 echo;echo
 # PEM to text for FPGA
-openssl rsa -text -in private512.pem > private_key.txt
+openssl rsa -text -in private$BITS.pem > private_key.txt
 cat private_key.txt
 
 cd ../script
+[ "$BITS" != 512 ] && echo "The FPGA core is 512 bit only, use these keys with the emulator and KEY_BITS=$BITS builds"
 echo;echo; echo "Enter private exp and modulus on FPGA as seen above (private_key.txt)"
 echo; echo; echo "Your keys are in '../data'";
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+#generics of rsa_crt (CRT => true in Security_Token_Top_USB.vhd) for a 512 bit key
+#  ./crt_constants.sh [private key], default ../data/private512.pem
+KEY=${1:-../data/private512.pem}
+SRC=../../../VHDL_code/ver_B/RSA_Security_Token_USB_Version/rsa_512/trunk/src
+
+gcc -O2 -o constant_gen $SRC/constant_gen.c -lgmp || exit 1
+
+#hex of one field of the openssl text, without ':' and the leading 00
+field() {
+	openssl rsa -text -noout -in "$KEY" | awk -v f="$1:" '
+		$1 == f { on = 1; next }
+		on && /^ / { gsub(/[ :]/, ""); v = v $0; next }
+		on { exit }
+		END { sub(/^(00)+/, "", v); print v }'
+}
+
+N=$(field modulus)
+[ -z "$N" ] && echo "No RSA key in $KEY" && exit 1
+echo "MODULO => x\"$N\","
+./constant_gen $N $(field prime1) $(field prime2) $(field exponent1) $(field exponent2) $(field coefficient)
+RET=$?
+#e for the check of s in rsa_crt
+echo "PUB_EXP => x\"$(openssl rsa -text -noout -in "$KEY" | sed -n 's/^publicExponent: .*(0x\(.*\))$/\1/p')\","
+rm -f constant_gen
+exit $RET
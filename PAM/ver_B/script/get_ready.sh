@@ -1,9 +1,11 @@
 #!/bin/bash
 
 cd ../
+#key size of the build (512, 1024 or 2048), e.g. KEY_BITS=1024 ./get_ready.sh
+KEY_BITS=${KEY_BITS:-512}
 
 #compile and move if successful
-gcc -I/usr/include/openssl/ -L/gmp_install_lib -lgmp  -lm -lcrypto -g -shared -o pam_cthAuth.so -fPIC crypto.c pam_helper.c  pam_module.c && cp pam_cthAuth.so /lib64/security/
+gcc -DKEY_BITS=$KEY_BITS -I/usr/include/openssl/ -L/gmp_install_lib -lgmp  -lm -lcrypto -pthread -lrt -Wl,-z,nodelete -O2 -g -shared -o pam_cthAuth.so -fPIC crypto.c rsa_fixed.c pam_helper.c  usb_transport.c  broker_client.c  metrics.c  breaker.c  discovery.c  pam_module.c && cp pam_cthAuth.so /lib64/security/
 
 
 cd script
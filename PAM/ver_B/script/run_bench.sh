@@ -0,0 +1,27 @@
+#!/bin/bash
+
+cd ..
+#key size of the build (512, 1024 or 2048), e.g. KEY_BITS=1024 ./run_bench.sh
+KEY_BITS=${KEY_BITS:-512}
+#compile benchmark, run against device given as first argument or emulator
+#  ./run_bench.sh [device] [bench_main options], e.g. ./run_bench.sh /dev/ttyACM0 -n 100
+#  emulator options in EMU_ARGS, e.g. EMU_ARGS=-m ./run_bench.sh (model of the RSA core)
+gcc -Wall -DKEY_BITS=$KEY_BITS -O2 -o bench_main crypto.c rsa_fixed.c pam_helper.c usb_transport.c bench_main.c -lcrypto -pthread || exit 1
+
+if [ -n "$1" ] && [ "${1:0:1}" != "-" ]; then
+	PTY=$1
+	shift
+else
+	gcc -Wall -DKEY_BITS=$KEY_BITS -O2 -o token_emulator token_emulator.c rsa_model.c -lcrypto || exit 1
+	#emulator prints its pty on first line
+	coproc EMU { ./token_emulator -k data/private$KEY_BITS.pem $EMU_ARGS; }
+	read -r PTY <&"${EMU[0]}"
+fi
+
+./bench_main -d "$PTY" -k data/public$KEY_BITS.pem -o bench_result.json "$@"
+RET=$?
+cat bench_result.json
+
+[ -n "$EMU_PID" ] && kill $EMU_PID
+cd -
+exit $RET
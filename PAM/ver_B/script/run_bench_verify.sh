@@ -0,0 +1,15 @@
+#!/bin/bash
+
+cd ..
+#key size of the build (512, 1024 or 2048), e.g. KEY_BITS=1024 ./run_bench_verify.sh
+KEY_BITS=${KEY_BITS:-512}
+#compile and run verification microbenchmark (OpenSSL vs rsa_fixed.c)
+#  ./run_bench_verify.sh [bench_verify options], e.g. ./run_bench_verify.sh -n 10000
+gcc -Wall -DKEY_BITS=$KEY_BITS -O2 -o bench_verify crypto.c rsa_fixed.c pam_helper.c bench_verify.c -lcrypto -pthread || exit 1
+
+./bench_verify -k data/public$KEY_BITS.pem -o bench_verify_result.json "$@"
+RET=$?
+cat bench_verify_result.json
+
+cd -
+exit $RET
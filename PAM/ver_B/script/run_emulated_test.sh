@@ -0,0 +1,19 @@
+#!/bin/bash
+
+cd ..
+#key size of the build (512, 1024 or 2048), e.g. KEY_BITS=1024 ./run_emulated_test.sh
+KEY_BITS=${KEY_BITS:-512}
+#compile emulator and test, run test against emulated token (no FPGA needed)
+gcc -Wall -DKEY_BITS=$KEY_BITS -g -o token_emulator token_emulator.c rsa_model.c -lcrypto || exit 1
+gcc -Wall -DKEY_BITS=$KEY_BITS -g crypto.c rsa_fixed.c pam_helper.c usb_transport.c test_main.c -lcrypto -pthread || exit 1
+
+#emulator prints its pty on first line
+coproc EMU { ./token_emulator -k data/private$KEY_BITS.pem "$@"; }
+read -r PTY <&"${EMU[0]}"
+
+valgrind --leak-check=full ./a.out "$PTY" data/public$KEY_BITS.pem
+RET=$?
+
+kill $EMU_PID
+cd -
+exit $RET
@@ -0,0 +1,13 @@
+#!/bin/bash
+
+cd ..
+#compile and run the model of the RSA core of the token (rsa_model.c, 512 bit)
+#  ./run_model.sh [rsa_model options], e.g. ./run_model.sh -n 1000 -o vectors.txt
+#  -t checks RSA_512_tb.vhd first, -r also runs every vector clock by clock
+gcc -Wall -O2 -o rsa_model rsa_model.c model_main.c -lcrypto || exit 1
+
+./rsa_model -k data/private512.pem "$@"
+RET=$?
+
+cd -
+exit $RET
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+cd ..
+#tagged slots (*w/*r) against a multi-core emulated token, as RSA_CORES > 1 on the FPGA
+#  ./run_tagged_test.sh [slots] [cores] [sign_ms], default 4 slots on 4 cores, 300 ms a signature
+SLOTS=${1:-4}
+CORES=${2:-4}
+SIGN_MS=${3:-300}
+gcc -Wall -DKEY_BITS=512 -g -o token_emulator token_emulator.c rsa_model.c -lcrypto || exit 1
+gcc -Wall -DKEY_BITS=512 -g crypto.c rsa_fixed.c pam_helper.c usb_transport.c test_main.c -lcrypto -pthread || exit 1
+
+#emulator prints its pty on first line
+coproc EMU { exec ./token_emulator -k data/private512.pem -c $CORES -l $SIGN_MS; }
+read -r PTY <&"${EMU[0]}"
+
+OUT=$(./a.out "$PTY" data/public512.pem $SLOTS)
+RET=$?
+echo "$OUT"
+
+#the slots were signed at once: one after the other takes SLOTS*SIGN_MS
+MS=$(echo "$OUT" | sed -n 's/^usb_sign_tagged: 0, .* in \([0-9]*\) ms$/\1/p')
+if [ $RET -eq 0 ] && [ $CORES -ge $SLOTS ] && [ $SLOTS -gt 1 ] && [ "${MS:-0}" -ge $((SLOTS*SIGN_MS)) ]; then
+	echo "$SLOTS slots on $CORES cores took $MS ms, not signed at once"
+	RET=1
+fi
+
+kill $EMU_PID
+cd -
+exit $RET
@@ -1,8 +1,10 @@
 #!/bin/bash
 
 cd ..
+#key size of the build (512, 1024 or 2048), e.g. KEY_BITS=1024 ./run_test.sh
+KEY_BITS=${KEY_BITS:-512}
 #compile and move if successful
 #gcc -I/usr/include/openssl/ -L/gmp_install_lib -lgmp  -lm -lcrypto -g -shared -o pamiot.so -fPIC crypto.c  data_parser.c  pam_helper.c  eliot_test.c
-gcc -Wall -I/usr/include/openssl/ -L/gmp_install_lib -lgmp  -lm -lcrypto -g crypto.c pam_helper.c test_main.c
-valgrind --leak-check=full ./a.out testtest
+gcc -Wall -DKEY_BITS=$KEY_BITS -I/usr/include/openssl/ -L/gmp_install_lib -lgmp  -lm -lcrypto -pthread -g crypto.c rsa_fixed.c pam_helper.c usb_transport.c test_main.c
+valgrind --leak-check=full ./a.out
 cd -
@@ -37,179 +37,114 @@
  * SUCH DAMAGE.
  */
 
+#include <time.h>
 #include "header.h"
-#include <unistd.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <termios.h>
 
 
+// slots messages at once on the RSA cores of the token (*w/*r, tagged),
+// each signature checked against the message of its slot
+static int test_tagged(int usb, int slots) {
+  unsigned char orig[USB_BATCH_MAX][cleartextLen+2];
+  unsigned char sigBuf[USB_BATCH_MAX][ciphertextLen+2];
+  unsigned char *messages[USB_BATCH_MAX];
+  unsigned char *signatures[USB_BATCH_MAX];
+  struct timespec start, end;
+  int bad = 0;
+  int i;
 
-int main(int argc, char **argv){
-  // Send and recieve USB-data
-  // open port
-  int usb = open("/dev/ttyACM0", O_RDWR | O_NOCTTY | O_NDELAY);
-  if (usb == -1) {
-    printf("Unable to open port\n");
-    //return PAM_AUTH_ERR;
-  } else {
-    fcntl(usb, F_SETFL, 0);
-  }
-
-  // Set parameters
-  struct termios tty;
-  struct termios tty_old;
-  memset (&tty, 0, sizeof(tty));
-  if (tcgetattr (usb, &tty) != 0) {
-    //perror("error from tcgetattr");
-    //return PAM_AUTH_ERR;
+  for (i = 0; i < slots; i++) {
+    messages[i] = genNumber_raw(orig[i]);
+    memset(sigBuf[i], 0, sizeof(sigBuf[i]));
+    signatures[i] = sigBuf[i];
   }
 
-  // save old params for after close
-  tty_old = tty;
-
-  // set baud rate
-  cfsetospeed (&tty, (speed_t)B115200);
-  cfsetispeed (&tty, (speed_t)B115200);
-
-  // other port configs
-  tty.c_lflag = 0;  // noncanonical etc etc
-  tty.c_oflag = 0;  // no remapping, no delays
-
-  tty.c_cc[VMIN] = 0;   // no read block
-  tty.c_cc[VTIME] = 5;  // 0.5s timeout
-
-  //tty.c_iflag |= (IXON | IXOFF);
-
-  tty.c_cflag &= ~CSIZE;
-  tty.c_cflag |= CS8;
-  tty.c_cflag |= (CLOCAL | CREAD);
-
-  if (tcsetattr(usb, TCSANOW, &tty) != 0) {
-    //perror("error from tcsetattr");
-    //return PAM_AUTH_ERR;
+  // *w for each slot, then *r in turn until every *m is in
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int ret = usb_sign_tagged(usb, (const unsigned char**) messages, slots, signatures, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("usb_sign_tagged: %i, %i slots in %lld ms\n", ret, slots,
+    (long long) (end.tv_sec-start.tv_sec)*1000 + (end.tv_nsec-start.tv_nsec)/1000000);
+
+  for (i = 0; i < slots; i++) {
+    free(messages[i]);
+    if (ret != 0) {
+      continue;
+    }
+    //reverse because FPGA mem handling
+    sigBuf[i][ciphertextLen] = '\0';
+    reverseStr(sigBuf[i]);
+    const unsigned char *verifiedMessage = public_decrypt(sigBuf[i]);
+    if (memcmp(verifiedMessage, orig[i], ciphertextLen) != 0) {
+      printf("slot %i: signature is not of its message\n", i);
+      bad++;
+    }
+    free((unsigned char*) verifiedMessage);
   }
+  return (ret != 0 || bad > 0) ? 1 : 0;
+}
 
-  //printf("%s\n", randData_orig);
-
-  int bytes_written;
-  unsigned char usbMessageBuf[66];
-  memset(usbMessageBuf, 0, sizeof(usbMessageBuf));
-  unsigned char usbOpCode[3];
-  memset(usbOpCode, 0, sizeof(usbOpCode));
-  unsigned char usbReceiveBuf[66];
-  memset(usbReceiveBuf, 0, sizeof(usbReceiveBuf));
-  unsigned char *usbMessage = genNumber_raw();
-  printf("sizeofgenNumber: %i\n", strlen(usbMessage));
-  // *W = Write operation
-  usbMessageBuf[0] = '*';
-  usbMessageBuf[1] = 'W';
-  
-  int i;
-  for (i = 2; i < cleartextLen+2; i++) {
-    usbMessageBuf[i] = usbMessage[i-2];
+int main(int argc, char **argv){
+  // Send and recieve USB-data
+  // open port (argv[1] overrides, e.g. pty of token_emulator)
+  const char *device = (argc > 1) ? argv[1] : USB_DEVICE;
+  if (argc > 2) {
+    public_key_file = argv[2];
   }
-
-  free(usbMessage);
-   
-  //usbMessageBuf[cleartextLen+3] = '\0';
-  //usbMessageBuf[65] = '\0';
-  /*  
-  for (i = 2; i < cleartextLen+2; i++) {
-    usbMessageBuf[i] = 'a';
-    }
-  usbMessageBuf[cleartextLen+2] = 1;
-  
-  for (i = 2; i < cleartextLen+4; i++) {
-    printf("usbMesBuf: %i: %x\n", i, usbMessageBuf[i]);
+  // argv[3]: sign that many messages at once in tagged slots instead
+  int slots = (argc > 3) ? atoi(argv[3]) : 0;
+  if (slots < 0 || slots > USB_BATCH_MAX) {
+    printf("slots must be 0 to %i\n", USB_BATCH_MAX);
+    return 1;
   }
-  */
-  
-  printf("usbMessageBuf: %s\n", usbMessageBuf);
-
-  // Write random generated message to USB
-  bytes_written = write(usb, usbMessageBuf, cleartextLen+3);
-  if (bytes_written < cleartextLen+3) {
-    printf("Write failed\n");
+  struct termios tty_old;
+  int usb = usb_open(device, &tty_old);
+  if (usb == -1) {
+    printf("Unable to open port\n");
+    return 1;
   }
 
-  // Wait for *D response (msg received)
-  int chars_read;
-  while (!(usbOpCode[0] == '*' && usbOpCode[1] == 'D')) {
-    //break;
-    chars_read = read (usb, usbOpCode, 2);
-    printf("usbOpCode: %s\n", usbOpCode);
-    //if (chars_read != 0) {
-    //  usbOpCode[2] = '\0';;
-    //  printf("Read *D failed\n");
-    //  }
-    // if *T (time out), write again 
-    if (usbOpCode[0] == '*' && usbOpCode[1] == 'T') {
-      bytes_written = write(usb, usbMessageBuf, cleartextLen+3);
-      if (bytes_written < cleartextLen+3) {
-	printf("ReWrite failed\n");
-      }
-    }
+  if (slots > 0) {
+    int ret = test_tagged(usb, slots);
+    usb_close(usb, &tty_old);
+    return ret;
   }
 
-  usbOpCode[0] = 0;
-  usbOpCode[1] = 0;
-  // Request signed message *R
-  while (!(usbOpCode[0] == '*' && usbOpCode[1] == 'M')) {
-    //break;
-    bytes_written = write(usb, "*R", 2);
-    // Delay
-    usleep ((100 + 25) * 100);
-    if (bytes_written != 2) {
-      printf("Write *R failed\n");
-    }
-    chars_read = read (usb, usbOpCode, 2);
-    printf("usbOpCode:%s\n", usbOpCode);
-    if (chars_read != 0) {
-      //printf("Read *M or *B failed\n");
-    }
-  }
-  
-  //printf("usbOpCode:%s\n", usbOpCode);
+  unsigned char usbReceiveBuf[ciphertextLen+2];
+  memset(usbReceiveBuf, 0, sizeof(usbReceiveBuf));
+  unsigned char randData_orig[cleartextLen+2];
+  unsigned char *usbMessage = genNumber_raw(randData_orig);
+  printf("sizeofgenNumber: %i\n", (int) strlen((char*) usbMessage));
 
-  // *M received, request again and save in usbReceiveBuf
-  
-  //bytes_written = write(usb, "*R", 2);
-  
-  for (i = 0; i < 64; i++) {
-    usbReceiveBuf[i] = 0;
-  }
-  chars_read = read(usb, usbReceiveBuf, 64);//cleartextLen+3);
-  //if (chars_read != 0) {
-  //  printf("Failed to read message\n");
-  //  }
+  // *W message, wait for *D, poll *R until *M
+  int ret = usb_sign(usb, usbMessage, usbReceiveBuf, NULL);
+  free(usbMessage);
+  printf("usb_sign: %i\n", ret);
 
-  usbReceiveBuf[64] = '\0';
+  usbReceiveBuf[ciphertextLen] = '\0';
 
   printf("usbRecBuf: %s\n", usbReceiveBuf);
 
-  const unsigned char *verifiedMessage = malloc(cleartextLen+2);
-  verifiedMessage = public_decrypt(usbReceiveBuf);
+  //reverse because FPGA mem handling
+  reverseStr(usbReceiveBuf);
+
+  const unsigned char *verifiedMessage = public_decrypt(usbReceiveBuf);
 
   //printf("origMessag: %s\n", randData_orig);
   printf("verMessage: %s\n", verifiedMessage);
   
-  for (i = 0; i < 64; i++) {
-    //printf("OrigData  : %i:  %i\n", i, randData_orig[i]);
-    //printf("VerMessage: %i:  %i\n", i, verifiedMessage[i]);
-  }
-  
   printf("\n");
 
   // close port 
-  tcsetattr(usb, TCSANOW, &tty_old);
-  close(usb);
+  usb_close(usb, &tty_old);
 
+  int i;
   for (i = 0; i < ciphertextLen; i++) {
     if (verifiedMessage[i] != randData_orig[i]) {
+      free((unsigned char*) verifiedMessage);
       return 1;
     }
   }
   
+  free((unsigned char*) verifiedMessage);
   return 0;
 }
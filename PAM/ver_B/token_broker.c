@@ -0,0 +1,642 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "header.h"
+
+/* Token broker
+ *
+ * Owns the serial ports to the tokens and signs messages for many PAM
+ * clients (see broker_client.c), so parallel logins do not share the
+ * UART. Requests are served first come, first served, by one serial
+ * worker per token: a worker takes the next requests when its token is
+ * done, so the least loaded token gets them. The next *W is sent as
+ * soon as the previous *M is in, before the previous client gets its
+ * answer. Requests waiting in the queue are signed together, up to batch
+ * (default USB_BATCH_MAX) per *K and *Q exchange, use batch 1 for tokens
+ * without *K. Ports stay open and configured.
+ *
+ * device is a comma separated list of ports or patterns, e.g.
+ * /dev/ttyACM* . Ports that do not answer *I are not used, tokens are
+ * named by their ID (token_id generic). Patterns are watched (see
+ * discovery.c): a token plugged in later gets a serial worker, one
+ * unplugged gets no more requests until a port with its ID is back,
+ * whatever that port is called now. A token answering *B (no PIN
+ * entered yet) keeps its port, its requests go back to the front of the
+ * queue and it tries again after BROKER_BUSY_MS, so the requests wait
+ * for the user (up to BROKER_TIMEOUT_MS) on this or another token. A
+ * token answering *T or failing (hung, unplugged) gets no more requests
+ * for a while (BROKER_BACKOFF_MS, doubled per failure), its requests go
+ * to another token, failing after BROKER_TRIES tokens. Failing ports are
+ * reopened.
+ * With baud (one of USB_BAUD_RATES) tokens are switched to that baud
+ * (*S) on connect, rtscts turns on RTS/CTS flow control.
+ *
+ * usage: token_broker [device] [socket] [batch] [baud] [rtscts]
+ */
+
+struct request {
+	int fd;                               // client connection
+	int tries;                            // tokens that failed to sign it
+	long long queued;                     // ms, when read from the client
+	unsigned char message[KEY_LEN_BYTE];  // as from genNumber_raw
+};
+
+struct token {
+	char device[256];                     // tokensLock, discovery moves it
+	char port[256];                       // device as last opened, worker only
+	char id[4];                           // *I answer, written under tokensLock
+	int fd;                               // -1 until (re)connected
+	struct termios ttyOld;
+	dev_t rdev;
+	int present;                          // port plugged in (always for ports given by name)
+	int failures;                         // in a row, 0 = healthy
+	int busy;                             // answered *B, waiting for PIN
+	long long retryAt;                    // ms, no requests before
+	long long signatures;
+};
+
+struct connection {
+	int fd;
+	int have;                             // bytes of message read
+	long long started;
+	unsigned char message[KEY_LEN_BYTE];
+};
+
+// FIFO of complete requests, main thread -> serial worker
+static struct request queue[BROKER_QUEUE_LEN];
+static int queueHead = 0;
+static int queueCount = 0;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+
+// max requests per exchange with the token
+static int batchMax = USB_BATCH_MAX;
+// line settings of the tokens (usb_configure), 0 = power on baud
+static int lineBaud = 0;
+static int lineRtscts = 0;
+
+static struct token tokens[BROKER_TOKENS_MAX];
+static int nTokens = 0;
+// device and present of tokens, new tokens (discovery.c thread)
+static pthread_mutex_t tokensLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tokensCond = PTHREAD_COND_INITIALIZER;
+
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static int queue_push(const struct request* req) {
+	pthread_mutex_lock(&queueLock);
+	if (queueCount == BROKER_QUEUE_LEN) {
+		pthread_mutex_unlock(&queueLock);
+		return -1;
+	}
+	queue[(queueHead+queueCount) % BROKER_QUEUE_LEN] = *req;
+	queueCount++;
+	pthread_cond_signal(&queueCond);
+	pthread_mutex_unlock(&queueLock);
+	return 0;
+}
+
+// back to the front of the queue (for another token), -1 if full
+static int queue_unpop(const struct request* req) {
+	pthread_mutex_lock(&queueLock);
+	if (queueCount == BROKER_QUEUE_LEN) {
+		pthread_mutex_unlock(&queueLock);
+		return -1;
+	}
+	queueHead = (queueHead+BROKER_QUEUE_LEN-1) % BROKER_QUEUE_LEN;
+	queue[queueHead] = *req;
+	queueCount++;
+	pthread_cond_signal(&queueCond);
+	pthread_mutex_unlock(&queueLock);
+	return 0;
+}
+
+// pops up to batchMax requests, returns how many
+// wait = 0: return 0 at once if queue is empty
+static int queue_pop(struct request* reqs, int wait) {
+	int count = 0;
+	pthread_mutex_lock(&queueLock);
+	while (queueCount == 0) {
+		if (!wait) {
+			pthread_mutex_unlock(&queueLock);
+			return 0;
+		}
+		pthread_cond_wait(&queueCond, &queueLock);
+	}
+	while (queueCount > 0 && count < batchMax) {
+		reqs[count++] = queue[queueHead];
+		queueHead = (queueHead+1) % BROKER_QUEUE_LEN;
+		queueCount--;
+	}
+	pthread_mutex_unlock(&queueLock);
+	return count;
+}
+
+// status 0 = ok, signature may be NULL on failure
+static void reply(int fd, int status, const unsigned char* signature) {
+	unsigned char response[KEY_LEN_BYTE+1];
+	memset(response, 0, sizeof(response));
+	response[0] = (status == 0) ? 0 : 1;
+	if (status == 0) {
+		memcpy(response+1, signature, KEY_LEN_BYTE);
+	}
+	if (write(fd, response, sizeof(response)) != sizeof(response)) {
+		fprintf(stderr,"Client left before reply\n");
+	}
+	close(fd);
+}
+
+static void reply_all(const struct request* reqs, int count, int status, unsigned char signatures[][KEY_LEN_BYTE]) {
+	int i;
+	for (i = 0; i < count; i++) {
+		reply(reqs[i].fd, status, (status == 0) ? signatures[i] : NULL);
+	}
+}
+
+// requests of a failed token, to another token or failed after BROKER_TRIES
+static void requeue_all(struct request* reqs, int count) {
+	int i;
+	// last first, keeps the order at the front of the queue
+	for (i = count-1; i >= 0; i--) {
+		reqs[i].tries++;
+		if (reqs[i].tries >= BROKER_TRIES || queue_unpop(&reqs[i]) != 0) {
+			reply(reqs[i].fd, -1, NULL);
+		}
+	}
+}
+
+// requests of a busy token (*B), back to the queue as they are, the
+// client gave up on those older than BROKER_TIMEOUT_MS
+static void requeue_busy(struct request* reqs, int count) {
+	long long now = now_ms();
+	int i;
+	for (i = count-1; i >= 0; i--) {
+		if (now - reqs[i].queued >= BROKER_TIMEOUT_MS || queue_unpop(&reqs[i]) != 0) {
+			reply(reqs[i].fd, -1, NULL);
+		}
+	}
+}
+
+// *W for one request (works with any token), *K for more
+// returns 0 on *D, 'B' if the token waits for its PIN, else token failed
+static int send_requests(const struct token* tok, const struct request* reqs, int count) {
+	const unsigned char* messages[USB_BATCH_MAX];
+	int i;
+	for (i = 0; i < count; i++) {
+		messages[i] = reqs[i].message;
+	}
+	// others may be free, do not wait for a hung one
+	return usb_offer(tok->fd, messages, count, __atomic_load_n(&nTokens, __ATOMIC_ACQUIRE) == 1);
+}
+
+static int get_signatures(const struct token* tok, int count, unsigned char signatures[][KEY_LEN_BYTE]) {
+	unsigned char* sigs[USB_BATCH_MAX];
+	int i;
+	if (count == 1) {
+		return usb_get_signature(tok->fd, signatures[0], NULL);
+	}
+	for (i = 0; i < count; i++) {
+		sigs[i] = signatures[i];
+	}
+	return usb_get_batch(tok->fd, sigs, count, NULL);
+}
+
+// opens port, 0 if a token answers *I
+static int token_connect(struct token* tok) {
+	char id[4];
+	pthread_mutex_lock(&tokensLock);
+	memcpy(tok->port, tok->device, sizeof(tok->port));
+	pthread_mutex_unlock(&tokensLock);
+
+	tok->fd = usb_open(tok->port, &tok->ttyOld);
+	if (tok->fd == -1) {
+		return -1;
+	}
+	// we keep the port, keep others out
+	ioctl(tok->fd, TIOCEXCL);
+	if ((lineBaud != 0 || lineRtscts) && usb_configure(tok->fd, lineBaud, lineRtscts) != 0) {
+		fprintf(stderr,"Token on %s stays at power on baud\n", tok->port);
+	}
+	if (usb_identify(tok->fd, id) != 0) {
+		usb_close(tok->fd, &tok->ttyOld);
+		tok->fd = -1;
+		return -1;
+	}
+	if (tok->id[0] != '\0' && strcmp(id, tok->id) != 0) {
+		fprintf(stderr,"Token on %s is now %s (was %s)\n", tok->port, id, tok->id);
+	}
+	// token_discovered matches returning tokens by id
+	pthread_mutex_lock(&tokensLock);
+	memcpy(tok->id, id, sizeof(id));
+	pthread_mutex_unlock(&tokensLock);
+	return 0;
+}
+
+// skip token for a while, port is reopened before next use
+static void token_failed(struct token* tok, int op) {
+	int pause = BROKER_BACKOFF_MS;
+	int i;
+	tok->failures++;
+	for (i = 1; i < tok->failures && pause < BROKER_BACKOFF_MAX_MS; i++) {
+		pause *= 2;
+	}
+	if (pause > BROKER_BACKOFF_MAX_MS) {
+		pause = BROKER_BACKOFF_MAX_MS;
+	}
+	tok->retryAt = now_ms() + pause;
+	tok->busy = 0;
+	fprintf(stderr,"Token %s (%s) %s, skipped for %i ms\n", tok->id, tok->port,
+		(op == 'T') ? "timed out" : "failed", pause);
+
+	if (tok->fd != -1) {
+		usb_close(tok->fd, &tok->ttyOld);
+		tok->fd = -1;
+	}
+}
+
+// no PIN entered yet (*B), port stays open, try again after BROKER_BUSY_MS
+static void token_busy(struct token* tok) {
+	tok->retryAt = now_ms() + BROKER_BUSY_MS;
+	if (!tok->busy) {
+		fprintf(stderr,"Token %s (%s) waiting for PIN\n", tok->id, tok->port);
+		tok->busy = 1;
+	}
+}
+
+// waits out the pause of a failed token (or until it is plugged in
+// again) and reconnects, 0 when usable (healthy again after its next signature)
+static int token_ready(struct token* tok) {
+	int unplugged = 0;
+	pthread_mutex_lock(&tokensLock);
+	while (!tok->present) {
+		unplugged = 1;
+		pthread_cond_wait(&tokensCond, &tokensLock);
+	}
+	pthread_mutex_unlock(&tokensLock);
+	if (unplugged) {
+		tok->retryAt = 0; // plugged in again, no pause
+	}
+
+	long long wait = tok->retryAt - now_ms();
+	if (wait > 0) {
+		struct timespec ts = { wait/1000, (wait%1000)*1000000 };
+		nanosleep(&ts, NULL);
+	}
+	if (tok->fd == -1 && token_connect(tok) != 0) {
+		token_failed(tok, -1);
+		return -1;
+	}
+	return 0;
+}
+
+// serial worker, the only user of its token
+static void* serial_worker(void* arg) {
+	struct token* tok = (struct token*) arg;
+	unsigned char signatures[USB_BATCH_MAX][KEY_LEN_BYTE];
+	struct request cur[USB_BATCH_MAX], next[USB_BATCH_MAX];
+	int count = 0;  // requests in cur
+	int sent = 0;   // cur is written to token (got *D)
+
+	for (;;) {
+		if (token_ready(tok) != 0) {
+			continue;
+		}
+		if (count == 0) {
+			count = queue_pop(cur, 1);
+		}
+		int op = sent ? 0 : send_requests(tok, cur, count);
+		if (op == 'B') {
+			token_busy(tok);
+			requeue_busy(cur, count);
+			count = 0;
+			continue;
+		}
+		if (op != 0) {
+			token_failed(tok, op);
+			requeue_all(cur, count);
+			count = 0;
+			continue;
+		}
+
+		int status = get_signatures(tok, count, signatures);
+		if (status != 0) {
+			token_failed(tok, -1);
+			requeue_all(cur, count);
+			count = 0;
+			sent = 0;
+			continue;
+		}
+		tok->signatures += count;
+		tok->busy = 0;
+		if (tok->failures > 0) {
+			fprintf(stderr,"Token %s (%s) back\n", tok->id, tok->port);
+			tok->failures = 0;
+		}
+
+		// pipeline: hand next messages to token before answering, a
+		// token back at its PIN after *M answers *B, they wait then
+		int nextCount = queue_pop(next, 0);
+		sent = 0;
+		if (nextCount > 0) {
+			op = send_requests(tok, next, nextCount);
+			if (op == 'B') {
+				token_busy(tok);
+				requeue_busy(next, nextCount);
+				nextCount = 0;
+			} else if (op != 0) {
+				token_failed(tok, op);
+				requeue_all(next, nextCount);
+				nextCount = 0;
+			}
+			sent = (op == 0);
+		}
+
+		reply_all(cur, count, 0, signatures);
+
+		memcpy(cur, next, nextCount*sizeof(struct request));
+		count = nextCount;
+	}
+	return NULL;
+}
+
+static int token_start(struct token* tok) {
+	pthread_t worker;
+	if (pthread_create(&worker, NULL, serial_worker, tok) != 0) {
+		fprintf(stderr,"Unable to start serial worker\n");
+		return -1;
+	}
+	pthread_detach(worker);
+	return 0;
+}
+
+// token found or unplugged on a watched port (discovery.c)
+static void token_discovered(const char* device, const char* id, int ready) {
+	struct stat st;
+	int i;
+
+	pthread_mutex_lock(&tokensLock);
+	if (!ready) {
+		for (i = 0; i < nTokens; i++) {
+			if (tokens[i].present && strcmp(tokens[i].device, device) == 0) {
+				// its worker fails the next request (to another token) and waits
+				tokens[i].present = 0;
+			}
+		}
+		pthread_mutex_unlock(&tokensLock);
+		return;
+	}
+
+	if (stat(device, &st) == -1) {
+		pthread_mutex_unlock(&tokensLock);
+		return;
+	}
+	for (i = 0; i < nTokens; i++) {
+		if (tokens[i].present && tokens[i].rdev == st.st_rdev) {
+			pthread_mutex_unlock(&tokensLock);
+			return; // given by name as well
+		}
+	}
+	// back (on this port or another one), its worker goes on
+	for (i = 0; i < nTokens; i++) {
+		if (!tokens[i].present && strcmp(tokens[i].id, id) == 0) {
+			strncpy(tokens[i].device, device, sizeof(tokens[i].device)-1);
+			tokens[i].rdev = st.st_rdev;
+			tokens[i].present = 1;
+			pthread_cond_broadcast(&tokensCond);
+			pthread_mutex_unlock(&tokensLock);
+			return;
+		}
+	}
+	if (nTokens == BROKER_TOKENS_MAX) {
+		fprintf(stderr,"More than %i tokens, %s not used\n", BROKER_TOKENS_MAX, device);
+		pthread_mutex_unlock(&tokensLock);
+		return;
+	}
+	struct token* tok = &tokens[nTokens];
+	memset(tok, 0, sizeof(struct token));
+	strncpy(tok->device, device, sizeof(tok->device)-1);
+	memcpy(tok->id, id, sizeof(tok->id));
+	tok->rdev = st.st_rdev;
+	tok->fd = -1;
+	tok->present = 1;
+	for (i = 0; i < nTokens; i++) {
+		if (strcmp(tokens[i].id, tok->id) == 0) {
+			fprintf(stderr,"Tokens on %s and %s have the same ID %s\n", tokens[i].device, tok->device, tok->id);
+		}
+	}
+	if (token_start(tok) == 0) {
+		__atomic_store_n(&nTokens, nTokens+1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&tokensLock);
+}
+
+// adds the token on port device (given by name), 0 if it answers *I
+static int token_add(const char* device) {
+	struct token* tok = &tokens[nTokens];
+	struct stat st;
+	int j;
+
+	if (nTokens == BROKER_TOKENS_MAX) {
+		fprintf(stderr,"More than %i tokens, %s not used\n", BROKER_TOKENS_MAX, device);
+		return -1;
+	}
+	if (stat(device, &st) == -1) {
+		fprintf(stderr,"No port '%s'\n", device);
+		return -1;
+	}
+	// same port by two names (e.g. /dev/serial/by-id link)
+	for (j = 0; j < nTokens; j++) {
+		if (tokens[j].rdev == st.st_rdev) {
+			return -1;
+		}
+	}
+
+	memset(tok, 0, sizeof(struct token));
+	strncpy(tok->device, device, sizeof(tok->device)-1);
+	tok->rdev = st.st_rdev;
+	tok->present = 1;
+	if (token_connect(tok) != 0) {
+		fprintf(stderr,"No token on '%s'\n", tok->device);
+		return -1;
+	}
+	for (j = 0; j < nTokens; j++) {
+		if (strcmp(tokens[j].id, tok->id) == 0) {
+			fprintf(stderr,"Tokens on %s and %s have the same ID %s\n", tokens[j].device, tok->device, tok->id);
+		}
+	}
+	fprintf(stderr,"Token %s on %s\n", tok->id, tok->device);
+	if (token_start(tok) != 0) {
+		return -1;
+	}
+	__atomic_store_n(&nTokens, nTokens+1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static int broker_listen(const char* socketPath) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path)-1);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock == -1) {
+		return -1;
+	}
+	unlink(socketPath);
+	// only root (the PAM stack) may ask for signatures
+	mode_t oldMask = umask(077);
+	int ret = bind(sock, (struct sockaddr*) &addr, sizeof(addr));
+	umask(oldMask);
+	if (ret == -1 || listen(sock, BROKER_QUEUE_LEN) == -1) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+int main(int argc, char **argv) {
+	const char* device = (argc > 1) ? argv[1] : USB_DEVICE;
+	const char* socketPath = (argc > 2) ? argv[2] : BROKER_SOCKET;
+	int i;
+	if (argc > 3) {
+		batchMax = atoi(argv[3]);
+		if (batchMax < 1 || batchMax > USB_BATCH_MAX) {
+			fprintf(stderr,"batch must be 1 to %i\n", USB_BATCH_MAX);
+			return 1;
+		}
+	}
+	if (argc > 4) {
+		lineBaud = atoi(argv[4]);
+	}
+	if (argc > 5) {
+		lineRtscts = (strcmp(argv[5], "rtscts") == 0);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	// opened exclusive, keeps direct users (pam_module without broker) out
+	char devices[1024];
+	strncpy(devices, device, sizeof(devices)-1);
+	devices[sizeof(devices)-1] = '\0';
+	char* patterns[DISCOVERY_PATTERNS_MAX];
+	int nPatterns = 0;
+	char* save = NULL;
+	char* dev;
+	for (dev = strtok_r(devices, ",", &save); dev != NULL; dev = strtok_r(NULL, ",", &save)) {
+		if (strpbrk(dev, "*?[") == NULL) {
+			token_add(dev);
+		} else if (nPatterns < DISCOVERY_PATTERNS_MAX) {
+			patterns[nPatterns++] = dev;
+		}
+	}
+	// after the ports given by name, tokens plugged in later too
+	for (i = 0; i < nPatterns; i++) {
+		discovery_start(patterns[i], token_discovered);
+	}
+	if (nTokens == 0 && nPatterns == 0) {
+		fprintf(stderr,"No token found on '%s'\n", device);
+		return 1;
+	}
+
+	int sock = broker_listen(socketPath);
+	if (sock == -1) {
+		fprintf(stderr,"Unable to listen on '%s'\n", socketPath);
+		return 1;
+	}
+
+	/* Read requests from clients, complete ones go to the queue */
+	struct connection conns[BROKER_QUEUE_LEN];
+	struct pollfd pfds[BROKER_QUEUE_LEN+1];
+	int nConns = 0;
+
+	for (;;) {
+		pfds[0].fd = sock;
+		pfds[0].events = (nConns < BROKER_QUEUE_LEN) ? POLLIN : 0;
+		for (i = 0; i < nConns; i++) {
+			pfds[i+1].fd = conns[i].fd;
+			pfds[i+1].events = POLLIN;
+		}
+
+		if (poll(pfds, nConns+1, 1000) == -1 && errno != EINTR) {
+			fprintf(stderr,"poll failed\n");
+			return 1;
+		}
+
+		long long now = now_ms();
+		for (i = nConns-1; i >= 0; i--) {
+			struct connection* c = &conns[i];
+			int done = 0;   // 1 = queued, -1 = drop
+
+			if (pfds[i+1].revents) {
+				ssize_t ret = read(c->fd, c->message+c->have, KEY_LEN_BYTE-c->have);
+				if (ret > 0) {
+					c->have += ret;
+				} else if (!(ret == -1 && (errno == EAGAIN || errno == EINTR))) {
+					done = -1;
+				}
+			}
+			if (done == 0 && c->have == KEY_LEN_BYTE) {
+				struct request req;
+				req.fd = c->fd;
+				req.tries = 0;
+				req.queued = c->started;
+				memcpy(req.message, c->message, KEY_LEN_BYTE);
+				if (queue_push(&req) == 0) {
+					done = 1;
+				} else {
+					fprintf(stderr,"Queue full\n");
+					reply(c->fd, -1, NULL);
+					done = 1;
+				}
+			}
+			if (done == 0 && now - c->started > BROKER_READ_TIMEOUT_MS) {
+				done = -1;
+			}
+
+			if (done != 0) {
+				if (done == -1) {
+					close(c->fd);
+				}
+				conns[i] = conns[--nConns];
+			}
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (fd != -1) {
+				conns[nConns].fd = fd;
+				conns[nConns].have = 0;
+				conns[nConns].started = now;
+				nConns++;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,478 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/evp.h>
+#include <openssl/core_names.h>
+#include "header.h"
+
+/* Software token
+ *
+ * Emulates the USB version of the token (USB_CMD_PARSER.vhd) on a
+ * pseudo terminal, for testing and benchmarking without an FPGA.
+ * Signs with the private key, i.e. what the FPGA has in its generics.
+ *  *I          -> *I[id], HEJ unless -i
+ *  *W[64]      -> *D, or *B while signing (64: KEY_LEN_BYTE)
+ *  *R          -> *M[64] when signed, else *B
+ *  *K[n][n*64] -> like *W, n messages signed one after the other
+ *  *Q          -> *Q[n][n*64] when signed, else *B
+ *  *S[n]       -> *S[n], then baud n of USB_BAUD_RATES (back to 0
+ *                 unless a command follows within 0.5s)
+ *  *w[t][64]   -> *D, slot t (0 to USB_BATCH_MAX-1) signed on the first
+ *                 free of the -c cores, *B if the slot is in use
+ *  *r[t]       -> *m[t][64] when slot t is signed (frees it), else *B
+ *  (silence)   -> *T, command not complete within 0.5s
+ * Unlike the FPGA, no PIN or key press is needed between signatures
+ * unless -p: *W and *K get *B for pin_ms after each *M or *Q, as while
+ * the user enters the PIN. A slot can be written again once read.
+ * Bytes written while the pty is not at the baud of the emulator are
+ * lost, as on a UART. With -w every byte takes its 10 bit times.
+ * With -m the signature comes from the model of the RSA core
+ * (rsa_model.c, 512 bit keys), bit for bit what the FPGA returns, and
+ * takes the time of the core at RSA_MODEL_CLOCK_HZ unless -l is given.
+ *
+ * usage: token_emulator [-k private.pem] [-l sign_ms] [-b busy_%] [-t timeout_%] [-p pin_ms] [-i id] [-c cores] [-m] [-w] [-v]
+ *  prints the name of the pty to use as device
+ */
+
+#define EMU_TIMEOUT_MS 500   // USB_CMD_PARSER: Frequency/2 cycles
+
+enum emuState { EMU_IDLE, EMU_TRANSLATE_CMD, EMU_RECIVE_COUNT, EMU_RECIVE_DATA, EMU_RECIVE_BAUD, EMU_RECIVE_TAG, EMU_READ_TAG };
+
+static const int emuRates[] = USB_BAUD_RATES;
+static int emuBaud = 0;   // index in emuRates, BAUD_SEL
+static int emuWire = 0;   // -w, sleep for the time on the wire
+static int emuModel = 0;  // -m, sign with rsa_model.c
+static struct rsa_model_key modelKey;
+
+// termios speed of a baud in USB_BAUD_RATES
+static speed_t emu_speed(int baud) {
+	switch (baud) {
+		case 115200:  return B115200;
+		case 921600:  return B921600;
+		case 1000000: return B1000000;
+		case 2500000: return B2500000;
+		default:      return 0;
+	}
+}
+
+// time of len bytes (start + 8 data + stop bits) at the current baud
+static void emu_wire(int len) {
+	if (emuWire) {
+		usleep((useconds_t) ((long long) len*10*1000000/emuRates[emuBaud]));
+	}
+}
+
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static void emu_send(int pty, const char* op, const unsigned char* payload, int len, int verbose) {
+	unsigned char frame[2+1+USB_BATCH_MAX*KEY_LEN_BYTE];
+	memcpy(frame, op, 2);
+	if (len > 0) {
+		memcpy(frame+2, payload, len);
+	}
+	emu_wire(len+2);
+	if (write(pty, frame, len+2) != len+2) {
+		fprintf(stderr,"Emulator write failed\n");
+	}
+	if (verbose) {
+		fprintf(stderr,"-> %c%c\n", op[0], op[1]);
+	}
+}
+
+// percent chance
+static int emu_chance(int percent) {
+	return (percent > 0 && rand() % 100 < percent);
+}
+
+/* RSA on RAM contents, FPGA memory is little endian (byte 0 lowest) */
+static int emu_sign(EVP_PKEY* pkey, const unsigned char* ram, unsigned char* result) {
+	unsigned char in[KEY_LEN_BYTE], out[KEY_LEN_BYTE];
+	size_t outLen = sizeof(out);
+	int i;
+
+	for (i = 0; i < KEY_LEN_BYTE; i++) {
+		in[i] = ram[KEY_LEN_BYTE-1-i];
+	}
+
+	// raw private key operation (x^d mod n), same as the FPGA
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
+	int ok = (ctx != NULL
+		&& EVP_PKEY_decrypt_init(ctx) == 1
+		&& EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_NO_PADDING) == 1
+		&& EVP_PKEY_decrypt(ctx, out, &outLen, in, sizeof(in)) == 1
+		&& outLen == KEY_LEN_BYTE);
+	EVP_PKEY_CTX_free(ctx);
+
+	for (i = 0; i < KEY_LEN_BYTE; i++) {
+		result[i] = ok ? out[KEY_LEN_BYTE-1-i] : 0;
+	}
+	return ok ? 0 : -1;
+}
+
+/* rsa_model_key of the private key, bit_size 512 as Security_Token_Top_USB.vhd */
+static int emu_model_init(EVP_PKEY* pkey) {
+	unsigned char modulus[RSA_MODEL_BYTES], exponent[RSA_MODEL_BYTES];
+	BIGNUM *n = NULL, *d = NULL;
+	int ok = (KEY_LEN_BYTE == RSA_MODEL_BYTES
+		&& EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_RSA_N, &n) == 1
+		&& EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_RSA_D, &d) == 1
+		&& BN_bn2binpad(n, modulus, RSA_MODEL_BYTES) == RSA_MODEL_BYTES
+		&& BN_bn2binpad(d, exponent, RSA_MODEL_BYTES) == RSA_MODEL_BYTES
+		&& rsa_model_init(&modelKey, modulus, exponent, RSA_MODEL_BYTES, RSA_MODEL_WORDS*16) == 0);
+	BN_free(n);
+	BN_free(d);
+	return ok ? 0 : -1;
+}
+
+/* signs msg in place, returns the cycles of the RSA core with -m, else 0 */
+static long emu_sign_msg(EVP_PKEY* pkey, unsigned char* msg) {
+	if (emuModel) {
+		return rsa_model_sign(&modelKey, msg, msg);
+	}
+	emu_sign(pkey, msg, msg);
+	return 0;
+}
+
+/* ms a signature of cycles takes, -l or the time of the core */
+static long long emu_sign_ms(int signMs, long cycles) {
+	if (signMs >= 0 || !emuModel) {
+		return signMs > 0 ? signMs : 0;
+	}
+	return (cycles*1000 + RSA_MODEL_CLOCK_HZ-1)/RSA_MODEL_CLOCK_HZ;
+}
+
+int main(int argc, char **argv) {
+	const char* keyFile = "data/private" KEY_STR(KEY_BITS) ".pem";
+	int signMs = -1;
+	int busyPercent = 0;
+	int timeoutPercent = 0;
+	int pinMs = 0;       // -p, *B to *W/*K this long after *M/*Q (PIN entry)
+	int verbose = 0;
+	char id[4] = "HEJ";  // token_id generic
+	int cores = 1;       // RSA_CORES generic
+	int opt;
+
+	while ((opt = getopt(argc, argv, "k:l:b:t:p:i:c:mwv")) != -1) {
+		switch (opt) {
+			case 'k': keyFile = optarg; break;
+			case 'l': signMs = atoi(optarg); break;
+			case 'b': busyPercent = atoi(optarg); break;
+			case 't': timeoutPercent = atoi(optarg); break;
+			case 'p': pinMs = atoi(optarg); break;
+			case 'i': strncpy(id, optarg, 3); break;
+			case 'c': cores = atoi(optarg); break;
+			case 'm': emuModel = 1; break;
+			case 'w': emuWire = 1; break;
+			case 'v': verbose = 1; break;
+			default:
+				fprintf(stderr,"usage: %s [-k private.pem] [-l sign_ms] [-b busy_%%] [-t timeout_%%] [-p pin_ms] [-i id] [-c cores] [-m] [-w] [-v]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (cores < 1 || cores > USB_BATCH_MAX) {
+		fprintf(stderr,"cores must be 1 to %i (USB_BATCH_MAX)\n", USB_BATCH_MAX);
+		return 1;
+	}
+
+	FILE *fp0 = fopen(keyFile, "r");
+	if (fp0 == NULL) {
+		fprintf(stderr,"\nCannot read private key:\n '%s'\n", keyFile);
+		return 1;
+	}
+	EVP_PKEY *pkey = PEM_read_PrivateKey(fp0, NULL, NULL, NULL);
+	fclose(fp0);
+	if (pkey == NULL || EVP_PKEY_size(pkey) != KEY_LEN_BYTE) {
+		fprintf(stderr,"Private key must be %i bit RSA\n", KEY_LEN_BYTE*8);
+		return 1;
+	}
+	if (emuModel && emu_model_init(pkey) != 0) {
+		fprintf(stderr,"The RSA core (-m) is %i bit, key is %i bit\n", RSA_MODEL_BYTES*8, KEY_LEN_BYTE*8);
+		return 1;
+	}
+
+	// pty master is our side of the "USB cable"
+	int pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if (pty == -1 || grantpt(pty) == -1 || unlockpt(pty) == -1) {
+		fprintf(stderr,"Unable to create pty\n");
+		return 1;
+	}
+	const char* ptyName = ptsname(pty);
+
+	// keep the slave open (no hangup between clients), raw like the UART
+	int slave = open(ptyName, O_RDWR | O_NOCTTY);
+	struct termios tty;
+	if (slave == -1 || tcgetattr(slave, &tty) != 0) {
+		fprintf(stderr,"Unable to configure pty\n");
+		return 1;
+	}
+	cfmakeraw(&tty);
+	tcsetattr(slave, TCSANOW, &tty);
+
+	printf("%s\n", ptyName);
+	fflush(stdout);
+
+	enum emuState state = EMU_IDLE;
+	unsigned char ram[1+USB_BATCH_MAX*KEY_LEN_BYTE]; // [n] + messages, for *Q
+	unsigned char* msgRam = ram+1;
+	int ramAddr = 0;
+	int batchSize = 1;
+	long long cmdDeadline = 0;   // *T when passed (TRANSLATE_CMD, RECIVE_DATA)
+	long long signDone = 0;      // RSA finished at this time
+	int signing = 0;             // READY_FOR_DATA = 0
+	int rsaDone = 0;             // RSA_DONE = 1
+	int dropCmd = 0;             // injected timeout, ignore rest of command
+	long long confirmDeadline = 0; // back to baud 0 when passed, 0 = confirmed
+	long long pinDeadline = 0;   // READY_FOR_DATA = 0 until the PIN is in (-p)
+	unsigned char slotRam[USB_BATCH_MAX][1+KEY_LEN_BYTE]; // [t] + message, for *m
+	int slotUsed[USB_BATCH_MAX] = {0};       // written, not read yet
+	long long slotDone[USB_BATCH_MAX];       // signed at this time
+	long long coreFree[USB_BATCH_MAX] = {0}; // core idle from this time
+	int tag = -1;                            // slot of the *w being received, -1 for *W and *K
+	int anySlot;
+
+	for (;;) {
+		long long now = now_ms();
+		int wait = -1;
+
+		if (signing && now >= signDone) {
+			signing = 0;
+			rsaDone = 1;
+			if (verbose) {
+				fprintf(stderr,"   signed\n");
+			}
+		}
+		if (confirmDeadline != 0 && now >= confirmDeadline) {
+			if (verbose) {
+				fprintf(stderr,"   baud %i not confirmed, back to %i\n", emuRates[emuBaud], emuRates[0]);
+			}
+			emuBaud = 0;
+			confirmDeadline = 0;
+		}
+		if (state != EMU_IDLE && now >= cmdDeadline) {
+			emu_send(pty, "*T", NULL, 0, verbose);
+			state = EMU_IDLE;
+			dropCmd = 0;
+		}
+
+		if (state != EMU_IDLE) {
+			wait = (int) (cmdDeadline - now);
+		}
+		if (signing && (wait == -1 || signDone - now < wait)) {
+			wait = (int) (signDone - now);
+		}
+		if (confirmDeadline != 0 && (wait == -1 || confirmDeadline - now < wait)) {
+			wait = (int) (confirmDeadline - now);
+		}
+
+		struct pollfd pfd;
+		pfd.fd = pty;
+		pfd.events = POLLIN;
+		int ret = poll(&pfd, 1, wait);
+		if (ret == -1 && errno != EINTR) {
+			fprintf(stderr,"poll failed\n");
+			return 1;
+		}
+		if (ret <= 0) {
+			continue;
+		}
+
+		unsigned char buf[256];
+		ssize_t len = read(pty, buf, sizeof(buf));
+		if (len <= 0) {
+			continue;
+		}
+		// host at another baud: only garbage would reach the parser
+		if (tcgetattr(slave, &tty) == 0 && cfgetospeed(&tty) != emu_speed(emuRates[emuBaud])) {
+			if (verbose) {
+				fprintf(stderr,"   %zi bytes lost, not at %i baud\n", len, emuRates[emuBaud]);
+			}
+			continue;
+		}
+		emu_wire(len);
+
+		ssize_t i;
+		int j;
+		for (i = 0; i < len; i++) {
+			unsigned char c = buf[i];
+
+			if (dropCmd) {
+				continue; // lost on the line, *T follows
+			}
+
+			switch (state) {
+				case EMU_IDLE:
+					if (c == '*') {
+						state = EMU_TRANSLATE_CMD;
+						cmdDeadline = now_ms() + EMU_TIMEOUT_MS;
+					}
+					break;
+
+				case EMU_TRANSLATE_CMD:
+					if (verbose) {
+						fprintf(stderr,"<- *%c\n", c);
+					}
+					if (emu_chance(timeoutPercent)) {
+						dropCmd = 1;
+						break;
+					}
+					state = EMU_IDLE;
+					if (c != 0 && strchr("WKRQISwr", c) != NULL) {
+						confirmDeadline = 0; // parses, the host is at our baud
+					}
+					for (j = 0, anySlot = 0; j < USB_BATCH_MAX; j++) {
+						anySlot |= slotUsed[j];
+					}
+					if (c == 'W' || c == 'K') {
+						// the RAM holds *w slots
+						if (signing || anySlot || now_ms() < pinDeadline || emu_chance(busyPercent)) {
+							emu_send(pty, "*B", NULL, 0, verbose);
+						} else {
+							state = (c == 'W') ? EMU_RECIVE_DATA : EMU_RECIVE_COUNT;
+							ramAddr = 0;
+							batchSize = 1;
+							rsaDone = 0;
+							tag = -1;
+							cmdDeadline = now_ms() + EMU_TIMEOUT_MS;
+						}
+					} else if (c == 'w' || c == 'r') {
+						state = (c == 'w') ? EMU_RECIVE_TAG : EMU_READ_TAG;
+						cmdDeadline = now_ms() + EMU_TIMEOUT_MS;
+					} else if (c == 'R' || c == 'Q') {
+						if (!rsaDone || emu_chance(busyPercent)) {
+							emu_send(pty, "*B", NULL, 0, verbose);
+						} else if (c == 'R') {
+							emu_send(pty, "*M", msgRam, KEY_LEN_BYTE, verbose);
+							pinDeadline = now_ms() + pinMs;
+						} else {
+							ram[0] = (unsigned char) batchSize;
+							emu_send(pty, "*Q", ram, 1+batchSize*KEY_LEN_BYTE, verbose);
+							pinDeadline = now_ms() + pinMs;
+						}
+					} else if (c == 'I') {
+						emu_send(pty, "*I", (const unsigned char*) id, 3, verbose);
+					} else if (c == 'S') {
+						state = EMU_RECIVE_BAUD;
+						cmdDeadline = now_ms() + EMU_TIMEOUT_MS;
+					}
+					break;
+
+				case EMU_RECIVE_BAUD:
+					state = EMU_IDLE;
+					if (c >= sizeof(emuRates)/sizeof(emuRates[0])) {
+						emu_send(pty, "*B", NULL, 0, verbose);
+						break;
+					}
+					// echo at the old baud, then switch
+					emu_send(pty, "*S", &c, 1, verbose);
+					emuBaud = c;
+					confirmDeadline = (c == 0) ? 0 : now_ms() + EMU_TIMEOUT_MS;
+					if (verbose) {
+						fprintf(stderr,"   baud %i\n", emuRates[emuBaud]);
+					}
+					break;
+
+				case EMU_RECIVE_TAG:
+					state = EMU_IDLE;
+					if (c >= USB_BATCH_MAX || slotUsed[c] || signing || emu_chance(busyPercent)) {
+						emu_send(pty, "*B", NULL, 0, verbose);
+					} else {
+						tag = c;
+						ramAddr = 0;
+						state = EMU_RECIVE_DATA;
+					}
+					break;
+
+				case EMU_READ_TAG:
+					state = EMU_IDLE;
+					if (c >= USB_BATCH_MAX || !slotUsed[c] || now_ms() < slotDone[c] || emu_chance(busyPercent)) {
+						emu_send(pty, "*B", NULL, 0, verbose);
+					} else {
+						slotRam[c][0] = c;
+						emu_send(pty, "*m", slotRam[c], 1+KEY_LEN_BYTE, verbose);
+						slotUsed[c] = 0;
+					}
+					break;
+
+				case EMU_RECIVE_COUNT:
+					if (c < 1 || c > USB_BATCH_MAX) {
+						emu_send(pty, "*B", NULL, 0, verbose);
+						state = EMU_IDLE;
+					} else {
+						batchSize = c;
+						state = EMU_RECIVE_DATA;
+					}
+					break;
+
+				case EMU_RECIVE_DATA:
+					if (tag >= 0) {
+						slotRam[tag][1+ramAddr++] = c;
+						if (ramAddr == KEY_LEN_BYTE) {
+							emu_send(pty, "*D", NULL, 0, verbose);
+							state = EMU_IDLE;
+							long long ms = emu_sign_ms(signMs, emu_sign_msg(pkey, slotRam[tag]+1));
+							// first core to be free
+							int core = 0;
+							for (j = 1; j < cores; j++) {
+								if (coreFree[j] < coreFree[core]) {
+									core = j;
+								}
+							}
+							long long start = now_ms();
+							if (coreFree[core] > start) {
+								start = coreFree[core];
+							}
+							slotDone[tag] = start + ms;
+							coreFree[core] = slotDone[tag];
+							slotUsed[tag] = 1;
+							if (verbose) {
+								fprintf(stderr,"   slot %i on core %i\n", tag, core);
+							}
+							tag = -1;
+						}
+						break;
+					}
+					msgRam[ramAddr++] = c;
+					if (ramAddr == batchSize*KEY_LEN_BYTE) {
+						emu_send(pty, "*D", NULL, 0, verbose);
+						state = EMU_IDLE;
+						long cycles = 0;
+						for (j = 0; j < batchSize; j++) {
+							cycles += emu_sign_msg(pkey, msgRam+j*KEY_LEN_BYTE);
+						}
+						signing = 1;
+						if (signMs >= 0 || !emuModel) {
+							signDone = now_ms() + emu_sign_ms(signMs, 0)*batchSize;
+						} else {
+							signDone = now_ms() + emu_sign_ms(signMs, cycles);
+						}
+					}
+					break;
+			}
+		}
+	}
+	return 0;
+}
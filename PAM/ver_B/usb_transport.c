@@ -0,0 +1,866 @@
+/* [BSD-3 Clause] 
+ * Copyright 2017 Eliot Roxbergh, Adam Fredriksson
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "header.h"
+
+/* Serial transport for the USB token (see USB_CMD_PARSER.vhd)
+ *
+ * The port is non-blocking and every wait is a poll() with a deadline,
+ * responses are parsed as soon as their bytes arrive.
+ * Frames from the token:
+ *  *D          message received
+ *  *B          busy (not ready for data / signature not done)
+ *  *T          timeout (token did not get the whole command)
+ *  *M[64]      signed message (KEY_LEN_BYTE, 64 for 512 bit keys)
+ *  *Q[n][n*64] n signed messages (batch, *K[n][n*64] + *Q)
+ *  *m[t][64]   signed message of slot t (tagged, *w[t][64] + *r[t])
+ *  *IHEJ       ID
+ *  *S[n]       now at baud n (usb_configure)
+ */
+
+/* Persistent session (usb_session_*)
+ * One port per process, opened and configured once, kept open between
+ * authentications. Reopened when the token is gone (EIO, hot-unplug).
+ */
+static pthread_mutex_t sessionLock = PTHREAD_MUTEX_INITIALIZER;
+static int sessionFd = -1;
+static char sessionDevice[256];
+static struct termios sessionTtyOld;
+static int sessionBaud = 0;   // usb_session_configure, 0 = power on baud
+static int sessionRtscts = 0;
+static unsigned char sessionSent[KEY_LEN_BYTE]; // *W of usb_session_send, signature not read yet
+static long long sessionSentAt = 0;             // now_ms of that *W, 0 = none
+
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// wait until usb is readable/writable, 1 = ready, 0 = deadline passed, -1 = error
+static int usb_wait(int usb, short events, long long deadline) {
+	struct pollfd pfd;
+	pfd.fd = usb;
+	pfd.events = events;
+
+	for (;;) {
+		long long left = deadline - now_ms();
+		if (left <= 0) {
+			return 0;
+		}
+		int ret = poll(&pfd, 1, (int) left);
+		if (ret > 0) {
+			if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				return -1;
+			}
+			return 1;
+		}
+		if (ret == -1 && errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+int usb_open(const char* device, struct termios* tty_old) {
+  int usb = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (usb == -1) {
+		int err = errno; // for usb_in_use
+		fprintf(stderr,"Unable to open port\n");
+		errno = err;
+    return -1;
+  }
+
+  // Set parameters
+  struct termios tty;
+  memset (&tty, 0, sizeof(tty));
+  if (tcgetattr (usb, &tty) != 0) {
+    fprintf(stderr,"error from tcgetattr\n");
+		close(usb);
+    return -1;
+  }
+
+  // save old params for after close
+  *tty_old = tty;
+
+  // set baud rate (in / out)
+  cfsetospeed (&tty, (speed_t)B115200);
+  cfsetispeed (&tty, (speed_t)B115200);
+
+  /* ---- other port configs ---- */
+	// set lflag constants to 0 => non-canonical etc
+  tty.c_lflag = 0;
+	// set oflag constants to 0 => no remapping, no delays
+	tty.c_oflag = 0;
+	// no input mapping (CR/NL, parity marks, XON/XOFF) of binary data
+	tty.c_iflag = 0;
+	// reads never block, waiting is done with poll()
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 0;
+	//block size
+  tty.c_cflag &= ~CSIZE;
+  tty.c_cflag |= CS8;
+  tty.c_cflag |= (CLOCAL | CREAD);
+
+	// set specified configs	
+  if (tcsetattr(usb, TCSANOW, &tty) != 0) {
+    fprintf(stderr, "error from tcsetattr\n");
+		close(usb);
+    return -1;
+  }
+
+	// drop anything left from an earlier session
+	tcflush(usb, TCIOFLUSH);
+  return usb;
+}
+
+// termios speed of a baud, 0 if the host has none
+static speed_t usb_speed(int baud) {
+	switch (baud) {
+		case 115200:  return B115200;
+		case 230400:  return B230400;
+		case 460800:  return B460800;
+		case 921600:  return B921600;
+		case 1000000: return B1000000;
+		case 2000000: return B2000000;
+		case 2500000: return B2500000;
+		case 3000000: return B3000000;
+		default:      return 0;
+	}
+}
+
+// host side of the line: speed and RTS/CTS, after what is already written
+static int usb_set_speed(int usb, speed_t speed, int rtscts) {
+	struct termios tty;
+	if (tcgetattr(usb, &tty) != 0) {
+		return -1;
+	}
+	cfsetospeed(&tty, speed);
+	cfsetispeed(&tty, speed);
+	if (rtscts) {
+		tty.c_cflag |= CRTSCTS;
+	} else {
+		tty.c_cflag &= ~CRTSCTS;
+	}
+	return tcsetattr(usb, TCSADRAIN, &tty);
+}
+
+// *S[n] until the echo *S[n], the token is at baud n once it is sent
+static int usb_baud_switch(int usb, int n, int timeout_ms) {
+	unsigned char frame[3] = { '*', 'S', (unsigned char) n };
+	unsigned char payload[1];
+	if (usb_write(usb, frame, 3, timeout_ms) != 3
+		|| usb_read_frame(usb, payload, timeout_ms) != 'S' || payload[0] != n) {
+		return -1;
+	}
+	return 0;
+}
+
+void usb_close(int usb, const struct termios* tty_old) {
+	struct termios tty;
+	// next user of the token starts at the power on baud
+	if (tcgetattr(usb, &tty) == 0 && cfgetospeed(&tty) != B115200) {
+		usb_baud_switch(usb, 0, USB_PROBE_TIMEOUT_MS);
+	}
+  tcsetattr(usb, TCSANOW, tty_old);
+  close(usb);
+}
+
+int usb_write(int usb, const unsigned char* buf, int len, int timeout_ms) {
+	long long deadline = now_ms() + timeout_ms;
+	int written = 0;
+
+	while (written < len) {
+		ssize_t ret = write(usb, buf+written, len-written);
+		if (ret > 0) {
+			written += ret;
+		} else if (ret == -1 && errno != EAGAIN && errno != EINTR) {
+			return -1;
+		} else if (usb_wait(usb, POLLOUT, deadline) != 1) {
+			return -1;
+		}
+	}
+	AUTH_PROBE2(usb__write, buf[1], written); // opcode, bytes
+	return written;
+}
+
+int usb_read_frame(int usb, unsigned char* payload, int timeout_ms) {
+	long long deadline = now_ms() + timeout_ms;
+	unsigned char byte;
+	int op = 0;         // 0 = looking for '*', else opcode
+	int gotHeader = 0;  // '*' seen
+	int need = 0;       // payload bytes left
+	int have = 0;       // payload bytes read
+	unsigned char scratch[1+USB_BATCH_MAX*KEY_LEN_BYTE];
+
+	if (payload == NULL) {
+		payload = scratch; // caller does not want the payload
+	}
+
+	for (;;) {
+		ssize_t ret;
+		if (op == 0) {
+			ret = read(usb, &byte, 1);
+		} else {
+			ret = read(usb, payload+have, need);
+		}
+
+		if (ret == 0 || (ret == -1 && (errno == EAGAIN || errno == EINTR))) {
+			int ready = usb_wait(usb, POLLIN, deadline);
+			if (ready != 1) {
+				return ready; // 0 timeout, -1 error
+			}
+			continue;
+		}
+		if (ret == -1) {
+			return -1;
+		}
+
+		if (op != 0) {
+			// payload
+			have += ret;
+			need -= ret;
+			if (op == 'Q' && have == 1) {
+				// count byte, then the messages
+				if (payload[0] < 1 || payload[0] > USB_BATCH_MAX) {
+					fprintf(stderr,"Bad batch size from token\n");
+					return -1;
+				}
+				need = payload[0]*ciphertextLen;
+			}
+			if (need == 0) {
+				AUTH_PROBE2(usb__read, op, 2+have); // opcode, bytes
+				return op;
+			}
+		} else if (!gotHeader) {
+			// skip garbage until frame start
+			gotHeader = (byte == '*');
+		} else {
+			switch (byte) {
+				case 'D':
+				case 'B':
+				case 'T':
+					AUTH_PROBE2(usb__read, byte, 2);
+					return byte;
+				case 'M':
+					op = byte;
+					need = ciphertextLen;
+					break;
+				case 'm':
+					op = byte;
+					need = 1+ciphertextLen; // slot, then the message
+					break;
+				case 'Q':
+					op = byte;
+					need = 1; // count first
+					break;
+				case 'I':
+					op = byte;
+					need = 3; // ID, "HEJ" by default
+					break;
+				case 'S':
+					op = byte;
+					need = 1; // baud number
+					break;
+				case '*':
+					break; // still at frame start
+				default:
+					gotHeader = 0;
+			}
+		}
+	}
+}
+
+// stop of usb_write_frame
+#define FRAME_RESEND  0  // resend after *T or *B until *D
+#define FRAME_ONCE    1  // no resend, returns 'B' or 'T' instead
+#define FRAME_BUSY    2  // resend after *T, returns 'B' at the first *B
+
+// write *W or *K frame until *D (or stop)
+// timing is filled in also when failing (counts for metrics.c)
+static int usb_write_frame(int usb, const unsigned char* frame, int len, int stop, struct auth_timing* timing) {
+	long long start = now_ns();
+	long long writeTime = 0;
+	int writes = 0;
+	int timeouts = 0;
+	int busy = 0;
+	int ret = 0;
+
+	// Write random generated message to USB, wait for *D (msg received)
+	// *B is an answer, the deadline starts again, up to USB_PIN_TIMEOUT_MS
+	// while the user enters the PIN
+	long long ackDeadline = now_ms() + USB_ACK_TIMEOUT_MS;
+	long long pinDeadline = now_ms() + USB_PIN_TIMEOUT_MS;
+	long long deadline = ackDeadline;
+	int answer = 0; // last frame from the token
+	int op = 'T';
+	while (op != 'D') {
+		long long left = deadline - now_ms();
+		if (left <= 0 && answer == 'B' && deadline == pinDeadline) {
+			fprintf(stderr,"No PIN entered on the token\n");
+			ret = 'B';
+			break;
+		}
+		if (left <= 0) {
+			fprintf(stderr,"No *D from token\n");
+			ret = -1;
+			break;
+		}
+		if (op == 'B') {
+			// still busy with previous message or waiting for the PIN,
+			// wait and write again
+			usb_wait(usb, POLLIN, now_ms() + (now_ms() < ackDeadline ? USB_RETRY_MS : USB_PIN_POLL_MS));
+			op = 'T';
+		}
+		// first try, or *T (time out): write (again)
+		if (op == 'T') {
+			long long writeStart = now_ns();
+			if (usb_write(usb, frame, len, left) < len) {
+				fprintf(stderr,"Write failed\n");
+				ret = -1;
+				break;
+			}
+			writeTime += now_ns() - writeStart;
+			writes++;
+		}
+		op = usb_read_frame(usb, NULL, deadline - now_ms());
+		if (op == -1) {
+			fprintf(stderr,"Read *D failed\n");
+			ret = -1;
+			break;
+		}
+		if (op > 0) {
+			answer = op;
+		}
+		if (op == 'B') {
+			busy++;
+			deadline = now_ms() + USB_ACK_TIMEOUT_MS;
+			if (deadline > pinDeadline) {
+				deadline = pinDeadline;
+			}
+		} else if (op != 'D') {
+			timeouts++; // *T or no answer
+		}
+		if ((stop == FRAME_ONCE && op != 'D') || (stop == FRAME_BUSY && op == 'B')) {
+			ret = (op == 'B') ? 'B' : 'T';
+			break;
+		}
+	}
+
+	if (timing != NULL) {
+		timing->write = writeTime;
+		timing->ack = now_ns() - start - writeTime;
+		timing->resends = (writes > 0) ? writes-1 : 0;
+		timing->timeouts = timeouts;
+		timing->busy = busy;
+	}
+	return ret;
+}
+
+// *W frame in usbMessageBuf (cleartextLen+3 B), returns length
+static int usb_frame_message(unsigned char* usbMessageBuf, const unsigned char* message) {
+	// 2B header + 64B message (63B cleartext_len + 1B zero)
+	// last byte is never filled, the FPGA works on 64B messages
+	memset(usbMessageBuf, 0, cleartextLen+3);
+
+	// *W = Write operation
+	usbMessageBuf[0] = '*';
+	usbMessageBuf[1] = 'W';
+	memcpy(usbMessageBuf+2, message, cleartextLen);
+	return cleartextLen+3;
+}
+
+// *K frame in usbMessageBuf (3+USB_BATCH_MAX*KEY_LEN_BYTE B), returns length, -1 if count is out of range
+static int usb_frame_batch(unsigned char* usbMessageBuf, const unsigned char** messages, int count) {
+	int i;
+
+	if (count < 1 || count > USB_BATCH_MAX) {
+		fprintf(stderr,"Batch of %i messages not supported\n", count);
+		return -1;
+	}
+	// 3B header + count * 64B message, laid out as for *W
+	memset(usbMessageBuf, 0, 3+count*keyLen);
+
+	// *K = batch write operation
+	usbMessageBuf[0] = '*';
+	usbMessageBuf[1] = 'K';
+	usbMessageBuf[2] = (unsigned char) count;
+	for (i = 0; i < count; i++) {
+		memcpy(usbMessageBuf+3+i*keyLen, messages[i], cleartextLen);
+	}
+	return 3+count*keyLen;
+}
+
+// *w[tag] frame in usbMessageBuf (cleartextLen+4 B), returns length
+static int usb_frame_tagged(unsigned char* usbMessageBuf, int tag, const unsigned char* message) {
+	// 3B header + 64B message, laid out as for *W
+	memset(usbMessageBuf, 0, cleartextLen+4);
+
+	// *w = write to slot tag
+	usbMessageBuf[0] = '*';
+	usbMessageBuf[1] = 'w';
+	usbMessageBuf[2] = (unsigned char) tag;
+	memcpy(usbMessageBuf+3, message, cleartextLen);
+	return cleartextLen+4;
+}
+
+int usb_send_message(int usb, const unsigned char* message, struct auth_timing* timing) {
+	unsigned char usbMessageBuf[cleartextLen+3];
+	int len = usb_frame_message(usbMessageBuf, message);
+	return usb_write_frame(usb, usbMessageBuf, len, FRAME_RESEND, timing);
+}
+
+int usb_send_batch(int usb, const unsigned char** messages, int count, struct auth_timing* timing) {
+	unsigned char usbMessageBuf[3+USB_BATCH_MAX*KEY_LEN_BYTE];
+	int len = usb_frame_batch(usbMessageBuf, messages, count);
+	if (len == -1) {
+		return -1;
+	}
+	return usb_write_frame(usb, usbMessageBuf, len, FRAME_RESEND, timing);
+}
+
+int usb_send_tagged(int usb, int tag, const unsigned char* message, struct auth_timing* timing) {
+	unsigned char usbMessageBuf[cleartextLen+4];
+	if (tag < 0 || tag >= USB_BATCH_MAX) {
+		fprintf(stderr,"No slot %i on the token\n", tag);
+		return -1;
+	}
+	int len = usb_frame_tagged(usbMessageBuf, tag, message);
+	return usb_write_frame(usb, usbMessageBuf, len, FRAME_RESEND, timing);
+}
+
+int usb_offer(int usb, const unsigned char** messages, int count, int resend) {
+	unsigned char usbMessageBuf[3+USB_BATCH_MAX*KEY_LEN_BYTE];
+	int len = (count == 1) ? usb_frame_message(usbMessageBuf, messages[0])
+		: usb_frame_batch(usbMessageBuf, messages, count);
+	if (len == -1) {
+		return -1;
+	}
+	return usb_write_frame(usb, usbMessageBuf, len, resend ? FRAME_BUSY : FRAME_ONCE, NULL);
+}
+
+static int usb_identify_within(int usb, char* id, int timeout_ms) {
+	unsigned char payload[3];
+	if (usb_write(usb, (const unsigned char*) "*I", 2, timeout_ms) != 2
+		|| usb_read_frame(usb, payload, timeout_ms) != 'I') {
+		return -1;
+	}
+	memcpy(id, payload, 3);
+	id[3] = '\0';
+	return 0;
+}
+
+int usb_identify(int usb, char* id) {
+	return usb_identify_within(usb, id, USB_ACK_TIMEOUT_MS);
+}
+
+int usb_probe(int usb, char* id) {
+	return usb_identify_within(usb, id, USB_PROBE_TIMEOUT_MS);
+}
+
+int usb_configure(int usb, int baud, int rtscts) {
+	static const int rates[] = USB_BAUD_RATES;
+	const int nRates = sizeof(rates)/sizeof(rates[0]);
+	char id[4];
+	int n, i;
+
+	if (baud == 0) {
+		baud = rates[0];
+	}
+	for (n = 0; n < nRates && rates[n] != baud; n++);
+	if (n == nRates || usb_speed(baud) == 0) {
+		fprintf(stderr,"Baud %i not supported\n", baud);
+		return -1;
+	}
+	if (usb_set_speed(usb, usb_speed(rates[0]), rtscts) != 0) {
+		fprintf(stderr,"error from tcsetattr\n");
+		return -1;
+	}
+
+	// a host that did not close the port (crashed) may have left the
+	// token at another baud, ask there for *S0
+	if (usb_identify_within(usb, id, USB_PROBE_TIMEOUT_MS) != 0) {
+		for (i = 1; i < nRates; i++) {
+			// let a command garbled by the wrong baud time out first
+			usleep(USB_BAUD_CONFIRM_MS*1000);
+			tcflush(usb, TCIOFLUSH);
+			if (usb_speed(rates[i]) != 0 && usb_set_speed(usb, usb_speed(rates[i]), rtscts) == 0
+				&& usb_baud_switch(usb, 0, USB_PROBE_TIMEOUT_MS) == 0) {
+				break;
+			}
+		}
+		usb_set_speed(usb, usb_speed(rates[0]), rtscts);
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	// the token switches when the echo is sent, so do we. It goes back
+	// unless a command (*I) follows within USB_BAUD_CONFIRM_MS
+	if (usb_baud_switch(usb, n, USB_ACK_TIMEOUT_MS) != 0) {
+		fprintf(stderr,"Token did not take baud %i\n", baud);
+		return -1;
+	}
+	if (usb_set_speed(usb, usb_speed(baud), rtscts) != 0
+		|| usb_identify_within(usb, id, USB_BAUD_CONFIRM_MS) != 0) {
+		fprintf(stderr,"No answer at baud %i\n", baud);
+		usb_set_speed(usb, usb_speed(rates[0]), rtscts);
+		usleep(USB_BAUD_CONFIRM_MS*1000);
+		tcflush(usb, TCIOFLUSH);
+		return -1;
+	}
+	return 0;
+}
+
+// write *R or *Q until the result frame (not *B)
+static int usb_poll_result(int usb, const char* request, unsigned char* payload, int timeout_ms, struct auth_timing* timing) {
+	long long start = now_ns();
+	int polls = 0;
+	int busy = 0;
+	int ret = 0;
+
+	long long deadline = now_ms() + timeout_ms;
+	int resultOp = (request[1] == 'R') ? 'M' : request[1];
+	int op = 0;
+	while (op != resultOp) {
+		long long left = deadline - now_ms();
+		if (left <= 0) {
+			fprintf(stderr,"No *%c from token\n", resultOp);
+			ret = -1;
+			break;
+		}
+		if (op == 'B') {
+			// let the RSA core work before asking again
+			usb_wait(usb, POLLIN, now_ms() + USB_RETRY_MS);
+		}
+		if (usb_write(usb, (const unsigned char*) request, 2, left) != 2) {
+			fprintf(stderr,"Write %s failed\n", request);
+			ret = -1;
+			break;
+		}
+		polls++;
+		op = usb_read_frame(usb, payload, deadline - now_ms());
+		if (op == -1) {
+			fprintf(stderr,"Read *%c or *B failed\n", resultOp);
+			ret = -1;
+			break;
+		}
+		if (op == 'B') {
+			busy++;
+		}
+	}
+
+	if (timing != NULL) {
+		timing->sign = now_ns() - start;
+		timing->polls = polls;
+		timing->busy += busy;
+	}
+	return ret;
+}
+
+int usb_get_signature(int usb, unsigned char* signature, struct auth_timing* timing) {
+	// Request signed message *R until *M
+	return usb_poll_result(usb, "*R", signature, USB_SIGN_TIMEOUT_MS, timing);
+}
+
+int usb_get_batch(int usb, unsigned char** signatures, int count, struct auth_timing* timing) {
+	unsigned char payload[1+USB_BATCH_MAX*KEY_LEN_BYTE];
+	int i;
+
+	// Request signed batch *Q until *Q, the token signs one message after the other
+	if (usb_poll_result(usb, "*Q", payload, count*USB_SIGN_TIMEOUT_MS, timing) != 0) {
+		return -1;
+	}
+	if (payload[0] != count) {
+		fprintf(stderr,"Token signed %i messages, not %i\n", payload[0], count);
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		memcpy(signatures[i], payload+1+i*ciphertextLen, ciphertextLen);
+	}
+	return 0;
+}
+
+int usb_get_tagged(int usb, unsigned char** signatures, int count, struct auth_timing* timing) {
+	unsigned char payload[1+KEY_LEN_BYTE];
+	unsigned char request[3] = {'*', 'r', 0};
+	int done[USB_BATCH_MAX] = {0};
+	long long start = now_ns();
+	int left = count;
+	int polls = 0;
+	int busy = 0;
+	int signedInRound = 0;
+	int ret = 0;
+	int tag;
+
+	if (count < 1 || count > USB_BATCH_MAX) {
+		fprintf(stderr,"No %i slots on the token\n", count);
+		return -1;
+	}
+
+	// *r each slot not read yet in turn, the cores finish in any order
+	long long deadline = now_ms() + count*USB_SIGN_TIMEOUT_MS;
+	for (tag = 0; left > 0; tag = (tag+1) % count) {
+		if (tag == 0) {
+			if (polls > 0 && !signedInRound) {
+				// nothing signed in the last round, let the cores work
+				usb_wait(usb, POLLIN, now_ms() + USB_RETRY_MS);
+			}
+			signedInRound = 0;
+		}
+		if (done[tag]) {
+			continue;
+		}
+		long long remaining = deadline - now_ms();
+		if (remaining <= 0) {
+			fprintf(stderr,"No *m from token\n");
+			ret = -1;
+			break;
+		}
+		request[2] = (unsigned char) tag;
+		if (usb_write(usb, request, 3, remaining) != 3) {
+			fprintf(stderr,"Write *r failed\n");
+			ret = -1;
+			break;
+		}
+		polls++;
+		int op = usb_read_frame(usb, payload, deadline - now_ms());
+		if (op == -1) {
+			fprintf(stderr,"Read *m or *B failed\n");
+			ret = -1;
+			break;
+		}
+		if (op == 'B') {
+			busy++;
+		} else if (op == 'm') {
+			if (payload[0] >= count || done[payload[0]]) {
+				fprintf(stderr,"Token sent slot %i\n", payload[0]);
+				ret = -1;
+				break;
+			}
+			memcpy(signatures[payload[0]], payload+1, ciphertextLen);
+			done[payload[0]] = 1;
+			signedInRound = 1;
+			left--;
+		}
+	}
+
+	if (timing != NULL) {
+		timing->sign = now_ns() - start;
+		timing->polls = polls;
+		timing->busy += busy;
+	}
+	return ret;
+}
+
+int usb_sign(int usb, const unsigned char* message, unsigned char* signature, struct auth_timing* timing) {
+	int ret = usb_send_message(usb, message, timing);
+	if (ret != 0) {
+		return ret;
+	}
+	return usb_get_signature(usb, signature, timing);
+}
+
+int usb_sign_batch(int usb, const unsigned char** messages, int count, unsigned char** signatures, struct auth_timing* timing) {
+	int ret = usb_send_batch(usb, messages, count, timing);
+	if (ret != 0) {
+		return ret;
+	}
+	return usb_get_batch(usb, signatures, count, timing);
+}
+
+int usb_sign_tagged(int usb, const unsigned char** messages, int count, unsigned char** signatures, struct auth_timing* timing) {
+	int i;
+	if (count < 1 || count > USB_BATCH_MAX) {
+		fprintf(stderr,"No %i slots on the token\n", count);
+		return -1;
+	}
+	// each *w starts a core while the next one is on the line
+	for (i = 0; i < count; i++) {
+		int ret = usb_send_tagged(usb, i, messages[i], timing);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return usb_get_tagged(usb, signatures, count, timing);
+}
+
+// 0 if port is hung up or gone (unplugged token)
+static int usb_alive(int usb) {
+	struct pollfd pfd;
+	struct termios tty;
+	pfd.fd = usb;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) == -1 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+		return 0;
+	}
+	return (tcgetattr(usb, &tty) == 0);
+}
+
+int usb_in_use(void) {
+	return errno == EBUSY || errno == EACCES;
+}
+
+// sessionLock within USB_SESSION_WAIT_MS, -1 if another login keeps the port longer
+static int usb_session_lock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += USB_SESSION_WAIT_MS/1000;
+	ts.tv_nsec += (USB_SESSION_WAIT_MS%1000)*1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	if (pthread_mutex_timedlock(&sessionLock, &ts) != 0) {
+		fprintf(stderr,"Token busy with another login\n");
+		return -1;
+	}
+	return 0;
+}
+
+// sessionLock must be held
+static int usb_session_open_locked(const char* device) {
+	if (sessionFd != -1 && strcmp(device, sessionDevice) != 0) {
+		usb_close(sessionFd, &sessionTtyOld);
+		sessionFd = -1;
+	}
+	if (sessionFd != -1 && !usb_alive(sessionFd)) {
+		fprintf(stderr,"Token gone, reconnecting\n");
+		close(sessionFd); // nothing to restore on a dead port
+		sessionFd = -1;
+	}
+	if (sessionFd == -1) {
+		sessionSentAt = 0; // other token, or it lost the message
+		sessionFd = usb_open(device, &sessionTtyOld);
+		if (sessionFd != -1) {
+			// we keep the port, keep others out
+			ioctl(sessionFd, TIOCEXCL);
+			if (sessionBaud != 0 || sessionRtscts) {
+				usb_configure(sessionFd, sessionBaud, sessionRtscts); // power on baud if not
+			}
+			strncpy(sessionDevice, device, sizeof(sessionDevice)-1);
+			sessionDevice[sizeof(sessionDevice)-1] = '\0';
+		}
+	}
+	return sessionFd;
+}
+
+int usb_session_open(const char* device) {
+	pthread_mutex_lock(&sessionLock);
+	int usb = usb_session_open_locked(device);
+	pthread_mutex_unlock(&sessionLock);
+	return usb;
+}
+
+void usb_session_configure(int baud, int rtscts) {
+	pthread_mutex_lock(&sessionLock);
+	if (sessionFd != -1 && (baud != sessionBaud || rtscts != sessionRtscts)) {
+		usb_configure(sessionFd, baud, rtscts);
+	}
+	sessionBaud = baud;
+	sessionRtscts = rtscts;
+	pthread_mutex_unlock(&sessionLock);
+}
+
+void usb_session_close(void) {
+	pthread_mutex_lock(&sessionLock);
+	if (sessionFd != -1) {
+		usb_close(sessionFd, &sessionTtyOld);
+		sessionFd = -1;
+	}
+	sessionSentAt = 0;
+	pthread_mutex_unlock(&sessionLock);
+}
+
+int usb_session_probe(const char* device, char* id) {
+	int ret = -1;
+
+	if (usb_session_lock() != 0) {
+		return -2;
+	}
+	int usb = usb_session_open_locked(device);
+	if (usb != -1) {
+		ret = usb_probe(usb, id);
+	} else if (usb_in_use()) {
+		ret = -2;
+	}
+	pthread_mutex_unlock(&sessionLock);
+	return ret;
+}
+
+int usb_session_send(const char* device, const unsigned char* message) {
+	int ret = -1;
+
+	if (usb_session_lock() != 0) {
+		return -1;
+	}
+	int usb = usb_session_open_locked(device);
+	if (usb != -1) {
+		ret = usb_send_message(usb, message, NULL);
+	}
+	if (ret == 0) {
+		memcpy(sessionSent, message, KEY_LEN_BYTE);
+		sessionSentAt = now_ms();
+	} else {
+		sessionSentAt = 0;
+	}
+	pthread_mutex_unlock(&sessionLock);
+	return ret;
+}
+
+int usb_session_sign(const char* device, const unsigned char* message, unsigned char* signature, struct auth_timing* timing) {
+	int ret = -1;
+	int attempt;
+
+	if (usb_session_lock() != 0) {
+		return -2;
+	}
+	// second attempt only if token was gone (reconnect)
+	for (attempt = 0; attempt < 2; attempt++) {
+		int usb = usb_session_open_locked(device);
+		if (usb == -1) {
+			ret = usb_in_use() ? -2 : -1;
+			break;
+		}
+		// sent by usb_session_send and nothing since: only fetch it,
+		// the token signs one message at a time
+		int sent = (sessionSentAt != 0
+			&& now_ms() - sessionSentAt < PREFETCH_TTL_MS
+			&& memcmp(message, sessionSent, KEY_LEN_BYTE) == 0);
+		sessionSentAt = 0;
+		if (sent && usb_get_signature(usb, signature, timing) == 0) {
+			ret = 0;
+			break;
+		}
+		ret = usb_sign(usb, message, signature, timing);
+		if (ret == 0 || usb_alive(usb)) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sessionLock);
+	return ret;
+}
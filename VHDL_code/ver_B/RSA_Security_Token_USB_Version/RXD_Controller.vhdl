@@ -22,7 +22,10 @@ use IEEE.numeric_std.all;
 
 entity RXD_Controller is
 
-Generic (Baud_Rate : integer; --Baud of this port
+Generic (Baud_Rate : integer; --Baud of this port at power on (BAUD_SEL "00")
+	  BAUD_RATE_1 : integer := 921_600;   --Bauds selected by BAUD_SEL "01", "10" and "11"
+	  BAUD_RATE_2 : integer := 1_000_000;
+	  BAUD_RATE_3 : integer := 2_500_000;
 	  CLOCK_RATE : integer;   --Frequency of the CLK. Needed to perform correct sampling
 	  OVERSAMPLES : integer := 4);
 
@@ -30,7 +33,8 @@ Port(	CLK		: in STD_LOGIC;
 	RESET		   : in STD_LOGIC;
 	RXD_PIN		: in STD_LOGIC;
 	RXD_BYTE 	: out STD_LOGIC_VECTOR(7 downto 0);
-	VALID_DATA_IN		: out STD_LOGIC := '0'
+	VALID_DATA_IN		: out STD_LOGIC := '0';
+	BAUD_SEL	: in STD_LOGIC_VECTOR(1 downto 0) := "00"	--Baud to use, taken when idle (between bytes)
 );
 end RXD_Controller;
 
@@ -38,6 +42,23 @@ end RXD_Controller;
 
 architecture Behavioral of RXD_Controller is
 
+--Clock cycles per sample at a baud rate (rounded), the counter passes it once per sample
+function SAMPLE_CYCLES(BAUD : integer) return integer is
+begin
+	return (CLOCK_RATE + BAUD*OVERSAMPLES/2)/(BAUD*OVERSAMPLES) - 1;
+end SAMPLE_CYCLES;
+
+--Sample cycles of the rate chosen by BAUD_SEL (*S command)
+function SELECTED_RATE(SEL : STD_LOGIC_VECTOR(1 downto 0)) return integer is
+begin
+	case SEL is
+		when "01" => return SAMPLE_CYCLES(BAUD_RATE_1);
+		when "10" => return SAMPLE_CYCLES(BAUD_RATE_2);
+		when "11" => return SAMPLE_CYCLES(BAUD_RATE_3);
+		when others => return SAMPLE_CYCLES(BAUD_RATE);
+	end case;
+end SELECTED_RATE;
+
 	type STATES is (IDLE, START, DATA, STOP);
 	signal state	: STATES := IDLE;
 	signal bit_counter : integer range 0 to 8 := 0;
@@ -46,12 +67,12 @@ architecture Behavioral of RXD_Controller is
 	signal SAMPLE_COUNTER : integer := 0;
 	signal SAMPLE_COUNT : integer range 0 to OVERSAMPLES;
 	signal SAMPLE_NOW : STD_LOGIC;
+	signal RATE_OF_SAMPLING : integer := SAMPLE_CYCLES(BAUD_RATE); --How many cycles beween each sample
 begin
 
 -- Handle the oversampler	
 oversampler: process (CLK) 
 
-	constant RATE_OF_SAMPLING : integer := CLOCK_RATE/BAUD_RATE/OVERSAMPLES; --How many cycles beween each sample
 	variable CURRENT_SAMPLE_COUNTER : integer := 0;
 
 	
@@ -66,6 +87,7 @@ oversampler: process (CLK)
 			elsif STATE = IDLE then
 				SAMPLE_COUNTER <= 0; 
 				SAMPLE_COUNT <= 0;
+				RATE_OF_SAMPLING <= SELECTED_RATE(BAUD_SEL); --Baud may only change between bytes
 			--If not reset perform standard behaviour	
 			elsif STATE /= IDLE then --We need sampling in every state but IDLE
 				CURRENT_SAMPLE_COUNTER := SAMPLE_COUNTER;
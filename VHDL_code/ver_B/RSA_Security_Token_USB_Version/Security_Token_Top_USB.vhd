@@ -34,6 +34,9 @@ Use work.all;
 --The flow of the program is:
 --PowerOn->Init->PIN->Input from PC->RSA-encryption->Signal data avalible to PC -> 
 --On keyboard press soft reset circuit (returns to INIT).
+--A batch (*K) of up to BATCH_MAX messages is signed back to back in the RSA state
+--Tagged messages (*w[t]) go to slot t of the same RAM and are signed on RSA_CORES cores at
+--once while in Input from PC, each slot once per PIN. They are read back (*r[t]) in any order
 --If a wrong PIN is input MAX_TRIES times in a row the program freezes at a blank screen
 ------------------------------------------------------------------------------------------
 Entity Security_Token_Top_USB is
@@ -47,11 +50,24 @@ Entity Security_Token_Top_USB is
 				
 				--Encryption settings
 				KEY_LENGTH 		: Integer := 512; 							--Key length in bits. HAS to be 512 with current modules
+				RSA_WIDTH		: Integer := 16;								--Word width of RSA_top: 16, 32 or 64 (R_C_VAL and the cores of RSA_top for it, 16 with CRT)
 				EXPONENT		: STD_LOGIC_VECTOR := x"b15f20094a5fbcd7605b23bb7dbe7d421556df00d266c649d019cfc87eae543f703f6870013851130d3a2ed993ef76a1c377a96b95fe326f7326a319bae5fe01"; --Exponent of the RSA
 				MODULO			: STD_LOGIC_VECTOR := x"bb847f2d87e8030926eea2a0a3f89877e6f63c1e2f65f3791e9c85549f48863a1dcc9f8b477c36dfea2573c49fc59259efe83b9996d093b4be09666e904cb17f"; --Modulus of the RSA
 				R_C_VAL	  		: STD_LOGIC_VECTOR := x"8F80651391C778113C509FDD5C205AE6648A94DBC225A1ECA53F149BCF135AFCAC7E47DF209AC030325E1904AD7D260E236CE56D6753F488E3E489D50A6C2B0E"; --R_C value
-														--R_C is calculated by the formula 2^(16*([Words into RSA_512] + 1) * 2) mod MODULO, in standard case 2^(1056) mod MODULO
+														--R_C is calculated by the formula 2^(RSA_WIDTH*([Words into RSA_512] + 1) * 2) mod MODULO, in standard case 2^(1056) mod MODULO (constant_gen -w RSA_WIDTH)
 																			--If you are going to use this in a real world scenario, please use self-generated keys
+				CRT				: boolean := false;						--Sign with rsa_crt (p, q and d mod p-1, q-1 below, from PAM/ver_B/script/crt_constants.sh)
+				CRT_CORES		: integer := 2;								--2: x^dp and x^dq at the same time on two RSA_top, 1: one after the other
+				PRIME_P			: STD_LOGIC_VECTOR := x"0";				--prime1 of the key, 256 bit
+				PRIME_Q			: STD_LOGIC_VECTOR := x"0";				--prime2
+				EXP_P				: STD_LOGIC_VECTOR := x"0";				--exponent1 (d mod p-1)
+				EXP_Q				: STD_LOGIC_VECTOR := x"0";				--exponent2 (d mod q-1)
+				Q_INV				: STD_LOGIC_VECTOR := x"0";				--coefficient (q^-1 mod p)
+				R_C_P				: STD_LOGIC_VECTOR := x"0";				--2^1056 mod PRIME_P
+				R_C_Q				: STD_LOGIC_VECTOR := x"0";				--2^1056 mod PRIME_Q
+				R_C_P_HALF		: STD_LOGIC_VECTOR := x"0";				--2^544 mod PRIME_P
+				R_C_Q_HALF		: STD_LOGIC_VECTOR := x"0";				--2^544 mod PRIME_Q
+				PUB_EXP			: STD_LOGIC_VECTOR := x"10001";			--publicExponent, rsa_crt checks s^e = x before s goes out
 				--String pointers
 				STRING_PTR_0 : unsigned := to_unsigned(0,6);
 				STRING_PTR_1 : unsigned := to_unsigned(10,6);
@@ -60,7 +76,14 @@ Entity Security_Token_Top_USB is
 				
 				--USB settings
 				Frequency : integer := 100_000_000;
-				BAUD  	 : integer := 115200
+				BAUD  	 : integer := 115200;								--Baud at power on, *S switches to BAUD_1 to BAUD_3
+				BAUD_1  	 : integer := 921_600;
+				BAUD_2  	 : integer := 1_000_000;
+				BAUD_3  	 : integer := 2_500_000;
+				FLOW_CONTROL : boolean := false;						--Hold replies while CTS is high (RTS/CTS wired to the USB UART)
+				BATCH_MAX : integer := 4;								--Max messages signed per PIN (*K or *w slots), the RAM holds BATCH_MAX*64 bytes
+				RSA_CORES : integer := 1;								--RSA_top (rsa_crt with CRT) signing *w slots in parallel, 1 to BATCH_MAX
+				TOKEN_ID  : STD_LOGIC_VECTOR(23 downto 0) := x"48454A"	--ID sent on *I ("HEJ"), give each board of a host its own ID
 				
 );
 
@@ -75,6 +98,8 @@ Entity Security_Token_Top_USB is
 		
 		TXD : out STD_LOGIC;
 		RXD : in STD_LOGIC;
+		CTS : in STD_LOGIC := '0';
+		RTS : out STD_LOGIC;
 
 		RESET : in STD_LOGIC
 		);
@@ -82,18 +107,31 @@ end Security_Token_Top_USB;
 
 architecture USB_behav of Security_Token_Top_USB is 
 	
-constant MemSize : integer := (KEY_LENGTH/8);
+constant MsgSize : integer := (KEY_LENGTH/8);
+constant MemSize : integer := MsgSize*BATCH_MAX;
 constant LCD_CLEAR : STD_LOGIC_VECTOR (1 downto 0) := "00";
 constant LCD_PRINT : STD_LOGIC_VECTOR (1 downto 0) := "01";
 constant LCD_CHANGE: STD_LOGIC_VECTOR (1 downto 0) := "10";
 constant PASSWORD : STD_LOGIC_VECTOR (PIN_LENGTH * 4 - 1 downto 0) := PIN_PSWRD;
 constant MEM_BUS_WIDTH : Integer := integer(ceil(log2(real(MemSize))));
+constant MSG_BUS_WIDTH : Integer := integer(ceil(log2(real(MsgSize)))); --RSA_MEM_ADDR is the address inside one message
 constant RAM_MAX_ADDR: unsigned(MEM_BUS_WIDTH-1 downto 0) := (others => '1');
 constant ROM_MAX_ADDR: unsigned(5 downto 0) := (others => '1');
 
 constant RSA_E : STD_LOGIC_VECTOR(KEY_LENGTH-1 downto 0) := EXPONENT;
 constant RSA_M : STD_LOGIC_VECTOR(KEY_LENGTH-1 downto 0) := MODULO;
 constant RSA_R_C : STD_LOGIC_VECTOR(KEY_LENGTH-1 downto 0) := R_C_VAL;
+constant RSA_WORDS : integer := KEY_LENGTH/RSA_WIDTH; --Words of x, y, m and r_c into RSA_top
+constant CRT_P : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(PRIME_P), KEY_LENGTH/2));
+constant CRT_Q : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(PRIME_Q), KEY_LENGTH/2));
+constant CRT_DP : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(EXP_P), KEY_LENGTH/2));
+constant CRT_DQ : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(EXP_Q), KEY_LENGTH/2));
+constant CRT_Q_INV : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(Q_INV), KEY_LENGTH/2));
+constant CRT_R_C_P : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(R_C_P), KEY_LENGTH/2));
+constant CRT_R_C_Q : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(R_C_Q), KEY_LENGTH/2));
+constant CRT_R_C_P_HALF : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(R_C_P_HALF), KEY_LENGTH/2));
+constant CRT_R_C_Q_HALF : STD_LOGIC_VECTOR(KEY_LENGTH/2-1 downto 0) := std_logic_vector(resize(unsigned(R_C_Q_HALF), KEY_LENGTH/2));
+constant CRT_E : STD_LOGIC_VECTOR(31 downto 0) := std_logic_vector(resize(unsigned(PUB_EXP), 32));
 
 
 
@@ -115,15 +153,48 @@ Signal MODE_SELECT : STD_LOGIC_VECTOR (1 downto 0) := LCD_CLEAR;
 Signal TMP_INPUT : STD_LOGIC_VECTOR (3 downto 0);
 
 Signal RSA_RESET, RSA_DONE, RSA_WE : STD_LOGIC := '0';
-Signal RSA_START_ADDR, RSA_MEM_ADDR : STD_LOGIC_VECTOR (MEM_BUS_WIDTH-1 downto 0) := (others => '0');
+Signal RSA_MEM_ADDR : STD_LOGIC_VECTOR (MSG_BUS_WIDTH-1 downto 0) := (others => '0');
+Signal RSA_RAM_ADDR : UNSIGNED (MEM_BUS_WIDTH-1 downto 0);
+signal RSA_MSG : integer range 0 to BATCH_MAX-1 := 0; --Message in the batch being signed
 Signal RSA_MEM_DATA_IN, RSA_MEM_DATA_OUT : STD_LOGIC_VECTOR(7 downto 0) := (others => '0');
-signal RSA_WORD : integer range 0 to 32 := 0;
+signal RSA_WORD : integer range 0 to RSA_WORDS := 0;
 signal RSA_byte : integer range 0 to 64 := 0;
 
 Signal LCD_INPUT_SELECT : LCD_SELECT := SELECT_ROM;
 
 Signal valid_in, start_in, valid_out : STD_LOGIC;
-Signal x, y, m, r_c, s : STD_LOGIC_VECTOR(15 downto 0);
+Signal x, y, m, r_c, s : STD_LOGIC_VECTOR(RSA_WIDTH-1 downto 0);
+
+--Tagged slots. A *w marks its slot used and waiting, the pool loads it into an idle core,
+--feeds the core like the RSA state does and stores the result back in the slot (done)
+type CORE_STATE is (CORE_IDLE, CORE_FEED, CORE_RUN, CORE_DONE);
+type POOL_XFER_STATE is (XFER_IDLE, XFER_LOAD, XFER_STORE); --RAM transfer, one core at a time
+type CORE_STATE_ARRAY is array (0 to RSA_CORES-1) of CORE_STATE;
+type CORE_WORD_ARRAY is array (0 to RSA_CORES-1) of STD_LOGIC_VECTOR(RSA_WIDTH-1 downto 0);
+type CORE_MSG_ARRAY is array (0 to RSA_CORES-1) of STD_LOGIC_VECTOR(KEY_LENGTH-1 downto 0);
+type CORE_SLOT_ARRAY is array (0 to RSA_CORES-1) of integer range 0 to BATCH_MAX-1;
+type CORE_COUNT_ARRAY is array (0 to RSA_CORES-1) of integer range 0 to RSA_WORDS+9;
+
+constant NO_SLOTS : STD_LOGIC_VECTOR(BATCH_MAX-1 downto 0) := (others => '0');
+constant ALL_SLOTS : STD_LOGIC_VECTOR(BATCH_MAX-1 downto 0) := (others => '1');
+
+Signal CORE_STATES : CORE_STATE_ARRAY := (others => CORE_IDLE);
+Signal CORE_X : CORE_MSG_ARRAY; --Message, then signature, of each core (as RSA_X)
+Signal CORE_SLOT : CORE_SLOT_ARRAY := (others => 0);
+Signal CORE_COUNT : CORE_COUNT_ARRAY := (others => 0);
+Signal POOL_VALID_IN, POOL_START_IN : STD_LOGIC_VECTOR(RSA_CORES-1 downto 0) := (others => '0');
+Signal POOL_X, POOL_Y, POOL_M, POOL_R_C : CORE_WORD_ARRAY;
+Signal CORE_VALID_IN, CORE_START_IN, CORE_VALID_OUT : STD_LOGIC_VECTOR(RSA_CORES-1 downto 0);
+Signal CORE_XW, CORE_Y, CORE_M, CORE_R_C, CORE_S : CORE_WORD_ARRAY;
+
+Signal SLOT_USED, SLOT_WAIT, SLOT_DONE : STD_LOGIC_VECTOR(BATCH_MAX-1 downto 0) := (others => '0');
+Signal POOL_XFER : POOL_XFER_STATE := XFER_IDLE;
+Signal POOL_CORE : integer range 0 to RSA_CORES-1 := 0;
+Signal POOL_SLOT : integer range 0 to BATCH_MAX-1 := 0;
+Signal POOL_BYTE : integer range 0 to MsgSize-1 := 0;
+Signal POOL_RAM, POOL_WE, POOL_ACTIVE : STD_LOGIC;
+Signal POOL_RAM_ADDR : UNSIGNED (MEM_BUS_WIDTH-1 downto 0);
+Signal POOL_MEM_DATA_IN : STD_LOGIC_VECTOR(7 downto 0);
 
 
 component Keyboard 
@@ -164,19 +235,33 @@ end component;
 component USB_TOP is
 	generic ( data_addr_width : integer := MEM_BUS_WIDTH;
 				BAUD_RATE : integer := BAUD; 
+				 BAUD_RATE_1 : integer := BAUD_1;
+				 BAUD_RATE_2 : integer := BAUD_2;
+				 BAUD_RATE_3 : integer := BAUD_3;
 				 CLOCK_RATE : integer := Frequency; 
-				 OVERSAMPLES : integer := 4);
+				 OVERSAMPLES : integer := 4;
+				 FLOW_CONTROL : boolean := FLOW_CONTROL;
+				 batch_max : integer := BATCH_MAX;
+				 token_id : STD_LOGIC_VECTOR(23 downto 0) := TOKEN_ID);
     Port ( CLK : in  STD_LOGIC;
 			  RESET : in STD_LOGIC;
            TXD : out  STD_LOGIC;
            RXD : in  STD_LOGIC;
+           CTS : in  STD_LOGIC;
+           RTS : out  STD_LOGIC;
            RAM_ADDR : out  STD_LOGIC_VECTOR (data_addr_width-1 downto 0);
            RAM_DATA_IN : in  STD_LOGIC_VECTOR (7 downto 0);
            RAM_DATA_OUT : out  STD_LOGIC_VECTOR (7 downto 0);
            RAM_WE : out  STD_LOGIC;
            READY_FOR_DATA : in  STD_LOGIC;
            RSA_DONE : in  STD_LOGIC;
-			  DATA_READY : out STD_LOGIC);
+			  DATA_READY : out STD_LOGIC;
+			  BATCH_SIZE : out STD_LOGIC_VECTOR (7 downto 0);
+			  TAG_FREE : in STD_LOGIC_VECTOR (batch_max-1 downto 0);
+			  TAG_DONE : in STD_LOGIC_VECTOR (batch_max-1 downto 0);
+			  TAG : out STD_LOGIC_VECTOR (7 downto 0);
+			  TAG_WRITTEN : out STD_LOGIC;
+			  RAM_BUSY : out STD_LOGIC);
 end component;
 
 
@@ -214,18 +299,49 @@ component mem_array_ROM is
 end component;
 
 component RSA_top is
+	generic(
+    WIDTH     : integer := 16
+    );
 	port(
     clk       : in  std_logic;
     reset     : in  std_logic;
     valid_in  : in  std_logic;
     start_in  : in  std_logic;
-    x         : in  std_logic_vector(15 downto 0);  -- estos 3 son x^y mod m
-    y         : in  std_logic_vector(15 downto 0);
-    m         : in  std_logic_vector(15 downto 0);
-    r_c       : in  std_logic_vector(15 downto 0);  --constante de montgomery r^2 mod m
+    x         : in  std_logic_vector(WIDTH-1 downto 0);  -- estos 3 son x^y mod m
+    y         : in  std_logic_vector(WIDTH-1 downto 0);
+    m         : in  std_logic_vector(WIDTH-1 downto 0);
+    r_c       : in  std_logic_vector(WIDTH-1 downto 0);  --constante de montgomery r^2 mod m
+    s         : out std_logic_vector(WIDTH-1 downto 0);
+    valid_out : out std_logic;
+    bit_size  : in  std_logic_vector(15 downto 0);  --tamano bit del exponente y (log2(y))
+    words     : in  std_logic_vector(7 downto 0)
+    );
+end component;
+
+component rsa_crt is
+	generic(
+    MODULO     : std_logic_vector(511 downto 0);
+    R_C        : std_logic_vector(511 downto 0);
+    PRIME_P    : std_logic_vector(255 downto 0);
+    PRIME_Q    : std_logic_vector(255 downto 0);
+    EXP_P      : std_logic_vector(255 downto 0);
+    EXP_Q      : std_logic_vector(255 downto 0);
+    Q_INV      : std_logic_vector(255 downto 0);
+    R_C_P      : std_logic_vector(255 downto 0);
+    R_C_Q      : std_logic_vector(255 downto 0);
+    R_C_P_HALF : std_logic_vector(255 downto 0);
+    R_C_Q_HALF : std_logic_vector(255 downto 0);
+    PUB_EXP    : std_logic_vector(31 downto 0);
+    CORES      : integer range 1 to 2 := 2
+    );
+	port(
+    clk       : in  std_logic;
+    reset     : in  std_logic;
+    valid_in  : in  std_logic;
+    x         : in  std_logic_vector(15 downto 0);
     s         : out std_logic_vector(15 downto 0);
     valid_out : out std_logic;
-    bit_size  : in  std_logic_vector(15 downto 0)  --tamano bit del exponente y (log2(y))
+    fault     : out std_logic
     );
 end component;
 
@@ -233,6 +349,10 @@ end component;
 signal RAM_DATA_IN_USB, RAM_DATA_OUT_USB : STD_LOGIC_VECTOR(7 downto 0);
 signal RAM_ADDR_USB : STD_LOGIC_VECTOR(MEM_BUS_WIDTH-1 downto 0);
 signal RAM_WE_USB, READY_FOR_DATA, DATA_READY: STD_LOGIC;
+signal BATCH_SIZE : STD_LOGIC_VECTOR(7 downto 0);
+signal TAG_FREE : STD_LOGIC_VECTOR(BATCH_MAX-1 downto 0);
+signal TAG : STD_LOGIC_VECTOR(7 downto 0);
+signal TAG_WRITTEN, USB_RAM_BUSY : STD_LOGIC;
 
 signal RSA_X : STD_LOGIC_VECTOR (511 downto 0);
 
@@ -256,27 +376,101 @@ USB: USB_TOP Port map (
 	RESET => RESETN,
 	TXD => TXD,
 	RXD => RXD,
+	CTS => CTS,
+	RTS => RTS,
 	RAM_ADDR => RAM_ADDR_USB,
 	RAM_DATA_IN => RAM_DATA_OUT,
 	RAM_DATA_OUT => RAM_DATA_OUT_USB,
 	RAM_WE => RAM_WE_USB,
 	DATA_READY => DATA_READY,
+	BATCH_SIZE => BATCH_SIZE,
 	READY_FOR_DATA => READY_FOR_DATA,
-	RSA_DONE => RSA_DONE);
-
-RSA_MODULE: RSA_top port map(
+	RSA_DONE => RSA_DONE,
+	TAG_FREE => TAG_FREE,
+	TAG_DONE => SLOT_DONE,
+	TAG => TAG,
+	TAG_WRITTEN => TAG_WRITTEN,
+	RAM_BUSY => USB_RAM_BUSY);
+
+assert RSA_CORES >= 1 and RSA_CORES <= BATCH_MAX report "RSA_CORES has to be 1 to BATCH_MAX" severity failure;
+
+--Core 0 also signs *W and *K in the RSA state, the others only take *w slots
+CORES: for k in 0 to RSA_CORES-1 generate
+
+SHARED_CORE: if k = 0 generate
+CORE_VALID_IN(k) <= valid_in when STATE = RSA else POOL_VALID_IN(k);
+CORE_START_IN(k) <= start_in when STATE = RSA else POOL_START_IN(k);
+CORE_XW(k) <= x when STATE = RSA else POOL_X(k);
+CORE_Y(k) <= y when STATE = RSA else POOL_Y(k);
+CORE_M(k) <= m when STATE = RSA else POOL_M(k);
+CORE_R_C(k) <= r_c when STATE = RSA else POOL_R_C(k);
+end generate;
+
+POOL_CORE_ONLY: if k > 0 generate
+CORE_VALID_IN(k) <= POOL_VALID_IN(k);
+CORE_START_IN(k) <= POOL_START_IN(k);
+CORE_XW(k) <= POOL_X(k);
+CORE_Y(k) <= POOL_Y(k);
+CORE_M(k) <= POOL_M(k);
+CORE_R_C(k) <= POOL_R_C(k);
+end generate;
+
+LADDER: if not CRT generate
+RSA_MODULE: RSA_top
+	generic map(
+    WIDTH     => RSA_WIDTH
+    )
+	port map(
     clk       => clk,
     reset     => RESETN,
-    valid_in  => valid_in,
-    start_in  => start_in,
-    x         => x,  -- estos 3 son x^y mod m
-    y         => y,
-    m         => m,
-    r_c       => r_c,  --constante de montgomery r^2 mod m
-    s         => s,
-    valid_out => valid_out,
-    bit_size  => x"0200"  --512 --tamano bit del exponente y (log2(y))
+    valid_in  => CORE_VALID_IN(k),
+    start_in  => CORE_START_IN(k),
+    x         => CORE_XW(k),  -- estos 3 son x^y mod m
+    y         => CORE_Y(k),
+    m         => CORE_M(k),
+    r_c       => CORE_R_C(k),  --constante de montgomery r^2 mod m
+    s         => CORE_S(k),
+    valid_out => CORE_VALID_OUT(k),
+    bit_size  => x"0200",  --512 --tamano bit del exponente y (log2(y))
+    words     => std_logic_vector(to_unsigned(RSA_WORDS, 8))
     );
+end generate;
+
+--start_in, y, m y r_c sobran, rsa_crt tiene la clave en los generics
+CHINESE_REMAINDER: if CRT generate
+assert RSA_WIDTH = 16 report "rsa_crt works on 16 bit words, set RSA_WIDTH to 16" severity failure;
+
+RSA_MODULE: rsa_crt
+	generic map(
+    MODULO     => RSA_M,
+    R_C        => RSA_R_C,
+    PRIME_P    => CRT_P,
+    PRIME_Q    => CRT_Q,
+    EXP_P      => CRT_DP,
+    EXP_Q      => CRT_DQ,
+    Q_INV      => CRT_Q_INV,
+    R_C_P      => CRT_R_C_P,
+    R_C_Q      => CRT_R_C_Q,
+    R_C_P_HALF => CRT_R_C_P_HALF,
+    R_C_Q_HALF => CRT_R_C_Q_HALF,
+    PUB_EXP    => CRT_E,
+    CORES      => CRT_CORES
+    )
+	port map(
+    clk       => clk,
+    reset     => RESETN,
+    valid_in  => CORE_VALID_IN(k),
+    x         => CORE_XW(k),
+    s         => CORE_S(k),
+    valid_out => CORE_VALID_OUT(k),
+    fault     => open  --s comes out as 0 then, the host's verify rejects it
+    );
+end generate;
+
+end generate;
+
+s <= CORE_S(0);
+valid_out <= CORE_VALID_OUT(0);
 		
 
 SCREEN: LCD port map ( 
@@ -319,24 +513,23 @@ mem_array port map(
 		
 INPUT_ASCII <= "0000" & IN_DATA;
 
-with STATE select 
-	RAM_DATA_IN <=
-			RAM_DATA_OUT_USB when GET_INPUT,
-			RSA_MEM_DATA_IN when RSA,
-			RAM_DATA_OUT_USB when others;
-	
-with STATE select
-		RAM_ADDR <= 
-			unsigned(RAM_ADDR_USB) when GET_INPUT,
-			unsigned(RSA_MEM_ADDR) when RSA, --Give the RSA access to the memory when it needs it
-			unsigned(RAM_ADDR_USB) when others; --Otherwise make the USB able to use it
-			
-with STATE select
-		WE <= 
-			RAM_WE_USB when GET_INPUT,
-			RSA_WE when RSA,
-			RAM_WE_USB when others;
+--In GET_INPUT the slot pool has the RAM whenever the USB is between commands
+POOL_RAM <= '1' when STATE = GET_INPUT and USB_RAM_BUSY = '0' else '0';
+
+RAM_DATA_IN <=	RSA_MEM_DATA_IN when STATE = RSA else
+					POOL_MEM_DATA_IN when POOL_RAM = '1' else
+					RAM_DATA_OUT_USB;
+
+RAM_ADDR <= 	RSA_RAM_ADDR when STATE = RSA else --Give the RSA access to the memory when it needs it
+					POOL_RAM_ADDR when POOL_RAM = '1' else
+					unsigned(RAM_ADDR_USB); --Otherwise make the USB able to use it
+
+WE <= 			RSA_WE when STATE = RSA else
+					POOL_WE when POOL_RAM = '1' else
+					RAM_WE_USB;
 	
+RSA_RAM_ADDR <= to_unsigned(RSA_MSG*MsgSize, MEM_BUS_WIDTH) + unsigned(RSA_MEM_ADDR); --Current message in the batch
+
 LCD_INPUT <= 	ROM_DATA when LCD_INPUT_SELECT = SELECT_ROM else --LCD gets data from ROM
 					RAM_DATA_OUT when LCD_INPUT_SELECT = SELECT_RAM else --LCD gets data from RAM
 					ASCII_ENCODED when (LCD_INPUT_SELECT = SELECT_ASCII AND SHOW_PIN) else -- LCD gets data from keyboard and shows the characters (show PIN)
@@ -345,6 +538,129 @@ LCD_INPUT <= 	ROM_DATA when LCD_INPUT_SELECT = SELECT_ROM else --LCD gets data f
 
 RESETN <= NOT RESET or soft_reset; --Invert the reset signal as the input is low when the button is pressed
 
+POOL_RAM_ADDR <= to_unsigned(POOL_SLOT*MsgSize + POOL_BYTE, MEM_BUS_WIDTH);
+POOL_MEM_DATA_IN <= CORE_X(POOL_CORE)(POOL_BYTE*8+7 downto POOL_BYTE*8);
+POOL_WE <= '1' when POOL_XFER = XFER_STORE else '0';
+POOL_ACTIVE <= '0' when (SLOT_USED AND NOT SLOT_DONE) = NO_SLOTS else '1'; --Slots waiting or being signed
+
+--*w only in GET_INPUT and not once a *W or *K has been written
+TAG_FREE <= NOT SLOT_USED when STATE = GET_INPUT and DATA_READY = '0' else NO_SLOTS;
+
+--Slot pool
+process(clk)
+variable found : boolean;
+variable word : integer range 0 to RSA_WORDS-1;
+begin
+	if rising_edge(clk) then
+		if RESETN = '1' then
+			SLOT_USED <= (others => '0');
+			SLOT_WAIT <= (others => '0');
+			SLOT_DONE <= (others => '0');
+			CORE_STATES <= (others => CORE_IDLE);
+			CORE_COUNT <= (others => 0);
+			POOL_VALID_IN <= (others => '0');
+			POOL_START_IN <= (others => '0');
+			POOL_XFER <= XFER_IDLE;
+			POOL_BYTE <= 0;
+		else
+		
+			if TAG_WRITTEN = '1' then --A *w has filled slot TAG
+				SLOT_USED(to_integer(unsigned(TAG))) <= '1';
+				SLOT_WAIT(to_integer(unsigned(TAG))) <= '1';
+			end if;
+			
+			--RAM transfers, a byte each cycle the USB leaves the RAM to us
+			case POOL_XFER is
+				when XFER_IDLE =>
+					found := false;
+					POOL_BYTE <= 0;
+					for k in 0 to RSA_CORES-1 loop --Results first, they free a core
+						if not found and CORE_STATES(k) = CORE_DONE then
+							found := true;
+							POOL_CORE <= k;
+							POOL_SLOT <= CORE_SLOT(k);
+							POOL_XFER <= XFER_STORE;
+						end if;
+					end loop;
+					for t in 0 to BATCH_MAX-1 loop --Then the lowest waiting slot to the lowest idle core
+						for k in 0 to RSA_CORES-1 loop
+							if not found and SLOT_WAIT(t) = '1' and CORE_STATES(k) = CORE_IDLE then
+								found := true;
+								POOL_CORE <= k;
+								POOL_SLOT <= t;
+								CORE_SLOT(k) <= t;
+								SLOT_WAIT(t) <= '0';
+								POOL_XFER <= XFER_LOAD;
+							end if;
+						end loop;
+					end loop;
+				
+				when XFER_LOAD =>
+					if POOL_RAM = '1' then
+						CORE_X(POOL_CORE)(POOL_BYTE*8+7 downto POOL_BYTE*8) <= RAM_DATA_OUT;
+						if POOL_BYTE = MsgSize-1 then
+							CORE_STATES(POOL_CORE) <= CORE_FEED;
+							CORE_COUNT(POOL_CORE) <= 0;
+							POOL_XFER <= XFER_IDLE;
+						else
+							POOL_BYTE <= POOL_BYTE + 1;
+						end if;
+					end if;
+				
+				when XFER_STORE =>
+					if POOL_RAM = '1' then --POOL_WE writes the byte this cycle
+						if POOL_BYTE = MsgSize-1 then
+							SLOT_DONE(POOL_SLOT) <= '1';
+							CORE_STATES(POOL_CORE) <= CORE_IDLE;
+							POOL_XFER <= XFER_IDLE;
+						else
+							POOL_BYTE <= POOL_BYTE + 1;
+						end if;
+					end if;
+			end case;
+			
+			--The cores. Same timing as the RSA state: n_c from the low word of m at start_in,
+			--the words 9 cycles later. rsa_crt takes only x
+			for k in 0 to RSA_CORES-1 loop
+				case CORE_STATES(k) is
+					when CORE_FEED =>
+						POOL_START_IN(k) <= '0';
+						if CORE_COUNT(k) < RSA_WORDS+9 then
+							CORE_COUNT(k) <= CORE_COUNT(k) + 1;
+						end if;
+						if CORE_COUNT(k) = 0 then
+							POOL_M(k) <= RSA_M(RSA_WIDTH-1 downto 0);
+							POOL_START_IN(k) <= '1';
+						elsif CORE_COUNT(k) > 8 and CORE_COUNT(k) < RSA_WORDS+9 then
+							word := CORE_COUNT(k) - 9;
+							POOL_X(k) <= CORE_X(k)(word*RSA_WIDTH+RSA_WIDTH-1 downto word*RSA_WIDTH);
+							POOL_Y(k) <= RSA_E(word*RSA_WIDTH+RSA_WIDTH-1 downto word*RSA_WIDTH);
+							POOL_M(k) <= RSA_M(word*RSA_WIDTH+RSA_WIDTH-1 downto word*RSA_WIDTH);
+							POOL_R_C(k) <= RSA_R_C(word*RSA_WIDTH+RSA_WIDTH-1 downto word*RSA_WIDTH);
+							POOL_VALID_IN(k) <= '1';
+						elsif CORE_COUNT(k) = RSA_WORDS+9 then
+							POOL_VALID_IN(k) <= '0';
+							CORE_COUNT(k) <= 0;
+							CORE_STATES(k) <= CORE_RUN;
+						end if;
+					
+					when CORE_RUN => --Collect s over the message, as in the RSA state
+						if CORE_VALID_OUT(k) = '1' then
+							CORE_X(k)(CORE_COUNT(k)*RSA_WIDTH+RSA_WIDTH-1 downto CORE_COUNT(k)*RSA_WIDTH) <= CORE_S(k);
+							if CORE_COUNT(k) = RSA_WORDS-1 then
+								CORE_STATES(k) <= CORE_DONE;
+							else
+								CORE_COUNT(k) <= CORE_COUNT(k) + 1;
+							end if;
+						end if;
+					
+					when others => --Idle, or done and waiting for XFER_STORE
+				end case;
+			end loop;
+		end if;
+	end if;
+end process;
+
 --State changes
 process(clk)
 begin
@@ -364,6 +680,7 @@ begin
 			RSA_DONE <= '0';
 			RSA_X <= (others => '0');
 			RSA_MEM_ADDR <= (others => '0');
+			RSA_MSG <= 0;
 			RSA_BYTE <= 0;
 			RSA_WORD <= 0;
 			RSA_MEM_DATA_IN <= (others => '0');
@@ -511,17 +828,31 @@ begin
 ------------------------------------------------------------------------------
 				when GET_INPUT => 
 		
-					READY_FOR_DATA <= '1'; --Signal the USB-controller that we are ready for loading the RAM with data
+					if SLOT_USED = NO_SLOTS then
+						READY_FOR_DATA <= '1'; --Signal the USB-controller that we are ready for loading the RAM with data
+					else
+						READY_FOR_DATA <= '0'; --*w slots in the RAM, no *W or *K until the next PIN
+					end if;
 					RSA_DONE <= '0'; --Signal the USB-controller that the RSA is NOT done
 					flag <= '1';
-					timeout_timer <= timeout_timer + 1;
+					
+					if TAG_WRITTEN = '1' or POOL_ACTIVE = '1' then --The timeout counts from the last *w or signature
+						timeout_timer <= 0;
+					else
+						timeout_timer <= timeout_timer + 1;
+					end if;
 					
 					if timeout_timer = timeout_seconds * frequency then
 						SOFT_RESET <= '1';
+					elsif SLOT_DONE = ALL_SLOTS then --Every slot signed, the PIN is used up. *r works until the key press
+						READY_FOR_DATA <= '0';
+						STATE <= PRINT_MSG_2;
+						flag <= '0';
 					elsif DATA_READY = '1' and flag = '1' then --Data recieved. (and one cycle extra passed to let things catch up in a loop scenario)
 						STATE <= RSA;			 --Perform the RSA
 						READY_FOR_DATA <= '0';--And set so the USB can't write to the RAM anymore
 						RSA_MEM_ADDR <= (others => '0'); --reset the RSA_MEM_ADDR pointer
+						RSA_MSG <= 0; --start with the first message of the batch
 						READY_FOR_DATA <= '0';
 						STATE <= RSA;
 						flag <= '0';
@@ -547,29 +878,29 @@ begin
 					end if;
 					
 						
-						if RSA_WORD = 32 then
+						if RSA_WORD = RSA_WORDS then
 							valid_in <= '0';
 						end if;					
 					if flag = '0' then --The loading of the RSA module
 						if RSA_MEM_ADDR < 31-8 then --preload the n_c value for the RSA init-sequence
-							m(15 downto 0) <= RSA_M(15 downto 0);
+							m <= RSA_M(RSA_WIDTH-1 downto 0);
 						elsif RSA_MEM_ADDR = 31 - 8 then --Start the init-sequence when half-6 bytes are loaded to the register
 							start_in <= '1';
 						elsif RSA_MEM_ADDR <= 31 then --Set the flag low again and wait for 6 cycles
 							start_in <= '0';
-						elsif RSA_MEM_ADDR > 31 and RSA_WORD < 32 then --Start loading the RSA_512
+						elsif RSA_MEM_ADDR > 31 and RSA_WORD < RSA_WORDS then --Start loading the RSA_512
 							
-							x <= RSA_X(RSA_WORD*16+15 downto RSA_WORD*16);		--Message value
+							x <= RSA_X(RSA_WORD*RSA_WIDTH+RSA_WIDTH-1 downto RSA_WORD*RSA_WIDTH);		--Message value
 							
 							
-							y <= RSA_E(RSA_WORD*16+15 downto RSA_WORD*16);		--Key value
-							m <= RSA_M(RSA_WORD*16+15 downto RSA_WORD*16);		--Modulo value
-							r_c <= RSA_R_C(RSA_WORD*16+15 downto RSA_WORD*16);	--R_C value
+							y <= RSA_E(RSA_WORD*RSA_WIDTH+RSA_WIDTH-1 downto RSA_WORD*RSA_WIDTH);		--Key value
+							m <= RSA_M(RSA_WORD*RSA_WIDTH+RSA_WIDTH-1 downto RSA_WORD*RSA_WIDTH);		--Modulo value
+							r_c <= RSA_R_C(RSA_WORD*RSA_WIDTH+RSA_WIDTH-1 downto RSA_WORD*RSA_WIDTH);	--R_C value
 						
 							valid_in <= '1'; --Valid data in flag
 							
 							RSA_WORD <= RSA_WORD + 1; --inc the pointer
-							if RSA_WORD = 31 then
+							if RSA_WORD = RSA_WORDS-1 then
 							     --notihing
 							end if;
 						else
@@ -587,13 +918,13 @@ begin
 					else --Writing to memory
 						
 						
-						if RSA_WORD < 32 AND valid_out = '1' then --if not the final byte from RSA_512 result (s)
-							RSA_X(RSA_WORD*16+15 downto RSA_WORD*16) <= s; --save it in the register
+						if RSA_WORD < RSA_WORDS AND valid_out = '1' then --if not the final byte from RSA_512 result (s)
+							RSA_X(RSA_WORD*RSA_WIDTH+RSA_WIDTH-1 downto RSA_WORD*RSA_WIDTH) <= s; --save it in the register
 							RSA_WORD <= RSA_WORD + 1; --inc the pointer
 							input_counter <= (others => '0');
 							RSA_MEM_ADDR <= (others => '1'); --Set this to max to overflow back to 0 and thus inserting the correct number in that cell
 							RSA_BYTE <= 0;
-						elsif RSA_WORD = 32 then --start writing back to RAM
+						elsif RSA_WORD = RSA_WORDS then --start writing back to RAM
 							
 							if RSA_BYTE < 64 then --If we haven't written the entire result to memory
 								RSA_MEM_ADDR <= RSA_MEM_ADDR + 1; --increase the addr
@@ -603,11 +934,17 @@ begin
 							else --everything written back
 								RSA_WE <= '0'; --stop writing
 								flag <= '0'; --reset this flag
-								RSA_DONE <= '1'; --The result is done and in memory. Tell USB-cmd so
-								STATE <= PRINT_MSG_2; --move on
 								RSA_BYTE <= 0;
 								RSA_WORD <= 0;
 								
+								if RSA_MSG < to_integer(unsigned(BATCH_SIZE)) - 1 then --More messages in the batch, load the next one
+									RSA_MSG <= RSA_MSG + 1;
+									RSA_MEM_ADDR <= (others => '0');
+								else
+									RSA_DONE <= '1'; --The result is done and in memory. Tell USB-cmd so
+									STATE <= PRINT_MSG_2; --move on
+								end if;
+								
 							end if;
 						end if;
 					end if;
@@ -22,28 +22,53 @@ use IEEE.STD_LOGIC_UNSIGNED.ALL;
 use IEEE.NUMERIC_STD.ALL;
 
 entity TXD_Controller is
-	 Generic (BAUD_RATE : integer; --Baud of this port
+	 Generic (BAUD_RATE : integer; --Baud of this port at power on (BAUD_SEL "00")
+				 BAUD_RATE_1 : integer := 921_600; --Bauds selected by BAUD_SEL "01", "10" and "11"
+				 BAUD_RATE_2 : integer := 1_000_000;
+				 BAUD_RATE_3 : integer := 2_500_000;
 				 CLOCK_RATE : integer; --Frequency of the CLK. Needed to perform correct sampling
-				 OVERSAMPLES : integer := 4);
+				 OVERSAMPLES : integer := 4;
+				 FLOW_CONTROL : boolean := false); --If true no byte is started while CTS is high
 				 
     Port ( CLK : in  STD_LOGIC; --Global clock	
 			  RESET : in STD_LOGIC; --reset signal (synchronous)
            TXD_PIN : out  STD_LOGIC; --data pin
            FIFO_DATA_IN : in  STD_LOGIC_VECTOR (7 downto 0); --byte from FIFO
            FIFO_READ : out  STD_LOGIC; --Read next signal to the FIFO
-           FIFO_EMPTY : in  STD_LOGIC); --Flag from FIFO to signal if the FIFO is empty or not
+           FIFO_EMPTY : in  STD_LOGIC; --Flag from FIFO to signal if the FIFO is empty or not
+           BAUD_SEL : in STD_LOGIC_VECTOR(1 downto 0) := "00"; --Baud to use, taken when idle (between bytes)
+           CTS : in STD_LOGIC := '0'); --Clear to send from the PC side (active low), only used with FLOW_CONTROL
 end TXD_Controller;
 
 --This module handles transmission of bytes (8 bit) from a FIFO to a serial port (UART)
 
 architecture Behavioral of TXD_Controller is
 
+--Clock cycles per sample at a baud rate (rounded), the counter passes it once per sample
+function SAMPLE_CYCLES(BAUD : integer) return integer is
+begin
+	return (CLOCK_RATE + BAUD*OVERSAMPLES/2)/(BAUD*OVERSAMPLES) - 1;
+end SAMPLE_CYCLES;
+
+--Sample cycles of the rate chosen by BAUD_SEL (*S command)
+function SELECTED_RATE(SEL : STD_LOGIC_VECTOR(1 downto 0)) return integer is
+begin
+	case SEL is
+		when "01" => return SAMPLE_CYCLES(BAUD_RATE_1);
+		when "10" => return SAMPLE_CYCLES(BAUD_RATE_2);
+		when "11" => return SAMPLE_CYCLES(BAUD_RATE_3);
+		when others => return SAMPLE_CYCLES(BAUD_RATE);
+	end case;
+end SELECTED_RATE;
+
 type STATES is (IDLE, START, DATA, STOP);
 signal STATE : STATES := IDLE;
 signal SAMPLE_COUNTER : integer := 0;
 signal SAMPLE_COUNT : integer range 0 to OVERSAMPLES := 1;
 signal bit_counter : integer range 0 to 8 := 0;
 signal SAMPLE_NOW, BYTE_SENT, over_sampling_done : STD_LOGIC := '0';
+signal RATE_OF_SAMPLING : integer := SAMPLE_CYCLES(BAUD_RATE); --How many cycles beween each sample
+signal SEND_OK : STD_LOGIC; --A new byte may be started
 
 
 begin
@@ -51,7 +76,6 @@ begin
 
 oversampler: process (CLK) 
 
-	constant RATE_OF_SAMPLING : integer := CLOCK_RATE/BAUD_RATE/OVERSAMPLES; --How many cycles beween each sample
 	variable CURRENT_SAMPLE_COUNTER : integer := 0;
 
 	
@@ -78,10 +102,14 @@ oversampler: process (CLK)
 					end if;
 					
 				end if;
+			else --IDLE, baud may only change between bytes
+				RATE_OF_SAMPLING <= SELECTED_RATE(BAUD_SEL);
 			end if;
 		end if;
 	end process;
 	
+SEND_OK <= '1' when FIFO_EMPTY = '0' and (not FLOW_CONTROL or CTS = '0') else '0';
+
 State_process: process (CLK)
 
 begin
@@ -95,7 +123,7 @@ begin
 			case STATE is
 			
 				when IDLE => 
-					if FIFO_EMPTY = '0' then --Do nothing until there's a byte in the FIFO to work on
+					if SEND_OK = '1' then --Do nothing until there's a byte in the FIFO to work on (and the PC is ready)
 						STATE <= START;
 						FIFO_READ <= '1'; --Read the byte from FIFO. Data will remain on FIFO_DATA_IN
 						
@@ -114,7 +142,7 @@ begin
 				when STOP =>
 				
 				if over_sampling_done = '1' then
-					if FIFO_EMPTY = '1' then --FIFO empty, return to idle
+					if SEND_OK = '0' then --FIFO empty (or PC not ready), return to idle
 						STATE <= IDLE;
 					else 							--FIFO not empty, return to start
 						STATE <= START;
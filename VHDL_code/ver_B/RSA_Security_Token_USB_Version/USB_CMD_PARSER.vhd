@@ -25,7 +25,9 @@ use IEEE.NUMERIC_STD.all;
 
 entity USB_CMD_PARSER is
 	generic ( data_addr_width : integer;
-				 Frequency : integer);
+				 Frequency : integer;
+				 batch_max : integer := 1;													--Max number of messages in one *K batch. The RAM must hold batch_max*64 bytes
+				 token_id : STD_LOGIC_VECTOR(23 downto 0) := x"48454A");			--3 byte ID sent on *I, HEJ by default. Lets a host tell several tokens apart
     Port ( RXD_BYTE 			: in  STD_LOGIC_VECTOR (7 downto 0);						--Input byte from the serial-to-parallell translator
            TXD_BYTE 			: out STD_LOGIC_VECTOR (7 downto 0);						--Output byte to the parallell-to-serial translator
            RAM_ADDR 			: out STD_LOGIC_VECTOR (data_addr_width-1 downto 0) := (others => '1');	--RAM ADDR where the RSA (signed) message is
@@ -39,7 +41,14 @@ entity USB_CMD_PARSER is
 			  RESET 				: in 	STD_LOGIC;													--Reset for module. When high all registers and counters resets at next high flank of the clock
            CLK 				: in  STD_LOGIC;													--Global clock signal
 			  DATA_READY		: out STD_LOGIC := '0';													--Flag for 64 byte recieved
-			  FIFO_EMPTY		: in 	STD_LOGIC);
+			  BATCH_SIZE		: out STD_LOGIC_VECTOR (7 downto 0) := x"01";				--Number of 64 byte messages in RAM when DATA_READY is high
+			  FIFO_EMPTY		: in 	STD_LOGIC;
+			  BAUD_SEL			: out STD_LOGIC_VECTOR (1 downto 0) := "00";				--Baud for RXD/TXD set by *S, "00" is the power on baud
+			  TAG_FREE			: in 	STD_LOGIC_VECTOR (batch_max-1 downto 0) := (others => '0');	--Slot t can take a *w
+			  TAG_DONE			: in 	STD_LOGIC_VECTOR (batch_max-1 downto 0) := (others => '0');	--Slot t holds a signature for *r
+			  TAG					: out STD_LOGIC_VECTOR (7 downto 0) := x"00";				--Slot of the last *w
+			  TAG_WRITTEN		: out STD_LOGIC := '0';											--One cycle pulse when a *w has filled its slot
+			  RAM_BUSY			: out STD_LOGIC);													--High while a command runs. The RAM may be used by others when low
 end USB_CMD_PARSER;
 
 
@@ -48,11 +57,21 @@ end USB_CMD_PARSER;
 --The commands are all this module accepts, and any other data recieved is disgarded.
 --Everything that is to be sent is put in the TXD_FIFO in order of how it should be sent.
 --The commands are all on the form '*' followed by the command specific character, and are as follows:
---*I - Request ID. The parser will respond with *IHEJ
+--*I - Request ID. The parser will respond with *I and the 3 byte token_id (*IHEJ by default)
 --*W[64 byte] - Write request. Depending on READY_FOR_DATA flag, this will either 
 --respond with *B for "busy" or *D when all 64 bytes has been written to memory
 --*R -- Request encrypted data. Depending on DATA_READY flag, this will either 
 --respond with *B for "busy" or *M[64 bytes], where the 64 bytes are the encrypted data
+--*K[n][n*64 byte] - Batch write request, n messages (1 to batch_max) back to back in RAM.
+--Responds like *W, *B is also sent if n is out of range
+--*Q -- Request a batch. Responds with *B for "busy" or *Q[n][n*64 bytes]. Each 64 byte
+--message is put in the TXD_FIFO when it is empty, so the FIFO only needs room for one message
+--*S[n] - Set baud n (0 to 3, 0 is the power on baud). Responds *S[n] at the old baud and switches 
+--once it is sent. If no command is recieved at the new baud within half a second it goes back to 0.
+--Responds *B if n is out of range
+--*w[t][64 byte] - Tagged write to slot t (0 to batch_max-1) at t*64 in RAM. Responds *D when written,
+--*B if t is out of range or the slot is not free. Slots are signed in parallel, see TAG_FREE/TAG_DONE
+--*r[t] - Tagged read. Responds *m[t][64 bytes] if slot t is signed, *B otherwise. Any order
 --In certain cases if data is either not recieved or not provided, the module will respond
 --with *T for timeout
 architecture Behavioral of USB_CMD_PARSER is
@@ -68,15 +87,23 @@ constant ASCII_R : STD_LOGIC_VECTOR(7 downto 0) := x"52";		--R
 constant ASCII_M : STD_LOGIC_VECTOR(7 downto 0) := x"4D";		--M
 constant ASCII_I : STD_LOGIC_VECTOR(7 downto 0) := x"49";		--I
 constant ASCII_T : STD_LOGIC_VECTOR(7 downto 0) := x"54";		--T
+constant ASCII_K : STD_LOGIC_VECTOR(7 downto 0) := x"4B";		--K
+constant ASCII_Q : STD_LOGIC_VECTOR(7 downto 0) := x"51";		--Q
+constant ASCII_S : STD_LOGIC_VECTOR(7 downto 0) := x"53";		--S
+constant ASCII_W_LOW : STD_LOGIC_VECTOR(7 downto 0) := x"77";	--w
+constant ASCII_R_LOW : STD_LOGIC_VECTOR(7 downto 0) := x"72";	--r
+constant ASCII_M_LOW : STD_LOGIC_VECTOR(7 downto 0) := x"6D";	--m
+
+constant MSG_BYTES : integer := 64; --Bytes in one message
 
 --No. They are not in alphabetical order. Deal with it
 
 type STATES is (IDLE, TRANSLATE_CMD, DO_CMD); --States for the overarching functionality
-type CMDS	is (TIMEOUT, RECIVE_DATA, TRANSMIT_DATA, TRANSMIT_ID, TRANSMIT_BUSY); --Depending on flags and inputs different commands are to be executed
+type CMDS	is (TIMEOUT, RECIVE_DATA, TRANSMIT_DATA, TRANSMIT_ID, TRANSMIT_BUSY, RECIVE_BATCH, TRANSMIT_BATCH, SET_BAUD, RECIVE_TAGGED, TRANSMIT_TAGGED); --Depending on flags and inputs different commands are to be executed
 
 signal TIMEOUT_COUNTER : integer range 0 to Frequency/2 := 0;
 
-signal BYTE_COUNTER : unsigned (7 downto 0) := (others => '0'); --Counter to keep track of what byte in memory to read/write
+signal BYTE_COUNTER : unsigned (data_addr_width downto 0) := (others => '0'); --Counter to keep track of what byte in memory to read/write
 signal HEADER_COUNTER : unsigned (1 downto 0) := (others => '0'); --counter to keep track of if an * or a message specific char is to be sent
 
 signal STATE : STATES := IDLE;
@@ -85,10 +112,21 @@ signal CMD : CMDS;
 signal flag : std_logic := '0';
 
 Signal DATA_READY_S : STD_LOGIC;
+Signal BATCH_COUNT : unsigned(7 downto 0) := (others => '0'); --Number of messages in the *K being recieved
+Signal BATCH_SIZE_S : STD_LOGIC_VECTOR(7 downto 0) := x"01"; --Number of messages in RAM
+Signal BAUD_REQ : unsigned(7 downto 0) := (others => '0'); --Baud number in the *S being recieved
+Signal BAUD_SEL_S : STD_LOGIC_VECTOR(1 downto 0) := "00";
+Signal BAUD_CONFIRMED : STD_LOGIC := '1'; --Low from a *S switch until a command is recieved at the new baud
+signal CONFIRM_COUNTER : integer range 0 to Frequency/2 := 0;
+Signal TAG_S : unsigned(7 downto 0) := (others => '0'); --Slot in the *w/*r being handled
 	
 begin
 
 DATA_READY <= DATA_READY_S;
+BATCH_SIZE <= BATCH_SIZE_S;
+BAUD_SEL <= BAUD_SEL_S;
+TAG <= STD_LOGIC_VECTOR(TAG_S);
+RAM_BUSY <= '0' when STATE = IDLE else '1';
 
 process(clk) 
 
@@ -112,6 +150,8 @@ procedure TRANSLATE
 	signal RAM_ADDR : out STD_LOGIC_VECTOR(data_addr_width-1 downto 0)) is
 	begin
 	
+	BAUD_CONFIRMED <= '1'; --A command that parses means the PC talks at our baud
+	
 	case DATA is
 	
 		--Write request
@@ -137,14 +177,50 @@ procedure TRANSLATE
 				CMD <= TRANSMIT_BUSY;
 			end if;
 			
+		--Batch write request, same as *W
+		when ASCII_K =>
+			STATE <= DO_CMD;
+			
+			if READY_FOR_DATA = '1' then
+				CMD <= RECIVE_BATCH;
+			else
+				CMD <= TRANSMIT_BUSY;
+			end if;
+		
+		--Batch request of data from the PC, same as *R
+		when ASCII_Q =>
+			STATE <= DO_CMD;
+			
+			if RSA_DONE = '1' AND FIFO_EMPTY = '1' then
+				CMD <= TRANSMIT_BATCH;
+				RAM_ADDR <= (others => '0');
+			else
+				CMD <= TRANSMIT_BUSY;
+			end if;
+			
 		--Request of ID-sequence from the PC	
 		when ASCII_I =>
 			STATE <= DO_CMD;
 			CMD <= TRANSMIT_ID;
 			
+		--Tagged write and read, the tag byte and the slot are checked in DO_CMD
+		when ASCII_W_LOW =>
+			STATE <= DO_CMD;
+			CMD <= RECIVE_TAGGED;
+		
+		when ASCII_R_LOW =>
+			STATE <= DO_CMD;
+			CMD <= TRANSMIT_TAGGED;
+			
+		--Baud change request from the PC
+		when ASCII_S =>
+			STATE <= DO_CMD;
+			CMD <= SET_BAUD;
+			
 		--Illegal command. Go back to idle	
 		when others => 
 			STATE <= IDLE;
+			BAUD_CONFIRMED <= BAUD_CONFIRMED; --Garbage does not confirm a baud
 		
 	end case;
 end TRANSLATE;
@@ -152,7 +228,7 @@ end TRANSLATE;
 --Procedure for DO_CMD state
 procedure DO_CMD
 	(DATA : in STD_LOGIC_VECTOR(7 downto 0); 						--Data form RXD as input
-	 BYTE_COUNT : in unsigned(7 downto 0); 	--Byte_counter as input
+	 BYTE_COUNT : in unsigned(data_addr_width downto 0); 	--Byte_counter as input
 	 HEADER_COUNT : in unsigned(1 downto 0);						--Header_counter as input
 	 CMD  : in CMDS;														--current CMD as input
 	 VALID_DATA_IN : in STD_LOGIC;									--VALID_DATA_IN as input
@@ -162,7 +238,7 @@ procedure DO_CMD
 	signal RAM_ADDR : out STD_LOGIC_VECTOR(data_addr_width-1 downto 0); --May change RAM_ADDR 
 	signal RAM_WE, VALID_DATA_OUT : out STD_LOGIC;							--May change WE and VALID flags
 	signal RAM_DATA_OUT, TXD_BYTE : out STD_LOGIC_VECTOR (7 downto 0);--May change RAM_DATA_OUT and TXD 
-	signal BYTE_COUNTER : out unsigned(7 downto 0);	--May change the counters
+	signal BYTE_COUNTER : out unsigned(data_addr_width downto 0);	--May change the counters
 	signal HEADER_COUNTER : out unsigned(1 downto 0)) is
 	begin
 
@@ -179,6 +255,7 @@ procedure DO_CMD
 				VALID_DATA_OUT <= '1';
 				
 				DATA_READY_S <= '1';
+				BATCH_SIZE_S <= x"01";
 				if header_count_var = 0 then -- When the message is recived, tell the PC by sending *D
 					TXD_BYTE <= ASCII_ASTERISK;
 					HEADER_COUNTER <= HEADER_COUNT + 1;
@@ -191,7 +268,7 @@ procedure DO_CMD
 				
 			elsif VALID_DATA_IN = '1' then  --Write the current number to the current cell in memory
 				DATA_READY_S <= '0';
-				RAM_ADDR <= STD_LOGIC_VECTOR(BYTE_COUNT(5 downto 0));
+				RAM_ADDR <= STD_LOGIC_VECTOR(resize(BYTE_COUNT, data_addr_width));
 				RAM_DATA_OUT <= DATA;
 				RAM_WE <= '1';
 	
@@ -221,7 +298,197 @@ procedure DO_CMD
 				
 			else --Put the data to the serial out
 				
-				RAM_ADDR <= STD_LOGIC_VECTOR(BYTE_COUNT(5 downto 0));
+				RAM_ADDR <= STD_LOGIC_VECTOR(resize(BYTE_COUNT, data_addr_width));
+				TXD_BYTE <= RAM_DATA_IN;
+				BYTE_COUNTER <= BYTE_COUNT + 1;
+			
+			end if;
+		
+		--Recieve batch case. The first byte is the number of messages, then write them to the RAM
+		when RECIVE_BATCH =>
+		
+			if HEADER_COUNT_var = 0 then
+				if VALID_DATA_IN = '1' then
+					BATCH_COUNT <= unsigned(DATA);
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				end if;
+			
+			elsif BATCH_COUNT = 0 OR BATCH_COUNT > batch_max then --No room for that many messages, tell the PC by sending *B
+				VALID_DATA_OUT <= '1';
+				if HEADER_COUNT_var = 1 then
+					TXD_BYTE <= ASCII_ASTERISK;
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				else
+					TXD_BYTE <= ASCII_B;
+					HEADER_COUNTER <= (others => '0');
+					STATE <= IDLE;
+				end if;
+			
+			elsif BYTE_COUNT_var > to_integer(BATCH_COUNT)*MSG_BYTES-1 then --all bytes have been written
+				
+				RAM_ADDR <= (others => '1'); --Reset signals that are not used anymore
+				RAM_WE <= '0';
+				RAM_DATA_OUT <= (others => '0');
+				
+				VALID_DATA_OUT <= '1';
+				
+				DATA_READY_S <= '1';
+				BATCH_SIZE_S <= STD_LOGIC_VECTOR(BATCH_COUNT);
+				if HEADER_COUNT_var = 1 then -- When the batch is recived, tell the PC by sending *D
+					TXD_BYTE <= ASCII_ASTERISK;
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				else
+					TXD_BYTE <= ASCII_D;
+					HEADER_COUNTER <= (others => '0');
+					STATE <= IDLE;
+					BYTE_COUNTER <= (others => '0');
+				end if;
+			
+			elsif VALID_DATA_IN = '1' then --Write the current number to the current cell in memory
+				DATA_READY_S <= '0';
+				RAM_ADDR <= STD_LOGIC_VECTOR(resize(BYTE_COUNT, data_addr_width));
+				RAM_DATA_OUT <= DATA;
+				RAM_WE <= '1';
+				
+				BYTE_COUNTER <= BYTE_COUNT + 1; --inc the RAM ptr
+			
+			end if;
+		
+		--Transmit batch case. Write *Q, the number of messages and then the messages in RAM to the port
+		--RAM_ADDR is kept equal to BYTE_COUNTER, so RAM_DATA_IN is always the byte to send next
+		when TRANSMIT_BATCH =>
+			VALID_DATA_OUT <= '1';
+			if HEADER_COUNT_var = 0 then
+				TXD_BYTE <= ASCII_ASTERISK;
+				HEADER_COUNTER <= HEADER_COUNT + 1;
+			
+			elsif HEADER_COUNT_var = 1 then
+				TXD_BYTE <= ASCII_Q;
+				HEADER_COUNTER <= HEADER_COUNT + 1;
+			
+			elsif HEADER_COUNT_var = 2 then
+				TXD_BYTE <= BATCH_SIZE_S;
+				HEADER_COUNTER <= HEADER_COUNT + 1;
+			
+			elsif BYTE_COUNT_var > to_integer(unsigned(BATCH_SIZE_S))*MSG_BYTES-1 then --all bytes has been transmitted
+				VALID_DATA_OUT <= '0';
+				STATE <= IDLE;
+				RAM_ADDR <= (others => '0');
+				BYTE_COUNTER <= (others => '0');
+				HEADER_COUNTER <= (others => '0');
+			
+			elsif BYTE_COUNT_var mod MSG_BYTES = 0 AND BYTE_COUNT_var > 0 AND FIFO_EMPTY = '0' then --Next message, wait until the previous one is sent
+				VALID_DATA_OUT <= '0';
+			
+			else --Put the data to the serial out
+				
+				RAM_ADDR <= STD_LOGIC_VECTOR(resize(BYTE_COUNT + 1, data_addr_width));
+				TXD_BYTE <= RAM_DATA_IN;
+				BYTE_COUNTER <= BYTE_COUNT + 1;
+			
+			end if;
+		
+		--Recieve tagged case. The first byte is the slot, then write the 64 bytes to the slot
+		when RECIVE_TAGGED =>
+		
+			if HEADER_COUNT_var = 0 then
+				VALID_DATA_OUT <= '0';
+				if VALID_DATA_IN = '1' then
+					TAG_S <= unsigned(DATA);
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				end if;
+			
+			elsif TAG_S > batch_max-1 OR TAG_FREE(to_integer(TAG_S)) = '0' then --No such slot or still in use, *B
+				VALID_DATA_OUT <= '1';
+				if HEADER_COUNT_var = 1 then
+					TXD_BYTE <= ASCII_ASTERISK;
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				else
+					TXD_BYTE <= ASCII_B;
+					HEADER_COUNTER <= (others => '0');
+					STATE <= IDLE;
+				end if;
+			
+			elsif BYTE_COUNT_var > MSG_BYTES-1 then --all bytes have been written
+				
+				RAM_ADDR <= (others => '1'); --Reset signals that are not used anymore
+				RAM_WE <= '0';
+				RAM_DATA_OUT <= (others => '0');
+				
+				VALID_DATA_OUT <= '1';
+				if HEADER_COUNT_var = 1 then
+					TXD_BYTE <= ASCII_ASTERISK;
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				else
+					TXD_BYTE <= ASCII_D;
+					TAG_WRITTEN <= '1'; --Hand the slot to the RSA cores
+					HEADER_COUNTER <= (others => '0');
+					STATE <= IDLE;
+					BYTE_COUNTER <= (others => '0');
+				end if;
+			
+			elsif VALID_DATA_IN = '1' then --Write the current number to the current cell in the slot
+				VALID_DATA_OUT <= '0';
+				RAM_ADDR <= STD_LOGIC_VECTOR(resize(TAG_S*MSG_BYTES + BYTE_COUNT, data_addr_width));
+				RAM_DATA_OUT <= DATA;
+				RAM_WE <= '1';
+				
+				BYTE_COUNTER <= BYTE_COUNT + 1; --inc the RAM ptr
+			
+			end if;
+		
+		--Transmit tagged case. Read the slot, then *m, the slot and its 64 bytes
+		--BYTE_COUNTER 0 is the slot byte, RAM_ADDR is one message byte ahead of it after that
+		when TRANSMIT_TAGGED =>
+		
+			if HEADER_COUNT_var = 0 then
+				VALID_DATA_OUT <= '0';
+				if VALID_DATA_IN = '1' then
+					TAG_S <= unsigned(DATA);
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				end if;
+			
+			elsif TAG_S > batch_max-1 OR TAG_DONE(to_integer(TAG_S)) = '0' then --No such slot or not signed yet, *B
+				VALID_DATA_OUT <= '1';
+				if HEADER_COUNT_var = 1 then
+					TXD_BYTE <= ASCII_ASTERISK;
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				else
+					TXD_BYTE <= ASCII_B;
+					HEADER_COUNTER <= (others => '0');
+					STATE <= IDLE;
+				end if;
+			
+			elsif HEADER_COUNT_var = 1 then --Wait for room for the whole message in the FIFO
+				if FIFO_EMPTY = '1' then
+					VALID_DATA_OUT <= '1';
+					TXD_BYTE <= ASCII_ASTERISK;
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+					RAM_ADDR <= STD_LOGIC_VECTOR(resize(TAG_S*MSG_BYTES, data_addr_width));
+				else
+					VALID_DATA_OUT <= '0';
+				end if;
+			
+			elsif HEADER_COUNT_var = 2 then
+				VALID_DATA_OUT <= '1';
+				TXD_BYTE <= ASCII_M_LOW;
+				HEADER_COUNTER <= HEADER_COUNT + 1;
+			
+			elsif BYTE_COUNT_var = 0 then
+				VALID_DATA_OUT <= '1';
+				TXD_BYTE <= STD_LOGIC_VECTOR(TAG_S);
+				BYTE_COUNTER <= BYTE_COUNT + 1;
+			
+			elsif BYTE_COUNT_var > MSG_BYTES then --all bytes has been transmitted
+				VALID_DATA_OUT <= '0';
+				STATE <= IDLE;
+				RAM_ADDR <= (others => '0');
+				BYTE_COUNTER <= (others => '0');
+				HEADER_COUNTER <= (others => '0');
+			
+			else --Put the data to the serial out
+				VALID_DATA_OUT <= '1';
+				RAM_ADDR <= STD_LOGIC_VECTOR(resize(TAG_S*MSG_BYTES + BYTE_COUNT, data_addr_width));
 				TXD_BYTE <= RAM_DATA_IN;
 				BYTE_COUNTER <= BYTE_COUNT + 1;
 			
@@ -239,16 +506,16 @@ procedure DO_CMD
 				HEADER_COUNTER <= HEADER_COUNT + 1;
 			
 			else 
-				--Put the ID on the serial out. The ID is: HEJ
+				--Put the ID on the serial out. The ID is token_id, HEJ by default
 				case BYTE_COUNT_VAR  is 
 					when 0 =>
-						TXD_BYTE <= ASCII_H;
+						TXD_BYTE <= token_id(23 downto 16);
 						BYTE_COUNTER <= BYTE_COUNT + 1;
 					when 1 =>
-						TXD_BYTE <= ASCII_E;
+						TXD_BYTE <= token_id(15 downto 8);
 						BYTE_COUNTER <= BYTE_COUNT + 1;
 					when others =>
-						TXD_BYTE <= ASCII_J; --Last char to be transmitted. Return to IDLE state
+						TXD_BYTE <= token_id(7 downto 0); --Last char to be transmitted. Return to IDLE state
 						STATE <= IDLE;
 						HEADER_COUNTER <= (others => '0');
 						BYTE_COUNTER <= (others => '0');
@@ -256,6 +523,63 @@ procedure DO_CMD
 			end if;
 			VALID_DATA_OUT <= '1';
 			
+		--Set baud case. Read n, echo *S[n] and switch baud once the echo has left the FIFO
+		--The TXD/RXD controllers only take the new baud when idle, so the echo is sent at the old baud
+		when SET_BAUD =>
+		
+			if HEADER_COUNT_var = 0 then
+				VALID_DATA_OUT <= '0';
+				if VALID_DATA_IN = '1' then
+					BAUD_REQ <= unsigned(DATA);
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				end if;
+			
+			elsif BAUD_REQ > 3 then --No such baud, tell the PC by sending *B
+				VALID_DATA_OUT <= '1';
+				if HEADER_COUNT_var = 1 then
+					TXD_BYTE <= ASCII_ASTERISK;
+					HEADER_COUNTER <= HEADER_COUNT + 1;
+				else
+					TXD_BYTE <= ASCII_B;
+					HEADER_COUNTER <= (others => '0');
+					STATE <= IDLE;
+				end if;
+			
+			elsif HEADER_COUNT_var = 1 then
+				VALID_DATA_OUT <= '1';
+				TXD_BYTE <= ASCII_ASTERISK;
+				HEADER_COUNTER <= HEADER_COUNT + 1;
+			
+			elsif HEADER_COUNT_var = 2 then
+				VALID_DATA_OUT <= '1';
+				TXD_BYTE <= ASCII_S;
+				HEADER_COUNTER <= HEADER_COUNT + 1;
+			
+			elsif BYTE_COUNT_var = 0 then
+				VALID_DATA_OUT <= '1';
+				TXD_BYTE <= STD_LOGIC_VECTOR(BAUD_REQ);
+				BYTE_COUNTER <= BYTE_COUNT + 1;
+			
+			elsif BYTE_COUNT_var = 1 then --Give the FIFO a cycle to see the last write
+				VALID_DATA_OUT <= '0';
+				BYTE_COUNTER <= BYTE_COUNT + 1;
+			
+			elsif FIFO_EMPTY = '1' then --Echo taken by TXD, switch
+				VALID_DATA_OUT <= '0';
+				BAUD_SEL_S <= STD_LOGIC_VECTOR(BAUD_REQ(1 downto 0));
+				if BAUD_REQ = 0 then
+					BAUD_CONFIRMED <= '1';
+				else
+					BAUD_CONFIRMED <= '0';
+				end if;
+				STATE <= IDLE;
+				HEADER_COUNTER <= (others => '0');
+				BYTE_COUNTER <= (others => '0');
+			
+			else
+				VALID_DATA_OUT <= '0';
+			end if;
+			
 		when TRANSMIT_BUSY =>
 		
 		--First write the header *B for signal to tell PC that unit is busy
@@ -312,12 +636,31 @@ if rising_edge(clk) then
 		HEADER_COUNTER <= (others => '0');
 		TIMEOUT_COUNTER <= 0;
 		DATA_READY_S <= '0';
+		BATCH_COUNT <= (others => '0');
+		BATCH_SIZE_S <= x"01";
+		BAUD_SEL_S <= "00";
+		BAUD_CONFIRMED <= '1';
+		CONFIRM_COUNTER <= 0;
+		TAG_S <= (others => '0');
+		TAG_WRITTEN <= '0';
 		
 		else 
 	
+		TAG_WRITTEN <= '0';
+		
 		if DATA_READY_S = '1' and READY_FOR_DATA = '1' then
 			DATA_READY_S <= '0';
 		end if;
+		
+		--A *S baud that no command confirms within half a second goes back to the power on baud
+		if BAUD_CONFIRMED = '1' then
+			CONFIRM_COUNTER <= 0;
+		elsif CONFIRM_COUNTER < Frequency/2-1 then
+			CONFIRM_COUNTER <= CONFIRM_COUNTER + 1;
+		else
+			BAUD_SEL_S <= "00";
+			BAUD_CONFIRMED <= '1';
+		end if;
 	
 	
 	case STATE is
@@ -398,6 +741,7 @@ if rising_edge(clk) then
 			else --Timeout. Proceed to send *T
 				CMD <= TIMEOUT;
 				TIMEOUT_COUNTER <= 0;
+				HEADER_COUNTER <= (others => '0'); --*K may have counted its header already
 			end if;		
 		end case;
 	end if;
@@ -27,28 +27,51 @@ use IEEE.STD_LOGIC_1164.ALL;
 --Implements a simple request-response protocol
 --The commands from the PC -> response from token
 --
---*I -> *IHEJ (ID)
+--*I -> *I[3 byte ID] (token_id, default HEJ)
 --*W[64 byte] -> *D if successful, *T if timeout, *B if device busy with other task
 --*R -> *M[64 byte] if data ready, *B if device busy with other task
+--*K[n][n*64 byte] -> like *W, for n (1 to batch_max) messages signed back to back
+--*Q -> *Q[n][n*64 byte] if the batch is ready, *B if device busy with other task
+--*S[n] -> *S[n] at the old baud, then baud n (0 BAUD_RATE, 1-3 BAUD_RATE_1-3). *B if n > 3
+--          Goes back to BAUD_RATE unless a command follows at the new baud within 0.5 s
+--*w[t][64 byte] -> *D, written to slot t (0 to batch_max-1), *B if t is out of range or not free
+--*r[t] -> *m[t][64 byte] if slot t is signed, *B otherwise. Slots can be read in any order
+--
+--With FLOW_CONTROL the token holds its replies while CTS is high. RTS is always low, the 
+--parser takes every byte as it comes
 --
 -------------------------------------------------------------------------------------
 
 entity USB_TOP is
 	generic ( data_addr_width : integer := 6;
 				BAUD_RATE : integer := 115200; --baud of 115200
+				 BAUD_RATE_1 : integer := 921_600; --Bauds of *S1 to *S3. 100MHz/4 samples gives 921600 within 0.5%,
+				 BAUD_RATE_2 : integer := 1_000_000; --1M and 2.5M exact. 3M is not reachable (4% off)
+				 BAUD_RATE_3 : integer := 2_500_000;
 				 CLOCK_RATE : integer := 100_000_000; --100MHz
-				 OVERSAMPLES : integer := 4);
+				 OVERSAMPLES : integer := 4;
+				 FLOW_CONTROL : boolean := false; --Hold TXD while CTS is high
+				 batch_max : integer := 1; --Max messages in one *K batch
+				 token_id : STD_LOGIC_VECTOR(23 downto 0) := x"48454A"); --ID on *I, HEJ
     Port ( CLK : in  STD_LOGIC;
 			  RESET : in STD_LOGIC;
            TXD : out  STD_LOGIC;
            RXD : in  STD_LOGIC;
+           CTS : in  STD_LOGIC := '0'; --Clear to send from the PC (active low)
+           RTS : out  STD_LOGIC; --Request to send to the PC (active low)
            RAM_ADDR : out  STD_LOGIC_VECTOR (data_addr_width-1 downto 0);
            RAM_DATA_IN : in  STD_LOGIC_VECTOR (7 downto 0);
            RAM_DATA_OUT : out  STD_LOGIC_VECTOR (7 downto 0);
            RAM_WE : out  STD_LOGIC;
            READY_FOR_DATA : in  STD_LOGIC;
            RSA_DONE : in  STD_LOGIC;
-			  DATA_READY : out STD_LOGIC);
+			  DATA_READY : out STD_LOGIC;
+			  BATCH_SIZE : out STD_LOGIC_VECTOR (7 downto 0); --Number of messages in RAM
+			  TAG_FREE : in STD_LOGIC_VECTOR (batch_max-1 downto 0) := (others => '0'); --Slots open for *w
+			  TAG_DONE : in STD_LOGIC_VECTOR (batch_max-1 downto 0) := (others => '0'); --Slots signed for *r
+			  TAG : out STD_LOGIC_VECTOR (7 downto 0); --Slot of the last *w
+			  TAG_WRITTEN : out STD_LOGIC; --Pulse when a *w has filled slot TAG
+			  RAM_BUSY : out STD_LOGIC); --The parser is using the RAM
 end USB_TOP;
 
 architecture Behavioral of USB_TOP is
@@ -69,20 +92,29 @@ END component;
 
 component TXD_Controller is
 	 Generic (BAUD_RATE : integer := BAUD_RATE; --baud of 115200
+				 BAUD_RATE_1 : integer := BAUD_RATE_1;
+				 BAUD_RATE_2 : integer := BAUD_RATE_2;
+				 BAUD_RATE_3 : integer := BAUD_RATE_3;
 				 CLOCK_RATE : integer := CLOCK_RATE; --100MHz
-				 OVERSAMPLES : integer := OVERSAMPLES);
+				 OVERSAMPLES : integer := OVERSAMPLES;
+				 FLOW_CONTROL : boolean := FLOW_CONTROL);
 				 
     Port ( CLK : in  STD_LOGIC; --Global clock	
 			  RESET : in STD_LOGIC; --reset signal (synchronous)
            TXD_PIN : out  STD_LOGIC; --data pin
            FIFO_DATA_IN : in  STD_LOGIC_VECTOR (7 downto 0); --byte from FIFO
            FIFO_READ : out  STD_LOGIC; --Read next signal to the FIFO
-           FIFO_EMPTY : in  STD_LOGIC); --Flag from FIFO to signal if the FIFO is empty or not
+           FIFO_EMPTY : in  STD_LOGIC; --Flag from FIFO to signal if the FIFO is empty or not
+           BAUD_SEL : in STD_LOGIC_VECTOR(1 downto 0); --Baud to use
+           CTS : in STD_LOGIC); --Clear to send from the PC (active low)
 end component;
 
 component RXD_Controller is
 
 Generic (Baud_Rate : integer := BAUD_RATE; --Baud of 115200
+	  BAUD_RATE_1 : integer := BAUD_RATE_1;
+	  BAUD_RATE_2 : integer := BAUD_RATE_2;
+	  BAUD_RATE_3 : integer := BAUD_RATE_3;
 	  CLOCK_RATE : integer := CLOCK_RATE; --100MHz
 	  OVERSAMPLES : integer := OVERSAMPLES);
 
@@ -91,12 +123,15 @@ Port(
 	RESET : in STD_LOGIC;
 	RXD_PIN : in STD_LOGIC;
 	RXD_BYTE : out STD_LOGIC_VECTOR(7 downto 0);
-	VALID_DATA_IN : out STD_LOGIC);
+	VALID_DATA_IN : out STD_LOGIC;
+	BAUD_SEL : in STD_LOGIC_VECTOR(1 downto 0));
 	end component;
 
 component USB_CMD_PARSER is
 	generic ( data_addr_width : integer := data_addr_width;
-				Frequency : integer := CLOCK_RATE);
+				Frequency : integer := CLOCK_RATE;
+				batch_max : integer := batch_max;
+				token_id : STD_LOGIC_VECTOR(23 downto 0) := token_id);
     Port ( RXD_BYTE 			: in  STD_LOGIC_VECTOR (7 downto 0);						--Input byte from the serial-to-parallell translator
            TXD_BYTE 			: out STD_LOGIC_VECTOR (7 downto 0);						--Output byte to the parallell-to-serial translator
            RAM_ADDR 			: out STD_LOGIC_VECTOR (data_addr_width-1 downto 0);	--RAM ADDR where the RSA (signed) message is
@@ -110,11 +145,19 @@ component USB_CMD_PARSER is
 			  RESET 				: in 	STD_LOGIC;													--Reset for module. When high all registers and counters resets at next high flank of the clock
            CLK 				: in  STD_LOGIC;													--Global clock signal
 			  DATA_READY 		: out  STD_LOGIC;
-			  FIFO_EMPTY		: in STD_LOGIC);
+			  BATCH_SIZE		: out STD_LOGIC_VECTOR (7 downto 0);
+			  FIFO_EMPTY		: in STD_LOGIC;
+			  BAUD_SEL			: out STD_LOGIC_VECTOR (1 downto 0);
+			  TAG_FREE			: in 	STD_LOGIC_VECTOR (batch_max-1 downto 0);
+			  TAG_DONE			: in 	STD_LOGIC_VECTOR (batch_max-1 downto 0);
+			  TAG					: out STD_LOGIC_VECTOR (7 downto 0);
+			  TAG_WRITTEN		: out STD_LOGIC;
+			  RAM_BUSY			: out STD_LOGIC);
 end component;
 
 signal RXD_BYTE, TXD_BYTE, FIFO_DATA_OUT, FIFO_DATA_IN : STD_LOGIC_VECTOR(7 downto 0);
 signal VALID_DATA_IN, VALID_DATA_OUT, FIFO_READ, FIFO_EMPTY : STD_LOGIC;
+signal BAUD_SEL : STD_LOGIC_VECTOR(1 downto 0);
 
 
 begin
@@ -125,7 +168,9 @@ TXD_CONTRL: TXD_Controller port map(
 	TXD_PIN => TXD,
 	FIFO_DATA_IN => FIFO_DATA_OUT, --confusing name. DATA is OUT from FIFO and is IN to TXD
 	FIFO_READ => FIFO_READ,
-	FIFO_EMPTY => FIFO_EMPTY 
+	FIFO_EMPTY => FIFO_EMPTY,
+	BAUD_SEL => BAUD_SEL,
+	CTS => CTS
 	);
 
 RXD_CONTRL: RXD_Controller port map(
@@ -133,7 +178,8 @@ RXD_CONTRL: RXD_Controller port map(
 	RESET => RESET,
 	RXD_PIN => RXD,
 	RXD_BYTE => RXD_BYTE,
-	VALID_DATA_IN => VALID_DATA_IN);
+	VALID_DATA_IN => VALID_DATA_IN,
+	BAUD_SEL => BAUD_SEL);
 	
 
 CMD_PARSER: USB_CMD_PARSER port map(
@@ -148,9 +194,18 @@ CMD_PARSER: USB_CMD_PARSER port map(
 	RSA_DONE => RSA_DONE,
 	READY_FOR_DATA => READY_FOR_DATA,
 	DATA_READY => DATA_READY,
+	BATCH_SIZE => BATCH_SIZE,
 	RESET => RESET,
    CLK => CLK,
-	FIFO_EMPTY => FIFO_EMPTY);
+	FIFO_EMPTY => FIFO_EMPTY,
+	BAUD_SEL => BAUD_SEL,
+	TAG_FREE => TAG_FREE,
+	TAG_DONE => TAG_DONE,
+	TAG => TAG,
+	TAG_WRITTEN => TAG_WRITTEN,
+	RAM_BUSY => RAM_BUSY);
+
+RTS <= '0'; --Always ready to recieve
 
 FIFO: FIFO_TXD PORT MAP(
     clk => CLK,
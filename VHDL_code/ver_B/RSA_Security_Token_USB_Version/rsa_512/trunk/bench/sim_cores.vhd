@@ -0,0 +1,128 @@
+--------------------------------------------------------------------------------
+-- Company:
+-- Engineer:
+--
+-- Create Date:
+-- Design Name:
+-- Module Name:    sim_ram, sim_fifo - behavior
+-- Project Name:  ciosspartan
+-- Target Device:
+-- Tool versions:
+-- Description:
+--
+-- Behavioral models of the Core Generator cores of rsa_top and
+-- montgomery_mult, for simulation at any WIDTH (test_width.vhd binds
+-- them with a configuration). They behave as the cores of the data sheet
+-- (doc/rsa 512.pdf) and PAM/ver_B/rsa_model.c:
+--   sim_ram   Mem_b, 64 words, single port, write first
+--   sim_fifo  res_out_fifo, fifo_512_bram and fifo_256_feedback, standard
+--             (not first word fall through), read latency 1, a read of an
+--             empty FIFO or a write to a full one is ignored
+--
+-- Dependencies:
+--
+-- Revision:
+-- Revision 0.01 - File Created
+-- Additional Comments:
+-- Not for synthesis, the design uses the generated cores.
+--------------------------------------------------------------------------------
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+
+entity sim_ram is
+  generic(
+    WIDTH : integer := 16
+    );
+  port(
+    clka  : in  std_logic;
+    wea   : in  std_logic_vector(0 downto 0);
+    addra : in  std_logic_vector(5 downto 0);
+    dina  : in  std_logic_vector(WIDTH-1 downto 0);
+    douta : out std_logic_vector(WIDTH-1 downto 0) := (others => '0')
+    );
+end sim_ram;
+
+architecture behavior of sim_ram is
+
+  type ram_type is array (0 to 63) of std_logic_vector(WIDTH-1 downto 0);
+  signal ram : ram_type := (others => (others => '0'));
+
+begin
+
+  process(clka)
+  begin
+    if(clka = '1' and clka'event) then
+      if(wea(0) = '1') then
+        ram(to_integer(unsigned(addra))) <= dina;
+        douta                            <= dina;
+      else
+        douta <= ram(to_integer(unsigned(addra)));
+      end if;
+    end if;
+  end process;
+
+end behavior;
+
+
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+
+entity sim_fifo is
+  generic(
+    WIDTH : integer := 16;
+    DEPTH : integer := 64
+    );
+  port(
+    clk   : in  std_logic;
+    rst   : in  std_logic;
+    din   : in  std_logic_vector(WIDTH-1 downto 0);
+    wr_en : in  std_logic;
+    rd_en : in  std_logic;
+    dout  : out std_logic_vector(WIDTH-1 downto 0) := (others => '0');
+    full  : out std_logic;
+    empty : out std_logic
+    );
+end sim_fifo;
+
+architecture behavior of sim_fifo is
+
+  type fifo_type is array (0 to DEPTH-1) of std_logic_vector(WIDTH-1 downto 0);
+  signal mem   : fifo_type := (others => (others => '0'));
+  signal head  : integer range 0 to DEPTH-1 := 0;
+  signal count : integer range 0 to DEPTH   := 0;
+
+begin
+
+  -- flags of the count before the edge, as the registered ones of the core
+  empty <= '1' when count = 0     else '0';
+  full  <= '1' when count = DEPTH else '0';
+
+  process(clk)
+    variable next_head  : integer range 0 to DEPTH-1;
+    variable next_count : integer range 0 to DEPTH;
+  begin
+    if(clk = '1' and clk'event) then
+      if(rst = '1') then
+        head  <= 0;
+        count <= 0;
+      else
+        next_head  := head;
+        next_count := count;
+        if(wr_en = '1' and count /= DEPTH) then
+          mem((head+count) mod DEPTH) <= din;
+          next_count                  := next_count+1;
+        end if;
+        if(rd_en = '1' and count /= 0) then
+          dout       <= mem(head);
+          next_head  := (head+1) mod DEPTH;
+          next_count := next_count-1;
+        end if;
+        head  <= next_head;
+        count <= next_count;
+      end if;
+    end if;
+  end process;
+
+end behavior;
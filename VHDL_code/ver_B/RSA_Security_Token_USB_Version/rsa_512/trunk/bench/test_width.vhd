@@ -0,0 +1,290 @@
+--------------------------------------------------------------------------------
+-- Company:
+-- Engineer:
+--
+-- Create Date:
+-- Design Name:
+-- Module Name:
+-- Project Name:  ciosspartan
+-- Target Device:
+-- Tool versions:
+-- Description:
+--
+-- VHDL Test Bench for module: rsa_top
+--
+-- Dependencies:
+--
+-- Revision:
+-- Revision 0.01 - File Created
+-- Additional Comments:
+--
+-- Notes:
+-- The same 512 bit signature (key of PAM/ver_B/data/private512.pem) on three
+-- rsa_top, WIDTH 16, 32 and 64, each with its R_C (constant_gen -w WIDTH).
+-- Counts the cycles each one takes in the simulation, from the first word in
+-- to the last word out, and checks the result, that a wider core takes fewer
+-- cycles, and that rsa_model counts the same.
+-- Elaborate the configuration test_rsa_width_sim (end of this file, with
+-- sim_cores.vhd): it binds Mem_b, res_out_fifo and the fifos of
+-- montgomery_mult of each width to behavioral models of that width, the
+-- generated cores only exist at one.
+--------------------------------------------------------------------------------
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.std_logic_unsigned.all;
+use ieee.numeric_std.all;
+
+entity test_rsa_width is
+end test_rsa_width;
+
+architecture behavior of test_rsa_width is
+
+  component rsa_top
+    generic(
+      WIDTH : integer := 16
+      );
+    port(
+      clk       : in  std_logic;
+      reset     : in  std_logic;
+      valid_in  : in  std_logic;
+      start_in  : in  std_logic;
+      x         : in  std_logic_vector(WIDTH-1 downto 0);
+      y         : in  std_logic_vector(WIDTH-1 downto 0);
+      m         : in  std_logic_vector(WIDTH-1 downto 0);
+      r_c       : in  std_logic_vector(WIDTH-1 downto 0);
+      s         : out std_logic_vector(WIDTH-1 downto 0);
+      valid_out : out std_logic;
+      bit_size  : in  std_logic_vector(15 downto 0);
+      words     : in  std_logic_vector(7 downto 0)
+      );
+  end component;
+
+  constant X_VAL : std_logic_vector(511 downto 0) := x"566a850ae3673bd63ac6120aff9340d8b505dacb25bc7b6f652c48c770d5e621f53ae5099b035a3ccc89308c9a0c039a53495c1e2fc63d6ad17c8ca5f0dcf111";
+  constant D_VAL : std_logic_vector(511 downto 0) := x"57be9810272c4dbfa2ec31d9093fb25664a44ede1d0493fab0fad98c3d0f73627532331c0fa9ca6fdc9e3a0bf61ec5b184947eeb3184f314eb78013df50f4791";
+  constant N_VAL : std_logic_vector(511 downto 0) := x"a9431b57de93d12179eed35b17ec12e9f97ad5af8602c014c62fcac3c0da57b3359b384b648c191f6b573bee94b253fa41e7a0bba736e03090869b5bc57f2b17";
+  -- x^d mod n
+  constant S_VAL : std_logic_vector(511 downto 0) := x"3a7a48cb2da8901d22eb2aa8fc68375093197150f3e7e5f983b4db51f5a83626ed8a209f3fb0ef6d786af6aaadc617a7f0c42960a8453d32594255ad18259162";
+
+  -- 2^(2*WIDTH*(512/WIDTH+1)) mod n for WIDTH 16, 32 and 64
+  type r_c_array is array (0 to 2) of std_logic_vector(511 downto 0);
+  constant R_C_VAL : r_c_array := (
+    x"8cd44641efa139b3fcb853e586e69a894f6b31c6f219925e7a4c9db8723e194257eec679032b9c68ea34a8c28936c032bdaa383a47f7f30fafaf5474ea33d6a8",
+    x"567377c58494b65082af2d916654d6dad916e8f2304bb69380f6e81d96a3eef952797dcc470565bde8ae3fe4bee3ed334a6bc0665df8a1079c4011b90f00aca1",
+    x"3815170c10a507de90c21dcce18ce1f7c8e3d82ee1ec5dddfcb3cfd4892554a04639ff4f289007140a825554ab6088b4c12af9a5412a2ca5f11aa2d9ea2079b5");
+
+  signal clk   : std_logic := '0';
+  signal reset : std_logic := '1';
+
+  -- cycles counted for each width, 0 until its signature is out
+  type cycles_array is array (0 to 2) of integer;
+  signal cycles_out : cycles_array := (others => 0);
+
+  -- Clock period definitions
+  constant clk_period : time := 1ns;
+
+begin
+
+  -- Clock process definitions
+  clk_process : process
+  begin
+    clk <= '0';
+    wait for clk_period/2;
+    clk <= '1';
+    wait for clk_period/2;
+  end process;
+
+  reset_proc : process
+  begin
+    reset <= '1';
+    wait for 10ns;
+    reset <= '0';
+    wait;
+  end process;
+
+  widths : for g in 0 to 2 generate
+    constant W     : integer := 16*2**g;
+    constant WORDS : integer := 512/W;
+    -- 28 + 45*words/2 + (20 + 45*words/4)*bit_size, as rsa_model
+    constant CYCLES : integer := 28 + 45*WORDS/2 + (20 + 45*WORDS/4)*512;
+
+    signal valid_in, start_in, valid_out : std_logic := '0';
+    signal x, y, m, r_c, s               : std_logic_vector(W-1 downto 0) := (others => '0');
+  begin
+
+    uut : rsa_top
+      generic map (
+        WIDTH => W
+        )
+      port map (
+        clk       => clk,
+        reset     => reset,
+        valid_in  => valid_in,
+        start_in  => start_in,
+        x         => x,
+        y         => y,
+        m         => m,
+        r_c       => r_c,
+        s         => s,
+        valid_out => valid_out,
+        bit_size  => x"0200",
+        words     => std_logic_vector(to_unsigned(WORDS, 8))
+        );
+
+    stim_proc : process
+    begin
+      wait until reset = '0';
+      wait for clk_period*10;
+
+      -- n_c of the low word of m, data 7 cycles after start_in
+      m        <= N_VAL(W-1 downto 0);
+      start_in <= '1';
+      wait for clk_period;
+      start_in <= '0';
+      wait for clk_period*6;
+      valid_in <= '1';
+      for i in 0 to WORDS-1 loop
+        x   <= X_VAL(i*W+W-1 downto i*W);
+        y   <= D_VAL(i*W+W-1 downto i*W);
+        m   <= N_VAL(i*W+W-1 downto i*W);
+        r_c <= R_C_VAL(g)(i*W+W-1 downto i*W);
+        wait for clk_period;
+      end loop;
+      valid_in <= '0';
+      wait;
+    end process;
+
+    -- Cycles from the first word in to the last word out
+    check_proc : process(clk)
+      variable cycles  : integer   := 0;
+      variable run     : boolean   := false;
+      variable word    : integer   := 0;
+      variable result  : std_logic_vector(511 downto 0);
+      variable was_out : std_logic := '0';
+    begin
+      if(clk = '1' and clk'event) then
+        if(run) then
+          cycles := cycles+1;
+        elsif(valid_in = '1' and word = 0) then
+          run    := true;
+          cycles := 1;
+        end if;
+
+        if(valid_out = '1' and word < WORDS) then
+          result(word*W+W-1 downto word*W) := s;
+          word := word+1;
+        elsif(was_out = '1' and run) then
+          run := false;
+          cycles_out(g) <= cycles-1;
+          report "WIDTH " & integer'image(W) & ": " & integer'image(cycles-1) & " cycles";
+          assert result = S_VAL report "WIDTH " & integer'image(W) & ": wrong signature" severity error;
+          assert cycles-1 = CYCLES report "WIDTH " & integer'image(W) & ": rsa_model counts "
+            & integer'image(CYCLES) & " cycles" severity error;
+        elsif(run and cycles > 2*CYCLES) then
+          run := false;
+          cycles_out(g) <= -1;
+          report "WIDTH " & integer'image(W) & ": no signature after "
+            & integer'image(cycles) & " cycles" severity error;
+        end if;
+        was_out := valid_out;
+      end if;
+    end process;
+  end generate;
+
+  -- Measured cycles of the widths against each other
+  summary_proc : process
+  begin
+    wait until cycles_out(0) /= 0 and cycles_out(1) /= 0 and cycles_out(2) /= 0;
+    for g in 1 to 2 loop
+      if(cycles_out(g) > 0 and cycles_out(g-1) > 0) then
+        report "WIDTH " & integer'image(16*2**g) & ": " & integer'image(cycles_out(g))
+          & " cycles, " & integer'image(100*cycles_out(g)/cycles_out(g-1)) & "% of WIDTH "
+          & integer'image(8*2**g);
+        assert cycles_out(g) < cycles_out(g-1) report "WIDTH " & integer'image(16*2**g)
+          & " is not faster than WIDTH " & integer'image(8*2**g) severity error;
+      end if;
+    end loop;
+    report "test_rsa_width done" severity note;
+    wait;
+  end process;
+
+end;
+
+
+-- Mem_b, res_out_fifo, fifo_512_bram and fifo_256_feedback of each width on
+-- the models of sim_cores.vhd
+configuration test_rsa_width_sim of test_rsa_width is
+  for behavior
+    for widths(0)
+      for uut : rsa_top
+        use entity work.rsa_top(Behavioral);
+        for Behavioral
+          for exp, n_mod : Mem_b
+            use entity work.sim_ram generic map(WIDTH => 16);
+          end for;
+          for fifo_mon_out : res_out_fifo
+            use entity work.sim_fifo generic map(WIDTH => 2*16, DEPTH => 64);
+          end for;
+          for mon_1, mon_2 : montgomery_mult
+            use entity work.montgomery_mult(Behavioral);
+            for Behavioral
+              for fifo_b : fifo_512_bram
+                use entity work.sim_fifo generic map(WIDTH => 16, DEPTH => 64);
+              end for;
+              for fifo_feed : fifo_256_feedback
+                use entity work.sim_fifo generic map(WIDTH => 3*16+1, DEPTH => 32);
+              end for;
+            end for;
+          end for;
+        end for;
+      end for;
+    end for;
+    for widths(1)
+      for uut : rsa_top
+        use entity work.rsa_top(Behavioral);
+        for Behavioral
+          for exp, n_mod : Mem_b
+            use entity work.sim_ram generic map(WIDTH => 32);
+          end for;
+          for fifo_mon_out : res_out_fifo
+            use entity work.sim_fifo generic map(WIDTH => 2*32, DEPTH => 64);
+          end for;
+          for mon_1, mon_2 : montgomery_mult
+            use entity work.montgomery_mult(Behavioral);
+            for Behavioral
+              for fifo_b : fifo_512_bram
+                use entity work.sim_fifo generic map(WIDTH => 32, DEPTH => 64);
+              end for;
+              for fifo_feed : fifo_256_feedback
+                use entity work.sim_fifo generic map(WIDTH => 3*32+1, DEPTH => 32);
+              end for;
+            end for;
+          end for;
+        end for;
+      end for;
+    end for;
+    for widths(2)
+      for uut : rsa_top
+        use entity work.rsa_top(Behavioral);
+        for Behavioral
+          for exp, n_mod : Mem_b
+            use entity work.sim_ram generic map(WIDTH => 64);
+          end for;
+          for fifo_mon_out : res_out_fifo
+            use entity work.sim_fifo generic map(WIDTH => 2*64, DEPTH => 64);
+          end for;
+          for mon_1, mon_2 : montgomery_mult
+            use entity work.montgomery_mult(Behavioral);
+            for Behavioral
+              for fifo_b : fifo_512_bram
+                use entity work.sim_fifo generic map(WIDTH => 64, DEPTH => 64);
+              end for;
+              for fifo_feed : fifo_256_feedback
+                use entity work.sim_fifo generic map(WIDTH => 3*64+1, DEPTH => 32);
+              end for;
+            end for;
+          end for;
+        end for;
+      end for;
+    end for;
+  end for;
+end test_rsa_width_sim;
@@ -28,14 +28,14 @@ use IEEE.STD_LOGIC_UNSIGNED.all;
 --use UNISIM.VComponents.all;
 
 entity m_calc is
-
+  generic(WIDTH : integer := 16);  --bits de palabra: 16, 32 o 64
   port(
     clk        : in  std_logic;
     reset      : in  std_logic;
-    ab         : in  std_logic_vector (15 downto 0);
-    t          : in  std_logic_vector (15 downto 0);
-    n_cons     : in  std_logic_vector (15 downto 0);
-    m          : out std_logic_vector (15 downto 0);
+    ab         : in  std_logic_vector (WIDTH-1 downto 0);
+    t          : in  std_logic_vector (WIDTH-1 downto 0);
+    n_cons     : in  std_logic_vector (WIDTH-1 downto 0);
+    m          : out std_logic_vector (WIDTH-1 downto 0);
     mult_valid : in  std_logic;         -- indica que los datos de entrada son validos
     m_valid    : out std_logic);        -- la m calculada es valida
 end m_calc;
@@ -44,9 +44,9 @@ architecture Behavioral of m_calc is
 
 
 
-  signal sum_res, next_sum_res      : std_logic_vector(15 downto 0);
+  signal sum_res, next_sum_res      : std_logic_vector(WIDTH-1 downto 0);
   signal mult_valid_1, mult_valid_2 : std_logic;  --delay del valido a lo largo del calculo
-  signal mult                       : std_logic_vector(31 downto 0);
+  signal mult                       : std_logic_vector(2*WIDTH-1 downto 0);
 begin
 
 
@@ -74,7 +74,7 @@ begin
 
   process(ab, t, mult_valid_2)
   begin
-    m            <= mult(15 downto 0);
+    m            <= mult(WIDTH-1 downto 0);
     next_sum_res <= ab+t;
     m_valid      <= mult_valid_2;
   end process;
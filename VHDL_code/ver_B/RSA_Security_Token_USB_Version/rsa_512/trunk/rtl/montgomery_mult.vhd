@@ -28,18 +28,19 @@ use IEEE.STD_LOGIC_UNSIGNED.all;
 --use UNISIM.VComponents.all;
 
 entity montgomery_mult is
-
+  generic(WIDTH : integer := 16);  --bits de palabra: 16, 32 o 64
   port(
     clk       : in  std_logic;
     reset     : in  std_logic;
     valid_in  : in  std_logic;
-    a         : in  std_logic_vector(15 downto 0);
-    b         : in  std_logic_vector(15 downto 0);
-    n         : in  std_logic_vector(15 downto 0);
-    s_prev    : in  std_logic_vector(15 downto 0);
-    n_c       : in  std_logic_vector(15 downto 0);
-    s         : out std_logic_vector( 15 downto 0);
-    valid_out : out std_logic           -- es le valid out TODO : cambiar nombre
+    a         : in  std_logic_vector(WIDTH-1 downto 0);
+    b         : in  std_logic_vector(WIDTH-1 downto 0);
+    n         : in  std_logic_vector(WIDTH-1 downto 0);
+    s_prev    : in  std_logic_vector(WIDTH-1 downto 0);
+    n_c       : in  std_logic_vector(WIDTH-1 downto 0);
+    s         : out std_logic_vector( WIDTH-1 downto 0);
+    valid_out : out std_logic;          -- es le valid out TODO : cambiar nombre
+    words     : in  std_logic_vector(7 downto 0)  --palabras del modulo, multiplo de 8 (x"20" con 512 bits)
     );
 
 end montgomery_mult;
@@ -47,23 +48,25 @@ end montgomery_mult;
 architecture Behavioral of montgomery_mult is
 
   component montgomery_step is
+                              generic(WIDTH : integer := 16);
                               port(
                                 clk       : in  std_logic;
                                 reset     : in  std_logic;
                                 valid_in  : in  std_logic;
-                                a         : in  std_logic_vector(15 downto 0);
-                                b         : in  std_logic_vector(15 downto 0);
-                                n         : in  std_logic_vector(15 downto 0);
-                                s_prev    : in  std_logic_vector(15 downto 0);
-                                n_c       : in  std_logic_vector(15 downto 0);
-                                s         : out std_logic_vector( 15 downto 0);
+                                a         : in  std_logic_vector(WIDTH-1 downto 0);
+                                b         : in  std_logic_vector(WIDTH-1 downto 0);
+                                n         : in  std_logic_vector(WIDTH-1 downto 0);
+                                s_prev    : in  std_logic_vector(WIDTH-1 downto 0);
+                                n_c       : in  std_logic_vector(WIDTH-1 downto 0);
+                                s         : out std_logic_vector( WIDTH-1 downto 0);
                                 valid_out : out std_logic;  -- es le valid out TODO : cambiar nombre
                                 busy      : out std_logic;
                                 b_req     : out std_logic;
-                                a_out     : out std_logic_vector(15 downto 0);
-                                n_out     : out std_logic_vector(15 downto 0);  --seal que indica que el modulo est ocupado y no puede procesar nuevas peticiones
+                                a_out     : out std_logic_vector(WIDTH-1 downto 0);
+                                n_out     : out std_logic_vector(WIDTH-1 downto 0);  --seal que indica que el modulo est ocupado y no puede procesar nuevas peticiones
                                 c_step    : out std_logic;  --genera un pulso cuando termina su computo para avisar al modulo superior
-                                stop      : in  std_logic
+                                stop      : in  std_logic;
+                                words     : in  std_logic_vector(7 downto 0)
                                 );
   end component;
 
@@ -71,10 +74,10 @@ architecture Behavioral of montgomery_mult is
     port (
       clk   : in  std_logic;
       rst   : in  std_logic;
-      din   : in  std_logic_vector(15 downto 0);
+      din   : in  std_logic_vector(WIDTH-1 downto 0);
       wr_en : in  std_logic;
       rd_en : in  std_logic;
-      dout  : out std_logic_vector(15 downto 0);
+      dout  : out std_logic_vector(WIDTH-1 downto 0);
       full  : out std_logic;
       empty : out std_logic);
   end component;
@@ -83,31 +86,31 @@ architecture Behavioral of montgomery_mult is
     port (
       clk   : in  std_logic;
       rst   : in  std_logic;
-      din   : in  std_logic_vector(48 downto 0);
+      din   : in  std_logic_vector(3*WIDTH downto 0);
       wr_en : in  std_logic;
       rd_en : in  std_logic;
-      dout  : out std_logic_vector(48 downto 0);
+      dout  : out std_logic_vector(3*WIDTH downto 0);
       full  : out std_logic;
       empty : out std_logic);
   end component;
 
-  type arr_dat_out is array(0 to 7) of std_logic_vector(15 downto 0);
+  type arr_dat_out is array(0 to 7) of std_logic_vector(WIDTH-1 downto 0);
   type arr_val is array(0 to 7) of std_logic;
-  type arr_b is array(0 to 7) of std_logic_vector(15 downto 0);
+  type arr_b is array(0 to 7) of std_logic_vector(WIDTH-1 downto 0);
 
   signal b_reg, next_b_reg                                              : arr_b;
   signal valid_mid, fifo_reqs, fifo_reqs_reg, next_fifo_reqs_reg, stops : arr_val;
-  signal a_out_mid, n_out_mid, s_out_mid                                : arr_dat_out;  --std_logic_vector(15 downto 0);
+  signal a_out_mid, n_out_mid, s_out_mid                                : arr_dat_out;  --std_logic_vector(WIDTH-1 downto 0);
 
   --Seales a la fifo
   signal wr_en, rd_en, empty : std_logic;
-  signal fifo_out            : std_logic_vector(15 downto 0);
+  signal fifo_out            : std_logic_vector(WIDTH-1 downto 0);
 
-  signal fifo_out_feedback, fifo_in_feedback : std_logic_vector(48 downto 0);
+  signal fifo_out_feedback, fifo_in_feedback : std_logic_vector(3*WIDTH downto 0);
   signal read_fifo_feedback, empty_feedback  : std_logic;
 
   --Seales de entrada al primer PE
-  signal a_in, s_in, n_in : std_logic_vector(15 downto 0);
+  signal a_in, s_in, n_in : std_logic_vector(WIDTH-1 downto 0);
   signal f_valid, busy_pe : std_logic;
 
   --salida c_step del primer PE para ir contando y saber cuando sacar el valor correcto.
@@ -152,7 +155,7 @@ begin
 
 
 --Primer PE
-  et_first : montgomery_step port map(
+  et_first : montgomery_step generic map(WIDTH => WIDTH) port map(
     clk       => clk,
     reset     => reset,
     valid_in  => f_valid,
@@ -168,11 +171,12 @@ begin
     a_out     => a_out_mid(0),
     n_out     => n_out_mid(0),
     c_step    => c_step,
-    stop      => stops(0)
+    stop      => stops(0),
+    words     => words
     );
 
 --Ultimo PE
-  et_last : montgomery_step port map(
+  et_last : montgomery_step generic map(WIDTH => WIDTH) port map(
     clk       => clk,
     reset     => reset,
     valid_in  => valid_mid(6),
@@ -186,11 +190,12 @@ begin
     b_req     => fifo_reqs(7),
     a_out     => a_out_mid(7),
     n_out     => n_out_mid(7),
-    stop      => stops(7)
+    stop      => stops(7),
+    words     => words
     );
 
   g1     : for i in 1 to 6 generate
-    et_i : montgomery_step port map(
+    et_i : montgomery_step generic map(WIDTH => WIDTH) port map(
       clk       => clk,
       reset     => reset,
       valid_in  => valid_mid(i-1),
@@ -204,7 +209,8 @@ begin
       b_req     => fifo_reqs(i),
       a_out     => a_out_mid(i),
       n_out     => n_out_mid(i),
-      stop      => stops(i)
+      stop      => stops(i),
+      words     => words
       );
 
   end generate g1;
@@ -269,7 +275,7 @@ begin
   end process;
 
   --Proceso combinacional fsm principal
-  process( valid_in, b, state, fifo_reqs, a_out_mid, n_out_mid, s_out_mid, valid_mid, a, s_prev, n, busy_pe, empty_feedback, fifo_out_feedback, count, reg_c_step, reset, reg_busy, count_feedback )
+  process( valid_in, b, state, fifo_reqs, a_out_mid, n_out_mid, s_out_mid, valid_mid, a, s_prev, n, busy_pe, empty_feedback, fifo_out_feedback, count, reg_c_step, reset, reg_busy, count_feedback, words )
   begin
 
     --las peticiones a la fifo son las or de los modulos
@@ -297,7 +303,7 @@ begin
       next_count        <= count + 8;
     end if;
     --durante el ciclo de la pipeline que sea considerado el ultimo, sacamos los datos
-    if( count = x"20") then
+    if( count = words) then
       s                 <= s_out_mid(0);
       valid_out         <= valid_mid(0);
     end if;
@@ -330,7 +336,7 @@ begin
         end if;
 
         --Si ya hemos sobrepasado el limite paramos y volvemos a la espera
-        if( count > x"23") then
+        if( count > words+3) then
           next_state <= wait_start;
                                         --y
           for i in 0 to 7 loop
@@ -347,15 +353,15 @@ begin
         end if;
         wr_fifofeed           <= valid_mid(7);
         read_fifo_feedback    <= '1';
-        a_in                  <= fifo_out_feedback(48 downto 33);
-        n_in                  <= fifo_out_feedback(32 downto 17);
-        s_in                  <= fifo_out_feedback(16 downto 1);
+        a_in                  <= fifo_out_feedback(3*WIDTH downto 2*WIDTH+1);
+        n_in                  <= fifo_out_feedback(2*WIDTH downto WIDTH+1);
+        s_in                  <= fifo_out_feedback(WIDTH downto 1);
         f_valid               <= fifo_out_feedback(0);
         if(empty_feedback = '1') then
           next_state          <= process_data;
 
         end if;
-        if(count_feedback = x"22") then
+        if(count_feedback = words+2) then
           read_fifo_feedback <= '0';
           next_state         <= process_data;
         end if;
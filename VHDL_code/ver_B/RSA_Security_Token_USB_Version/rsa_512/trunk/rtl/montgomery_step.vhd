@@ -28,40 +28,43 @@ use IEEE.STD_LOGIC_UNSIGNED.all;
 --use UNISIM.VComponents.all;
 
 entity montgomery_step is
+  generic(WIDTH : integer := 16);  --bits de palabra: 16, 32 o 64
   port(
     clk       : in  std_logic;
     reset     : in  std_logic;
     valid_in  : in  std_logic;
-    a         : in  std_logic_vector(15 downto 0);
-    b         : in  std_logic_vector(15 downto 0);
-    n         : in  std_logic_vector(15 downto 0);
-    s_prev    : in  std_logic_vector(15 downto 0);
-    n_c       : in  std_logic_vector(15 downto 0);
-    s         : out std_logic_vector( 15 downto 0);
+    a         : in  std_logic_vector(WIDTH-1 downto 0);
+    b         : in  std_logic_vector(WIDTH-1 downto 0);
+    n         : in  std_logic_vector(WIDTH-1 downto 0);
+    s_prev    : in  std_logic_vector(WIDTH-1 downto 0);
+    n_c       : in  std_logic_vector(WIDTH-1 downto 0);
+    s         : out std_logic_vector( WIDTH-1 downto 0);
     valid_out : out std_logic;          -- es le valid out TODO : cambiar nombre
     busy      : out std_logic;
     b_req     : out std_logic;
-    a_out     : out std_logic_vector(15 downto 0);
-    n_out     : out std_logic_vector(15 downto 0);  --seal que indica que el modulo est ocupado y no puede procesar nuevas peticiones
+    a_out     : out std_logic_vector(WIDTH-1 downto 0);
+    n_out     : out std_logic_vector(WIDTH-1 downto 0);  --seal que indica que el modulo est ocupado y no puede procesar nuevas peticiones
     c_step    : out std_logic;          --genera un pulso cuando termina su computo para avisar al modulo superior
-    stop      : in  std_logic
+    stop      : in  std_logic;
+    words     : in  std_logic_vector(7 downto 0)  --palabras del modulo, multiplo de 8 (x"20" con 512 bits)
     );
 end montgomery_step;
 
 architecture Behavioral of montgomery_step is
 
   component pe_wrapper
+    generic(WIDTH : integer := 16);
     port(
       clk          : in  std_logic;
       reset        : in  std_logic;
       ab_valid     : in  std_logic;
       valid_in     : in  std_logic;
-      a            : in  std_logic_vector(15 downto 0);
-      b            : in  std_logic_vector(15 downto 0);
-      n            : in  std_logic_vector(15 downto 0);
-      s_prev       : in  std_logic_vector(15 downto 0);
-      n_c          : in  std_logic_vector(15 downto 0);
-      s            : out std_logic_vector( 15 downto 0);
+      a            : in  std_logic_vector(WIDTH-1 downto 0);
+      b            : in  std_logic_vector(WIDTH-1 downto 0);
+      n            : in  std_logic_vector(WIDTH-1 downto 0);
+      s_prev       : in  std_logic_vector(WIDTH-1 downto 0);
+      n_c          : in  std_logic_vector(WIDTH-1 downto 0);
+      s            : out std_logic_vector( WIDTH-1 downto 0);
       data_ready   : out std_logic;
       fifo_req     : out std_logic;
       m_val        : out std_logic;
@@ -82,18 +85,18 @@ architecture Behavioral of montgomery_step is
 
 
   --Seales nuevas
-  signal mont_input_a, mont_input_n, mont_input_s                   : std_logic_vector(15 downto 0);
-  signal reg_constant, next_reg_constant, next_reg_input, reg_input : std_logic_vector(47 downto 0);
-  signal reg_out, reg_out_1, reg_out_2, reg_out_3, reg_out_4        : std_logic_vector(31 downto 0);
-  signal next_reg_out                                               : std_logic_vector(31 downto 0);
+  signal mont_input_a, mont_input_n, mont_input_s                   : std_logic_vector(WIDTH-1 downto 0);
+  signal reg_constant, next_reg_constant, next_reg_input, reg_input : std_logic_vector(3*WIDTH-1 downto 0);
+  signal reg_out, reg_out_1, reg_out_2, reg_out_3, reg_out_4        : std_logic_vector(2*WIDTH-1 downto 0);
+  signal next_reg_out                                               : std_logic_vector(2*WIDTH-1 downto 0);
 
   --Cadena de registros hacia fuera
-  signal reg_input_1, reg_input_2, reg_input_3, reg_input_4, reg_input_5 : std_logic_vector(47 downto 0);
+  signal reg_input_1, reg_input_2, reg_input_3, reg_input_4, reg_input_5 : std_logic_vector(3*WIDTH-1 downto 0);
 
 
 begin
 
-  mont : pe_wrapper port map (
+  mont : pe_wrapper generic map(WIDTH => WIDTH) port map (
     clk          => clk,
     reset        => reset,
     ab_valid     => ab_valid,
@@ -137,7 +140,7 @@ begin
         reg_input_4 <= reg_input_3;
         reg_input_5 <= reg_input_4;
 
-        reg_out   <= reg_input_4(47 downto 32) & reg_input_4(31 downto 16);
+        reg_out   <= reg_input_4(3*WIDTH-1 downto 2*WIDTH) & reg_input_4(2*WIDTH-1 downto WIDTH);
         reg_out_1 <= reg_out;
         reg_out_2 <= reg_out_1;
         reg_out_3 <= reg_out_2;
@@ -150,15 +153,15 @@ begin
     end if;
   end process;
 
-  process(state, valid_in, m_val, a, n, s_prev, counter, valid_mont_out, stop, reg_constant, reg_input_5, reg_out_4)
+  process(state, valid_in, m_val, a, n, s_prev, counter, valid_mont_out, stop, reg_constant, reg_input_5, reg_out_4, words)
   begin
     --reset_fifo <= '0';
     next_reg_input <= a&n&s_prev;       --Propagacin de la entrada TODO add variable 
     --next_reg_out <= a&n;              --Vamos retrasando la entrada TODO add variable 
 
 
-    a_out <= reg_out_4(31 downto 16);
-    n_out <= reg_out_4(15 downto 0);
+    a_out <= reg_out_4(2*WIDTH-1 downto WIDTH);
+    n_out <= reg_out_4(WIDTH-1 downto 0);
 
     next_state   <= state;
     next_counter <= counter;
@@ -190,35 +193,35 @@ begin
       when b_stable =>
         next_state          <= prep_m;
       when prep_m   =>
-        mont_input_a        <= reg_constant(47 downto 32);  --TODO add this to sensitivity
-        mont_input_n        <= reg_constant(31 downto 16);
-        mont_input_s        <= reg_constant(15 downto 0);
+        mont_input_a        <= reg_constant(3*WIDTH-1 downto 2*WIDTH);  --TODO add this to sensitivity
+        mont_input_n        <= reg_constant(2*WIDTH-1 downto WIDTH);
+        mont_input_s        <= reg_constant(WIDTH-1 downto 0);
         ab_valid            <= '1';
         next_state          <= wait_m;
       when wait_m   =>
 
         --Mantenemos las entradas para que nos calcule m correctamente
-        mont_input_a <= reg_constant(47 downto 32);  --TODO add this to sensitivity
-        mont_input_n <= reg_constant(31 downto 16);
-        mont_input_s <= reg_constant(15 downto 0);
+        mont_input_a <= reg_constant(3*WIDTH-1 downto 2*WIDTH);  --TODO add this to sensitivity
+        mont_input_n <= reg_constant(2*WIDTH-1 downto WIDTH);
+        mont_input_s <= reg_constant(WIDTH-1 downto 0);
 
 
         if (m_val = '1') then
 
           valid_mont   <= '1';
           next_state   <= mont_proc;
-          mont_input_a <= reg_input_5(47 downto 32);
-          mont_input_n <= reg_input_5(31 downto 16);
-          mont_input_s <= reg_input_5(15 downto 0);
+          mont_input_a <= reg_input_5(3*WIDTH-1 downto 2*WIDTH);
+          mont_input_n <= reg_input_5(2*WIDTH-1 downto WIDTH);
+          mont_input_s <= reg_input_5(WIDTH-1 downto 0);
 
         end if;
 
       when mont_proc =>
 
         valid_mont   <= '1';
-        mont_input_a <= reg_input_5(47 downto 32);
-        mont_input_n <= reg_input_5(31 downto 16);
-        mont_input_s <= reg_input_5(15 downto 0);
+        mont_input_a <= reg_input_5(3*WIDTH-1 downto 2*WIDTH);
+        mont_input_n <= reg_input_5(2*WIDTH-1 downto WIDTH);
+        mont_input_s <= reg_input_5(WIDTH-1 downto 0);
 
         if(valid_mont_out = '1') then
 
@@ -232,11 +235,11 @@ begin
         next_counter <= counter+1;
         valid_mont   <= '1';
 
-        mont_input_a <= reg_input_5(47 downto 32);
-        mont_input_n <= reg_input_5(31 downto 16);
-        mont_input_s <= reg_input_5(15 downto 0);
+        mont_input_a <= reg_input_5(3*WIDTH-1 downto 2*WIDTH);
+        mont_input_n <= reg_input_5(2*WIDTH-1 downto WIDTH);
+        mont_input_s <= reg_input_5(WIDTH-1 downto 0);
 
-        if(counter = (x"22")) then
+        if(counter = words+2) then
           next_state <= wait_valid;
           c_step     <= '1';
           reset_pe   <= '1';
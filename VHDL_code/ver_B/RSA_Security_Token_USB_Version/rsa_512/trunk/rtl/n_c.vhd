@@ -26,10 +26,11 @@ use IEEE.STD_LOGIC_UNSIGNED.all;
 --use UNISIM.VComponents.all;
 
 entity n_c_core is
+  generic(WIDTH : integer := 16);  --bits de palabra: 16, 32 o 64, 4 pasos de Newton llegan a 128
   port (clk   : in  std_logic;
-        m_lsw : in  std_logic_vector(15 downto 0);
+        m_lsw : in  std_logic_vector(WIDTH-1 downto 0);
         ce    : in  std_logic;
-        n_c   : out std_logic_vector(15 downto 0);
+        n_c   : out std_logic_vector(WIDTH-1 downto 0);
         done  : out std_logic
         );
 end n_c_core;
@@ -42,17 +43,17 @@ architecture Behavioral of n_c_core is
   signal stateNC       : stateNC_type;
   signal NC_complete   : std_logic := '0';
   signal NC_start      : std_logic := '0';
-  signal LSW_M         : std_logic_vector(15 downto 0);
+  signal LSW_M         : std_logic_vector(WIDTH-1 downto 0);
   signal adr_tbl       : std_logic_vector(2 downto 0);
   signal X0_tbl        : std_logic_vector(3 downto 0);
   signal Z0_tbl        : std_logic_vector(3 downto 0);
   signal X1_tbl        : std_logic_vector(3 downto 0);
   signal V1x9          : std_logic_vector(3 downto 0);
-  signal TforNC        : std_logic_vector(15 downto 0);
-  signal not_TforNCPl3 : std_logic_vector(15 downto 0);
-  signal NC            : std_logic_vector(15 downto 0);
-  signal t_NC          : std_logic_vector(15 downto 0);
-  signal t_NC_out      : std_logic_vector(15 downto 0);
+  signal TforNC        : std_logic_vector(WIDTH-1 downto 0);
+  signal not_TforNCPl3 : std_logic_vector(WIDTH-1 downto 0);
+  signal NC            : std_logic_vector(WIDTH-1 downto 0);
+  signal t_NC          : std_logic_vector(WIDTH-1 downto 0);
+  signal t_NC_out      : std_logic_vector(WIDTH-1 downto 0);
   signal b2equalb1     : std_logic;
 
 
@@ -60,13 +61,13 @@ architecture Behavioral of n_c_core is
   signal DUMMY_SIM0 : std_logic_vector(19 downto 0);
   signal DUMMY_SIM1 : std_logic_vector(19 downto 0);
 --
-  signal mul1, mul2 : std_logic_vector(35 downto 0);
+  signal mul1, mul2 : std_logic_vector(2*WIDTH+3 downto 0);
 begin
 
   mul1     <= ("00"&t_NC)*("00"&LSW_M);
-  TforNC   <= mul1(15 downto 0);
+  TforNC   <= mul1(WIDTH-1 downto 0);
   mul2     <= ("00"&t_NC)*("00"&not_TforNCPl3);
-  t_NC_out <= mul2(15 downto 0);
+  t_NC_out <= mul2(WIDTH-1 downto 0);
 
 -- TforNC_inst : MULT18X18
 -- port map (
@@ -149,7 +150,7 @@ begin
           when stNC_idle  =>
             done                    <= '0';
             stateNC                 <= stNC_step1;
-            t_NC                    <= X"00" & X1_tbl & X0_tbl;
+            t_NC                    <= conv_std_logic_vector(0, WIDTH-8) & X1_tbl & X0_tbl;
           when stNC_step1 =>
             t_NC                    <= t_NC_out;
             stateNC                 <= stNC_step2;
@@ -166,7 +167,7 @@ begin
             NC_complete             <= '1';
             done                    <= '1';
             stateNC                 <= stNC_idle;
-            NC                      <= (not (t_NC(15 downto 1))) & '1';
+            NC                      <= (not (t_NC(WIDTH-1 downto 1))) & '1';
           when others     =>
             stateNC                 <= stNC_idle;
         end case;
@@ -28,18 +28,18 @@ use IEEE.STD_LOGIC_UNSIGNED.all;
 --use UNISIM.VComponents.all;
 
 entity pe_wrapper is
-
+  generic(WIDTH : integer := 16);  --bits de palabra: 16, 32 o 64
   port(
     clk          : in  std_logic;
     reset        : in  std_logic;
     ab_valid     : in  std_logic;
     valid_in     : in  std_logic;
-    a            : in  std_logic_vector(15 downto 0);
-    b            : in  std_logic_vector(15 downto 0);
-    n            : in  std_logic_vector(15 downto 0);
-    s_prev       : in  std_logic_vector(15 downto 0);
-    n_c          : in  std_logic_vector(15 downto 0);
-    s            : out std_logic_vector( 15 downto 0);
+    a            : in  std_logic_vector(WIDTH-1 downto 0);
+    b            : in  std_logic_vector(WIDTH-1 downto 0);
+    n            : in  std_logic_vector(WIDTH-1 downto 0);
+    s_prev       : in  std_logic_vector(WIDTH-1 downto 0);
+    n_c          : in  std_logic_vector(WIDTH-1 downto 0);
+    s            : out std_logic_vector( WIDTH-1 downto 0);
     data_ready   : out std_logic;
     fifo_req     : out std_logic;
     m_val        : out std_logic;
@@ -50,15 +50,16 @@ end pe_wrapper;
 architecture Behavioral of pe_wrapper is
 
   component pe is
+                 generic(WIDTH : integer := 16);
                  port ( clk          : in  std_logic;
                         reset        : in  std_logic;
-                        a_j          : in  std_logic_vector(15 downto 0);
-                        b_i          : in  std_logic_vector(15 downto 0);
-                        s_prev       : in  std_logic_vector(15 downto 0);  --entrada de la s anterior para la suma
-                        m            : in  std_logic_vector(15 downto 0);
-                        n_j          : in  std_logic_vector(15 downto 0);
-                        s_next       : out std_logic_vector(15 downto 0);  --salida con la siguiente s
-                        aj_bi        : out std_logic_vector(15 downto 0);  --salida de multiplicador reutilizado para calcular a*b
+                        a_j          : in  std_logic_vector(WIDTH-1 downto 0);
+                        b_i          : in  std_logic_vector(WIDTH-1 downto 0);
+                        s_prev       : in  std_logic_vector(WIDTH-1 downto 0);  --entrada de la s anterior para la suma
+                        m            : in  std_logic_vector(WIDTH-1 downto 0);
+                        n_j          : in  std_logic_vector(WIDTH-1 downto 0);
+                        s_next       : out std_logic_vector(WIDTH-1 downto 0);  --salida con la siguiente s
+                        aj_bi        : out std_logic_vector(WIDTH-1 downto 0);  --salida de multiplicador reutilizado para calcular a*b
                         ab_valid_in  : in  std_logic;  --indica que los datos de entrada en el multiplicador son validos
                         valid_in     : in  std_logic;  --todas las entradas son validas, y la m est calculada
                         ab_valid_out : out std_logic;  --indica que la multiplicacion de un a y b validos se ha realizado con exito
@@ -67,23 +68,24 @@ architecture Behavioral of pe_wrapper is
   end component;
 
   component m_calc is
+                     generic(WIDTH : integer := 16);
                      port(
                        clk        : in  std_logic;
                        reset      : in  std_logic;
-                       ab         : in  std_logic_vector (15 downto 0);
-                       t          : in  std_logic_vector (15 downto 0);
-                       n_cons     : in  std_logic_vector (15 downto 0);
-                       m          : out std_logic_vector (15 downto 0);
+                       ab         : in  std_logic_vector (WIDTH-1 downto 0);
+                       t          : in  std_logic_vector (WIDTH-1 downto 0);
+                       n_cons     : in  std_logic_vector (WIDTH-1 downto 0);
+                       m          : out std_logic_vector (WIDTH-1 downto 0);
                        mult_valid : in  std_logic;
                        m_valid    : out std_logic);
   end component;
 
-  signal aj_bi, m, next_m, m_out          : std_logic_vector(15 downto 0);
+  signal aj_bi, m, next_m, m_out          : std_logic_vector(WIDTH-1 downto 0);
   signal mult_valid, valid_m, valid_m_reg : std_logic;  --lo registro para compararlos
 
 begin
 
-  pe_0 : pe port map(
+  pe_0 : pe generic map(WIDTH => WIDTH) port map(
     clk          => clk,
     reset        => reset,
     a_j          => a,
@@ -99,7 +101,7 @@ begin
     valid_out    => data_ready,
     fifo_req     => fifo_req);
 
-  mcons_0 : m_calc port map(
+  mcons_0 : m_calc generic map(WIDTH => WIDTH) port map(
     clk        => clk,
     reset      => reset,
     ab         => aj_bi,
@@ -0,0 +1,429 @@
+----------------------------------------------------------------------------------
+-- Company:
+-- Engineer:
+--
+-- Create Date:
+-- Design Name:
+-- Module Name:    rsa_crt - Behavioral
+-- Project Name:
+-- Target Devices:
+-- Tool versions:
+-- Description: x^d mod n por el teorema chino del resto (Garner) sobre rsa_top:
+--              x^dp mod p y x^dq mod q con 16 palabras, cada bit del exponente
+--              en 200 ciclos en vez de 380, y la mitad de bits.
+--
+-- Dependencies: rsa_top
+--
+-- Revision:
+-- Revision 0.01 - File Created
+-- Additional Comments:
+--   Siete pasadas de un rsa_top (run):
+--     0: a = x mod p                 (y = 1, 32 palabras)
+--     1: b = x mod q
+--     2: a = a^dp mod p              (16 palabras)
+--     3: b = b^dq mod q
+--     4: a = (a + 2p - b)*qInv mod p (lo_in = qInv)
+--     5: s = a*q mod n + b           (lo_in = q, b se suma, s a b_reg & a_reg)
+--     6: s^e mod n                   (e = PUB_EXP), debe ser x
+--   Con CORES = 2, 0 y 1, y luego 2 y 3, van a la vez en dos rsa_top.
+--   s solo sale si la pasada 6 da x: un fallo en x^dp o x^dq daria p o q
+--   por gcd(s^e - x, n). Si no, salen 32 palabras a cero con fault = '1'.
+--   x debe estar por debajo de n. p y q deben tener 256 bits justos
+--   (2p > b). Las constantes las da PAM/ver_B/script/crt_constants.sh.
+----------------------------------------------------------------------------------
+library IEEE;
+use IEEE.STD_LOGIC_1164.all;
+use IEEE.STD_LOGIC_ARITH.all;
+use IEEE.STD_LOGIC_UNSIGNED.all;
+
+entity rsa_crt is
+  generic(
+    MODULO     : std_logic_vector(511 downto 0);
+    R_C        : std_logic_vector(511 downto 0);  --2^1056 mod MODULO
+    PRIME_P    : std_logic_vector(255 downto 0);
+    PRIME_Q    : std_logic_vector(255 downto 0);
+    EXP_P      : std_logic_vector(255 downto 0);  --d mod p-1
+    EXP_Q      : std_logic_vector(255 downto 0);  --d mod q-1
+    Q_INV      : std_logic_vector(255 downto 0);  --q^-1 mod p
+    R_C_P      : std_logic_vector(255 downto 0);  --2^1056 mod p
+    R_C_Q      : std_logic_vector(255 downto 0);  --2^1056 mod q
+    R_C_P_HALF : std_logic_vector(255 downto 0);  --2^544 mod p
+    R_C_Q_HALF : std_logic_vector(255 downto 0);  --2^544 mod q
+    PUB_EXP    : std_logic_vector(31 downto 0) := x"00010001";  --e, para comprobar s
+    --1: un rsa_top, 2: dos, x^dp y x^dq a la vez (el doble de multiplicadores)
+    CORES      : integer range 1 to 2 := 2
+    );
+  port(
+    clk       : in  std_logic;
+    reset     : in  std_logic;
+    valid_in  : in  std_logic;                      --32 palabras de x seguidas
+    x         : in  std_logic_vector(15 downto 0);
+    s         : out std_logic_vector(15 downto 0);  --x^d mod n, 32 palabras seguidas
+    valid_out : out std_logic;
+    fault     : out std_logic                       --con valid_out, s^e /= x y s a cero
+    );
+end rsa_crt;
+
+architecture Behavioral of rsa_crt is
+
+  component rsa_top
+    port(
+      clk       : in  std_logic;
+      reset     : in  std_logic;
+      valid_in  : in  std_logic;
+      start_in  : in  std_logic;
+      x         : in  std_logic_vector(15 downto 0);
+      y         : in  std_logic_vector(15 downto 0);
+      m         : in  std_logic_vector(15 downto 0);
+      r_c       : in  std_logic_vector(15 downto 0);
+      s         : out std_logic_vector(15 downto 0);
+      valid_out : out std_logic;
+      bit_size  : in  std_logic_vector(15 downto 0);
+      words     : in  std_logic_vector(7 downto 0);
+      lo_sel    : in  std_logic;
+      lo_in     : in  std_logic_vector(15 downto 0)
+      );
+  end component;
+
+  --Palabra i de v, 0 por encima
+  function word(v : std_logic_vector; i : integer) return std_logic_vector is
+    variable r : std_logic_vector(15 downto 0) := (others => '0');
+  begin
+    if(i*16 < v'length) then
+      r := v(v'low+i*16+15 downto v'low+i*16);
+    end if;
+    return r;
+  end word;
+
+  --Palabras de la pasada
+  function run_words(run : std_logic_vector(2 downto 0)) return std_logic_vector is
+  begin
+    if(run = "010" or run = "011") then
+      return x"10";
+    end if;
+    return x"20";
+  end run_words;
+
+  --Bits de v hasta el 1 mas alto, bit_size de la pasada 6
+  function bits(v : std_logic_vector) return std_logic_vector is
+    variable r : integer := 0;
+  begin
+    for k in 0 to v'length-1 loop
+      if(v(v'low+k) = '1') then
+        r := k+1;
+      end if;
+    end loop;
+    return conv_std_logic_vector(r, 16);
+  end bits;
+
+  constant P2     : std_logic_vector(271 downto 0) := "000000000000000" & PRIME_P & '0';  --2p
+  constant E_BITS : std_logic_vector(15 downto 0) := bits(PUB_EXP);
+
+  type state_type is (wait_x, run_start, run_nc, run_feed, run_wait, show_s);
+  signal state, next_state : state_type;
+
+  signal run, next_run         : std_logic_vector(2 downto 0);
+  --Palabra de entrada, o ciclos de n_c_core
+  signal count, next_count     : std_logic_vector(5 downto 0);
+  --Palabras recibidas de cada rsa_top
+  signal out_0, next_out_0     : std_logic_vector(5 downto 0);
+  signal out_1, next_out_1     : std_logic_vector(5 downto 0);
+  signal x_reg, next_x_reg     : std_logic_vector(511 downto 0);
+  signal a_reg, next_a_reg     : std_logic_vector(255 downto 0);
+  signal b_reg, next_b_reg     : std_logic_vector(255 downto 0);
+  signal d_carry, next_d_carry : std_logic_vector(1 downto 0);
+  signal s_carry, next_s_carry : std_logic;
+  --s^e /= x en la pasada 6
+  signal fail, next_fail       : std_logic;
+
+  --Entradas de la pasada 4 y la 5, de a_reg y b_reg
+  signal a_word, d_word : std_logic_vector(15 downto 0);
+
+  type word_array is array (0 to 1) of std_logic_vector(15 downto 0);
+  type byte_array is array (0 to 1) of std_logic_vector(7 downto 0);
+  signal core_active, core_start, core_valid_in, core_valid_out, core_lo_sel : std_logic_vector(1 downto 0);
+  signal core_x, core_y, core_m, core_r_c, core_s, core_lo, core_bits        : word_array;
+  signal core_words                                                          : byte_array;
+
+begin
+
+  --El rsa_top c hace la pasada run+c
+  cores_gen : for c in 0 to CORES-1 generate
+
+    core : rsa_top port map(
+      clk       => clk,
+      reset     => reset,
+      valid_in  => core_valid_in(c),
+      start_in  => core_start(c),
+      x         => core_x(c),
+      y         => core_y(c),
+      m         => core_m(c),
+      r_c       => core_r_c(c),
+      s         => core_s(c),
+      valid_out => core_valid_out(c),
+      bit_size  => core_bits(c),
+      words     => core_words(c),
+      lo_sel    => core_lo_sel(c),
+      lo_in     => core_lo(c)
+      );
+
+    process(state, run, count, core_active, x_reg, a_reg, b_reg, a_word, d_word)
+      variable r : std_logic_vector(2 downto 0);
+      variable i : integer range 0 to 63;
+    begin
+      r := run;
+      if(c = 1) then
+        r := run+1;
+      end if;
+      i := conv_integer(count);
+
+      core_start(c)    <= '0';
+      core_valid_in(c) <= '0';
+      if(state = run_start) then
+        core_start(c)    <= core_active(c);
+      end if;
+      if(state = run_feed) then
+        core_valid_in(c) <= core_active(c);
+      end if;
+
+      core_x(c)      <= x_reg(15 downto 0);
+      core_y(c)      <= (others => '0');
+      if(i = 0) then
+        core_y(c)    <= x"0001";
+      end if;
+      core_bits(c)   <= x"0001";
+      core_words(c)  <= run_words(r);
+      core_lo_sel(c) <= '0';
+      core_lo(c)     <= (others => '0');
+
+      case r is
+        when "000" =>
+          core_m(c)   <= word(PRIME_P, i);
+          core_r_c(c) <= word(R_C_P, i);
+        when "001" =>
+          core_m(c)   <= word(PRIME_Q, i);
+          core_r_c(c) <= word(R_C_Q, i);
+        when "010" =>
+          core_x(c)    <= a_reg(15 downto 0);
+          core_y(c)    <= word(EXP_P, i);
+          core_m(c)    <= word(PRIME_P, i);
+          core_r_c(c)  <= word(R_C_P_HALF, i);
+          core_bits(c) <= x"0100";
+        when "011" =>
+          core_x(c)    <= b_reg(15 downto 0);
+          core_y(c)    <= word(EXP_Q, i);
+          core_m(c)    <= word(PRIME_Q, i);
+          core_r_c(c)  <= word(R_C_Q_HALF, i);
+          core_bits(c) <= x"0100";
+        when "100" =>
+          core_x(c)      <= d_word;
+          core_m(c)      <= word(PRIME_P, i);
+          core_r_c(c)    <= word(R_C_P, i);
+          core_lo_sel(c) <= '1';
+          core_lo(c)     <= word(Q_INV, i);
+        when "101" =>
+          core_x(c)      <= a_word;
+          core_m(c)      <= word(MODULO, i);
+          core_r_c(c)    <= word(R_C, i);
+          core_lo_sel(c) <= '1';
+          core_lo(c)     <= word(PRIME_Q, i);
+        when others =>
+          core_x(c)    <= a_reg(15 downto 0);
+          core_y(c)    <= word(PUB_EXP, i);
+          core_m(c)    <= word(MODULO, i);
+          core_r_c(c)  <= word(R_C, i);
+          core_bits(c) <= E_BITS;
+      end case;
+    end process;
+  end generate;
+
+  one_core : if CORES = 1 generate
+    core_valid_out(1) <= '0';
+    core_s(1)         <= (others => '0');
+  end generate;
+
+  core_active(0) <= '1';
+  core_active(1) <= '1' when (CORES = 2 and (run = "000" or run = "010")) else '0';
+
+  process(clk, reset)
+  begin
+    if(clk = '1' and clk'event) then
+      if(reset = '1') then
+        state   <= wait_x;
+        run     <= (others => '0');
+        count   <= (others => '0');
+        out_0   <= (others => '0');
+        out_1   <= (others => '0');
+        d_carry <= (others => '0');
+        s_carry <= '0';
+        fail    <= '0';
+      else
+        state   <= next_state;
+        run     <= next_run;
+        count   <= next_count;
+        out_0   <= next_out_0;
+        out_1   <= next_out_1;
+        d_carry <= next_d_carry;
+        s_carry <= next_s_carry;
+        fail    <= next_fail;
+      end if;
+      x_reg <= next_x_reg;
+      a_reg <= next_a_reg;
+      b_reg <= next_b_reg;
+    end if;
+  end process;
+
+  process(state, run, count, out_0, out_1, x_reg, a_reg, b_reg, d_carry, s_carry, fail, valid_in, x, core_active, core_valid_out, core_s)
+    variable i     : integer range 0 to 63;
+    variable a_w   : std_logic_vector(15 downto 0);
+    variable b_w   : std_logic_vector(15 downto 0);
+    variable d_sum : std_logic_vector(17 downto 0);
+    variable s_sum : std_logic_vector(16 downto 0);
+  begin
+    next_state   <= state;
+    next_run     <= run;
+    next_count   <= count;
+    next_out_0   <= out_0;
+    next_out_1   <= out_1;
+    next_x_reg   <= x_reg;
+    next_a_reg   <= a_reg;
+    next_b_reg   <= b_reg;
+    next_d_carry <= d_carry;
+    next_s_carry <= s_carry;
+    next_fail    <= fail;
+    s            <= (others => '0');
+    valid_out    <= '0';
+    fault        <= '0';
+
+    --d = a + 2p - b palabra a palabra (17 palabras, acarreo inicial 1 por el ~b)
+    i := conv_integer(count);
+    a_w := (others => '0');
+    b_w := (others => '1');
+    if(i < 16) then
+      a_w := a_reg(15 downto 0);
+      b_w := not b_reg(15 downto 0);
+    end if;
+    d_sum := ("00" & a_w) + ("00" & word(P2, i)) + ("00" & b_w) + d_carry;
+    a_word <= a_w;
+    d_word <= (others => '0');
+    if(i <= 16) then
+      d_word <= d_sum(15 downto 0);
+    end if;
+
+    case state is
+
+      when wait_x =>
+        if(valid_in = '1') then
+          next_x_reg   <= x & x_reg(511 downto 16);
+          next_count   <= count+1;
+          if(count = "011111") then
+            next_count <= (others => '0');
+            next_run   <= (others => '0');
+            next_fail  <= '0';
+            next_state <= run_start;
+          end if;
+        end if;
+
+        --start_in con la palabra 0 del modulo
+      when run_start =>
+        next_count <= (others => '0');
+        next_state <= run_nc;
+
+        --n_c_core, 7 ciclos como RSA_512_tb
+      when run_nc =>
+        next_count       <= count+1;
+        if(count = "000110") then
+          next_count     <= (others => '0');
+          next_d_carry   <= "01";
+          next_s_carry   <= '0';
+          next_state     <= run_feed;
+        end if;
+
+        --x_reg, a_reg y b_reg giran una palabra por ciclo, quedan como estaban
+        --(x_reg solo con 32 palabras, en la pasada 6 b_reg & a_reg es s)
+      when run_feed =>
+        next_count     <= count+1;
+        if(run_words(run) = x"20") then
+          next_x_reg   <= x_reg(15 downto 0) & x_reg(511 downto 16);
+        end if;
+        if(run = "110") then
+          next_a_reg   <= b_reg(15 downto 0) & a_reg(255 downto 16);
+          next_b_reg   <= a_reg(15 downto 0) & b_reg(255 downto 16);
+        elsif(i < 16) then
+          next_a_reg   <= a_reg(15 downto 0) & a_reg(255 downto 16);
+          next_b_reg   <= b_reg(15 downto 0) & b_reg(255 downto 16);
+        end if;
+        next_d_carry   <= d_sum(17 downto 16);
+        if(count = run_words(run)-1) then
+          next_out_0   <= (others => '0');
+          next_out_1   <= (others => '0');
+          next_state   <= run_wait;
+        end if;
+
+        --Las 16 palabras bajas de cada resultado a a_reg o b_reg, en la
+        --pasada 5 s = salida mas b entra por arriba de b_reg & a_reg, en
+        --la 6 cada palabra se compara con x
+      when run_wait =>
+        if(core_valid_out(0) = '1') then
+          next_out_0     <= out_0+1;
+          if(run = "101") then
+            b_w          := (others => '0');
+            if(out_0 < 16) then
+              b_w        := b_reg(15 downto 0);
+            end if;
+            s_sum        := ('0' & core_s(0)) + ('0' & b_w) + s_carry;
+            next_s_carry <= s_sum(16);
+            next_b_reg   <= s_sum(15 downto 0) & b_reg(255 downto 16);
+            next_a_reg   <= b_reg(15 downto 0) & a_reg(255 downto 16);
+          elsif(run = "110") then
+            next_x_reg   <= x_reg(15 downto 0) & x_reg(511 downto 16);
+            if(core_s(0) /= x_reg(15 downto 0)) then
+              next_fail  <= '1';
+            end if;
+          elsif(out_0 < 16) then
+            if(run = "001" or run = "011") then
+              next_b_reg <= core_s(0) & b_reg(255 downto 16);
+            else
+              next_a_reg <= core_s(0) & a_reg(255 downto 16);
+            end if;
+          end if;
+        end if;
+        if(core_valid_out(1) = '1') then
+          next_out_1     <= out_1+1;
+          if(out_1 < 16) then
+            next_b_reg   <= core_s(1) & b_reg(255 downto 16);
+          end if;
+        end if;
+
+        if(out_0 = run_words(run) and (core_active(1) = '0' or out_1 = run_words(run+1))) then
+          next_count   <= (others => '0');
+          next_state   <= run_start;
+          if(core_active(1) = '1') then
+            next_run   <= run+2;
+          else
+            next_run   <= run+1;
+          end if;
+          if(run = "110") then
+            next_state <= show_s;
+          end if;
+        end if;
+
+        --s de b_reg & a_reg, o 0 si la pasada 6 no dio x
+      when show_s =>
+        valid_out    <= '1';
+        fault        <= fail;
+        if(fail = '0') then
+          s          <= a_reg(15 downto 0);
+        end if;
+        next_a_reg   <= b_reg(15 downto 0) & a_reg(255 downto 16);
+        next_b_reg   <= a_reg(15 downto 0) & b_reg(255 downto 16);
+        next_count   <= count+1;
+        if(count = "011111") then
+          next_count <= (others => '0');
+          next_state <= wait_x;
+        end if;
+
+    end case;
+  end process;
+
+end Behavioral;
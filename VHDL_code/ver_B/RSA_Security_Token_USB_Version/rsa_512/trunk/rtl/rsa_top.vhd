@@ -32,68 +32,86 @@ use UNISIM.VCOMPONENTS.all;
 --use UNISIM.VComponents.all;
 
 entity rsa_top is
+  generic(
+    --bits de las palabras de x, y, m, r_c y s y de todo el multiplicador: 16, 32
+    --o 64. Los multiplicadores de los pe crecen (DSP48), las palabras por numero
+    --bajan (words), los ciclos por palabra son los mismos. Mem_b, res_out_fifo y
+    --las fifos de montgomery_mult se generan con este ancho
+    WIDTH  : integer := 16
+    );
   port(
     clk       : in  std_logic;
     reset     : in  std_logic;
     valid_in  : in  std_logic;
     start_in  : in  std_logic;
-    x         : in  std_logic_vector(15 downto 0);  -- estos 3 son x^y mod m
-    y         : in  std_logic_vector(15 downto 0);
-    m         : in  std_logic_vector(15 downto 0);
-    r_c       : in  std_logic_vector(15 downto 0);  --constante de montgomery r^2 mod m
-    s         : out std_logic_vector( 15 downto 0);
+    x         : in  std_logic_vector(WIDTH-1 downto 0);  -- estos 3 son x^y mod m
+    y         : in  std_logic_vector(WIDTH-1 downto 0);
+    m         : in  std_logic_vector(WIDTH-1 downto 0);
+    r_c       : in  std_logic_vector(WIDTH-1 downto 0);  --constante de montgomery r^2 mod m
+    s         : out std_logic_vector( WIDTH-1 downto 0);
     valid_out : out std_logic;
-    bit_size  : in  std_logic_vector(15 downto 0)  --tamano bit del exponente y (log2(y))
+    bit_size  : in  std_logic_vector(15 downto 0);  --tamano bit del exponente y (log2(y))
+    --palabras de WIDTH bits de x, m y r_c, multiplo de 8 hasta x"20". Con menos
+    --palabras cada multiplicacion es mas corta (x"10": 200 ciclos por bit en vez de 380)
+    words     : in  std_logic_vector(7 downto 0) := x"20";
+    --con lo_sel = '1' la escalera empieza en lo_in*R en vez de R (lo_in entra
+    --con x, palabra a palabra): sale x^y*lo_in mod m, con y = 1 el producto
+    --modular x*lo_in
+    lo_sel    : in  std_logic := '0';
+    lo_in     : in  std_logic_vector(WIDTH-1 downto 0) := (others => '0')
     );
 end rsa_top;
 
 architecture Behavioral of rsa_top is
 
   component n_c_core
+    generic(WIDTH : integer := 16);
     port (clk   : in  std_logic;
-          m_lsw : in  std_logic_vector(15 downto 0);
+          m_lsw : in  std_logic_vector(WIDTH-1 downto 0);
           ce    : in  std_logic;
-          n_c   : out std_logic_vector(15 downto 0);
+          n_c   : out std_logic_vector(WIDTH-1 downto 0);
           done  : out std_logic
           );
   end component;
 
 --Multiplicador de Montgomery que sera instanciado 2 veces
   component montgomery_mult
+    generic(WIDTH : integer := 16);
     port(
       clk       : in  std_logic;
       reset     : in  std_logic;
       valid_in  : in  std_logic;
-      a         : in  std_logic_vector(15 downto 0);
-      b         : in  std_logic_vector(15 downto 0);
-      n         : in  std_logic_vector(15 downto 0);
-      s_prev    : in  std_logic_vector(15 downto 0);
-      n_c       : in  std_logic_vector(15 downto 0);
-      s         : out std_logic_vector( 15 downto 0);
-      valid_out : out std_logic         -- es le valid out TODO : cambiar nombre
+      a         : in  std_logic_vector(WIDTH-1 downto 0);
+      b         : in  std_logic_vector(WIDTH-1 downto 0);
+      n         : in  std_logic_vector(WIDTH-1 downto 0);
+      s_prev    : in  std_logic_vector(WIDTH-1 downto 0);
+      n_c       : in  std_logic_vector(WIDTH-1 downto 0);
+      s         : out std_logic_vector( WIDTH-1 downto 0);
+      valid_out : out std_logic;        -- es le valid out TODO : cambiar nombre
+      words     : in  std_logic_vector(7 downto 0)
       );
   end component;
 
---Memoria para guardar el exponente y el modulo
+--Memoria para guardar el exponente y el modulo (64 palabras de WIDTH bits)
   component Mem_b
     port (
       clka  : in  std_logic;
       wea   : in  std_logic_vector(0 downto 0);
       addra : in  std_logic_vector(5 downto 0);
-      dina  : in  std_logic_vector(15 downto 0);
-      douta : out std_logic_vector(15 downto 0));
+      dina  : in  std_logic_vector(WIDTH-1 downto 0);
+      douta : out std_logic_vector(WIDTH-1 downto 0));
   end component;
 
 
---fifos para los resultados de las mult parciales
+--fifos para los resultados de las mult parciales (dos palabras)
   component res_out_fifo
     port (
       clk   : in  std_logic;
       rst   : in  std_logic;
-      din   : in  std_logic_vector(31 downto 0);
+      din   : in  std_logic_vector(2*WIDTH-1 downto 0);
       wr_en : in  std_logic;
       rd_en : in  std_logic;
-      dout  : out std_logic_vector(31 downto 0);
+      dout  : out std_logic_vector(2*WIDTH-1 downto 0);
       full  : out std_logic;
       empty : out std_logic);
   end component;
@@ -101,30 +119,50 @@ architecture Behavioral of rsa_top is
 
   signal valid_in_mon_1, valid_in_mon_2, valid_out_mon_1, valid_out_mon_2, fifo_1_rd, fifo_1_wr : std_logic;
 
-  signal a_mon_1, b_mon_1, n_mon_1, s_p_mon_1, s_out_mon_1, a_mon_2, b_mon_2, n_mon_2, s_p_mon_2, s_out_mon_2, fifo_1_in, fifo_2_in, fifo_1_out, exp_out, n_out : std_logic_vector(15 downto 0);
+  signal a_mon_1, b_mon_1, n_mon_1, s_p_mon_1, s_out_mon_1, a_mon_2, b_mon_2, n_mon_2, s_p_mon_2, s_out_mon_2, fifo_1_in, fifo_2_in, fifo_1_out, exp_out, n_out : std_logic_vector(WIDTH-1 downto 0);
 
-  signal fifo_out, fifo_in : std_logic_vector(31 downto 0);
+  signal fifo_out, fifo_in : std_logic_vector(2*WIDTH-1 downto 0);
 
   signal addr_exp, addr_n, next_addr_exp, next_addr_n : std_logic_vector(5 downto 0);
 
   type state_type is (wait_start, prepare_data, wait_constants, writting_cts_fifo, processing_data_0, processing_data_1, wait_results, transition, prepare_next, writting_results, final_mult, show_final, prepare_final, wait_final);
   signal state, next_state                                            : state_type;
   signal w_numb, next_w_numb                                          : std_logic_vector(7 downto 0);
+  signal words_reg, next_words_reg                                    : std_logic_vector(7 downto 0);
 --Seales registradas
-  signal n_c_reg, next_n_c_reg                                        : std_logic_vector(15 downto 0);
+  signal n_c_reg, next_n_c_reg                                        : std_logic_vector(WIDTH-1 downto 0);
   --Cuenta los datos que se van metiendo al multiplicador para generar el padding por si solo.
-  signal count_input, next_count_input, bit_counter, next_bit_counter : std_logic_vector(15 downto 0);
+  signal count_input, next_count_input                                : std_logic_vector(15 downto 0);
+  --Mascara del bit del exponente en la palabra exp_out
+  signal bit_counter, next_bit_counter                                : std_logic_vector(WIDTH-1 downto 0);
 
   signal bsize_reg, next_bsize_reg : std_logic_vector (15 downto 0);
   signal write_b_n                 : std_logic_vector(0 downto 0);
+  signal y_mem, m_mem              : std_logic_vector(WIDTH-1 downto 0);
 
-  signal n_c_o    : std_logic_vector(15 downto 0);
-  signal n_c      : std_logic_vector(15 downto 0);
+  --log2(WIDTH), bits del numero de bit dentro de la palabra
+  function word_log2(w : integer) return integer is
+    variable l : integer := 0;
+  begin
+    while(2**l < w) loop
+      l := l+1;
+    end loop;
+    return l;
+  end word_log2;
+
+  constant LOG_W   : integer                            := word_log2(WIDTH);
+  constant ZERO    : std_logic_vector(WIDTH-1 downto 0) := (others => '0');
+  constant ONE     : std_logic_vector(WIDTH-1 downto 0) := conv_std_logic_vector(1, WIDTH);
+  constant TOP_BIT : std_logic_vector(WIDTH-1 downto 0) := '1' & conv_std_logic_vector(0, WIDTH-1);
+
+  signal n_c_o    : std_logic_vector(WIDTH-1 downto 0);
+  signal n_c      : std_logic_vector(WIDTH-1 downto 0);
   signal n_c_load : std_logic;
 
 begin
 
   n_c1 : n_c_core
+    generic map(WIDTH => WIDTH)
     port map (
       clk   => clk,
       m_lsw => m,
@@ -134,7 +172,11 @@ begin
       );
 
 
-  mon_1 : montgomery_mult port map(
+  --escalera de montgomery: por cada bit de y un cuadrado y un producto a la vez,
+  --uno en cada multiplicador, bit_size multiplicaciones seguidas. Ningun metodo
+  --baja de los bit_size cuadrados en cadena, una ventana solo quita productos que
+  --aqui ya no cuestan ciclos (WINDOW 4: 236970 ciclos contra 195308), no se usa
+  mon_1 : montgomery_mult generic map(WIDTH => WIDTH) port map(
     clk       => clk,
     reset     => reset,
     valid_in  => valid_in_mon_1,
@@ -144,10 +186,11 @@ begin
     s_prev    => s_p_mon_1,
     n_c       => n_c_reg,
     s         => s_out_mon_1,
-    valid_out => valid_out_mon_1
+    valid_out => valid_out_mon_1,
+    words     => words_reg
     );
 
-  mon_2 : montgomery_mult port map(
+  mon_2 : montgomery_mult generic map(WIDTH => WIDTH) port map(
     clk       => clk,
     reset     => reset,
     valid_in  => valid_in_mon_2,
@@ -157,7 +200,8 @@ begin
     s_prev    => s_p_mon_2,
     n_c       => n_c_reg,
     s         => s_out_mon_2,
-    valid_out => valid_out_mon_2
+    valid_out => valid_out_mon_2,
+    words     => words_reg
     );
 
 
@@ -175,14 +219,14 @@ begin
     clka  => clk,
     wea   => write_b_n,
     addra => addr_exp,
-    dina  => y,
+    dina  => y_mem,
     douta => exp_out);
 
   n_mod : Mem_b port map (
     clka  => clk,
     wea   => write_b_n,
     addra => addr_n,
-    dina  => m,
+    dina  => m_mem,
     douta => n_out);
 
 
@@ -196,6 +240,7 @@ begin
         state       <= wait_start;
         n_c_reg     <= (others => '0');
         w_numb      <= (others => '0');
+        words_reg   <= x"20";
         count_input <= (others => '0');
         addr_exp    <= (others => '0');
         addr_n      <= (others => '0');
@@ -210,6 +255,7 @@ begin
         state       <= next_state;
         n_c_reg     <= next_n_c_reg;
         w_numb      <= next_w_numb;
+        words_reg   <= next_words_reg;
         count_input <= next_count_input;
         addr_exp    <= next_addr_exp;
         addr_n      <= next_addr_n;
@@ -219,9 +265,7 @@ begin
     end if;
   end process;
 
-  process(state, bsize_reg, n_c_reg, valid_in, x, n_c, r_c, m, y, w_numb, count_input, addr_exp, addr_n, s_out_mon_1, s_out_mon_2, bit_size, valid_out_mon_1, bit_counter, exp_out, fifo_out, n_out)
-
-    variable mask : std_logic_vector(3 downto 0);
+  process(state, bsize_reg, n_c_reg, valid_in, x, n_c, r_c, m, y, w_numb, words, words_reg, lo_sel, lo_in, count_input, addr_exp, addr_n, s_out_mon_1, s_out_mon_2, bit_size, valid_out_mon_1, bit_counter, exp_out, fifo_out, n_out)
 
   begin
 
@@ -229,6 +273,7 @@ begin
     next_state       <= state;
     next_n_c_reg     <= n_c_reg;
     next_w_numb      <= w_numb;
+    next_words_reg   <= words_reg;
     next_count_input <= count_input;
     next_bsize_reg   <= bsize_reg;
     --Entradas de los montgomerys.
@@ -248,6 +293,8 @@ begin
     fifo_1_wr        <= '0';
     --Control de memorias de exp y modulo
     write_b_n        <= b"0";
+    y_mem            <= y;
+    m_mem            <= m;
     next_addr_exp    <= addr_exp;
     next_addr_n      <= addr_n;
     next_bit_counter <= bit_counter;
@@ -265,10 +312,14 @@ begin
           b_mon_1      <= r_c;
           n_mon_1      <= m;
 
-          a_mon_2          <= x"0001";
+          a_mon_2          <= ONE;
+          if(lo_sel = '1') then
+            a_mon_2        <= lo_in;
+          end if;
           b_mon_2          <= r_c;
           n_mon_2          <= m;
-          next_w_numb      <= x"23";    --Se extiende en 3 para poder usar las multiplicaciones modulares
+          next_w_numb      <= words+3;  --Se extiende en 3 para poder usar las multiplicaciones modulares
+          next_words_reg   <= words;
           next_n_c_reg     <= n_c;
           next_state       <= prepare_data;
           next_count_input <= x"0001";
@@ -289,39 +340,30 @@ begin
           a_mon_1        <= x;
           b_mon_1        <= r_c;
           n_mon_1        <= m;
+          if(lo_sel = '1') then
+            a_mon_2      <= lo_in;
+          end if;
           b_mon_2        <= r_c;
           n_mon_2        <= m;
 
           write_b_n     <= b"1";
           next_addr_exp <= addr_exp+1;
           next_addr_n   <= addr_n+1;
+        else
+          --Modulo de menos palabras: las siguientes a 0, el multiplicador las lee
+          write_b_n     <= b"1";
+          y_mem         <= (others => '0');
+          m_mem         <= (others => '0');
+          next_addr_exp <= addr_exp+1;
+          next_addr_n   <= addr_n+1;
         end if;
         if(count_input = w_numb) then
           next_state    <= wait_constants;
           next_addr_n   <= (others => '0');
 
-          next_addr_exp                                                    <= bsize_reg(9 downto 4);
-                                        --Decodificador para establecer la mascara
-          mask := bsize_reg(3 downto 0);
-          case (mask) is
-            when "0000"                                => next_bit_counter <= "0000000000000001";
-            when "0001"                                => next_bit_counter <= "0000000000000010";
-            when "0010"                                => next_bit_counter <= "0000000000000100";
-            when "0011"                                => next_bit_counter <= "0000000000001000";
-            when "0100"                                => next_bit_counter <= "0000000000010000";
-            when "0101"                                => next_bit_counter <= "0000000000100000";
-            when "0110"                                => next_bit_counter <= "0000000001000000";
-            when "0111"                                => next_bit_counter <= "0000000010000000";
-            when "1000"                                => next_bit_counter <= "0000000100000000";
-            when "1001"                                => next_bit_counter <= "0000001000000000";
-            when "1010"                                => next_bit_counter <= "0000010000000000";
-            when "1011"                                => next_bit_counter <= "0000100000000000";
-            when "1100"                                => next_bit_counter <= "0001000000000000";
-            when "1101"                                => next_bit_counter <= "0010000000000000";
-            when "1110"                                => next_bit_counter <= "0100000000000000";
-            when "1111"                                => next_bit_counter <= "1000000000000000";
-            when others                                =>
-          end case;
+          next_addr_exp                                                    <= bsize_reg(LOG_W+5 downto LOG_W);
+          --Mascara del bit mas alto del exponente
+          next_bit_counter <= SHL(ONE, bsize_reg(LOG_W-1 downto 0));
           next_count_input                                                 <= (others => '0');
         end if;
 
@@ -340,7 +382,7 @@ begin
       when writting_cts_fifo =>
         fifo_1_wr        <= valid_out_mon_1;
         next_count_input <= count_input+1;
-        if(count_input < x"20") then
+        if(count_input < words_reg) then
           fifo_in        <= s_out_mon_1 & s_out_mon_2;
         end if;
 
@@ -358,7 +400,7 @@ begin
           next_count_input <= (others => '0');
                                         --fifo_1_rd <= '1';
                                         --next_addr_n <= addr_n+1;
-          if((bit_counter and exp_out) = x"0000") then
+          if((bit_counter and exp_out) = ZERO) then
             next_state     <= processing_data_0;
           else
             next_state     <= processing_data_1;
@@ -378,12 +420,12 @@ begin
 
         fifo_1_rd <= '1';
 
-        a_mon_1 <= fifo_out(31 downto 16);
-        b_mon_1 <= fifo_out(15 downto 0);
+        a_mon_1 <= fifo_out(2*WIDTH-1 downto WIDTH);
+        b_mon_1 <= fifo_out(WIDTH-1 downto 0);
         n_mon_1 <= n_out;
 
-        a_mon_2 <= fifo_out(31 downto 16);
-        b_mon_2 <= fifo_out(31 downto 16);
+        a_mon_2 <= fifo_out(2*WIDTH-1 downto WIDTH);
+        b_mon_2 <= fifo_out(2*WIDTH-1 downto WIDTH);
         n_mon_2 <= n_out;
 
         next_addr_n      <= addr_n+1;
@@ -403,12 +445,12 @@ begin
 
         fifo_1_rd <= '1';
 
-        a_mon_1 <= fifo_out(15 downto 0);
-        b_mon_1 <= fifo_out(15 downto 0);
+        a_mon_1 <= fifo_out(WIDTH-1 downto 0);
+        b_mon_1 <= fifo_out(WIDTH-1 downto 0);
         n_mon_1 <= n_out;
 
-        a_mon_2 <= fifo_out(31 downto 16);
-        b_mon_2 <= fifo_out(15 downto 0);
+        a_mon_2 <= fifo_out(2*WIDTH-1 downto WIDTH);
+        b_mon_2 <= fifo_out(WIDTH-1 downto 0);
         n_mon_2 <= n_out;
 
         next_addr_n      <= addr_n+1;
@@ -435,7 +477,7 @@ begin
         next_addr_n      <= (others => '0');
         fifo_1_wr        <= valid_out_mon_1;
         next_count_input <= count_input+1;
-        if(count_input < x"20") then
+        if(count_input < words_reg) then
           fifo_in        <= s_out_mon_2 & s_out_mon_1;
         end if;
 
@@ -445,13 +487,13 @@ begin
           next_state         <= prepare_next;
                                         --Calculo del siguiente bit del exponente
                                         --Shifto uno la mascara
-          next_bit_counter   <= '0'&bit_counter(15 downto 1);
-          if(bit_counter = x"0001")
+          next_bit_counter   <= '0'&bit_counter(WIDTH-1 downto 1);
+          if(bit_counter = ONE)
           then
             next_addr_exp    <= addr_exp -1;
-            next_bit_counter <= "1000000000000000";
+            next_bit_counter <= TOP_BIT;
           end if;
-          if((bit_counter = x"0001") and addr_exp = "000000000")
+          if((bit_counter = ONE) and addr_exp = "000000000")
           then
             next_state       <= final_mult;
             next_count_input <= (others => '0');
@@ -480,9 +522,9 @@ begin
 
         fifo_1_rd <= '1';
 
-        a_mon_1   <= fifo_out(15 downto 0);
+        a_mon_1   <= fifo_out(WIDTH-1 downto 0);
         if(count_input = x"0001") then
-          b_mon_1 <= x"0001";
+          b_mon_1 <= ONE;
         end if;
         n_mon_1   <= n_out;
 
@@ -509,9 +551,11 @@ begin
         s                <= s_out_mon_1;
         next_count_input <= count_input +1;
         --Cuando llego al final cambio de estado a esperar resultados
-        if(count_input = x"20") then
+        if(count_input = words_reg) then
           valid_out      <= '0';
           next_state     <= wait_start;
+          --wait_start escribe la palabra 0 de y y m en addr_n
+          next_addr_n    <= (others => '0');
         end if;
 
     end case;
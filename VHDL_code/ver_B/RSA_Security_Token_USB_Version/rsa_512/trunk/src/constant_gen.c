@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <gmp.h>
 #include <string.h>
 #include <sys/types.h>
@@ -12,11 +13,15 @@
 #define uint64 unsigned long long int
 #define WORD_SIZE 32
 
+//bits de palabra de rsa_top (generic WIDTH): 16, 32 o 64, -w
+uint32 word_size = 16;
+
 
 uint32 getMpzSize(mpz_t n)
 {
 
-   return (mpz_size(n)*2);
+   //palabras de word_size bits, mpz_size cuenta limbs de 32 o 64 bits segun la maquina
+   return ((mpz_sizeinbase(n,2)+word_size-1)/word_size);
 
 }
 
@@ -31,16 +36,58 @@ uint16 getlimb(mpz_t n, int i)
 
 
 
-int main()
+//Generic R_C de rsa_crt para una pasada de words palabras sobre p: 2^(16*(words+1)*2) mod p
+void printCrtConstant(const char *name, mpz_t p, uint32 words)
+{
+    mpz_t r_aux;
+
+    mpz_init(r_aux);
+    mpz_ui_pow_ui(r_aux,2,32*(words+1));
+    mpz_mod(r_aux,r_aux,p);
+    gmp_printf("%s => x\"%064Zx\",\n", name, r_aux);
+    mpz_clear(r_aux);
+}
+
+
+//constant_gen [-w bits] [modulo [p q dp dq qinv]], en hexadecimal
+//Con p, q, d mod p-1, d mod q-1 y q^-1 mod p saca tambien los generics de rsa_crt
+int main(int argc, char **argv)
 {
      
-    int i;
+    int i, arg = 1;
     
     mpz_t m,x,y,r,r_aux, n_cons, zero, recons;
+    mpz_t crt[5];
+    const char *crt_names[5] = { "PRIME_P", "PRIME_Q", "EXP_P", "EXP_Q", "Q_INV" };
   
     char *template;
    
-    mpz_init_set_str(m,"00f7d41c34be5878fc1202ae8e82609a0da7e7f1dca245ae319f05b58c4dc9b1fbcb323f030fba596dfa1f6a52c5458bf7fe33d2d0d984fa13bf8e7007d78f0b05",16); //mpz_init_set_str(m,"c3217fff",16);
+    if(argc > 2 && strcmp(argv[1], "-w") == 0)
+    {
+        word_size = atoi(argv[2]);
+        arg = 3;
+    }
+    if((argc-arg != 0 && argc-arg != 1 && argc-arg != 6) || (word_size != 16 && word_size != 32 && word_size != 64))
+    {
+        fprintf(stderr, "usage: %s [-w 16|32|64] [modulus [p q dp dq qinv]]\n", argv[0]);
+        return 1;
+    }
+    if(argc-arg == 6 && word_size != 16)
+    {
+        fprintf(stderr, "rsa_crt is 16 bit words only\n");
+        return 1;
+    }
+
+    if(argc-arg > 0)
+    {
+        if(mpz_init_set_str(m,argv[arg],16) != 0)
+        {
+            fprintf(stderr, "modulus is not hexadecimal: %s\n", argv[arg]);
+            return 1;
+        }
+    }
+    else
+        mpz_init_set_str(m,"00f7d41c34be5878fc1202ae8e82609a0da7e7f1dca245ae319f05b58c4dc9b1fbcb323f030fba596dfa1f6a52c5458bf7fe33d2d0d984fa13bf8e7007d78f0b05",16); //mpz_init_set_str(m,"c3217fff",16);
    
     mpz_init(r);
     mpz_init(r_aux);
@@ -48,7 +95,7 @@ int main()
     mpz_init_set_ui(zero,0);
     
     //Calculo de la constante para salir de la representacion de montgomery
-    mpz_ui_pow_ui(r,2,16*(getMpzSize(m)+1));
+    mpz_ui_pow_ui(r,2,word_size*(getMpzSize(m)+1));
     mpz_mul(r_aux,r,r);
     mpz_mod(r_aux,r_aux,m);
     
@@ -57,8 +104,27 @@ int main()
 
    
 
-    printf    ("n_c <= %x;\n\n", (uint32)mpz_getlimbn(n_cons,0)&0xffff);
+    mpz_fdiv_r_2exp(n_cons,n_cons,word_size);
+    gmp_printf("n_c <= %Zx;\n\n", n_cons);
     gmp_printf("r_c <= %Zx\n\n", r_aux);
+
+    if(argc-arg == 6)
+    {
+        //rsa_crt hace las pasadas de 512 bits con las palabras del modulo y las de 256 con la mitad
+        for(i = 0; i < 5; i++)
+        {
+            if(mpz_init_set_str(crt[i],argv[arg+1+i],16) != 0)
+            {
+                fprintf(stderr, "%s is not hexadecimal: %s\n", crt_names[i], argv[arg+1+i]);
+                return 1;
+            }
+            gmp_printf("%s => x\"%064Zx\",\n", crt_names[i], crt[i]);
+        }
+        printCrtConstant("R_C_P", crt[0], getMpzSize(m));
+        printCrtConstant("R_C_Q", crt[1], getMpzSize(m));
+        printCrtConstant("R_C_P_HALF", crt[0], getMpzSize(m)/2);
+        printCrtConstant("R_C_Q_HALF", crt[1], getMpzSize(m)/2);
+    }
    
     return 0;  
 }
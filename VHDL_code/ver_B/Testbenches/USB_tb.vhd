@@ -53,7 +53,8 @@ Component USB_TOP is
            RAM_WE : out  STD_LOGIC;
            READY_FOR_DATA : in  STD_LOGIC;
            RSA_DONE : in  STD_LOGIC;
-			  DATA_READY : out STD_LOGIC);
+			  DATA_READY : out STD_LOGIC;
+			  BATCH_SIZE : out STD_LOGIC_VECTOR (7 downto 0));
 end component;
 
 Component mem_array is
@@ -106,7 +107,8 @@ test_USB_TOP: USB_TOP Port Map(CLK => CLK,
            RAM_WE => RAM_WE,
            READY_FOR_DATA => READY_FOR_DATA,
            RSA_DONE => RSA_DONE,
-			  DATA_READY => DATA_READY);
+			  DATA_READY => DATA_READY,
+			  BATCH_SIZE => open);
               
 test_RAM: mem_array Port Map (    
         ADDR => RAM_ADDR,